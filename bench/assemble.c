@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hal64.h"
+#include "assembler/assembler.h"
+#include "utils/memory.h"
+
+#define FUNCTIONS 20000
+#define BODY_INSTRUCTIONS 40
+#define CALLED 10
+#define REPEATS 5
+
+/*
+ * Function 0 calls the first CALLED of FUNCTIONS generated functions, each
+ * a chain of BODY_INSTRUCTIONS additions.
+ */
+static char *
+generate_program(void)
+{
+    size_t capacity = 1024 + (size_t) FUNCTIONS * (BODY_INSTRUCTIONS * 48 + 96), length;
+    char *source = safe_malloc(capacity);
+    int i, j;
+
+    length = sprintf(source,
+                     "---\nglobals: 0\nglobal_pointers: 0\n---\n"
+                     ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n");
+    for (i = 1; i <= CALLED; i++)
+        length += sprintf(source + length, "    Call :%d;\n", i);
+    length += sprintf(source + length, "    Exit;\n}\n");
+    for (i = 1; i < FUNCTIONS; i++) {
+        length += sprintf(source + length,
+                          ":%d { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+                          "    PushI64 %d;\n",
+                          i, i);
+        for (j = 0; j < BODY_INSTRUCTIONS; j++)
+            length += sprintf(source + length, "    AddI64_RI $0 %d;\n    StoreLocalI64 $0;\n", j);
+        length += sprintf(source + length, "    Return;\n}\n");
+    }
+    return source;
+}
+
+static size_t
+assembled_instructions(const Program *program)
+{
+    size_t i, count = 0;
+    for (i = 0; i < program->functions_count; i++)
+        count += program->functions[i].instructions_count;
+    return count;
+}
+
+/* Fastest of REPEATS assemble-and-run cycles, in milliseconds. */
+static double
+time_startup(const char *source, int lazy, size_t *instructions)
+{
+    Program program;
+    clock_t start;
+    double elapsed, best = 0;
+    int i;
+
+    for (i = 0; i < REPEATS; i++) {
+        VM vm = init_vm();
+        start = clock();
+        program = lazy ? assemble_lazy(source) : assemble(source);
+        run_program(&vm, &program);
+        elapsed = (double) (clock() - start) / CLOCKS_PER_SEC * 1e3;
+        *instructions = assembled_instructions(&program);
+        free_vm(vm);
+        free_program(program);
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+int
+main(void)
+{
+    char *source = generate_program();
+    size_t instructions;
+    double elapsed;
+
+    printf("%d functions of %d instructions, %d called\n", FUNCTIONS, BODY_INSTRUCTIONS * 2 + 2, CALLED);
+    printf("%-8s %12s %14s\n", "", "ms", "instructions");
+    elapsed = time_startup(source, 0, &instructions);
+    printf("%-8s %12.3f %14zu\n", "eager", elapsed, instructions);
+    elapsed = time_startup(source, 1, &instructions);
+    printf("%-8s %12.3f %14zu\n", "lazy", elapsed, instructions);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hal64.h"
+#include "register_vm.h"
+#include "assembler/assembler.h"
+
+#define ITERATIONS 10000000
+#define REPEATS 10
+#define FIB_ARGUMENT 25
+
+typedef enum
+{
+    RUN_CHECKED,
+    RUN_FAST,
+    RUN_REGISTERS,
+} RunMode;
+
+#define HEADER \
+    "---\n" \
+    "globals: 0\n" \
+    "global_pointers: 0\n" \
+    "---\n" \
+    ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 0 } {\n" \
+    "    PushI64 %d;\n" \
+    "    StoreLocalI64 $0;\n" \
+    "    PushI64 0;\n" \
+    "    StoreLocalI64 $1;\n"
+
+#define BODY \
+    "    AddI64_RI $1 3;\n" \
+    "    StoreLocalI64 $1;\n"
+
+static const char *compare_loop =
+    HEADER
+    BODY
+    "    AddI64_RI $0 1;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LessThanI64_RI $0 %d;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #4;\n"
+    "    Exit;\n"
+    "}\n";
+
+static const char *dec_jump_loop =
+    HEADER
+    BODY
+    "    DecJumpIfNotZero $0 #4;\n"
+    "    Exit;\n"
+    "}\n";
+
+static const char *inc_jump_loop =
+    HEADER
+    BODY
+    "    IncJumpIfLessThan $0 %d #4;\n"
+    "    Exit;\n"
+    "}\n";
+
+static const char *fib_calls =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+    "    PushI64 %d;\n"
+    "    Call :1;\n"
+    "    Exit;\n"
+    "}\n"
+    ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+    "    LessThanI64_RI $0 2;\n"
+    "    JumpIfFalse #4;\n"
+    "    LoadLocalI64 $0;\n"
+    "    Return;\n"
+    "    SubI64_RI $0 1;\n"
+    "    Call :1;\n"
+    "    SubI64_RI $0 2;\n"
+    "    Call :1;\n"
+    "    AddI64;\n"
+    "    Return;\n"
+    "}\n";
+
+/*
+ * The counter starts at `start_value`, which is ITERATIONS for the count-down
+ * loop and 0 otherwise. Returns the fastest of REPEATS runs on the checked
+ * or fast stack interpreter or the register VM, in nanoseconds per iteration.
+ */
+static double
+time_loop(const char *format, int start_value, int iterations, RunMode mode)
+{
+    char source[1024];
+    Program program;
+    RegisterProgram register_program;
+    clock_t start;
+    double elapsed, best = 0;
+    int i, registers = mode == RUN_REGISTERS;
+
+    snprintf(source, sizeof(source), format, start_value, ITERATIONS);
+    program = assemble(source);
+    if (registers && !translate_program(&program, &register_program)) {
+        fprintf(stderr, "Failed to translate the benchmark to register code\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < REPEATS; i++) {
+        VM vm = init_vm();
+        vm.checked = mode == RUN_CHECKED;
+        start = clock();
+        if (registers)
+            run_register_program(&vm, &register_program);
+        else
+            run_program(&vm, &program);
+        elapsed = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / iterations;
+        free_vm(vm);
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    if (registers)
+        free_register_program(register_program);
+    free_program(program);
+    return best;
+}
+
+static void
+report(const char *name, int dispatches, const char *format, int start_value, int iterations)
+{
+    printf("%-32s %12d %10.3f %10.3f %10.3f\n", name, dispatches,
+           time_loop(format, start_value, iterations, RUN_CHECKED),
+           time_loop(format, start_value, iterations, RUN_FAST),
+           time_loop(format, start_value, iterations, RUN_REGISTERS));
+}
+
+int
+main(void)
+{
+    printf("%d iterations, 2 body instructions each, ns per iteration\n", ITERATIONS);
+    printf("%-32s %12s %10s %10s %10s\n", "", "dispatches", "checked", "stack VM", "reg VM");
+    report("AddI64_RI/LessThan/JumpIfFalse", 7, compare_loop, 0, ITERATIONS);
+    report("DecJumpIfNotZero", 3, dec_jump_loop, ITERATIONS, ITERATIONS);
+    report("IncJumpIfLessThan", 3, inc_jump_loop, 0, ITERATIONS);
+    // fib(25) makes 242785 calls
+    report("fib(25), per call", 10, fib_calls, FIB_ARGUMENT, 242785);
+    return 0;
+}
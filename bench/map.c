@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hal64.h"
+#include "assembler/assembler.h"
+
+#define REPEATS 3
+
+static const size_t sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+
+// keys are spread out by an odd multiplier so they are not consecutive
+#define INSERTS \
+    "---\n" \
+    "globals: 0\n" \
+    "global_pointers: 0\n" \
+    "---\n" \
+    ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 1 } {\n" \
+    "    NewMap 0;\n" \
+    "    StoreLocalPointer $0;\n" \
+    "    PushI64 0;\n" \
+    "    StoreLocalI64 $0;\n" \
+    "    LoadLocalPointer $0;\n" \
+    "    LoadLocalI64 $0;\n" \
+    "    MulI64_RI $0 40503;\n" \
+    "    LoadLocalI64 $0;\n" \
+    "    MapPutI64;\n" \
+    "    IncJumpIfLessThan $0 %zu #4;\n"
+
+static const char *insert_only =
+    INSERTS
+    "    Exit;\n"
+    "}\n";
+
+static const char *insert_then_get =
+    INSERTS
+    "    PushI64 0;\n"
+    "    StoreLocalI64 $0;\n"
+    "    PushI64 0;\n"
+    "    StoreLocalI64 $1;\n"
+    "    LoadLocalPointer $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    MulI64_RI $0 40503;\n"
+    "    MapGetI64;\n"
+    "    LoadLocalI64 $1;\n"
+    "    AddI64;\n"
+    "    StoreLocalI64 $1;\n"
+    "    IncJumpIfLessThan $0 %zu #14;\n"
+    "    Exit;\n"
+    "}\n";
+
+/* Fastest of REPEATS runs, in seconds. */
+static double
+time_program(const char *format, size_t size)
+{
+    char source[2048];
+    Program program;
+    clock_t start;
+    double elapsed, best = 0;
+    int i;
+
+    sprintf(source, format, size, size);
+    program = assemble(source);
+    for (i = 0; i < REPEATS; i++) {
+        VM vm = init_vm();
+        start = clock();
+        run_program(&vm, &program);
+        elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+        free_vm(vm);
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    free_program(program);
+    return best;
+}
+
+int
+main(void)
+{
+    size_t i;
+    double inserts, total;
+
+    printf("%-10s %14s %14s\n", "entries", "ns/insert", "ns/get");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        inserts = time_program(insert_only, sizes[i]);
+        total = time_program(insert_then_get, sizes[i]);
+        printf("%-10zu %14.2f %14.2f\n", sizes[i], inserts / sizes[i] * 1e9, (total - inserts) / sizes[i] * 1e9);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal64.h"
+#include "assembler/assembler.h"
+
+#define REPEATS 5
+
+/* Maps 200 rounds of a linear congruential step over 100000 elements, then sums them. */
+static const char *source =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+    "    PushI64 100000;\n"
+    "    NewArrayI64;\n"
+    "    StoreLocalPointer $0;\n"
+    "    LoadLocalPointer $0;\n"
+    "    ParallelMapI64 :1;\n"
+    "    PushI64 0;\n"
+    "    LoadLocalPointer $0;\n"
+    "    ParallelReduceI64 :2;\n"
+    "    Exit;\n"
+    "}\n"
+    ":1 { args: 1 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+    "    PushI64 0;\n"
+    "    StoreLocalI64 $1;\n"
+    "    MulI64_RI $0 1103515245;\n"
+    "    PushI64 12345;\n"
+    "    AddI64;\n"
+    "    StoreLocalI64 $0;\n"
+    "    IncJumpIfLessThan $1 200 #2;\n"
+    "    LoadLocalI64 $0;\n"
+    "    Return;\n"
+    "}\n"
+    ":2 { args: 2 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalI64 $1;\n"
+    "    AddI64;\n"
+    "    Return;\n"
+    "}\n";
+
+static double
+wall_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Fastest of REPEATS runs, in milliseconds; worker threads start outside the timing. */
+static double
+time_threads(const Program *program, size_t threads, uint64_t *result)
+{
+    double start, elapsed, best = 0;
+    int i;
+
+    for (i = 0; i < REPEATS; i++) {
+        VM vm = init_vm();
+        vm.threads = threads;
+        vm.checked = 0;
+        run_program(&vm, program);
+        vm.operands_stack.size = 0;
+        start = wall_seconds();
+        run_program(&vm, program);
+        elapsed = (wall_seconds() - start) * 1e3;
+        *result = vm.operands_stack.data[0];
+        free_vm(vm);
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+/* Usage: BENCH_PARALLEL [max threads], by default one per core. */
+int
+main(int argc, char **argv)
+{
+    Program program = assemble(source);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads, max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : (size_t) (cores > 0 ? cores : 1);
+    uint64_t result;
+    double single = 0, elapsed;
+
+    printf("%ld cores online\n", cores);
+    printf("%-8s %12s %10s %22s\n", "threads", "ms", "speedup", "result");
+    for (threads = 1; threads <= max_threads; threads++) {
+        elapsed = time_threads(&program, threads, &result);
+        if (threads == 1)
+            single = elapsed;
+        printf("%-8zu %12.3f %10.2f %22zu\n", threads, elapsed, single / elapsed, (size_t) result);
+    }
+    free_program(program);
+    return 0;
+}
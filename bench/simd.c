@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hal64.h"
+#include "simd.h"
+#include "assembler/assembler.h"
+#include "utils/memory.h"
+
+#define LENGTH (1 << 20)
+#define REPEATS 20
+#define VECTOR_PASSES 32
+
+#define HEADER \
+    "---\n" \
+    "globals: 0\n" \
+    "global_pointers: 0\n" \
+    "---\n" \
+    ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 2 } {\n" \
+    "    PushI64 %d;\n" \
+    "    NewArrayI64;\n" \
+    "    StoreLocalPointer $0;\n" \
+    "    PushI64 %d;\n" \
+    "    NewArrayI64;\n" \
+    "    StoreLocalPointer $1;\n" \
+    "    LoadLocalPointer $0;\n" \
+    "    PushI64 3;\n" \
+    "    ArrayFillI64;\n" \
+    "    PushI64 0;\n" \
+    "    StoreLocalI64 $0;\n"
+
+static const char *setup_only =
+    HEADER
+    "    Exit;\n"
+    "}\n";
+
+static const char *sum_loop =
+    HEADER
+    "    LoadLocalI64 $1;\n"
+    "    LoadLocalPointer $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    ArrayLoadI64;\n"
+    "    AddI64;\n"
+    "    StoreLocalI64 $1;\n"
+    "    AddI64_RI $0 1;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LessThanI64_RI $0 %d;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #11;\n"
+    "    Exit;\n"
+    "}\n";
+
+static const char *sum_vector =
+    HEADER
+    "    LoadLocalPointer $0;\n"
+    "    ArraySumI64;\n"
+    "    StoreLocalI64 $1;\n"
+    "    AddI64_RI $0 1;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LessThanI64_RI $0 %d;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #11;\n"
+    "    Exit;\n"
+    "}\n";
+
+static const char *add_loop =
+    HEADER
+    "    LoadLocalPointer $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalPointer $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    ArrayLoadI64;\n"
+    "    LoadLocalPointer $1;\n"
+    "    LoadLocalI64 $0;\n"
+    "    ArrayLoadI64;\n"
+    "    AddI64;\n"
+    "    ArrayStoreI64;\n"
+    "    AddI64_RI $0 1;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LessThanI64_RI $0 %d;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #11;\n"
+    "    Exit;\n"
+    "}\n";
+
+static const char *add_vector =
+    HEADER
+    "    LoadLocalPointer $0;\n"
+    "    LoadLocalPointer $1;\n"
+    "    ArrayAddI64;\n"
+    "    AddI64_RI $0 1;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LessThanI64_RI $0 %d;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #11;\n"
+    "    Exit;\n"
+    "}\n";
+
+/* Returns the fastest of REPEATS runs, in nanoseconds. */
+static double
+time_program(const char *format, int passes)
+{
+    char source[2048];
+    Program program;
+    clock_t start;
+    double elapsed, best = 0;
+    int i;
+
+    snprintf(source, sizeof(source), format, LENGTH, LENGTH, passes == 1 ? LENGTH : passes);
+    program = assemble(source);
+    for (i = 0; i < REPEATS; i++) {
+        VM vm = init_vm();
+        start = clock();
+        run_program(&vm, &program);
+        elapsed = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9;
+        free_vm(vm);
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    free_program(program);
+    return best;
+}
+
+static double
+time_kernel(const SimdKernels *kernels, int add)
+{
+    uint64_t *a = safe_aligned_malloc(LENGTH * sizeof(uint64_t), 64);
+    uint64_t *b = safe_aligned_malloc(LENGTH * sizeof(uint64_t), 64);
+    volatile uint64_t sink = 0;
+    clock_t start;
+    int i;
+
+    for (i = 0; i < LENGTH; i++)
+        a[i] = b[i] = i;
+    start = clock();
+    for (i = 0; i < REPEATS * 10; i++) {
+        if (add)
+            kernels->add(a, b, LENGTH);
+        else
+            sink += kernels->sum(a, LENGTH);
+    }
+    free(a);
+    free(b);
+    return (double) (clock() - start) / CLOCKS_PER_SEC / (REPEATS * 10) * 1e9 / LENGTH;
+}
+
+static double
+per_element(const char *format, int passes, double setup)
+{
+    return (time_program(format, passes) - setup) / passes / LENGTH;
+}
+
+/*
+ * Program timings have the cost of allocating and filling the arrays
+ * subtracted, so they only show the loop or the bulk opcode; the bulk
+ * opcodes run VECTOR_PASSES times to rise above that noise.
+ */
+int
+main(void)
+{
+    int level;
+    double setup = time_program(setup_only, 1);
+    const char *name = simd_kernels()->name;
+
+    printf("%d elements, ns per element\n", LENGTH);
+    printf("interpreted sum loop:   %8.3f\n", per_element(sum_loop, 1, setup));
+    printf("ArraySumI64 (%s):%*s%8.3f\n", name, 8 - (int) strlen(name), "",
+           per_element(sum_vector, VECTOR_PASSES, setup));
+    printf("interpreted add loop:   %8.3f\n", per_element(add_loop, 1, setup));
+    printf("ArrayAddI64 (%s):%*s%8.3f\n", name, 8 - (int) strlen(name), "",
+           per_element(add_vector, VECTOR_PASSES, setup));
+
+    for (level = SIMD_SCALAR; level < SIMD_COUNT; level++) {
+        const SimdKernels *kernels = simd_kernels_for((SimdLevel) level);
+        if (kernels == NULL)
+            continue;
+        printf("%-6s kernel sum: %8.3f  add: %8.3f\n", kernels->name, time_kernel(kernels, 0), time_kernel(kernels, 1));
+    }
+    return 0;
+}
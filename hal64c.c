@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "assembler/assembler.h"
+#include "assembler/lexer.h"
+#include "compiler/compile_c.h"
+#include "optimizer/optimizer.h"
+
+static char *
+read_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char *buffer;
+    long length;
+
+    if (!file) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buffer = malloc(length + 1);
+    if (!buffer) {
+        fclose(file);
+        return NULL;
+    }
+    fread(buffer, 1, length, file);
+    buffer[length] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+static void
+print_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <file>\n", name);
+    fprintf(stderr, "Compiles a HAL64 program to C; link the output against the hal64 runtime.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -O0            disable bytecode optimizations\n");
+    fprintf(stderr, "  -o FILE        write the C code to FILE instead of stdout\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *path = NULL, *output = NULL;
+    int optimize = 1, status;
+    char *source;
+    Program program;
+    FILE *out;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0) {
+            optimize = 0;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (path == NULL) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    source = read_file(path);
+    if (source == NULL) {
+        fprintf(stderr, "Failed to read file\n");
+        return EXIT_FAILURE;
+    }
+    init_lexer(source);
+    program = assemble(source);
+    if (optimize) {
+        inline_functions(&program, INLINE_DEFAULT_BUDGET);
+        optimize_program(&program);
+        layout_functions(&program, NULL);
+    }
+
+    out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", output, strerror(errno));
+        status = 0;
+    } else {
+        status = compile_to_c(&program, out);
+        if (out != stdout)
+            fclose(out);
+    }
+
+    free_lexer();
+    free_program(program);
+    free(source);
+    return status ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -6,3 +6,7 @@
 
 Program
 assemble(const char *source);
+Program
+assemble_lazy(const char *source);
+void
+assemble_body(Function *function);
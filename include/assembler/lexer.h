@@ -1,6 +1,12 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
+#include "opcodes.h"
+
+#define OPCODE_TOKEN(OP, MNEMONIC, OPERANDS, OPERAND_POPS, OPERAND_PUSHES, POINTER_POPS, POINTER_PUSHES, \
+                     VM_ONLY) \
+    TOKEN_##MNEMONIC,
 
 typedef enum
 {
@@ -12,34 +18,8 @@ typedef enum
     TOKEN_PTR_ARGS,
     TOKEN_LOCALS,
     TOKEN_LOCAL_POINTERS,
-    TOKEN_LoadLocalI64,
-    TOKEN_PushI64,
-    TOKEN_LessThanI64_RI,
-    TOKEN_LessThanI64,
-    TOKEN_GreaterThanI64_RI,
-    TOKEN_GreaterThanI64,
-    TOKEN_EqualsI64_RI,
-    TOKEN_EqualsI64,
-    TOKEN_NotEqualsI64,
-    TOKEN_Not,
-    TOKEN_JumpIfFalse,
-    TOKEN_Return,
-    TOKEN_AddI64_RI,
-    TOKEN_AddI64,
-    TOKEN_SubI64_RI,
-    TOKEN_SubI64,
-    TOKEN_MulI64_RI,
-    TOKEN_MulI64,
-    TOKEN_DivI64_RI,
-    TOKEN_DivI64,
-    TOKEN_ModI64_RI,
-    TOKEN_ModI64,
-    TOKEN_Call,
-    TOKEN_PrintTopStackI64,
-    TOKEN_PushLiteralString,
-    TOKEN_ConcatStrings,
-    TOKEN_PrintString,
-    TOKEN_Exit,
+    TOKEN_PURE,
+    HAL64_OPCODES(OPCODE_TOKEN)
     TOKEN_NUMBER,
     TOKEN_STRING,
     TOKEN_COLON,
@@ -48,7 +28,7 @@ typedef enum
     TOKEN_DOLARSIGN,
     TOKEN_OPEN_BRACE,
     TOKEN_CLOSE_BRACE,
-
+    TOKEN_UNKNOWN,
 } TokenType;
 
 typedef struct
@@ -57,6 +37,9 @@ typedef struct
     char value[64];
 } Token;
 
+TokenType opcode_token(const char *word);
 void init_lexer(const char *source);
+void init_lexer_span(const char *source, size_t length);
+int skip_block(size_t *start, size_t *length);
 Token read_token(void);
 void free_lexer(void);
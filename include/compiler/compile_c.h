@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdio.h>
+#include "hal64.h"
+
+int compile_to_c(const Program *program, FILE *out);
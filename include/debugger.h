@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal64.h"
+
+/* Called before every instruction runs, with the index of the instruction in `function`. */
+typedef void (*TraceHook)(void *context, const VM *vm, const Function *function, size_t instruction);
+
+typedef struct
+{
+    size_t function;
+    size_t instruction;
+} Breakpoint;
+
+/*
+ * Hooks into a stack VM. While one is attached the VM runs a separate,
+ * checked copy of the interpreter loop that stops at breakpoints, steps
+ * and traces; without one, the usual loops run untouched, so the hooks
+ * cost nothing. A breakpoint or a step pauses the VM before the
+ * instruction, with `stopped` set, and resume_program() runs it. Attach,
+ * detach and change the hooks only while the VM is not running.
+ */
+typedef struct Debugger
+{
+    TraceHook trace; // NULL for none
+    void *context;   // passed to trace
+    uint8_t stepping; // stop before every instruction
+    uint8_t stopped;  // the VM paused at a breakpoint or step, which resuming runs first
+    Breakpoint *breakpoints;
+    size_t breakpoints_count;
+} Debugger;
+
+Debugger *attach_debugger(VM *vm);
+void detach_debugger(VM *vm);
+void set_breakpoint(Debugger *debugger, size_t function, size_t instruction);
+int clear_breakpoint(Debugger *debugger, size_t function, size_t instruction);
+int debug_stop(VM *vm, const Function *function, const Instruction *instruction);
@@ -2,41 +2,22 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "memo.h"
+#include "opcodes.h"
+#include "simd.h"
 
-#define GC_LIMIT 0
+#define GC_DEFAULT_THRESHOLD (1 << 20)
+#define GC_DEFAULT_GROWTH_FACTOR 2.0
+#define GC_PAUSE_BUCKETS 7
+#define VM_UNLIMITED_FUEL UINT64_MAX
+#define INPUT_DEFAULT_CHUNK_SIZE (1 << 16)
 
-typedef enum
-{
-    OP_NOOP = 0,
-    OP_LOAD_LOCAL_I64,
-    OP_PUSH_I64,
-    OP_LESS_THAN_I64_RI,
-    OP_LESS_THAN_I64,
-    OP_GREATER_THAN_I64_RI,
-    OP_GREATER_THAN_I64,
-    OP_EQUALS_I64_RI,
-    OP_EQUALS_I64,
-    OP_NOT_EQUALS_I64,
-    OP_NOT,
-    OP_JUMP_IF_FALSE,
-    OP_RETURN,
-    OP_ADD_I64_RI,
-    OP_ADD_I64,
-    OP_SUB_I64_RI,
-    OP_SUB_I64,
-    OP_MUL_I64_RI,
-    OP_MUL_I64,
-    OP_DIV_I64_RI,
-    OP_DIV_I64,
-    OP_MOD_I64_RI,
-    OP_MOD_I64,
-    OP_CALL,
-    OP_PRINT_TOP_STACK_I64,
-    OP_PUSH_LITERAL_STRING,
-    OP_CONCAT_STRINGS,
-    OP_PRINT_STRING,
-    OP_EXIT,
-} InstructionOp;
+// release builds run the interpreter without its runtime checks unless asked
+#ifdef NDEBUG
+#define VM_CHECKED_DEFAULT 0
+#else
+#define VM_CHECKED_DEFAULT 1
+#endif
 
 typedef struct
 {
@@ -60,6 +41,12 @@ typedef struct
             char *ptr;
             size_t size;
         } string;
+        struct
+        {
+            uint32_t reg;
+            uint32_t target;
+            uint64_t limit; // only used by IncJumpIfLessThan
+        } loop;
     } data;
 } Instruction;
 
@@ -67,12 +54,16 @@ typedef struct
 {
     Instruction *instructions;
     size_t id;
+    size_t source_id; // the id the source gave it, kept for diagnostics when layout_functions() renumbers
     size_t args_count;
     size_t ptr_args_count;
     size_t locals_count;
     size_t local_pointers_count;
     size_t instructions_count;
     size_t stack_frame_size;
+    uint8_t pure;
+    const char *body; // source of a body not yet assembled, see assemble_lazy()
+    size_t body_length;
 } Function;
 
 typedef struct
@@ -83,13 +74,39 @@ typedef struct
     Function *functions;
 } Program;
 
-typedef struct
+typedef enum
+{
+    OBJECT_STRING = 0,
+    OBJECT_I64_ARRAY,
+    OBJECT_STRING_VIEW,
+    OBJECT_MAP, // data is a HashMap, size counts its table
+} HeapObjectKind;
+
+typedef struct HeapObject
 {
     uint8_t marked;
-    size_t size;
-    void *data;
+    uint8_t kind;
+    uint32_t refs; // pointers to it, only counted in MEMORY_REFCOUNT mode
+    size_t size;   // in bytes, an i64 array holds size / 8 elements
+    void *data;    // a string view points into its parent's data
+    struct HeapObject *parent;
+    size_t index; // in vm->objects, only kept in MEMORY_REFCOUNT mode
 } HeapObject;
 
+/*
+ * Strings of up to STRING_INLINE_MAX bytes are never allocated: the pointer
+ * slot holds them itself, with (length << 1) | 1 in its low byte and the
+ * bytes above it, first byte lowest. Heap objects are aligned, so only these
+ * pointers have the low bit set. Any string pointer may be one, so read
+ * strings through string_length() and string_bytes().
+ */
+#define STRING_INLINE_MAX 7
+
+int is_inline_string(const HeapObject *string);
+HeapObject *inline_string(const char *bytes, size_t length);
+size_t string_length(const HeapObject *string);
+const char *string_bytes(const HeapObject *string, char *buffer);
+
 typedef struct
 {
     uint64_t *data;
@@ -104,6 +121,79 @@ typedef struct
     size_t capacity;
 } PointersArray;
 
+/*
+ * How a VM frees heap objects. Reference counting frees each one as soon as
+ * the last pointer to it is dropped, so it never pauses; only maps can hold
+ * pointers to maps, and a map that reaches itself is kept until free_vm().
+ */
+typedef enum
+{
+    MEMORY_TRACING = 0, // collections driven by GCConfig
+    MEMORY_REFCOUNT,
+} MemoryMode;
+
+typedef struct
+{
+    size_t initial_threshold; // bytes allocated before the first collection
+    double growth_factor;     // the next threshold is the live heap size times this
+    size_t max_heap_size;     // 0 means unlimited
+} GCConfig;
+
+typedef struct
+{
+    size_t collections;
+    size_t pause_histogram[GC_PAUSE_BUCKETS]; // <1us, <10us, ... <100ms, >=100ms
+    double total_pause;
+    double max_pause;
+    size_t objects_swept;
+    size_t bytes_swept;
+    size_t peak_heap_size;
+    size_t call_stack_high_water;
+    size_t operands_stack_high_water;
+    size_t pointers_stack_high_water;
+} GCStats;
+
+/*
+ * A C function called by CallNative. `args` points at its first argument
+ * on the operand stack and `ptr_args` at its first pointer argument on
+ * the pointer stack; it leaves its results in args[0], args[1], ..., which
+ * has room for them even when there are more results than arguments. It
+ * must not keep either pointer, nor any object it did not get as an argument.
+ * String arguments may be inline, see is_inline_string().
+ */
+typedef void (*NativeFunction)(uint64_t *args, HeapObject **ptr_args);
+
+typedef struct
+{
+    NativeFunction function;
+    size_t args_count;
+    size_t ptr_args_count;
+    size_t results_count;
+} Native;
+
+/*
+ * Input is read a chunk at a time into a string on the heap, and lines are
+ * views of it. A full chunk is left to the collector once no line points
+ * into it, so input of any size streams through a few chunks.
+ */
+typedef struct
+{
+    int fd;
+    size_t chunk_size; // a chunk is bigger when one line does not fit
+    HeapObject *chunk; // NULL until the first read
+    size_t start;      // unread bytes of the chunk are [start, end)
+    size_t end;
+    uint8_t eof;
+} InputBuffer;
+
+typedef struct
+{
+    size_t function;
+    size_t call_depth;
+    size_t operands_size;
+    size_t key_offset;
+} MemoFrame;
+
 typedef struct
 {
     Array call_stack;
@@ -111,7 +201,36 @@ typedef struct
     PointersArray pointers_stack;
     PointersArray objects;
     uint64_t *locals;
+    uint64_t *globals;
+    HeapObject **global_pointers; // shares the cache-aligned block of globals
+    const Program *program;
+    const Function *function;
+    const SimdKernels *simd;
     size_t allocated_heap_size;
+    size_t gc_threshold;
+    uint8_t memory; // a MemoryMode, chosen before anything is allocated
+    GCConfig gc;
+    GCStats gc_stats;
+    MemoCache *memo_caches; // indexed by function id, NULL unless a function is pure
+    size_t memo_caches_count;
+    size_t memo_capacity;
+    Array memo_keys;
+    MemoFrame *memo_frames;
+    size_t memo_frames_size;
+    size_t memo_frames_capacity;
+    uint8_t pause_at_snapshot; // when clear, Snapshot does nothing
+    uint8_t paused;
+    uint8_t out_of_fuel;       // set along with paused when fuel ran out rather than a Snapshot
+    uint64_t fuel;             // spent on backward jumps and calls, see charge_fuel()
+    size_t resume_instruction; // in vm->function, valid while paused
+    struct Profile *profile;   // edge counters, NULL unless profiling
+    uint8_t checked;           // run the interpreter loop that validates every instruction
+    Native *natives;           // indexed by CallNative's operand
+    size_t natives_count;
+    InputBuffer input; // read by ReadLine, ReadI64 and ReadAll, stdin by default
+    size_t threads;    // workers for the parallel instructions, 0 for one per core
+    struct WorkerPool *workers; // NULL until the first parallel instruction
+    struct Debugger *debugger;  // NULL unless hooks are attached, see debugger.h
 } VM;
 
 Program init_program(void);
@@ -120,10 +239,19 @@ void emit_function(Program *program, Function function);
 void emit_instruction(Function *function, Instruction instruction);
 
 void free_program(Program program);
+uint64_t program_fingerprint(const Program *program);
 void print_program(Program program);
 
 void instruction_as_string(Instruction instruction, char *s, size_t max_length);
 
 VM init_vm(void);
 void free_vm(VM vm);
-void execute_program(Program program);
\ No newline at end of file
+void register_native(VM *vm, size_t id, Native native);
+void count_references(VM *vm);
+void init_globals(VM *vm, const Program *program);
+void run_program(VM *vm, const Program *program);
+uint64_t invoke_i64_function(VM *vm, const Program *program, size_t id, const uint64_t *args);
+void resume_program(VM *vm, const Program *program);
+void execute_program(Program program);
+void print_memo_stats(const VM *vm);
+void print_gc_stats(const VM *vm);
\ No newline at end of file
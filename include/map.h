@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAP_GROUP_SIZE 16
+
+// NewMap's operand
+#define MAP_STRING_KEYS 1    // keys are strings compared by content, otherwise i64s
+#define MAP_POINTER_VALUES 2 // values are heap objects, otherwise i64s
+#define MAP_KINDS (MAP_STRING_KEYS | MAP_POINTER_VALUES)
+
+typedef struct
+{
+    uint64_t key;   // an i64, or the HeapObject * of a string
+    uint64_t value; // an i64, or a HeapObject *
+} MapSlot;
+
+/*
+ * An open-addressing table probed MAP_GROUP_SIZE slots at a time. Each
+ * slot has a control byte holding 7 bits of its key's hash, or marking it
+ * empty or deleted, so a group is matched with one SIMD compare and keys
+ * are only compared on a hash match.
+ */
+typedef struct
+{
+    uint8_t *control;
+    MapSlot *slots;
+    size_t capacity; // a power of two, at least MAP_GROUP_SIZE
+    size_t size;
+    size_t deleted;
+    uint8_t flags;
+} HashMap;
+
+HashMap init_hash_map(uint8_t flags);
+void free_hash_map(HashMap *map);
+size_t hash_map_bytes(const HashMap *map);
+MapSlot *hash_map_find(const HashMap *map, uint64_t key);
+MapSlot *hash_map_insert(HashMap *map, uint64_t key);
+int hash_map_remove(HashMap *map, uint64_t key);
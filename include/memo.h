@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMO_DEFAULT_CAPACITY 4096
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t result;
+    uint8_t used;
+    uint8_t referenced;
+} MemoEntry;
+
+typedef struct
+{
+    MemoEntry *entries;
+    uint64_t *keys;
+    size_t args_count;
+    size_t mask;
+    size_t size;
+    size_t max_size;
+    size_t hand;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} MemoCache;
+
+MemoCache init_memo_cache(size_t args_count, size_t max_size);
+void free_memo_cache(MemoCache cache);
+int memo_lookup(MemoCache *cache, const uint64_t *args, uint64_t *result);
+void memo_insert(MemoCache *cache, const uint64_t *args, uint64_t result);
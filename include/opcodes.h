@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+
+/* What follows a mnemonic in assembly, and how the operands are stored in an Instruction. */
+typedef enum
+{
+    OPERANDS_NONE,
+    OPERANDS_LOCAL,              // $n in data.reg
+    OPERANDS_LOCAL_POINTER,      // $n in data.reg
+    OPERANDS_GLOBAL,             // $n in data.reg
+    OPERANDS_GLOBAL_POINTER,     // $n in data.reg
+    OPERANDS_IMMEDIATE,          // n in data.immediate
+    OPERANDS_LOCAL_IMMEDIATE,    // $n n in data.ri
+    OPERANDS_TARGET,             // #n in data.reg
+    OPERANDS_FUNCTION,           // :n in data.reg
+    OPERANDS_NATIVE,             // :n in data.reg, an id registered with register_native()
+    OPERANDS_STRING,             // "..." in data.string
+    OPERANDS_LOCAL_TARGET,       // $n #n in data.loop
+    OPERANDS_LOCAL_LIMIT_TARGET, // $n n #n in data.loop
+} OperandFormat;
+
+/*
+ * Every instruction, in opcode order: the opcode, its assembler mnemonic,
+ * its operands, then how many operands and pointers it pops and pushes.
+ * A call's stack effect comes from the callee instead, and a native
+ * call's from the VM it runs on. The last column marks instructions that
+ * only run on the VM: natives are registered on a VM, and the compiled
+ * runtime has no maps, input or worker threads.
+ *
+ * The opcode enum, the lexer tokens, the assembler, the disassembler and
+ * the interpreters' operand checks are all expanded from this list, so a
+ * new instruction only needs an entry here and its handlers.
+ */
+#define HAL64_OPCODES(X) \
+    X(OP_NOOP, Noop, OPERANDS_NONE, 0, 0, 0, 0, 0) \
+    X(OP_LOAD_LOCAL_I64, LoadLocalI64, OPERANDS_LOCAL, 0, 1, 0, 0, 0) \
+    X(OP_STORE_LOCAL_I64, StoreLocalI64, OPERANDS_LOCAL, 1, 0, 0, 0, 0) \
+    X(OP_LOAD_LOCAL_POINTER, LoadLocalPointer, OPERANDS_LOCAL_POINTER, 0, 0, 0, 1, 0) \
+    X(OP_STORE_LOCAL_POINTER, StoreLocalPointer, OPERANDS_LOCAL_POINTER, 0, 0, 1, 0, 0) \
+    X(OP_LOAD_GLOBAL_I64, LoadGlobalI64, OPERANDS_GLOBAL, 0, 1, 0, 0, 0) \
+    X(OP_STORE_GLOBAL_I64, StoreGlobalI64, OPERANDS_GLOBAL, 1, 0, 0, 0, 0) \
+    X(OP_LOAD_GLOBAL_POINTER, LoadGlobalPointer, OPERANDS_GLOBAL_POINTER, 0, 0, 0, 1, 0) \
+    X(OP_STORE_GLOBAL_POINTER, StoreGlobalPointer, OPERANDS_GLOBAL_POINTER, 0, 0, 1, 0, 0) \
+    X(OP_PUSH_I64, PushI64, OPERANDS_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_LESS_THAN_I64_RI, LessThanI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_LESS_THAN_I64, LessThanI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_GREATER_THAN_I64_RI, GreaterThanI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_GREATER_THAN_I64, GreaterThanI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_EQUALS_I64_RI, EqualsI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_EQUALS_I64, EqualsI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_NOT_EQUALS_I64, NotEqualsI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_NOT, NotI64, OPERANDS_NONE, 1, 1, 0, 0, 0) \
+    X(OP_JUMP_IF_FALSE, JumpIfFalse, OPERANDS_TARGET, 1, 0, 0, 0, 0) \
+    X(OP_JUMP_IF_TRUE, JumpIfTrue, OPERANDS_TARGET, 1, 0, 0, 0, 0) \
+    X(OP_JUMP, Jump, OPERANDS_TARGET, 0, 0, 0, 0, 0) \
+    X(OP_DEC_JUMP_IF_NOT_ZERO, DecJumpIfNotZero, OPERANDS_LOCAL_TARGET, 0, 0, 0, 0, 0) \
+    X(OP_INC_JUMP_IF_LESS_THAN, IncJumpIfLessThan, OPERANDS_LOCAL_LIMIT_TARGET, 0, 0, 0, 0, 0) \
+    X(OP_RETURN, Return, OPERANDS_NONE, 0, 0, 0, 0, 0) \
+    X(OP_ADD_I64_RI, AddI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_ADD_I64, AddI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_SUB_I64_RI, SubI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_SUB_I64, SubI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_MUL_I64_RI, MulI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_MUL_I64, MulI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_DIV_I64_RI, DivI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_DIV_I64, DivI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_MOD_I64_RI, ModI64_RI, OPERANDS_LOCAL_IMMEDIATE, 0, 1, 0, 0, 0) \
+    X(OP_MOD_I64, ModI64, OPERANDS_NONE, 2, 1, 0, 0, 0) \
+    X(OP_CALL, Call, OPERANDS_FUNCTION, 0, 0, 0, 0, 0) \
+    X(OP_CALL_NATIVE, CallNative, OPERANDS_NATIVE, 0, 0, 0, 0, 1) \
+    X(OP_PRINT_TOP_STACK_I64, PrintTopStackI64, OPERANDS_NONE, 1, 0, 0, 0, 0) \
+    X(OP_PUSH_LITERAL_STRING, PushLiteralString, OPERANDS_STRING, 0, 0, 0, 1, 0) \
+    X(OP_CONCAT_STRINGS, ConcatStrings, OPERANDS_NONE, 0, 0, 2, 1, 0) \
+    X(OP_PRINT_STRING, PrintString, OPERANDS_NONE, 0, 0, 1, 0, 0) \
+    X(OP_SLICE_STRING, SliceString, OPERANDS_NONE, 2, 0, 1, 1, 0) \
+    X(OP_STRING_LENGTH, StringLength, OPERANDS_NONE, 0, 1, 1, 0, 0) \
+    X(OP_FIND_STRING, FindString, OPERANDS_NONE, 0, 1, 2, 0, 0) \
+    X(OP_COMPARE_STRINGS, CompareStrings, OPERANDS_NONE, 0, 1, 2, 0, 0) \
+    X(OP_NEW_ARRAY_I64, NewArrayI64, OPERANDS_NONE, 1, 0, 0, 1, 0) \
+    X(OP_ARRAY_LENGTH_I64, ArrayLengthI64, OPERANDS_NONE, 0, 1, 1, 0, 0) \
+    X(OP_ARRAY_LOAD_I64, ArrayLoadI64, OPERANDS_NONE, 1, 1, 1, 0, 0) \
+    X(OP_ARRAY_STORE_I64, ArrayStoreI64, OPERANDS_NONE, 2, 0, 1, 0, 0) \
+    X(OP_ARRAY_FILL_I64, ArrayFillI64, OPERANDS_NONE, 1, 0, 1, 0, 0) \
+    X(OP_ARRAY_COPY_I64, ArrayCopyI64, OPERANDS_NONE, 3, 0, 2, 0, 0) \
+    X(OP_ARRAY_ADD_I64, ArrayAddI64, OPERANDS_NONE, 0, 0, 2, 0, 0) \
+    X(OP_ARRAY_SUB_I64, ArraySubI64, OPERANDS_NONE, 0, 0, 2, 0, 0) \
+    X(OP_ARRAY_MUL_I64, ArrayMulI64, OPERANDS_NONE, 0, 0, 2, 0, 0) \
+    X(OP_ARRAY_ADD_SCALAR_I64, ArrayAddScalarI64, OPERANDS_NONE, 1, 0, 1, 0, 0) \
+    X(OP_ARRAY_SUB_SCALAR_I64, ArraySubScalarI64, OPERANDS_NONE, 1, 0, 1, 0, 0) \
+    X(OP_ARRAY_MUL_SCALAR_I64, ArrayMulScalarI64, OPERANDS_NONE, 1, 0, 1, 0, 0) \
+    X(OP_ARRAY_SUM_I64, ArraySumI64, OPERANDS_NONE, 0, 1, 1, 0, 0) \
+    X(OP_ARRAY_MIN_I64, ArrayMinI64, OPERANDS_NONE, 0, 1, 1, 0, 0) \
+    X(OP_ARRAY_MAX_I64, ArrayMaxI64, OPERANDS_NONE, 0, 1, 1, 0, 0) \
+    X(OP_ARRAY_EQUALS_I64, ArrayEqualsI64, OPERANDS_NONE, 0, 0, 2, 1, 0) \
+    X(OP_ARRAY_LESS_THAN_I64, ArrayLessThanI64, OPERANDS_NONE, 0, 0, 2, 1, 0) \
+    X(OP_ARRAY_GREATER_THAN_I64, ArrayGreaterThanI64, OPERANDS_NONE, 0, 0, 2, 1, 0) \
+    X(OP_NEW_MAP, NewMap, OPERANDS_IMMEDIATE, 0, 0, 0, 1, 1) \
+    X(OP_MAP_SIZE, MapSize, OPERANDS_NONE, 0, 1, 1, 0, 1) \
+    X(OP_MAP_GET_I64, MapGetI64, OPERANDS_NONE, 1, 1, 1, 0, 1) \
+    X(OP_MAP_PUT_I64, MapPutI64, OPERANDS_NONE, 2, 0, 1, 0, 1) \
+    X(OP_MAP_CONTAINS_I64, MapContainsI64, OPERANDS_NONE, 1, 1, 1, 0, 1) \
+    X(OP_MAP_DELETE_I64, MapDeleteI64, OPERANDS_NONE, 1, 0, 1, 0, 1) \
+    X(OP_MAP_GET_POINTER_I64, MapGetPointerI64, OPERANDS_NONE, 1, 0, 1, 1, 1) \
+    X(OP_MAP_PUT_POINTER_I64, MapPutPointerI64, OPERANDS_NONE, 1, 0, 2, 0, 1) \
+    X(OP_MAP_GET_STRING, MapGetString, OPERANDS_NONE, 0, 1, 2, 0, 1) \
+    X(OP_MAP_PUT_STRING, MapPutString, OPERANDS_NONE, 1, 0, 2, 0, 1) \
+    X(OP_MAP_CONTAINS_STRING, MapContainsString, OPERANDS_NONE, 0, 1, 2, 0, 1) \
+    X(OP_MAP_DELETE_STRING, MapDeleteString, OPERANDS_NONE, 0, 0, 2, 0, 1) \
+    X(OP_MAP_GET_POINTER_STRING, MapGetPointerString, OPERANDS_NONE, 0, 0, 2, 1, 1) \
+    X(OP_MAP_PUT_POINTER_STRING, MapPutPointerString, OPERANDS_NONE, 0, 0, 3, 0, 1) \
+    X(OP_READ_LINE, ReadLine, OPERANDS_NONE, 0, 1, 0, 1, 1) \
+    X(OP_READ_I64, ReadI64, OPERANDS_NONE, 0, 2, 0, 0, 1) \
+    X(OP_READ_ALL, ReadAll, OPERANDS_NONE, 0, 0, 0, 1, 1) \
+    X(OP_PARALLEL_MAP_I64, ParallelMapI64, OPERANDS_FUNCTION, 0, 0, 1, 0, 1) \
+    X(OP_PARALLEL_REDUCE_I64, ParallelReduceI64, OPERANDS_FUNCTION, 1, 1, 1, 0, 1) \
+    X(OP_SNAPSHOT, Snapshot, OPERANDS_NONE, 0, 0, 0, 0, 0) \
+    X(OP_EXIT, Exit, OPERANDS_NONE, 0, 0, 0, 0, 0)
+
+#define OPCODE_ENUM(OP, MNEMONIC, OPERANDS, OPERAND_POPS, OPERAND_PUSHES, POINTER_POPS, POINTER_PUSHES, \
+                    VM_ONLY) OP,
+
+typedef enum
+{
+    HAL64_OPCODES(OPCODE_ENUM)
+    OPCODES_COUNT
+} InstructionOp;
+
+typedef struct
+{
+    const char *mnemonic;
+    const char *name; // the opcode without its OP_ prefix, used when printing
+    OperandFormat operands;
+    uint8_t operand_pops;
+    uint8_t operand_pushes;
+    uint8_t pointer_pops;
+    uint8_t pointer_pushes;
+    uint8_t vm_only; // compile_to_c() rejects programs using it
+} OpcodeInfo;
+
+extern const OpcodeInfo opcodes[OPCODES_COUNT];
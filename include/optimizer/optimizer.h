@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal64.h"
+#include "profile.h"
+
+#define INLINE_DEFAULT_BUDGET 16
+#define INLINE_HOT_BUDGET 64 // for call sites a profile shows to be hot
+#define STACK_DEPTH_UNKNOWN SIZE_MAX
+
+typedef struct
+{
+    size_t *callees;
+    size_t callees_count;
+    uint8_t recursive;
+} CallGraphNode;
+
+typedef struct
+{
+    CallGraphNode *nodes;
+    size_t nodes_count;
+    size_t *order; // post-order: every callee comes before its callers
+} CallGraph;
+
+typedef struct
+{
+    size_t operands;
+    size_t pointers;
+} StackDepth;
+
+typedef struct
+{
+    StackDepth **depths; // per function, the depth before each instruction; unreachable ones are unknown
+    StackDepth *max_depths;
+    StackDepth *returns; // what each function leaves on the stacks when it returns
+    size_t functions_count;
+} StackLayout;
+
+CallGraph build_call_graph(const Program *program);
+void free_call_graph(CallGraph graph);
+
+int compute_stack_layout(const Program *program, StackLayout *layout);
+void free_stack_layout(StackLayout layout);
+
+size_t jump_target(const Instruction *instruction);
+void set_jump_target(Instruction *instruction, size_t target);
+size_t compact_function(Function *function, const uint8_t *removed);
+size_t fold_constants(Function *function);
+size_t inline_functions(Program *program, size_t budget);
+size_t inline_hot_calls(Program *program, const Profile *profile, size_t budget);
+size_t layout_hot_paths(Program *program, Profile *profile);
+size_t layout_functions(Program *program, Profile *profile);
+size_t infer_purity(Program *program);
+int verify_purity(const Program *program, size_t id);
+size_t optimize_program(Program *program);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal64.h"
+
+#define PARALLEL_BLOCK 256 // elements a worker takes at a time
+
+/*
+ * Runs a pure function over the elements of an i64 array on a set of
+ * worker threads. Each worker has a VM of its own for the calls, while
+ * the program is shared read-only; the thread that starts a job works on
+ * it too, as worker 0.
+ */
+typedef struct WorkerPool WorkerPool;
+
+WorkerPool *init_worker_pool(const VM *vm, size_t threads);
+void free_worker_pool(WorkerPool *pool);
+int check_parallel_function(WorkerPool *pool, const Program *program, size_t function, size_t args_count);
+void parallel_map(WorkerPool *pool, const Program *program, size_t function, uint64_t *data, size_t length);
+uint64_t parallel_reduce(WorkerPool *pool, const Program *program, size_t function, uint64_t initial,
+                         uint64_t *data, size_t length);
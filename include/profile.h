@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal64.h"
+
+#define PROFILE_HOT_PERCENT 1 // call sites making at least this share of all calls are hot
+
+/*
+ * Edge counters of one function, indexed by instruction. Jumps count in
+ * `taken`, conditional ones count the fall-through in `not_taken` too, and
+ * call sites count in `taken`. Block counts follow from these and the
+ * entry count, so straight-line code costs nothing to profile.
+ */
+typedef struct
+{
+    uint64_t calls;
+    uint64_t *taken;
+    uint64_t *not_taken;
+    size_t instructions_count;
+} FunctionProfile;
+
+typedef struct Profile
+{
+    FunctionProfile *functions;
+    size_t functions_count;
+    uint64_t fingerprint; // of the program the counters were recorded on
+} Profile;
+
+Profile init_profile(const Program *program);
+void free_profile(Profile profile);
+int save_profile(const Profile *profile, const char *path);
+int load_profile(Profile *profile, const Program *program, const char *path);
+uint64_t *execution_counts(const Function *function, const FunctionProfile *profile);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal64.h"
+
+typedef enum
+{
+    REG_MOVE = 0,
+    REG_LOAD_IMMEDIATE,
+    REG_LOAD_GLOBAL,
+    REG_STORE_GLOBAL,
+    REG_ADD,
+    REG_SUB,
+    REG_MUL,
+    REG_DIV,
+    REG_MOD,
+    REG_LESS_THAN,
+    REG_GREATER_THAN,
+    REG_EQUALS,
+    REG_NOT_EQUALS,
+    REG_NOT,
+    REG_ADD_IMMEDIATE,
+    REG_SUB_IMMEDIATE,
+    REG_MUL_IMMEDIATE,
+    REG_DIV_IMMEDIATE,
+    REG_MOD_IMMEDIATE,
+    REG_LESS_THAN_IMMEDIATE,
+    REG_GREATER_THAN_IMMEDIATE,
+    REG_EQUALS_IMMEDIATE,
+    REG_NOT_EQUALS_IMMEDIATE,
+    REG_JUMP,
+    REG_JUMP_IF_FALSE,
+    REG_JUMP_IF_TRUE,
+    REG_DEC_JUMP_IF_NOT_ZERO,
+    REG_INC_JUMP_IF_LESS_THAN,
+    REG_CALL,
+    REG_RETURN,
+    REG_RETURN_VOID,
+    REG_PRINT,
+    REG_EXIT,
+} RegisterOp;
+
+/*
+ * Three-address code over the registers of the current frame. `b` doubles
+ * as the jump target, the global index or the callee id; a call passes its
+ * arguments in consecutive registers starting at `a` and gets the result
+ * back in `a`. Exit hands `dst` registers starting at `a` back to the
+ * operand stack.
+ */
+typedef struct
+{
+    RegisterOp op;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+    uint64_t immediate;
+} RegisterInstruction;
+
+typedef struct
+{
+    RegisterInstruction *instructions;
+    size_t instructions_count;
+    size_t args_count;
+    size_t registers_count; // locals first, then one register per operand stack slot
+    uint8_t returns_value;
+} RegisterFunction;
+
+typedef struct
+{
+    RegisterFunction *functions;
+    size_t functions_count;
+    const Program *source;
+} RegisterProgram;
+
+int translate_program(const Program *program, RegisterProgram *result);
+void free_register_program(RegisterProgram program);
+void run_register_program(VM *vm, const RegisterProgram *program);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "hal64.h"
+
+#define SERVER_DEFAULT_CACHE_SIZE 64
+#define SERVER_REQUEST_MAX 4096 // bytes in one request line, newline included
+
+typedef struct
+{
+    char *path;            // NULL once the file changed, so only the fingerprint finds it
+    struct timespec mtime; // of the file when it was assembled
+    off_t size;
+    uint64_t fingerprint;
+    Program program;
+    uint64_t last_used;
+} CachedProgram;
+
+/* Least recently used programs are evicted first; lookups scan, capacities are small. */
+typedef struct
+{
+    CachedProgram *entries;
+    size_t count;
+    size_t capacity;
+    uint64_t clock;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} ProgramCache;
+
+/*
+ * Runs programs on request, assembling each file once. A request is one line:
+ *
+ *     <path or #fingerprint> [argument ...]
+ *
+ * where the fingerprint is the one a response gave for an earlier run, and
+ * the arguments are the program's input, one per line. The response is
+ *
+ *     program <fingerprint>
+ *     out <n> followed by n bytes of standard output
+ *     err <n> followed by n bytes of standard error
+ *     exit <status>
+ *
+ * with any number of out and err frames, as the program writes them, and no
+ * program line when there was no program to run. Errors end a VM's process,
+ * so every request runs in a child forked from the server, on a copy of its
+ * VM and cached program; files are first assembled in a child the same way,
+ * so one that does not assemble only fails its request.
+ */
+typedef struct
+{
+    VM vm; // every request starts from a copy of it
+    ProgramCache cache;
+    int optimize;
+    size_t inline_budget;
+} Server;
+
+Server init_server(VM vm, size_t cache_capacity);
+void free_server(Server server);
+int serve_requests(Server *server, int in_fd, int out_fd);
+int serve_socket(Server *server, const char *path);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_COUNT,
+} SimdLevel;
+
+typedef struct
+{
+    const char *name;
+    void (*add)(uint64_t *a, const uint64_t *b, size_t n);
+    void (*sub)(uint64_t *a, const uint64_t *b, size_t n);
+    void (*mul)(uint64_t *a, const uint64_t *b, size_t n);
+    void (*add_scalar)(uint64_t *a, uint64_t b, size_t n);
+    void (*sub_scalar)(uint64_t *a, uint64_t b, size_t n);
+    void (*mul_scalar)(uint64_t *a, uint64_t b, size_t n);
+    uint64_t (*sum)(const uint64_t *a, size_t n);
+    uint64_t (*min)(const uint64_t *a, size_t n);
+    uint64_t (*max)(const uint64_t *a, size_t n);
+    void (*equals)(uint64_t *mask, const uint64_t *a, const uint64_t *b, size_t n);
+    void (*less_than)(uint64_t *mask, const uint64_t *a, const uint64_t *b, size_t n);
+    void (*greater_than)(uint64_t *mask, const uint64_t *a, const uint64_t *b, size_t n);
+} SimdKernels;
+
+const SimdKernels *simd_kernels(void);
+const SimdKernels *simd_kernels_for(SimdLevel level);
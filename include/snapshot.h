@@ -0,0 +1,6 @@
+#pragma once
+
+#include "hal64.h"
+
+int save_snapshot(const VM *vm, const Program *program, const char *path);
+int load_snapshot(VM *vm, const Program *program, const char *path);
@@ -4,3 +4,4 @@
 
 void *safe_malloc(size_t size);
 void *safe_realloc(void *buff, size_t size);
+void *safe_aligned_malloc(size_t size, size_t alignment);
@@ -1,9 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #include "assembler/assembler.h"
 #include "assembler/lexer.h"
+#include "debugger.h"
+#include "optimizer/optimizer.h"
+#include "profile.h"
+#include "register_vm.h"
+#include "server.h"
+#include "snapshot.h"
 
 char *
 read_file(const char *path)
@@ -26,26 +34,274 @@ read_file(const char *path)
     return buffer;
 }
 
+/* Prints each instruction to stderr as it is about to run. */
+static void
+trace_instruction(void *context, const VM *vm, const Function *function, size_t instruction)
+{
+    Instruction shown = function->instructions[instruction];
+    char buff[256];
+
+    (void) context;
+    // functions are shown by the ids the source gave them, callees too
+    if (opcodes[shown.op].operands == OPERANDS_FUNCTION && shown.data.reg < vm->program->functions_count)
+        shown.data.reg = vm->program->functions[shown.data.reg].source_id;
+    instruction_as_string(shown, buff, sizeof(buff));
+    fprintf(stderr, ":%zu #%zu %s\n", function->source_id, instruction, buff);
+}
+
+static void
+print_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <file>\n", name);
+    fprintf(stderr, "       %s [options] --serve=SOCKET\n", name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -O0            disable bytecode optimizations\n");
+    fprintf(stderr, "  --inline-budget=N\n");
+    fprintf(stderr, "                 inline non-recursive functions of up to N instructions (default %d)\n",
+            INLINE_DEFAULT_BUDGET);
+    fprintf(stderr, "  --opt-stats    report what the optimizer did\n");
+    fprintf(stderr, "  --lazy         assemble each function body on its first call; skips the bytecode\n");
+    fprintf(stderr, "                 optimizations, ignored with options that need the whole program\n");
+    fprintf(stderr, "  --infer-purity memoize every function proven pure, not only `pure: 1` ones\n");
+    fprintf(stderr, "  --memo-size=N  cache up to N results per pure function, 0 disables (default %d)\n",
+            MEMO_DEFAULT_CAPACITY);
+    fprintf(stderr, "  --memo-stats   report memoization cache hits and misses\n");
+    fprintf(stderr, "  --register-vm  translate to register code and run it on the register VM,\n");
+    fprintf(stderr, "                 falling back to the stack VM for heap and pointer code and pure functions\n");
+    fprintf(stderr, "  --profile-generate=FILE\n");
+    fprintf(stderr, "                 count branches and calls on the stack VM and write them to FILE\n");
+    fprintf(stderr, "  --profile-use=FILE\n");
+    fprintf(stderr, "                 lay out hot paths, inline hot call sites and place hot functions first\n");
+    fprintf(stderr, "                 from a profile of the same program, compiled the same way\n");
+    fprintf(stderr, "  --checked      validate every instruction: stack depths, operand indices, divisors\n");
+    fprintf(stderr, "                 and heap bounds (the default unless built with NDEBUG)\n");
+    fprintf(stderr, "  --unchecked    run the interpreter loop with every check compiled out\n");
+    fprintf(stderr, "  --threads=N    run ParallelMapI64 and ParallelReduceI64 on N threads (default one per core)\n");
+    fprintf(stderr, "  --fuel=N       stop with an error once about N instructions have run; fuel is charged\n");
+    fprintf(stderr, "                 on calls and backward jumps, and always runs on the stack VM\n");
+    fprintf(stderr, "  --trace        print every instruction to stderr before it runs, always on the stack VM\n");
+    fprintf(stderr, "  --input=FILE   read input from FILE instead of stdin\n");
+    fprintf(stderr, "  --snapshot=FILE\n");
+    fprintf(stderr, "                 stop at the first Snapshot instruction and save the VM to FILE\n");
+    fprintf(stderr, "  --restore=FILE resume from a snapshot of the same program, compiled the same way;\n");
+    fprintf(stderr, "                 both always run on the stack VM\n");
+    fprintf(stderr, "  --gc-stats     report collections, pause times, heap and stack usage\n");
+    fprintf(stderr, "  --gc-threshold=BYTES\n");
+    fprintf(stderr, "                 heap size that triggers the first collection (default %d)\n",
+            GC_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  --gc-growth=F  grow the threshold to F times the live heap (default %.1f)\n",
+            GC_DEFAULT_GROWTH_FACTOR);
+    fprintf(stderr, "  --gc-max-heap=BYTES\n");
+    fprintf(stderr, "                 fail when the live heap outgrows BYTES (default unlimited)\n");
+    fprintf(stderr, "  --serve=SOCKET run the programs requested on a Unix domain socket, or on stdin for -, on\n");
+    fprintf(stderr, "                 the stack VM with these options; see server.h for the protocol\n");
+    fprintf(stderr, "  --cache-size=N keep up to N assembled programs while serving (default %d)\n",
+            SERVER_DEFAULT_CACHE_SIZE);
+    fprintf(stderr, "  --refcount     free each object as soon as nothing points at it instead of collecting;\n");
+    fprintf(stderr, "                 maps that reach themselves are kept until exit\n");
+}
+
 int
 main(int argc, char **argv)
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+    const char *path = NULL, *snapshot_path = NULL, *restore_path = NULL;
+    const char *profile_generate = NULL, *profile_use = NULL, *input_path = NULL, *serve_path = NULL;
+    int optimize = 1, lazy = 0, opt_stats = 0, infer_pure = 0, memo_stats = 0, gc_stats = 0, use_registers = 0;
+    int trace = 0;
+    int status = EXIT_SUCCESS;
+    RegisterProgram register_program;
+    size_t inline_budget = INLINE_DEFAULT_BUDGET, inlined, removed, moved, dropped, function;
+    Profile profile;
+    size_t memo_capacity = MEMO_DEFAULT_CAPACITY, cache_size = SERVER_DEFAULT_CACHE_SIZE;
+    Server server;
+    VM vm = init_vm();
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0) {
+            optimize = 0;
+        } else if (strncmp(argv[i], "--inline-budget=", 16) == 0) {
+            inline_budget = strtoul(argv[i] + 16, NULL, 10);
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[i], "--opt-stats") == 0) {
+            opt_stats = 1;
+        } else if (strcmp(argv[i], "--infer-purity") == 0) {
+            infer_pure = 1;
+        } else if (strncmp(argv[i], "--memo-size=", 12) == 0) {
+            memo_capacity = strtoul(argv[i] + 12, NULL, 10);
+        } else if (strcmp(argv[i], "--memo-stats") == 0) {
+            memo_stats = 1;
+        } else if (strcmp(argv[i], "--register-vm") == 0) {
+            use_registers = 1;
+        } else if (strcmp(argv[i], "--checked") == 0) {
+            vm.checked = 1;
+        } else if (strcmp(argv[i], "--unchecked") == 0) {
+            vm.checked = 0;
+        } else if (strncmp(argv[i], "--profile-generate=", 19) == 0) {
+            profile_generate = argv[i] + 19;
+        } else if (strncmp(argv[i], "--profile-use=", 14) == 0) {
+            profile_use = argv[i] + 14;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            vm.threads = strtoul(argv[i] + 10, NULL, 10);
+        } else if (strncmp(argv[i], "--fuel=", 7) == 0) {
+            vm.fuel = strtoull(argv[i] + 7, NULL, 10);
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = 1;
+        } else if (strncmp(argv[i], "--input=", 8) == 0) {
+            input_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--snapshot=", 11) == 0) {
+            snapshot_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--restore=", 10) == 0) {
+            restore_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_stats = 1;
+        } else if (strncmp(argv[i], "--gc-threshold=", 15) == 0) {
+            vm.gc.initial_threshold = strtoul(argv[i] + 15, NULL, 10);
+        } else if (strncmp(argv[i], "--gc-growth=", 12) == 0) {
+            vm.gc.growth_factor = strtod(argv[i] + 12, NULL);
+        } else if (strncmp(argv[i], "--gc-max-heap=", 14) == 0) {
+            vm.gc.max_heap_size = strtoul(argv[i] + 14, NULL, 10);
+        } else if (strcmp(argv[i], "--refcount") == 0) {
+            vm.memory = MEMORY_REFCOUNT;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serve_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cache_size = strtoul(argv[i] + 13, NULL, 10);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            free_vm(vm);
+            return EXIT_FAILURE;
+        }
+    }
+    if (serve_path != NULL && path == NULL) {
+        vm.memo_capacity = memo_capacity;
+        server = init_server(vm, cache_size);
+        server.optimize = optimize;
+        server.inline_budget = inline_budget;
+        if (!(strcmp(serve_path, "-") == 0 ? serve_requests(&server, STDIN_FILENO, STDOUT_FILENO)
+                                           : serve_socket(&server, serve_path)))
+            status = EXIT_FAILURE;
+        free_server(server);
+        free_lexer();
+        return status;
+    }
+    if (path == NULL || serve_path != NULL || (profile_generate != NULL && profile_use != NULL)) {
+        print_usage(argv[0]);
+        free_vm(vm);
         return EXIT_FAILURE;
     }
-    char *source = read_file(argv[1]);
+
+    char *source = read_file(path);
     Program program;
     if (source == NULL) {
         fprintf(stderr, "Failed to read file\n");
+        free_vm(vm);
         return EXIT_FAILURE;
     }
+    if (input_path != NULL && (vm.input.fd = open(input_path, O_RDONLY)) < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", input_path, strerror(errno));
+        free_vm(vm);
+        free(source);
+        return EXIT_FAILURE;
+    }
+
+    // profiles, snapshots, purity inference and register code all read every body
+    if (profile_generate != NULL || profile_use != NULL || snapshot_path != NULL || restore_path != NULL
+        || infer_pure || use_registers)
+        lazy = 0;
+    program = lazy ? assemble_lazy(source) : assemble(source);
+    if (optimize && !lazy) {
+        inlined = inline_functions(&program, inline_budget);
+        removed = optimize_program(&program);
+        dropped = layout_functions(&program, NULL);
+        if (opt_stats) {
+            fprintf(stderr, "Inliner expanded %zu call sites\n", inlined);
+            fprintf(stderr, "Optimizer removed %zu instructions\n", removed);
+            fprintf(stderr, "Removed %zu unreachable functions\n", dropped);
+        }
+    }
+    if (profile_use != NULL) {
+        if (!load_profile(&profile, &program, profile_use)) {
+            free_vm(vm);
+            free_lexer();
+            free_program(program);
+            free(source);
+            return EXIT_FAILURE;
+        }
+        moved = layout_hot_paths(&program, &profile);
+        inlined = inline_hot_calls(&program, &profile, INLINE_HOT_BUDGET);
+        // only reorders, unless inlining left callees unreachable
+        dropped = layout_functions(&program, &profile);
+        if (opt_stats) {
+            fprintf(stderr, "Layout rewrote %zu blocks and branches\n", moved);
+            fprintf(stderr, "Inliner expanded %zu hot call sites\n", inlined);
+            fprintf(stderr, "Removed %zu functions left unreachable\n", dropped);
+        }
+        free_profile(profile);
+    }
+    if (infer_pure)
+        infer_purity(&program);
 
-    init_lexer(source);
-    program = assemble(source);
-    execute_program(program);
+    if (snapshot_path != NULL || restore_path != NULL || profile_generate != NULL || vm.fuel != VM_UNLIMITED_FUEL
+        || trace)
+        use_registers = 0;
+    // the register VM does not memoize
+    for (function = 0; use_registers && memo_capacity > 0 && function < program.functions_count; function++) {
+        if (program.functions[function].pure)
+            use_registers = 0;
+    }
+    if (use_registers && !translate_program(&program, &register_program)) {
+        fprintf(stderr, "Register VM: unsupported instructions, running on the stack VM\n");
+        use_registers = 0;
+    }
+
+    vm.memo_capacity = memo_capacity;
+    vm.pause_at_snapshot = snapshot_path != NULL;
+    if (trace)
+        attach_debugger(&vm)->trace = trace_instruction;
+    if (profile_generate != NULL) {
+        profile = init_profile(&program);
+        vm.profile = &profile;
+    }
+    if (use_registers) {
+        run_register_program(&vm, &register_program);
+        free_register_program(register_program);
+    } else if (restore_path != NULL) {
+        if (load_snapshot(&vm, &program, restore_path))
+            resume_program(&vm, &program);
+        else
+            status = EXIT_FAILURE;
+    } else {
+        run_program(&vm, &program);
+    }
+    if (vm.out_of_fuel) {
+        fprintf(stderr, "Out of fuel\n");
+        status = EXIT_FAILURE;
+    } else if (snapshot_path != NULL && !vm.paused) {
+        if (status == EXIT_SUCCESS)
+            fprintf(stderr, "The program exited without reaching a Snapshot instruction\n");
+        status = EXIT_FAILURE;
+    } else if (snapshot_path != NULL && !save_snapshot(&vm, &program, snapshot_path)) {
+        status = EXIT_FAILURE;
+    }
+    if (profile_generate != NULL) {
+        if (!save_profile(&profile, profile_generate))
+            status = EXIT_FAILURE;
+        free_profile(profile);
+    }
+    if (memo_stats)
+        print_memo_stats(&vm);
+    if (gc_stats)
+        print_gc_stats(&vm);
+    if (input_path != NULL)
+        close(vm.input.fd);
+    free_vm(vm);
     free_lexer();
     free_program(program);
 
     free(source);
-    return 0;
+    return status;
 }
@@ -0,0 +1,275 @@
+#include <string.h>
+#include "hal64_runtime.h"
+#include "utils/memory.h"
+
+Hal64Frame *hal64_frames = NULL;
+uint64_t *hal64_globals = NULL;
+HeapObject **hal64_global_pointers = NULL;
+const SimdKernels *hal64_simd = NULL;
+
+static size_t global_pointers_count;
+static HeapObject **objects;
+static size_t objects_size, objects_capacity;
+static size_t allocated_heap_size, gc_threshold = GC_DEFAULT_THRESHOLD;
+
+void
+hal64_init(size_t globals_count, size_t pointers_count)
+{
+    size_t size = (globals_count + pointers_count) * sizeof(uint64_t);
+
+    size = (size + 63) & ~(size_t) 63;
+    hal64_globals = safe_aligned_malloc(size, 64);
+    if (hal64_globals != NULL)
+        memset(hal64_globals, 0, size);
+    hal64_global_pointers = (HeapObject **) (hal64_globals + globals_count);
+    global_pointers_count = pointers_count;
+    hal64_simd = simd_kernels();
+}
+
+static size_t
+heap_object_size(const HeapObject *object)
+{
+    return object->kind == OBJECT_STRING_VIEW ? sizeof(HeapObject) : object->size;
+}
+
+static void
+mark_object(HeapObject *object)
+{
+    if (object == NULL)
+        return;
+    object->marked = 1;
+    if (object->parent != NULL)
+        object->parent->marked = 1;
+}
+
+static void
+collect(void)
+{
+    const Hal64Frame *frame;
+    double threshold;
+    size_t i;
+
+    for (frame = hal64_frames; frame != NULL; frame = frame->previous) {
+        for (i = 0; i < frame->count; i++)
+            mark_object(frame->pointers[i]);
+    }
+    for (i = 0; i < global_pointers_count; i++)
+        mark_object(hal64_global_pointers[i]);
+
+    for (i = 0; i < objects_size; i++) {
+        HeapObject *object = objects[i];
+        if (object->marked) {
+            object->marked = 0;
+            continue;
+        }
+        allocated_heap_size -= heap_object_size(object);
+        if (object->kind != OBJECT_STRING_VIEW)
+            free(object->data);
+        free(object);
+        objects[i--] = objects[--objects_size];
+    }
+
+    threshold = allocated_heap_size * GC_DEFAULT_GROWTH_FACTOR;
+    gc_threshold = threshold < GC_DEFAULT_THRESHOLD ? GC_DEFAULT_THRESHOLD : (size_t) threshold;
+}
+
+/*
+ * Collections run before the new object is tracked: it is not stored in
+ * any frame yet and would otherwise look unreachable.
+ */
+static HeapObject *
+track(HeapObject *object)
+{
+    if (allocated_heap_size + heap_object_size(object) > gc_threshold)
+        collect();
+    if (objects_size == objects_capacity) {
+        objects_capacity = objects_capacity == 0 ? 256 : objects_capacity * 2;
+        objects = safe_realloc(objects, objects_capacity * sizeof(HeapObject *));
+    }
+    objects[objects_size++] = object;
+    allocated_heap_size += heap_object_size(object);
+    return object;
+}
+
+static HeapObject *
+new_object(HeapObjectKind kind, size_t size, void *data)
+{
+    HeapObject *object = safe_malloc(sizeof(HeapObject));
+    object->marked = 0;
+    object->kind = kind;
+    object->size = size;
+    object->data = data;
+    object->parent = NULL;
+    return object;
+}
+
+HeapObject *
+hal64_string(const char *data, size_t size)
+{
+    HeapObject *object = new_object(OBJECT_STRING, size, safe_malloc(size));
+    if (size > 0)
+        memcpy(object->data, data, size);
+    return track(object);
+}
+
+HeapObject *
+hal64_concat(const HeapObject *a, const HeapObject *b)
+{
+    HeapObject *object = new_object(OBJECT_STRING, a->size + b->size, safe_malloc(a->size + b->size));
+    if (a->size > 0)
+        memcpy(object->data, a->data, a->size);
+    if (b->size > 0)
+        memcpy((char *) object->data + a->size, b->data, b->size);
+    return track(object);
+}
+
+void
+hal64_print_string(const HeapObject *string)
+{
+    fwrite(string->data, 1, string->size, stdout);
+}
+
+HeapObject *
+hal64_slice(HeapObject *string, uint64_t offset, uint64_t length)
+{
+    HeapObject *object;
+
+    if (offset > string->size || length > string->size - offset) {
+        fprintf(stderr, "String slice out of bounds: [%zu, %zu) (length %zu)\n",
+                (size_t) offset, (size_t) (offset + length), string->size);
+        exit(EXIT_FAILURE);
+    }
+    object = new_object(OBJECT_STRING_VIEW, length, (char *) string->data + offset);
+    object->parent = string->parent != NULL ? string->parent : string;
+    return track(object);
+}
+
+uint64_t
+hal64_find(const HeapObject *haystack, const HeapObject *needle)
+{
+    const char *data = haystack->data;
+    size_t i;
+
+    if (needle->size == 0)
+        return 0;
+    for (i = 0; needle->size <= haystack->size && i <= haystack->size - needle->size; i++) {
+        const char *match = memchr(data + i, *(const char *) needle->data, haystack->size - needle->size - i + 1);
+        if (match == NULL)
+            break;
+        i = match - data;
+        if (memcmp(match, needle->data, needle->size) == 0)
+            return i;
+    }
+    return UINT64_MAX;
+}
+
+uint64_t
+hal64_compare(const HeapObject *a, const HeapObject *b)
+{
+    int result = memcmp(a->data, b->data, a->size < b->size ? a->size : b->size);
+    if (result == 0)
+        result = a->size < b->size ? -1 : a->size > b->size;
+    return result < 0 ? UINT64_MAX : (uint64_t) (result > 0);
+}
+
+HeapObject *
+hal64_new_array(uint64_t length)
+{
+    size_t size = length * sizeof(uint64_t);
+    HeapObject *object = new_object(OBJECT_I64_ARRAY, size, safe_aligned_malloc(size, 64));
+    if (object->data != NULL)
+        memset(object->data, 0, size);
+    return track(object);
+}
+
+uint64_t
+hal64_array_length(const HeapObject *array)
+{
+    return array->size / sizeof(uint64_t);
+}
+
+static void
+check_array_range(const HeapObject *array, uint64_t start, uint64_t count)
+{
+    if (start > hal64_array_length(array) || count > hal64_array_length(array) - start) {
+        fprintf(stderr, "Array access out of bounds: [%zu, %zu) (length %zu)\n",
+                (size_t) start, (size_t) (start + count), (size_t) hal64_array_length(array));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+check_same_length(const HeapObject *a, const HeapObject *b)
+{
+    if (a->size != b->size) {
+        fprintf(stderr, "Array length mismatch: %zu and %zu\n",
+                (size_t) hal64_array_length(a), (size_t) hal64_array_length(b));
+        exit(EXIT_FAILURE);
+    }
+}
+
+uint64_t
+hal64_array_load(const HeapObject *array, uint64_t index)
+{
+    check_array_range(array, index, 1);
+    return ((const uint64_t *) array->data)[index];
+}
+
+void
+hal64_array_store(HeapObject *array, uint64_t index, uint64_t value)
+{
+    check_array_range(array, index, 1);
+    ((uint64_t *) array->data)[index] = value;
+}
+
+void
+hal64_array_fill(HeapObject *array, uint64_t value)
+{
+    uint64_t *data = array->data;
+    size_t i, length = hal64_array_length(array);
+    for (i = 0; i < length; i++)
+        data[i] = value;
+}
+
+void
+hal64_array_copy(HeapObject *destination, const HeapObject *source,
+                 uint64_t destination_offset, uint64_t source_offset, uint64_t count)
+{
+    check_array_range(source, source_offset, count);
+    check_array_range(destination, destination_offset, count);
+    if (count > 0)
+        memmove((uint64_t *) destination->data + destination_offset,
+                (const uint64_t *) source->data + source_offset,
+                count * sizeof(uint64_t));
+}
+
+void
+hal64_array_binary(HeapObject *a, const HeapObject *b, void (*kernel)(uint64_t *, const uint64_t *, size_t))
+{
+    check_same_length(a, b);
+    kernel(a->data, b->data, hal64_array_length(a));
+}
+
+void
+hal64_array_scalar(HeapObject *a, uint64_t b, void (*kernel)(uint64_t *, uint64_t, size_t))
+{
+    kernel(a->data, b, hal64_array_length(a));
+}
+
+uint64_t
+hal64_array_reduce(const HeapObject *a, uint64_t (*kernel)(const uint64_t *, size_t))
+{
+    return kernel(a->data, hal64_array_length(a));
+}
+
+HeapObject *
+hal64_array_compare(const HeapObject *a, const HeapObject *b,
+                    void (*kernel)(uint64_t *, const uint64_t *, const uint64_t *, size_t))
+{
+    HeapObject *mask;
+
+    check_same_length(a, b);
+    mask = hal64_new_array(hal64_array_length(a));
+    kernel(mask->data, a->data, b->data, hal64_array_length(a));
+    return mask;
+}
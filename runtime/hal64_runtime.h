@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal64.h"
+#include "simd.h"
+
+/*
+ * Support code for programs compiled to C by hal64c. Every function that
+ * holds heap pointers keeps them in an array registered as a frame, so
+ * the collector can find its roots the same way the VM walks its stacks.
+ */
+typedef struct Hal64Frame
+{
+    struct Hal64Frame *previous;
+    HeapObject **pointers;
+    size_t count;
+} Hal64Frame;
+
+extern Hal64Frame *hal64_frames;
+extern uint64_t *hal64_globals;
+extern HeapObject **hal64_global_pointers;
+extern const SimdKernels *hal64_simd;
+
+#define hal64_enter(frame, slots, slots_count) \
+    ((frame)->previous = hal64_frames, \
+     (frame)->pointers = (slots), \
+     (frame)->count = (slots_count), \
+     hal64_frames = (frame))
+#define hal64_leave(frame) (hal64_frames = (frame)->previous)
+
+void hal64_init(size_t globals_count, size_t global_pointers_count);
+
+HeapObject *hal64_string(const char *data, size_t size);
+HeapObject *hal64_concat(const HeapObject *a, const HeapObject *b);
+void hal64_print_string(const HeapObject *string);
+HeapObject *hal64_slice(HeapObject *string, uint64_t offset, uint64_t length);
+uint64_t hal64_find(const HeapObject *haystack, const HeapObject *needle);
+uint64_t hal64_compare(const HeapObject *a, const HeapObject *b);
+
+HeapObject *hal64_new_array(uint64_t length);
+uint64_t hal64_array_length(const HeapObject *array);
+uint64_t hal64_array_load(const HeapObject *array, uint64_t index);
+void hal64_array_store(HeapObject *array, uint64_t index, uint64_t value);
+void hal64_array_fill(HeapObject *array, uint64_t value);
+void hal64_array_copy(HeapObject *destination, const HeapObject *source,
+                      uint64_t destination_offset, uint64_t source_offset, uint64_t count);
+void hal64_array_binary(HeapObject *a, const HeapObject *b, void (*kernel)(uint64_t *, const uint64_t *, size_t));
+void hal64_array_scalar(HeapObject *a, uint64_t b, void (*kernel)(uint64_t *, uint64_t, size_t));
+uint64_t hal64_array_reduce(const HeapObject *a, uint64_t (*kernel)(const uint64_t *, size_t));
+HeapObject *hal64_array_compare(const HeapObject *a, const HeapObject *b,
+                                void (*kernel)(uint64_t *, const uint64_t *, const uint64_t *, size_t));
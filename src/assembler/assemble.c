@@ -114,11 +114,20 @@ read_function_info(Function *function)
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case TOKEN_PURE:
+            READ_PARAM_VALUE()
+                function->pure = strtoll(token.value, NULL, 10) != 0;
+                break;
             default:
                 fprintf(stderr, "Unexpected token: %s\n", token.value);
                 exit(EXIT_FAILURE);
         }
     }
+    // memoization keys and pops only the i64 arguments
+    if (function->pure && (function->ptr_args_count != 0 || function->local_pointers_count != 0)) {
+        fprintf(stderr, "Function %zu is pure, so it cannot take or keep pointers\n", function->id);
+        exit(EXIT_FAILURE);
+    }
 }
 
 static Token
@@ -155,52 +164,79 @@ read_type(TokenType type, const char *typeName)
 #define read_literal_number() read_type(TOKEN_NUMBER, "number")
 #define read_literal_string() read_type(TOKEN_STRING, "string")
 
-static void
-read_ri(Instruction *instruction)
+static uint64_t
+read_number(Token token)
 {
-    Token token;
-    token = read_index();
-    instruction->data.ri.reg = strtoll(token.value, NULL, 10);
-    if (instruction->data.ri.reg == LONG_MAX) {
+    uint64_t value = strtoll(token.value, NULL, 10);
+    if (value == LONG_MAX) {
         fprintf(stderr, "Invalid number: %s\n", token.value);
         exit(EXIT_FAILURE);
     }
-    token = read_literal_number();
-    instruction->data.ri.immediate = strtoll(token.value, NULL, 10);
-    if (instruction->data.ri.immediate == LONG_MAX) {
+    return value;
+}
+
+static uint32_t
+read_loop_operand(Token token)
+{
+    uint64_t value = strtoll(token.value, NULL, 10);
+    if (value > UINT32_MAX) {
         fprintf(stderr, "Invalid number: %s\n", token.value);
         exit(EXIT_FAILURE);
     }
+    return value;
 }
 
-#define NO_PARAM_INSTRUCTION(TOKEN, OP) \
-    case TOKEN: \
-        instruction->op = OP; \
-        break;
-#define INDEX_PARAM_INSTRUCTION(TOKEN, OP) \
-    case TOKEN: \
-        instruction->op = OP; \
-        token = read_index(); \
-        instruction->data.reg = strtoll(token.value, NULL, 10); \
-        if (instruction->data.reg == LONG_MAX) { \
-            fprintf(stderr, "Invalid number: %s\n", token.value); \
-            exit(EXIT_FAILURE); \
-        } \
-        break;
-#define I64_PARAM_INSTRUCTION(TOKEN, OP) \
-    case TOKEN: \
-        instruction->op = OP; \
-        token = read_literal_number(); \
-        instruction->data.immediate = strtoll(token.value, NULL, 10); \
-        if (instruction->data.immediate == LONG_MAX) { \
-            fprintf(stderr, "Invalid number: %s\n", token.value); \
-            exit(EXIT_FAILURE); \
-        } \
-        break;
-#define RI_PARAM_INSTRUCTION(TOKEN, OP) \
-    case TOKEN: \
+static void
+read_operands(Instruction *instruction, OperandFormat operands)
+{
+    Token token;
+
+    switch (operands) {
+        case OPERANDS_NONE:
+            break;
+        case OPERANDS_LOCAL:
+        case OPERANDS_LOCAL_POINTER:
+        case OPERANDS_GLOBAL:
+        case OPERANDS_GLOBAL_POINTER:
+            instruction->data.reg = read_number(read_index());
+            break;
+        case OPERANDS_IMMEDIATE:
+            instruction->data.immediate = read_number(read_literal_number());
+            break;
+        case OPERANDS_LOCAL_IMMEDIATE:
+            instruction->data.ri.reg = read_number(read_index());
+            instruction->data.ri.immediate = read_number(read_literal_number());
+            break;
+        case OPERANDS_TARGET:
+            instruction->data.reg = read_number(read_instruction_index());
+            break;
+        case OPERANDS_FUNCTION:
+        case OPERANDS_NATIVE:
+            instruction->data.reg = read_number(read_function_index());
+            break;
+        case OPERANDS_STRING:
+            token = read_literal_string();
+            instruction->data.string.ptr = strdup(token.value);
+            instruction->data.string.size = strlen(token.value);
+            break;
+        case OPERANDS_LOCAL_TARGET:
+            instruction->data.loop.reg = read_loop_operand(read_index());
+            instruction->data.loop.target = read_loop_operand(read_instruction_index());
+            instruction->data.loop.limit = 0;
+            break;
+        case OPERANDS_LOCAL_LIMIT_TARGET:
+            instruction->data.loop.reg = read_loop_operand(read_index());
+            instruction->data.loop.limit = read_number(read_literal_number());
+            instruction->data.loop.target = read_loop_operand(read_instruction_index());
+            break;
+    }
+}
+
+#define ASSEMBLE_OPCODE(OP, MNEMONIC, OPERANDS, OPERAND_POPS, OPERAND_PUSHES, POINTER_POPS, POINTER_PUSHES, \
+                        VM_ONLY) \
+    case TOKEN_##MNEMONIC: \
         instruction->op = OP; \
-        read_ri(instruction); \
+        read_operands(instruction, OPERANDS); \
         break;
 static hal64_error
 read_instruction(Instruction *instruction)
@@ -211,55 +247,7 @@ read_instruction(Instruction *instruction)
     switch (token.type) {
         case TOKEN_CLOSE_BRACE:
             return HAL64_END_OF_BODY;
-        INDEX_PARAM_INSTRUCTION(TOKEN_LoadLocalI64, OP_LOAD_LOCAL_I64)
-        I64_PARAM_INSTRUCTION(TOKEN_PushI64, OP_PUSH_I64)
-        RI_PARAM_INSTRUCTION(TOKEN_AddI64_RI, OP_ADD_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_SubI64_RI, OP_SUB_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_MulI64_RI, OP_MUL_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_DivI64_RI, OP_DIV_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_ModI64_RI, OP_MOD_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_LessThanI64_RI, OP_LESS_THAN_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_GreaterThanI64_RI, OP_GREATER_THAN_I64_RI)
-        RI_PARAM_INSTRUCTION(TOKEN_EqualsI64_RI, OP_EQUALS_I64_RI)
-        NO_PARAM_INSTRUCTION(TOKEN_AddI64, OP_ADD_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_SubI64, OP_SUB_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_MulI64, OP_MUL_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_DivI64, OP_DIV_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_ModI64, OP_MOD_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_LessThanI64, OP_LESS_THAN_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_GreaterThanI64, OP_GREATER_THAN_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_EqualsI64, OP_EQUALS_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_NotEqualsI64, OP_NOT_EQUALS_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_Not, OP_NOT)
-        NO_PARAM_INSTRUCTION(TOKEN_Return, OP_RETURN)
-        NO_PARAM_INSTRUCTION(TOKEN_PrintTopStackI64, OP_PRINT_TOP_STACK_I64)
-        NO_PARAM_INSTRUCTION(TOKEN_PrintString, OP_PRINT_STRING)
-        NO_PARAM_INSTRUCTION(TOKEN_ConcatStrings, OP_CONCAT_STRINGS)
-        NO_PARAM_INSTRUCTION(TOKEN_Exit, OP_EXIT)
-        case TOKEN_JumpIfFalse:
-            instruction->op = OP_JUMP_IF_FALSE;
-            token = read_instruction_index();
-            instruction->data.reg = strtoll(token.value, NULL, 10);
-            if (instruction->data.reg == LONG_MAX) {
-                fprintf(stderr, "Invalid number: %s\n", token.value);
-                exit(EXIT_FAILURE);
-            }
-            break;
-        case TOKEN_Call:
-            instruction->op = OP_CALL;
-            token = read_function_index();
-            instruction->data.reg = strtoll(token.value, NULL, 10);
-            if (instruction->data.reg == LONG_MAX) {
-                fprintf(stderr, "Invalid number: %s\n", token.value);
-                exit(EXIT_FAILURE);
-            }
-            break;
-        case TOKEN_PushLiteralString:
-            instruction->op = OP_PUSH_LITERAL_STRING;
-            token = read_literal_string();
-            instruction->data.string.ptr = strdup(token.value);
-            instruction->data.string.size = strlen(token.value);
-            break;
+        HAL64_OPCODES(ASSEMBLE_OPCODE)
         default:
             fprintf(stderr, "Invalid instruction: %s\n", token.value);
             exit(EXIT_FAILURE);
@@ -295,8 +283,22 @@ read_function_body(Function *function)
     }
 }
 
+/* Records where the body is so assemble_body() can read it later. */
+static void
+skip_function_body(Function *function, const char *source)
+{
+    size_t start, length;
+
+    if (!skip_block(&start, &length)) {
+        fprintf(stderr, "Expected a function body for function %zu\n", function->id);
+        exit(EXIT_FAILURE);
+    }
+    function->body = source + start;
+    function->body_length = length;
+}
+
 static hal64_error
-read_function(Function *function)
+read_function_header(Function *function)
 {
     Token token;
 
@@ -320,13 +322,13 @@ read_function(Function *function)
     }
 
     read_function_info(function);
-    read_function_body(function);
 
     return HAL64_OK;
 }
 
-Program
-assemble(const char *source)
+/* With `lazy`, bodies are skipped and left to assemble_body(). */
+static Program
+assemble_program(const char *source, int lazy)
 {
     Program program;
     Function function;
@@ -337,10 +339,45 @@ assemble(const char *source)
     program = read_header();
     while (1) {
         function = init_function();
-        error = read_function(&function);
+        error = read_function_header(&function);
         if (error == HAL64_EOF)
             break;
+        if (lazy)
+            skip_function_body(&function, source);
+        else
+            read_function_body(&function);
         emit_function(&program, function);
     }
     return program;
+}
+
+Program
+assemble(const char *source)
+{
+    return assemble_program(source, 0);
+}
+
+/*
+ * Reads only the header and every function's signature; each body is
+ * found by matching braces and assembled on the first call into it, so
+ * `source` must outlive the program. Errors in a body are reported when
+ * it is assembled, and a function that is never called is never checked.
+ */
+Program
+assemble_lazy(const char *source)
+{
+    return assemble_program(source, 1);
+}
+
+/* Drops any input the lexer was still scanning. */
+void
+assemble_body(Function *function)
+{
+    if (function->body == NULL)
+        return;
+    init_lexer_span(function->body, function->body_length);
+    read_function_body(function);
+    free_lexer();
+    function->body = NULL;
+    function->body_length = 0;
 }
\ No newline at end of file
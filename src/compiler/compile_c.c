@@ -0,0 +1,486 @@
+#include <stdlib.h>
+#include <string.h>
+#include "compiler/compile_c.h"
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+/*
+ * Every operand stack slot becomes a C local `s<n>` and every pointer slot
+ * an element of `p`, after the local pointers. The stack layout gives the
+ * depth before each instruction, so each push and pop names its slot
+ * statically and the C compiler is free to keep them in registers.
+ */
+typedef struct
+{
+    FILE *out;
+    const Function *function;
+    StackDepth depth;
+    size_t pointer_slots;
+} Emitter;
+
+static size_t
+operand(const Emitter *e, size_t from_top)
+{
+    return e->depth.operands - from_top;
+}
+
+static size_t
+pointer(const Emitter *e, size_t from_top)
+{
+    return e->function->local_pointers_count + e->depth.pointers - from_top;
+}
+
+static void
+emit_string_literal(FILE *out, const char *data, size_t size)
+{
+    size_t i;
+
+    fputc('"', out);
+    for (i = 0; i < size; i++) {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\' || c == '?' || c < ' ' || c > '~')
+            fprintf(out, "\\%03o", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void
+emit_signature(FILE *out, const Program *program, const StackLayout *layout, size_t id)
+{
+    const Function *function = program->functions + id;
+    size_t i;
+    int first = 1;
+
+    fprintf(out, "static %s\nfunction_%zu(", layout->returns[id].operands ? "uint64_t" : "void", id);
+    for (i = 0; i < function->args_count; i++, first = 0)
+        fprintf(out, "%suint64_t a%zu", first ? "" : ", ", i);
+    for (i = 0; i < function->ptr_args_count; i++, first = 0)
+        fprintf(out, "%sHeapObject *q%zu", first ? "" : ", ", i);
+    if (layout->returns[id].pointers)
+        fprintf(out, "%sHeapObject **result", first ? "" : ", "), first = 0;
+    fprintf(out, "%s)", first ? "void" : "");
+}
+
+static void
+emit_return(const Emitter *e, const StackDepth *returns)
+{
+    if (returns->pointers)
+        fprintf(e->out, "*result = p[%zu]; ", pointer(e, 1));
+    if (e->pointer_slots > 0)
+        fprintf(e->out, "hal64_leave(&frame); ");
+    if (returns->operands)
+        fprintf(e->out, "return s%zu;\n", operand(e, 1));
+    else
+        fprintf(e->out, "return;\n");
+}
+
+static void
+emit_call(const Emitter *e, const Program *program, const StackLayout *layout, size_t id)
+{
+    const Function *callee = program->functions + id;
+    size_t i, base = operand(e, callee->args_count), pointer_base = pointer(e, callee->ptr_args_count);
+    int first = 1;
+
+    if (layout->returns[id].operands)
+        fprintf(e->out, "s%zu = ", base);
+    fprintf(e->out, "function_%zu(", id);
+    for (i = 0; i < callee->args_count; i++, first = 0)
+        fprintf(e->out, "%ss%zu", first ? "" : ", ", base + i);
+    for (i = 0; i < callee->ptr_args_count; i++, first = 0)
+        fprintf(e->out, "%sp[%zu]", first ? "" : ", ", pointer_base + i);
+    if (layout->returns[id].pointers)
+        fprintf(e->out, "%s&p[%zu]", first ? "" : ", ", pointer_base);
+    fprintf(e->out, ");\n");
+}
+
+static const char *
+binary_operator(InstructionOp op)
+{
+    switch (op) {
+        case OP_ADD_I64:
+        case OP_ADD_I64_RI:
+            return "+";
+        case OP_SUB_I64:
+        case OP_SUB_I64_RI:
+            return "-";
+        case OP_MUL_I64:
+        case OP_MUL_I64_RI:
+            return "*";
+        case OP_DIV_I64:
+        case OP_DIV_I64_RI:
+            return "/";
+        case OP_MOD_I64:
+        case OP_MOD_I64_RI:
+            return "%";
+        case OP_LESS_THAN_I64:
+        case OP_LESS_THAN_I64_RI:
+            return "<";
+        case OP_GREATER_THAN_I64:
+        case OP_GREATER_THAN_I64_RI:
+            return ">";
+        case OP_EQUALS_I64:
+        case OP_EQUALS_I64_RI:
+            return "==";
+        case OP_NOT_EQUALS_I64:
+            return "!=";
+        default:
+            return NULL;
+    }
+}
+
+static const char *
+kernel_name(InstructionOp op)
+{
+    switch (op) {
+        case OP_ARRAY_ADD_I64:
+            return "add";
+        case OP_ARRAY_SUB_I64:
+            return "sub";
+        case OP_ARRAY_MUL_I64:
+            return "mul";
+        case OP_ARRAY_ADD_SCALAR_I64:
+            return "add_scalar";
+        case OP_ARRAY_SUB_SCALAR_I64:
+            return "sub_scalar";
+        case OP_ARRAY_MUL_SCALAR_I64:
+            return "mul_scalar";
+        case OP_ARRAY_SUM_I64:
+            return "sum";
+        case OP_ARRAY_MIN_I64:
+            return "min";
+        case OP_ARRAY_MAX_I64:
+            return "max";
+        case OP_ARRAY_EQUALS_I64:
+            return "equals";
+        case OP_ARRAY_LESS_THAN_I64:
+            return "less_than";
+        case OP_ARRAY_GREATER_THAN_I64:
+            return "greater_than";
+        default:
+            return NULL;
+    }
+}
+
+static void
+compile_instruction(const Emitter *e, const Program *program, const StackLayout *layout, const Instruction *instruction)
+{
+    FILE *out = e->out;
+    const char *symbol = binary_operator(instruction->op);
+
+    fprintf(out, "    ");
+    switch (instruction->op) {
+        case OP_NOOP:
+        case OP_SNAPSHOT: // there is no VM state to save, so compiled programs run straight through
+            fprintf(out, ";\n");
+            break;
+        case OP_PUSH_I64:
+            fprintf(out, "s%zu = UINT64_C(%zu);\n", operand(e, 0), (size_t) instruction->data.immediate);
+            break;
+        case OP_LOAD_LOCAL_I64:
+            fprintf(out, "s%zu = l%zu;\n", operand(e, 0), instruction->data.reg);
+            break;
+        case OP_STORE_LOCAL_I64:
+            fprintf(out, "l%zu = s%zu;\n", instruction->data.reg, operand(e, 1));
+            break;
+        case OP_LOAD_LOCAL_POINTER:
+            fprintf(out, "p[%zu] = p[%zu];\n", pointer(e, 0), instruction->data.reg);
+            break;
+        case OP_STORE_LOCAL_POINTER:
+            fprintf(out, "p[%zu] = p[%zu];\n", instruction->data.reg, pointer(e, 1));
+            break;
+        case OP_LOAD_GLOBAL_I64:
+            fprintf(out, "s%zu = hal64_globals[%zu];\n", operand(e, 0), instruction->data.reg);
+            break;
+        case OP_STORE_GLOBAL_I64:
+            fprintf(out, "hal64_globals[%zu] = s%zu;\n", instruction->data.reg, operand(e, 1));
+            break;
+        case OP_LOAD_GLOBAL_POINTER:
+            fprintf(out, "p[%zu] = hal64_global_pointers[%zu];\n", pointer(e, 0), instruction->data.reg);
+            break;
+        case OP_STORE_GLOBAL_POINTER:
+            fprintf(out, "hal64_global_pointers[%zu] = p[%zu];\n", instruction->data.reg, pointer(e, 1));
+            break;
+        case OP_ADD_I64_RI:
+        case OP_SUB_I64_RI:
+        case OP_MUL_I64_RI:
+        case OP_DIV_I64_RI:
+        case OP_MOD_I64_RI:
+        case OP_LESS_THAN_I64_RI:
+        case OP_GREATER_THAN_I64_RI:
+        case OP_EQUALS_I64_RI:
+            fprintf(out, "s%zu = l%zu %s UINT64_C(%zu);\n", operand(e, 0), instruction->data.ri.reg, symbol,
+                    (size_t) instruction->data.ri.immediate);
+            break;
+        case OP_ADD_I64:
+        case OP_SUB_I64:
+        case OP_MUL_I64:
+        case OP_DIV_I64:
+        case OP_MOD_I64:
+        case OP_LESS_THAN_I64:
+        case OP_GREATER_THAN_I64:
+        case OP_EQUALS_I64:
+        case OP_NOT_EQUALS_I64:
+            fprintf(out, "s%zu = s%zu %s s%zu;\n", operand(e, 2), operand(e, 2), symbol, operand(e, 1));
+            break;
+        case OP_NOT:
+            fprintf(out, "s%zu = !s%zu;\n", operand(e, 1), operand(e, 1));
+            break;
+        case OP_JUMP:
+            fprintf(out, "goto i%zu;\n", instruction->data.reg);
+            break;
+        case OP_JUMP_IF_FALSE:
+            fprintf(out, "if (!s%zu) goto i%zu;\n", operand(e, 1), instruction->data.reg);
+            break;
+        case OP_JUMP_IF_TRUE:
+            fprintf(out, "if (s%zu) goto i%zu;\n", operand(e, 1), instruction->data.reg);
+            break;
+        case OP_DEC_JUMP_IF_NOT_ZERO:
+            fprintf(out, "if (--l%u != 0) goto i%u;\n", (unsigned) instruction->data.loop.reg,
+                    (unsigned) instruction->data.loop.target);
+            break;
+        case OP_INC_JUMP_IF_LESS_THAN:
+            fprintf(out, "if (++l%u < UINT64_C(%zu)) goto i%u;\n", (unsigned) instruction->data.loop.reg,
+                    (size_t) instruction->data.loop.limit, (unsigned) instruction->data.loop.target);
+            break;
+        case OP_RETURN:
+            emit_return(e, layout->returns + (e->function - program->functions));
+            break;
+        case OP_EXIT:
+            fprintf(out, "fflush(stdout); exit(EXIT_SUCCESS);\n");
+            break;
+        case OP_CALL:
+            emit_call(e, program, layout, instruction->data.reg);
+            break;
+        case OP_PRINT_TOP_STACK_I64:
+            fprintf(out, "printf(\"%%zu\\n\", (size_t) s%zu);\n", operand(e, 1));
+            break;
+        case OP_PUSH_LITERAL_STRING:
+            fprintf(out, "p[%zu] = hal64_string(", pointer(e, 0));
+            emit_string_literal(out, instruction->data.string.ptr, instruction->data.string.size);
+            fprintf(out, ", %zu);\n", instruction->data.string.size);
+            break;
+        case OP_CONCAT_STRINGS:
+            fprintf(out, "p[%zu] = hal64_concat(p[%zu], p[%zu]);\n", pointer(e, 2), pointer(e, 2), pointer(e, 1));
+            break;
+        case OP_PRINT_STRING:
+            fprintf(out, "hal64_print_string(p[%zu]);\n", pointer(e, 1));
+            break;
+        case OP_SLICE_STRING:
+            fprintf(out, "p[%zu] = hal64_slice(p[%zu], s%zu, s%zu);\n", pointer(e, 1), pointer(e, 1),
+                    operand(e, 2), operand(e, 1));
+            break;
+        case OP_STRING_LENGTH:
+            fprintf(out, "s%zu = p[%zu]->size;\n", operand(e, 0), pointer(e, 1));
+            break;
+        case OP_FIND_STRING:
+            fprintf(out, "s%zu = hal64_find(p[%zu], p[%zu]);\n", operand(e, 0), pointer(e, 2), pointer(e, 1));
+            break;
+        case OP_COMPARE_STRINGS:
+            fprintf(out, "s%zu = hal64_compare(p[%zu], p[%zu]);\n", operand(e, 0), pointer(e, 2), pointer(e, 1));
+            break;
+        case OP_NEW_ARRAY_I64:
+            fprintf(out, "p[%zu] = hal64_new_array(s%zu);\n", pointer(e, 0), operand(e, 1));
+            break;
+        case OP_ARRAY_LENGTH_I64:
+            fprintf(out, "s%zu = hal64_array_length(p[%zu]);\n", operand(e, 0), pointer(e, 1));
+            break;
+        case OP_ARRAY_LOAD_I64:
+            fprintf(out, "s%zu = hal64_array_load(p[%zu], s%zu);\n", operand(e, 1), pointer(e, 1), operand(e, 1));
+            break;
+        case OP_ARRAY_STORE_I64:
+            fprintf(out, "hal64_array_store(p[%zu], s%zu, s%zu);\n", pointer(e, 1), operand(e, 2), operand(e, 1));
+            break;
+        case OP_ARRAY_FILL_I64:
+            fprintf(out, "hal64_array_fill(p[%zu], s%zu);\n", pointer(e, 1), operand(e, 1));
+            break;
+        case OP_ARRAY_COPY_I64:
+            fprintf(out, "hal64_array_copy(p[%zu], p[%zu], s%zu, s%zu, s%zu);\n", pointer(e, 2), pointer(e, 1),
+                    operand(e, 3), operand(e, 2), operand(e, 1));
+            break;
+        case OP_ARRAY_ADD_I64:
+        case OP_ARRAY_SUB_I64:
+        case OP_ARRAY_MUL_I64:
+            fprintf(out, "hal64_array_binary(p[%zu], p[%zu], hal64_simd->%s);\n", pointer(e, 2), pointer(e, 1),
+                    kernel_name(instruction->op));
+            break;
+        case OP_ARRAY_ADD_SCALAR_I64:
+        case OP_ARRAY_SUB_SCALAR_I64:
+        case OP_ARRAY_MUL_SCALAR_I64:
+            fprintf(out, "hal64_array_scalar(p[%zu], s%zu, hal64_simd->%s);\n", pointer(e, 1), operand(e, 1),
+                    kernel_name(instruction->op));
+            break;
+        case OP_ARRAY_SUM_I64:
+        case OP_ARRAY_MIN_I64:
+        case OP_ARRAY_MAX_I64:
+            fprintf(out, "s%zu = hal64_array_reduce(p[%zu], hal64_simd->%s);\n", operand(e, 0), pointer(e, 1),
+                    kernel_name(instruction->op));
+            break;
+        case OP_ARRAY_EQUALS_I64:
+        case OP_ARRAY_LESS_THAN_I64:
+        case OP_ARRAY_GREATER_THAN_I64:
+            fprintf(out, "p[%zu] = hal64_array_compare(p[%zu], p[%zu], hal64_simd->%s);\n", pointer(e, 2),
+                    pointer(e, 2), pointer(e, 1), kernel_name(instruction->op));
+            break;
+        default:
+            // compile_to_c() rejects vm_only instructions up front, so every other one needs a case above
+            fprintf(stderr, "Internal error: no C translation for %s\n", opcodes[instruction->op].mnemonic);
+            exit(EXIT_FAILURE);
+    }
+}
+
+static void
+compile_function(FILE *out, const Program *program, const StackLayout *layout, size_t id)
+{
+    const Function *function = program->functions + id;
+    const StackDepth *depths = layout->depths[id];
+    uint8_t *labels = safe_malloc(function->instructions_count);
+    Emitter e;
+    size_t i;
+
+    e.out = out;
+    e.function = function;
+    e.pointer_slots = function->local_pointers_count + layout->max_depths[id].pointers;
+
+    memset(labels, 0, function->instructions_count);
+    for (i = 0; i < function->instructions_count; i++) {
+        size_t target = jump_target(function->instructions + i);
+        if (depths[i].operands != STACK_DEPTH_UNKNOWN && target != SIZE_MAX)
+            labels[target] = 1;
+    }
+
+    emit_signature(out, program, layout, id);
+    fprintf(out, "\n{\n");
+    for (i = 0; i < function->locals_count; i++) {
+        if (i < function->args_count)
+            fprintf(out, "    uint64_t l%zu = a%zu;\n", i, i);
+        else
+            fprintf(out, "    uint64_t l%zu = 0;\n", i);
+    }
+    for (i = 0; i < layout->max_depths[id].operands; i++)
+        fprintf(out, "    uint64_t s%zu;\n", i);
+    if (e.pointer_slots > 0) {
+        fprintf(out, "    HeapObject *p[%zu] = {0};\n", e.pointer_slots);
+        fprintf(out, "    Hal64Frame frame;\n\n");
+        for (i = 0; i < function->ptr_args_count; i++)
+            fprintf(out, "    p[%zu] = q%zu;\n", i, i);
+        fprintf(out, "    hal64_enter(&frame, p, %zu);\n", e.pointer_slots);
+    }
+
+    for (i = 0; i < function->instructions_count; i++) {
+        if (depths[i].operands == STACK_DEPTH_UNKNOWN)
+            continue;
+        if (labels[i])
+            fprintf(out, "i%zu:\n", i);
+        e.depth = depths[i];
+        compile_instruction(&e, program, layout, function->instructions + i);
+    }
+    fprintf(out, "}\n\n");
+    free(labels);
+}
+
+/*
+ * Functions the entry point never reaches, such as fully inlined ones, are
+ * left out. Only calls at instructions with a known depth count: the rest
+ * are dead and never validated.
+ */
+static uint8_t *
+reachable_functions(const Program *program, const StackLayout *layout)
+{
+    uint8_t *reachable = safe_malloc(program->functions_count);
+    size_t *worklist = safe_malloc(program->functions_count * sizeof(size_t));
+    size_t i, top = 0;
+
+    memset(reachable, 0, program->functions_count);
+    reachable[0] = 1;
+    worklist[top++] = 0;
+    while (top > 0) {
+        size_t id = worklist[--top];
+        const Function *function = program->functions + id;
+        for (i = 0; i < function->instructions_count; i++) {
+            size_t callee = function->instructions[i].data.reg;
+            if (function->instructions[i].op == OP_CALL && layout->depths[id][i].operands != STACK_DEPTH_UNKNOWN
+                && callee < program->functions_count && !reachable[callee]) {
+                reachable[callee] = 1;
+                worklist[top++] = callee;
+            }
+        }
+    }
+    free(worklist);
+    return reachable;
+}
+
+static const Instruction *
+find_vm_only_instruction(const Program *program)
+{
+    size_t i, j;
+    for (i = 0; i < program->functions_count; i++) {
+        for (j = 0; j < program->functions[i].instructions_count; j++) {
+            if (opcodes[program->functions[i].instructions[j].op].vm_only)
+                return program->functions[i].instructions + j;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Writes a standalone C translation unit for `program` to `out`; it links
+ * against the hal64 runtime. Returns 0, after reporting why on stderr,
+ * when a function does not keep a fixed stack depth at every instruction
+ * or uses an instruction that only runs on the VM.
+ */
+int
+compile_to_c(const Program *program, FILE *out)
+{
+    StackLayout layout;
+    const Instruction *vm_instruction = find_vm_only_instruction(program);
+    uint8_t *reachable;
+    size_t i;
+
+    if (vm_instruction != NULL) {
+        fprintf(stderr, "Cannot compile: %s only runs on the VM\n", opcodes[vm_instruction->op].mnemonic);
+        return 0;
+    }
+    if (!compute_stack_layout(program, &layout)) {
+        fprintf(stderr, "Cannot compile: stack depths are not fixed at every instruction\n");
+        return 0;
+    }
+    for (i = 0; i < program->functions_count; i++) {
+        const Function *function = program->functions + i;
+        if (function->args_count > function->locals_count
+            || function->ptr_args_count > function->local_pointers_count) {
+            fprintf(stderr, "Cannot compile: function %zu has more arguments than locals\n", i);
+            free_stack_layout(layout);
+            return 0;
+        }
+    }
+
+    reachable = reachable_functions(program, &layout);
+    fprintf(out, "#include \"hal64_runtime.h\"\n\n");
+    for (i = 0; i < program->functions_count; i++) {
+        if (!reachable[i])
+            continue;
+        emit_signature(out, program, &layout, i);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "\n");
+    for (i = 0; i < program->functions_count; i++) {
+        if (reachable[i])
+            compile_function(out, program, &layout, i);
+    }
+    free(reachable);
+
+    fprintf(out, "int\nmain(void)\n{\n");
+    if (layout.returns[0].pointers)
+        fprintf(out, "    HeapObject *result = NULL;\n\n");
+    fprintf(out, "    hal64_init(%zu, %zu);\n", program->globals_count, program->global_pointers_count);
+    fprintf(out, "    function_0(");
+    for (i = 0; i < program->functions[0].args_count + program->functions[0].ptr_args_count; i++)
+        fprintf(out, "%s0", i == 0 ? "" : ", ");
+    if (layout.returns[0].pointers)
+        fprintf(out, "%s&result", i == 0 ? "" : ", ");
+    fprintf(out, ");\n    return 0;\n}\n");
+    free_stack_layout(layout);
+    return 1;
+}
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+#include "debugger.h"
+#include "utils/memory.h"
+
+/* Returns the VM's debugger, attaching one with no hooks set if there is none. */
+Debugger *
+attach_debugger(VM *vm)
+{
+    if (vm->debugger == NULL) {
+        vm->debugger = safe_malloc(sizeof(Debugger));
+        memset(vm->debugger, 0, sizeof(Debugger));
+    }
+    return vm->debugger;
+}
+
+void
+detach_debugger(VM *vm)
+{
+    if (vm->debugger == NULL)
+        return;
+    free(vm->debugger->breakpoints);
+    free(vm->debugger);
+    vm->debugger = NULL;
+}
+
+static Breakpoint *
+find_breakpoint(const Debugger *debugger, size_t function, size_t instruction)
+{
+    size_t i;
+
+    for (i = 0; i < debugger->breakpoints_count; i++) {
+        if (debugger->breakpoints[i].function == function && debugger->breakpoints[i].instruction == instruction)
+            return debugger->breakpoints + i;
+    }
+    return NULL;
+}
+
+void
+set_breakpoint(Debugger *debugger, size_t function, size_t instruction)
+{
+    if (find_breakpoint(debugger, function, instruction) != NULL)
+        return;
+    debugger->breakpoints =
+        safe_realloc(debugger->breakpoints, (debugger->breakpoints_count + 1) * sizeof(Breakpoint));
+    debugger->breakpoints[debugger->breakpoints_count].function = function;
+    debugger->breakpoints[debugger->breakpoints_count].instruction = instruction;
+    debugger->breakpoints_count++;
+}
+
+/* Returns 0 when there was no such breakpoint. */
+int
+clear_breakpoint(Debugger *debugger, size_t function, size_t instruction)
+{
+    Breakpoint *breakpoint = find_breakpoint(debugger, function, instruction);
+
+    if (breakpoint == NULL)
+        return 0;
+    *breakpoint = debugger->breakpoints[--debugger->breakpoints_count];
+    return 1;
+}
+
+/*
+ * Run by the debugging interpreter loop before each instruction. Returns 1,
+ * with the VM paused before the instruction, at a breakpoint or a step;
+ * the instruction a stop paused at runs without stopping again once resumed.
+ */
+int
+debug_stop(VM *vm, const Function *function, const Instruction *instruction)
+{
+    Debugger *debugger = vm->debugger;
+    size_t id = function - vm->program->functions, index = instruction - function->instructions;
+
+    if (debugger->stopped) {
+        debugger->stopped = 0;
+    } else if (debugger->stepping || find_breakpoint(debugger, id, index) != NULL) {
+        debugger->stopped = 1;
+        vm->resume_instruction = index;
+        vm->paused = 1;
+        return 1;
+    }
+    if (debugger->trace != NULL)
+        debugger->trace(debugger->context, vm, function, index);
+    return 0;
+}
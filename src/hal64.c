@@ -4,6 +4,14 @@
 #include "hal64.h"
 #include "utils/memory.h"
 
+#define OPCODE_INFO(OP, MNEMONIC, OPERANDS, OPERAND_POPS, OPERAND_PUSHES, POINTER_POPS, POINTER_PUSHES, \
+                    VM_ONLY) \
+    {#MNEMONIC, #OP + 3, OPERANDS, OPERAND_POPS, OPERAND_PUSHES, POINTER_POPS, POINTER_PUSHES, VM_ONLY},
+
+const OpcodeInfo opcodes[OPCODES_COUNT] = {
+    HAL64_OPCODES(OPCODE_INFO)
+};
+
 static void
 free_instructions(Instruction *instructions, size_t count)
 {
@@ -47,6 +55,7 @@ print_function(Function function)
     printf("Number of pointer arguments: %zu\n", function.ptr_args_count);
     printf("Number of local variables: %zu\n", function.locals_count);
     printf("Number of local pointers: %zu\n", function.local_pointers_count);
+    printf("Pure: %s\n", function.pure ? "yes" : "no");
     printf("Number of instructions: %zu\n", function.instructions_count);
 
     printf("Instructions:\n");
@@ -61,65 +70,130 @@ print_function(Function function)
 void
 instruction_as_string(Instruction instruction, char *string, size_t max_length)
 {
-    switch (instruction.op) {
-        case OP_NOOP:
-            snprintf(string, max_length, "NOOP");
+    const OpcodeInfo *info;
+
+    if (instruction.op >= OPCODES_COUNT) {
+        snprintf(string, max_length, "UNKNOWN");
+        return;
+    }
+    info = opcodes + instruction.op;
+    switch (info->operands) {
+        case OPERANDS_NONE:
+            snprintf(string, max_length, "%s", info->name);
             break;
-        case OP_LOAD_LOCAL_I64:
-            snprintf(string, max_length, "LOAD_LOCAL_I64 $%zu", instruction.data);
+        case OPERANDS_LOCAL:
+        case OPERANDS_LOCAL_POINTER:
+        case OPERANDS_GLOBAL:
+        case OPERANDS_GLOBAL_POINTER:
+            snprintf(string, max_length, "%s $%zu", info->name, instruction.data.reg);
             break;
-        case OP_PUSH_I64:
-            snprintf(string, max_length, "PUSH_I64 %zu", instruction.data);
+        case OPERANDS_IMMEDIATE:
+            snprintf(string, max_length, "%s %zu", info->name, (size_t) instruction.data.immediate);
             break;
-        case OP_LESS_THAN_I64_RI:
+        case OPERANDS_LOCAL_IMMEDIATE:
             snprintf(string,
                      max_length,
-                     "LESS_THAN_I64_RI $%zu %zu",
+                     "%s $%zu %zu",
+                     info->name,
                      instruction.data.ri.reg,
-                     instruction.data.ri.immediate);
-            break;
-        case OP_LESS_THAN_I64:
-            snprintf(string, max_length, "LESS_THAN_I64");
-            break;
-        case OP_JUMP_IF_FALSE:
-            snprintf(string, max_length, "JUMP_IF_FALSE #%zu", instruction.data);
-            break;
-        case OP_RETURN:
-            snprintf(string, max_length, "RETURN");
-            break;
-        case OP_ADD_I64_RI:
-            snprintf(string, max_length, "ADD_I64_RI $%zu %zu", instruction.data.ri.reg, instruction.data.ri.immediate);
+                     (size_t) instruction.data.ri.immediate);
             break;
-        case OP_ADD_I64:
-            snprintf(string, max_length, "ADD_I64");
+        case OPERANDS_TARGET:
+            snprintf(string, max_length, "%s #%zu", info->name, instruction.data.reg);
             break;
-        case OP_SUB_I64_RI:
-            snprintf(string, max_length, "SUB_I64_RI $%zu %zu", instruction.data.ri.reg, instruction.data.ri.immediate);
+        case OPERANDS_FUNCTION:
+        case OPERANDS_NATIVE:
+            snprintf(string, max_length, "%s :%zu", info->name, instruction.data.reg);
             break;
-        case OP_SUB_I64:
-            snprintf(string, max_length, "SUB_I64");
+        case OPERANDS_STRING:
+            snprintf(string, max_length, "%s \"%s\"", info->name, instruction.data.string.ptr);
             break;
-        case OP_CALL:
-            snprintf(string, max_length, "CALL :%zu", instruction.data);
-            break;
-        case OP_PRINT_TOP_STACK_I64:
-            snprintf(string, max_length, "PRINT_TOP_STACK_I64");
-            break;
-        case OP_PUSH_LITERAL_STRING:
-            snprintf(string, max_length, "PUSH_LITERAL_STRING \"%s\"", instruction.data.string);
-            break;
-        case OP_CONCAT_STRINGS:
-            snprintf(string, max_length, "CONCAT_STRINGS");
-            break;
-        case OP_PRINT_STRING:
-            snprintf(string, max_length, "PRINT_STRING");
+        case OPERANDS_LOCAL_TARGET:
+            snprintf(string,
+                     max_length,
+                     "%s $%u #%u",
+                     info->name,
+                     (unsigned) instruction.data.loop.reg,
+                     (unsigned) instruction.data.loop.target);
             break;
-        default:
-            snprintf(string, max_length, "UNKNOWN");
+        case OPERANDS_LOCAL_LIMIT_TARGET:
+            snprintf(string,
+                     max_length,
+                     "%s $%u %zu #%u",
+                     info->name,
+                     (unsigned) instruction.data.loop.reg,
+                     (size_t) instruction.data.loop.limit,
+                     (unsigned) instruction.data.loop.target);
             break;
     }
 }
 
+static uint64_t
+hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t
+hash_word(uint64_t hash, uint64_t word)
+{
+    return hash_bytes(hash, &word, sizeof(word));
+}
+
+/*
+ * A hash of everything that affects execution, for files such as
+ * snapshots and profiles that refer to instruction positions.
+ */
+uint64_t
+program_fingerprint(const Program *program)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i, j;
+
+    hash = hash_word(hash, program->globals_count);
+    hash = hash_word(hash, program->global_pointers_count);
+    for (i = 0; i < program->functions_count; i++) {
+        const Function *function = program->functions + i;
+        hash = hash_word(hash, function->args_count);
+        hash = hash_word(hash, function->ptr_args_count);
+        hash = hash_word(hash, function->locals_count);
+        hash = hash_word(hash, function->local_pointers_count);
+        hash = hash_word(hash, function->instructions_count);
+        for (j = 0; j < function->instructions_count; j++) {
+            const Instruction *instruction = function->instructions + j;
+            hash = hash_word(hash, instruction->op);
+            switch (opcodes[instruction->op].operands) {
+                case OPERANDS_NONE:
+                    break;
+                case OPERANDS_STRING:
+                    hash = hash_word(hash, instruction->data.string.size);
+                    hash = hash_bytes(hash, instruction->data.string.ptr, instruction->data.string.size);
+                    break;
+                case OPERANDS_LOCAL_TARGET:
+                case OPERANDS_LOCAL_LIMIT_TARGET:
+                    hash = hash_word(hash, instruction->data.loop.reg);
+                    hash = hash_word(hash, instruction->data.loop.target);
+                    hash = hash_word(hash, instruction->data.loop.limit);
+                    break;
+                case OPERANDS_LOCAL_IMMEDIATE:
+                    hash = hash_word(hash, instruction->data.ri.reg);
+                    hash = hash_word(hash, instruction->data.ri.immediate);
+                    break;
+                default:
+                    hash = hash_word(hash, instruction->data.immediate);
+                    break;
+            }
+        }
+    }
+    return hash;
+}
+
 void
 print_program(Program program)
 {
@@ -149,10 +223,17 @@ void
 emit_function(Program *program, Function function)
 {
     if (function.id >= program->functions_count) {
+        program->functions = safe_realloc(program->functions, (function.id + 2) * sizeof(Function));
+        memset(program->functions + program->functions_count, 0,
+               (function.id + 2 - program->functions_count) * sizeof(Function));
         program->functions_count = function.id + 1;
-        program->functions = safe_realloc(program->functions, (program->functions_count + 1) * sizeof(Function));
     }
+    if (function.locals_count < function.args_count)
+        function.locals_count = function.args_count;
+    if (function.local_pointers_count < function.ptr_args_count)
+        function.local_pointers_count = function.ptr_args_count;
     program->functions[function.id] = function;
+    program->functions[function.id].source_id = function.id;
     program->functions[function.id].stack_frame_size =
         function.locals_count + function.local_pointers_count + 3;
 }
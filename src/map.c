@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hal64.h"
+#include "map.h"
+#include "utils/memory.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define HAL64_MAP_SSE2
+#include <emmintrin.h>
+#endif
+
+// control bytes of free slots have their top bit set, full ones hold 7 hash bits
+#define MAP_EMPTY 0x80
+#define MAP_DELETED 0xfe
+
+static uint64_t
+mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static const HeapObject *
+key_string(uint64_t key)
+{
+    return (const HeapObject *) (uintptr_t) key;
+}
+
+static uint64_t
+hash_key(const HashMap *map, uint64_t key)
+{
+    const HeapObject *string;
+    const unsigned char *bytes;
+    char buffer[STRING_INLINE_MAX];
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    if (!(map->flags & MAP_STRING_KEYS))
+        return mix(key);
+    string = key_string(key);
+    bytes = (const unsigned char *) string_bytes(string, buffer);
+    for (i = 0; i < string_length(string); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return mix(hash);
+}
+
+static int
+same_key(const HashMap *map, uint64_t a, uint64_t b)
+{
+    const HeapObject *x, *y;
+    char x_buffer[STRING_INLINE_MAX], y_buffer[STRING_INLINE_MAX];
+
+    if (a == b || !(map->flags & MAP_STRING_KEYS))
+        return a == b;
+    x = key_string(a);
+    y = key_string(b);
+    return string_length(x) == string_length(y)
+           && memcmp(string_bytes(x, x_buffer), string_bytes(y, y_buffer), string_length(x)) == 0;
+}
+
+/* Bit i is set when control byte i of the group equals `byte`. */
+static unsigned
+match_byte(const uint8_t *group, uint8_t byte)
+{
+#ifdef HAL64_MAP_SSE2
+    __m128i control = _mm_loadu_si128((const __m128i *) group);
+    return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char) byte)));
+#else
+    unsigned i, mask = 0;
+    for (i = 0; i < MAP_GROUP_SIZE; i++)
+        mask |= (unsigned) (group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+/* Bit i is set when slot i of the group is empty or deleted. */
+static unsigned
+match_free(const uint8_t *group)
+{
+#ifdef HAL64_MAP_SSE2
+    return (unsigned) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    unsigned i, mask = 0;
+    for (i = 0; i < MAP_GROUP_SIZE; i++)
+        mask |= (unsigned) (group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static unsigned
+lowest_bit(unsigned mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    unsigned i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/*
+ * The first group comes from the high bits of the hash, the tag from the
+ * low 7. Later groups follow triangular steps, which visit every group of
+ * a power-of-two table, and an empty slot ends the search because inserts
+ * never skip past a group with room left.
+ */
+static size_t
+first_group(const HashMap *map, uint64_t hash)
+{
+    return (hash >> 7) & (map->capacity / MAP_GROUP_SIZE - 1);
+}
+
+static size_t
+next_group(const HashMap *map, size_t group, size_t *step)
+{
+    return (group + ++*step) & (map->capacity / MAP_GROUP_SIZE - 1);
+}
+
+static MapSlot *
+find_slot(const HashMap *map, uint64_t key, uint64_t hash)
+{
+    size_t group = first_group(map, hash), step = 0;
+    uint8_t tag = hash & 0x7f;
+    unsigned mask;
+
+    while (1) {
+        const uint8_t *control = map->control + group * MAP_GROUP_SIZE;
+        for (mask = match_byte(control, tag); mask != 0; mask &= mask - 1) {
+            MapSlot *slot = map->slots + group * MAP_GROUP_SIZE + lowest_bit(mask);
+            if (same_key(map, slot->key, key))
+                return slot;
+        }
+        if (match_byte(control, MAP_EMPTY) != 0)
+            return NULL;
+        group = next_group(map, group, &step);
+    }
+}
+
+static size_t
+free_index(const HashMap *map, uint64_t hash)
+{
+    size_t group = first_group(map, hash), step = 0;
+    unsigned mask;
+
+    while ((mask = match_free(map->control + group * MAP_GROUP_SIZE)) == 0)
+        group = next_group(map, group, &step);
+    return group * MAP_GROUP_SIZE + lowest_bit(mask);
+}
+
+static void
+allocate_table(HashMap *map, size_t capacity)
+{
+    map->capacity = capacity;
+    map->control = safe_aligned_malloc(capacity, MAP_GROUP_SIZE);
+    map->slots = safe_malloc(capacity * sizeof(MapSlot));
+    memset(map->control, MAP_EMPTY, capacity);
+    map->deleted = 0;
+}
+
+/* Reinserts every key, which also clears out deleted slots. */
+static void
+resize(HashMap *map, size_t capacity)
+{
+    uint8_t *control = map->control;
+    MapSlot *slots = map->slots;
+    size_t i, index, old_capacity = map->capacity;
+    uint64_t hash;
+
+    allocate_table(map, capacity);
+    for (i = 0; i < old_capacity; i++) {
+        if (control[i] & 0x80)
+            continue;
+        hash = hash_key(map, slots[i].key);
+        index = free_index(map, hash);
+        map->control[index] = hash & 0x7f;
+        map->slots[index] = slots[i];
+    }
+    free(control);
+    free(slots);
+}
+
+HashMap
+init_hash_map(uint8_t flags)
+{
+    HashMap map;
+    map.size = 0;
+    map.flags = flags;
+    allocate_table(&map, MAP_GROUP_SIZE);
+    return map;
+}
+
+void
+free_hash_map(HashMap *map)
+{
+    free(map->control);
+    free(map->slots);
+}
+
+size_t
+hash_map_bytes(const HashMap *map)
+{
+    return sizeof(HashMap) + map->capacity * (sizeof(MapSlot) + 1);
+}
+
+MapSlot *
+hash_map_find(const HashMap *map, uint64_t key)
+{
+    return find_slot(map, key, hash_key(map, key));
+}
+
+/*
+ * Returns the slot holding `key`, adding one with a zero value if there
+ * is none; a string key equal to one already there is not stored again.
+ * The table stays at most 7/8 full counting deleted slots, and doubles
+ * when live keys alone would fill more than 7/16 of it.
+ */
+MapSlot *
+hash_map_insert(HashMap *map, uint64_t key)
+{
+    uint64_t hash = hash_key(map, key);
+    MapSlot *slot = find_slot(map, key, hash);
+    size_t index;
+
+    if (slot != NULL)
+        return slot;
+    if ((map->size + map->deleted + 1) * 8 > map->capacity * 7)
+        resize(map, (map->size + 1) * 16 > map->capacity * 7 ? map->capacity * 2 : map->capacity);
+    index = free_index(map, hash);
+    if (map->control[index] == MAP_DELETED)
+        map->deleted--;
+    map->control[index] = hash & 0x7f;
+    map->slots[index].key = key;
+    map->slots[index].value = 0;
+    map->size++;
+    return map->slots + index;
+}
+
+/*
+ * A slot in a group that still has an empty one can become empty again:
+ * no search ever went past that group. Otherwise it is marked deleted.
+ */
+int
+hash_map_remove(HashMap *map, uint64_t key)
+{
+    MapSlot *slot = hash_map_find(map, key);
+    size_t index;
+
+    if (slot == NULL)
+        return 0;
+    index = slot - map->slots;
+    if (match_byte(map->control + index / MAP_GROUP_SIZE * MAP_GROUP_SIZE, MAP_EMPTY) != 0) {
+        map->control[index] = MAP_EMPTY;
+    } else {
+        map->control[index] = MAP_DELETED;
+        map->deleted++;
+    }
+    map->size--;
+    return 1;
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memo.h"
+#include "utils/memory.h"
+
+static uint64_t
+hash_args(const uint64_t *args, size_t count)
+{
+    size_t i;
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (i = 0; i < count; i++) {
+        hash ^= args[i];
+        hash *= 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 31;
+    }
+    hash ^= hash >> 33;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+static int
+same_args(const MemoCache *cache, size_t slot, const uint64_t *args)
+{
+    return cache->args_count == 0
+        || memcmp(cache->keys + slot * cache->args_count, args, cache->args_count * sizeof(uint64_t)) == 0;
+}
+
+static void
+move_slot(MemoCache *cache, size_t to, size_t from)
+{
+    cache->entries[to] = cache->entries[from];
+    memcpy(cache->keys + to * cache->args_count,
+           cache->keys + from * cache->args_count,
+           cache->args_count * sizeof(uint64_t));
+}
+
+/*
+ * Linear probing with backward-shift deletion, so the table never
+ * accumulates tombstones no matter how often the clock evicts.
+ */
+static void
+remove_slot(MemoCache *cache, size_t slot)
+{
+    size_t next = slot, home;
+    while (1) {
+        next = (next + 1) & cache->mask;
+        if (!cache->entries[next].used)
+            break;
+        home = cache->entries[next].hash & cache->mask;
+        if (slot <= next ? (slot < home && home <= next) : (slot < home || home <= next))
+            continue;
+        move_slot(cache, slot, next);
+        slot = next;
+    }
+    cache->entries[slot].used = 0;
+    cache->size--;
+}
+
+static void
+evict_one(MemoCache *cache)
+{
+    while (1) {
+        MemoEntry *entry = cache->entries + cache->hand;
+        if (entry->used && !entry->referenced) {
+            remove_slot(cache, cache->hand);
+            cache->evictions++;
+            return;
+        }
+        entry->referenced = 0;
+        cache->hand = (cache->hand + 1) & cache->mask;
+    }
+}
+
+MemoCache
+init_memo_cache(size_t args_count, size_t max_size)
+{
+    MemoCache cache;
+    size_t capacity = 8;
+
+    memset(&cache, 0, sizeof(MemoCache));
+    while (capacity < max_size * 2)
+        capacity *= 2;
+    cache.args_count = args_count;
+    cache.max_size = max_size;
+    cache.mask = capacity - 1;
+    cache.entries = safe_malloc(capacity * sizeof(MemoEntry));
+    memset(cache.entries, 0, capacity * sizeof(MemoEntry));
+    cache.keys = safe_malloc(capacity * args_count * sizeof(uint64_t));
+    return cache;
+}
+
+void
+free_memo_cache(MemoCache cache)
+{
+    free(cache.entries);
+    free(cache.keys);
+}
+
+int
+memo_lookup(MemoCache *cache, const uint64_t *args, uint64_t *result)
+{
+    uint64_t hash = hash_args(args, cache->args_count);
+    size_t slot = hash & cache->mask;
+
+    while (cache->entries[slot].used) {
+        if (cache->entries[slot].hash == hash && same_args(cache, slot, args)) {
+            cache->entries[slot].referenced = 1;
+            *result = cache->entries[slot].result;
+            cache->hits++;
+            return 1;
+        }
+        slot = (slot + 1) & cache->mask;
+    }
+    cache->misses++;
+    return 0;
+}
+
+void
+memo_insert(MemoCache *cache, const uint64_t *args, uint64_t result)
+{
+    uint64_t hash = hash_args(args, cache->args_count);
+    size_t slot;
+
+    if (cache->max_size == 0)
+        return;
+    for (slot = hash & cache->mask; cache->entries[slot].used; slot = (slot + 1) & cache->mask) {
+        if (cache->entries[slot].hash == hash && same_args(cache, slot, args)) {
+            cache->entries[slot].result = result;
+            return;
+        }
+    }
+    if (cache->size >= cache->max_size) {
+        evict_one(cache);
+        for (slot = hash & cache->mask; cache->entries[slot].used; slot = (slot + 1) & cache->mask);
+    }
+    cache->entries[slot].hash = hash;
+    cache->entries[slot].result = result;
+    cache->entries[slot].used = 1;
+    cache->entries[slot].referenced = 1;
+    memcpy(cache->keys + slot * cache->args_count, args, cache->args_count * sizeof(uint64_t));
+    cache->size++;
+}
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+typedef struct
+{
+    size_t *index;
+    size_t *lowlink;
+    uint8_t *on_stack;
+    size_t *stack;
+    size_t stack_size;
+    size_t *path; // the functions being visited, each calling the next
+    size_t path_size;
+    size_t *next_callee; // per function, the callee to visit next
+    size_t next_index;
+    size_t order_size;
+} TarjanState;
+
+static void
+add_callee(CallGraphNode *node, size_t callee)
+{
+    node->callees = safe_realloc(node->callees, (node->callees_count + 1) * sizeof(size_t));
+    node->callees[node->callees_count++] = callee;
+}
+
+static void
+visit(TarjanState *state, size_t v)
+{
+    state->index[v] = state->lowlink[v] = ++state->next_index;
+    state->stack[state->stack_size++] = v;
+    state->on_stack[v] = 1;
+    state->path[state->path_size++] = v;
+}
+
+/* Walks the calls from `root` on an explicit path, so long call chains cannot overflow the C stack. */
+static void
+strong_connect(CallGraph *graph, TarjanState *state, size_t root)
+{
+    size_t i, v, w, members;
+    CallGraphNode *node;
+
+    visit(state, root);
+    while (state->path_size > 0) {
+        v = state->path[state->path_size - 1];
+        node = graph->nodes + v;
+        if (state->next_callee[v] < node->callees_count) {
+            w = node->callees[state->next_callee[v]++];
+            if (w == v)
+                node->recursive = 1;
+            if (!state->index[w])
+                visit(state, w);
+            else if (state->on_stack[w] && state->index[w] < state->lowlink[v])
+                state->lowlink[v] = state->index[w];
+            continue;
+        }
+
+        // all of v's callees are done, so v returns to its caller
+        state->path_size--;
+        if (state->path_size > 0 && state->lowlink[v] < state->lowlink[state->path[state->path_size - 1]])
+            state->lowlink[state->path[state->path_size - 1]] = state->lowlink[v];
+        if (state->lowlink[v] != state->index[v])
+            continue;
+        members = 0;
+        do {
+            w = state->stack[--state->stack_size];
+            state->on_stack[w] = 0;
+            graph->order[state->order_size++] = w;
+            members++;
+        } while (w != v);
+        if (members > 1) {
+            for (i = state->order_size - members; i < state->order_size; i++)
+                graph->nodes[graph->order[i]].recursive = 1;
+        }
+    }
+}
+
+CallGraph
+build_call_graph(const Program *program)
+{
+    CallGraph graph;
+    TarjanState state;
+    size_t i, j, n = program->functions_count;
+
+    graph.nodes_count = n;
+    graph.nodes = safe_malloc((n + 1) * sizeof(CallGraphNode));
+    graph.order = safe_malloc((n + 1) * sizeof(size_t));
+    memset(graph.nodes, 0, (n + 1) * sizeof(CallGraphNode));
+    for (i = 0; i < n; i++) {
+        const Function *function = program->functions + i;
+        for (j = 0; j < function->instructions_count; j++) {
+            if (opcodes[function->instructions[j].op].operands == OPERANDS_FUNCTION
+                && function->instructions[j].data.reg < n)
+                add_callee(graph.nodes + i, function->instructions[j].data.reg);
+        }
+    }
+
+    memset(&state, 0, sizeof(TarjanState));
+    state.index = safe_malloc((n + 1) * sizeof(size_t));
+    state.lowlink = safe_malloc((n + 1) * sizeof(size_t));
+    state.stack = safe_malloc((n + 1) * sizeof(size_t));
+    state.on_stack = safe_malloc(n + 1);
+    state.path = safe_malloc((n + 1) * sizeof(size_t));
+    state.next_callee = safe_malloc((n + 1) * sizeof(size_t));
+    memset(state.index, 0, (n + 1) * sizeof(size_t));
+    memset(state.on_stack, 0, n + 1);
+    memset(state.next_callee, 0, (n + 1) * sizeof(size_t));
+    for (i = 0; i < n; i++) {
+        if (!state.index[i])
+            strong_connect(&graph, &state, i);
+    }
+
+    free(state.index);
+    free(state.lowlink);
+    free(state.stack);
+    free(state.on_stack);
+    free(state.path);
+    free(state.next_callee);
+    return graph;
+}
+
+void
+free_call_graph(CallGraph graph)
+{
+    size_t i;
+    for (i = 0; i < graph.nodes_count; i++)
+        free(graph.nodes[i].callees);
+    free(graph.nodes);
+    free(graph.order);
+}
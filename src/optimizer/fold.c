@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+static uint8_t *
+find_jump_targets(const Function *function)
+{
+    size_t i, target;
+    uint8_t *targets = safe_malloc(function->instructions_count + 1);
+    memset(targets, 0, function->instructions_count + 1);
+    for (i = 0; i < function->instructions_count; i++) {
+        target = jump_target(function->instructions + i);
+        if (target <= function->instructions_count)
+            targets[target] = 1;
+    }
+    return targets;
+}
+
+static int
+fold_binary(InstructionOp op, uint64_t a, uint64_t b, uint64_t *result)
+{
+    switch (op) {
+        case OP_ADD_I64:
+            *result = a + b;
+            return 1;
+        case OP_SUB_I64:
+            *result = a - b;
+            return 1;
+        case OP_MUL_I64:
+            *result = a * b;
+            return 1;
+        case OP_DIV_I64:
+            if (b == 0)
+                return 0;
+            *result = a / b;
+            return 1;
+        case OP_MOD_I64:
+            if (b == 0)
+                return 0;
+            *result = a % b;
+            return 1;
+        case OP_LESS_THAN_I64:
+            *result = a < b;
+            return 1;
+        case OP_GREATER_THAN_I64:
+            *result = a > b;
+            return 1;
+        case OP_EQUALS_I64:
+            *result = a == b;
+            return 1;
+        case OP_NOT_EQUALS_I64:
+            *result = a != b;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static size_t
+fold_pass(Function *function, const uint8_t *targets, uint8_t *removed)
+{
+    size_t i, changes = 0;
+    Instruction *instructions = function->instructions;
+    size_t count = function->instructions_count;
+    uint64_t result;
+
+    for (i = 0; i + 1 < count; i++) {
+        if (removed[i] || instructions[i].op != OP_PUSH_I64 || targets[i + 1])
+            continue;
+        switch (instructions[i + 1].op) {
+            case OP_NOT:
+                instructions[i].data.immediate = !instructions[i].data.immediate;
+                removed[i + 1] = 1;
+                changes++;
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+                // a branch that is always taken becomes a plain jump
+                if ((instructions[i].data.immediate == 0) == (instructions[i + 1].op == OP_JUMP_IF_FALSE))
+                    instructions[i + 1].op = OP_JUMP;
+                else
+                    removed[i + 1] = 1;
+                removed[i] = 1;
+                changes++;
+                break;
+            case OP_PUSH_I64:
+                if (i + 2 < count
+                    && !targets[i + 2]
+                    && fold_binary(instructions[i + 2].op,
+                                   instructions[i].data.immediate,
+                                   instructions[i + 1].data.immediate,
+                                   &result)) {
+                    instructions[i].data.immediate = result;
+                    removed[i + 1] = 1;
+                    removed[i + 2] = 1;
+                    changes++;
+                }
+                break;
+            default:
+                break;
+        }
+        if (removed[i + 1])
+            i++;
+    }
+    return changes;
+}
+
+static size_t
+mark_unreachable(const Function *function, uint8_t *removed)
+{
+    size_t i, top = 0, changes = 0;
+    size_t count = function->instructions_count;
+    uint8_t *reachable = safe_malloc(count);
+    size_t *worklist = safe_malloc(count * sizeof(size_t));
+
+    memset(reachable, 0, count);
+    reachable[0] = 1;
+    worklist[top++] = 0;
+    while (top > 0) {
+        const Instruction *instruction;
+        size_t successors[2], successors_count = 0;
+
+        i = worklist[--top];
+        instruction = function->instructions + i;
+        switch (instruction->op) {
+            case OP_RETURN:
+            case OP_EXIT:
+                break;
+            case OP_JUMP:
+                successors[successors_count++] = instruction->data.reg;
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_DEC_JUMP_IF_NOT_ZERO:
+            case OP_INC_JUMP_IF_LESS_THAN:
+                successors[successors_count++] = jump_target(instruction);
+                successors[successors_count++] = i + 1;
+                break;
+            default:
+                successors[successors_count++] = i + 1;
+                break;
+        }
+        while (successors_count > 0) {
+            size_t next = successors[--successors_count];
+            if (next < count && !reachable[next]) {
+                reachable[next] = 1;
+                worklist[top++] = next;
+            }
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!reachable[i] && !removed[i]) {
+            removed[i] = 1;
+            changes++;
+        }
+    }
+    free(worklist);
+    free(reachable);
+    return changes;
+}
+
+size_t
+fold_constants(Function *function)
+{
+    size_t changes, removed_count = 0;
+    uint8_t *targets, *removed;
+
+    do {
+        if (function->instructions_count == 0)
+            break;
+        removed = safe_malloc(function->instructions_count);
+        memset(removed, 0, function->instructions_count);
+        targets = find_jump_targets(function);
+
+        changes = fold_pass(function, targets, removed);
+        changes += mark_unreachable(function, removed);
+        removed_count += compact_function(function, removed);
+
+        free(targets);
+        free(removed);
+    } while (changes > 0);
+
+    return removed_count;
+}
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+#define UNREACHABLE SIZE_MAX
+
+typedef struct
+{
+    size_t id;
+    uint64_t weight;
+} Callee;
+
+typedef struct
+{
+    Callee *callees; // heaviest first
+    size_t count;
+    size_t next; // the callee to place next
+} Placement;
+
+typedef struct
+{
+    const CallGraph *graph;
+    const Profile *profile;
+    size_t *order; // function ids in their new order
+    size_t order_size;
+    size_t *new_id; // UNREACHABLE until placed
+    size_t *cold; // callees the profile never saw called, left to place after everything hot
+    size_t cold_size;
+    Placement *path; // the functions being placed, each followed by the callees it has left
+    size_t path_size;
+} FunctionOrder;
+
+static int
+compare_ids(const void *a, const void *b)
+{
+    size_t x = *(const size_t *) a, y = *(const size_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// heaviest first, then by id so the order does not depend on qsort
+static int
+compare_callees(const void *a, const void *b)
+{
+    const Callee *x = a, *y = b;
+
+    if (x->weight != y->weight)
+        return x->weight > y->weight ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/*
+ * Places `id` and queues its callees, most called first, weighing the
+ * calls the profile recorded or else call sites.
+ */
+static void
+enter_function(FunctionOrder *state, size_t id)
+{
+    const CallGraphNode *node = state->graph->nodes + id;
+    size_t *ids = safe_malloc((node->callees_count + 1) * sizeof(size_t));
+    Callee *callees = safe_malloc((node->callees_count + 1) * sizeof(Callee));
+    size_t i, count = 0;
+
+    state->new_id[id] = state->order_size;
+    state->order[state->order_size++] = id;
+    if (node->callees_count > 0)
+        memcpy(ids, node->callees, node->callees_count * sizeof(size_t));
+    qsort(ids, node->callees_count, sizeof(size_t), compare_ids);
+    for (i = 0; i < node->callees_count; i++) {
+        if (count > 0 && callees[count - 1].id == ids[i]) {
+            callees[count - 1].weight++;
+        } else {
+            callees[count].id = ids[i];
+            callees[count++].weight = 1;
+        }
+    }
+    if (state->profile != NULL) {
+        for (i = 0; i < count; i++)
+            callees[i].weight = state->profile->functions[callees[i].id].calls;
+    }
+    qsort(callees, count, sizeof(Callee), compare_callees);
+    free(ids);
+    state->path[state->path_size].callees = callees;
+    state->path[state->path_size].count = count;
+    state->path[state->path_size++].next = 0;
+}
+
+/*
+ * Places `id`, then depth first its callees from the most called down, so
+ * each function is followed by the hottest callee not placed yet. The walk
+ * keeps its own path, so long call chains cannot overflow the C stack.
+ */
+static void
+place_function(FunctionOrder *state, size_t id)
+{
+    Placement *top;
+    size_t callee;
+
+    enter_function(state, id);
+    while (state->path_size > 0) {
+        top = state->path + state->path_size - 1;
+        if (top->next == top->count) {
+            free(top->callees);
+            state->path_size--;
+            continue;
+        }
+        callee = top->callees[top->next++].id;
+        if (state->new_id[callee] != UNREACHABLE)
+            continue;
+        if (state->profile != NULL && top->callees[top->next - 1].weight == 0)
+            state->cold[state->cold_size++] = callee;
+        else
+            enter_function(state, callee);
+    }
+}
+
+static void
+rewrite_calls(Function *function, const size_t *new_id, size_t functions_count)
+{
+    size_t i;
+
+    for (i = 0; i < function->instructions_count; i++) {
+        if (opcodes[function->instructions[i].op].operands == OPERANDS_FUNCTION
+            && function->instructions[i].data.reg < functions_count)
+            function->instructions[i].data.reg = new_id[function->instructions[i].data.reg];
+    }
+}
+
+static void
+free_function(Function function)
+{
+    size_t i;
+
+    for (i = 0; i < function.instructions_count; i++) {
+        if (function.instructions[i].op == OP_PUSH_LITERAL_STRING)
+            free(function.instructions[i].data.string.ptr);
+    }
+    free(function.instructions);
+}
+
+/* Moves the profile's counters along with their functions, dropping those of removed ones. */
+static void
+reorder_profile(Profile *profile, const FunctionOrder *state)
+{
+    FunctionProfile *functions = safe_malloc((state->order_size + 1) * sizeof(FunctionProfile));
+    size_t i;
+
+    for (i = 0; i < profile->functions_count; i++) {
+        if (state->new_id[i] != UNREACHABLE) {
+            functions[state->new_id[i]] = profile->functions[i];
+        } else {
+            free(profile->functions[i].taken);
+            free(profile->functions[i].not_taken);
+        }
+    }
+    free(profile->functions);
+    profile->functions = functions;
+    profile->functions_count = state->order_size;
+}
+
+/*
+ * Keeps only the functions Call, ParallelMapI64 and ParallelReduceI64 can
+ * reach from function 0, numbered in the order they are placed: every
+ * function is followed by its most called callee, by the calls a profile
+ * recorded or else by call sites, and with a profile the functions it
+ * never saw called go last. Instruction arrays are reallocated in that
+ * order too, so the allocator tends to lay callers and their hot callees
+ * out next to each other. Ids change, so hosts calling functions directly
+ * must not run this; source_id keeps the old one for diagnostics. The
+ * profile, if any, must match the program, and its counters are renumbered
+ * along with it. Does nothing while bodies are left to lazy assembly,
+ * which hides their calls. Returns how many functions were removed.
+ */
+size_t
+layout_functions(Program *program, Profile *profile)
+{
+    CallGraph graph;
+    FunctionOrder state;
+    Function *functions;
+    Instruction **instructions;
+    size_t i, next, edges = 0, n = program->functions_count;
+
+    if (n == 0)
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (program->functions[i].body != NULL)
+            return 0;
+    }
+
+    graph = build_call_graph(program);
+    state.graph = &graph;
+    state.profile = profile;
+    state.order = safe_malloc(n * sizeof(size_t));
+    state.order_size = 0;
+    state.new_id = safe_malloc(n * sizeof(size_t));
+    for (i = 0; i < n; i++)
+        edges += graph.nodes[i].callees_count;
+    state.cold = safe_malloc((edges + 1) * sizeof(size_t));
+    state.cold_size = 0;
+    state.path = safe_malloc((n + 1) * sizeof(Placement));
+    state.path_size = 0;
+    for (i = 0; i < n; i++)
+        state.new_id[i] = UNREACHABLE;
+    place_function(&state, 0);
+    // cold callees are placed in the order they were left behind, and may leave more behind
+    for (next = 0; next < state.cold_size; next++) {
+        if (state.new_id[state.cold[next]] == UNREACHABLE)
+            place_function(&state, state.cold[next]);
+    }
+
+    functions = safe_malloc((state.order_size + 1) * sizeof(Function));
+    instructions = safe_malloc(state.order_size * sizeof(Instruction *));
+    for (i = 0; i < state.order_size; i++) {
+        functions[i] = program->functions[state.order[i]];
+        functions[i].id = i;
+        rewrite_calls(functions + i, state.new_id, n);
+        instructions[i] = functions[i].instructions;
+        if (functions[i].instructions_count > 0) {
+            functions[i].instructions = safe_malloc(functions[i].instructions_count * sizeof(Instruction));
+            memcpy(functions[i].instructions, instructions[i], functions[i].instructions_count * sizeof(Instruction));
+        }
+    }
+    // the old arrays are only freed now, so none of the new ones reuses a hole among them
+    for (i = 0; i < state.order_size; i++) {
+        if (functions[i].instructions != instructions[i])
+            free(instructions[i]);
+    }
+    for (i = 0; i < n; i++) {
+        if (state.new_id[i] == UNREACHABLE)
+            free_function(program->functions[i]);
+    }
+    if (profile != NULL)
+        reorder_profile(profile, &state);
+    free(program->functions);
+    program->functions = functions;
+    program->functions_count = state.order_size;
+
+    free(instructions);
+    free(state.order);
+    free(state.new_id);
+    free(state.cold);
+    free(state.path);
+    free_call_graph(graph);
+    return n - state.order_size;
+}
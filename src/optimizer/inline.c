@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+static size_t
+frame_slots(const Function *function)
+{
+    return function->locals_count > function->args_count ? function->locals_count : function->args_count;
+}
+
+static int
+can_inline(const Program *program, const CallGraph *graph, size_t callee, size_t budget)
+{
+    const Function *function;
+
+    if (callee >= program->functions_count || graph->nodes[callee].recursive)
+        return 0;
+    function = program->functions + callee;
+    // a pure function stays a call, so its results are memoized
+    return !function->pure
+        && function->instructions_count > 0
+        && function->instructions_count <= budget
+        && function->ptr_args_count == 0
+        && function->local_pointers_count == 0;
+}
+
+static size_t
+inlined_size(const Function *callee)
+{
+    size_t i, size = callee->args_count;
+    for (i = 0; i < callee->instructions_count; i++) {
+        if (callee->instructions[i].op != OP_RETURN || i + 1 < callee->instructions_count)
+            size++;
+    }
+    return size;
+}
+
+static void
+relocate_locals(Instruction *instruction, size_t base)
+{
+    switch (instruction->op) {
+        case OP_LOAD_LOCAL_I64:
+        case OP_STORE_LOCAL_I64:
+            instruction->data.reg += base;
+            break;
+        case OP_LESS_THAN_I64_RI:
+        case OP_GREATER_THAN_I64_RI:
+        case OP_EQUALS_I64_RI:
+        case OP_ADD_I64_RI:
+        case OP_SUB_I64_RI:
+        case OP_MUL_I64_RI:
+        case OP_DIV_I64_RI:
+        case OP_MOD_I64_RI:
+            instruction->data.ri.reg += base;
+            break;
+        case OP_DEC_JUMP_IF_NOT_ZERO:
+        case OP_INC_JUMP_IF_LESS_THAN:
+            instruction->data.loop.reg += base;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Arguments are popped into the callee's relocated slots the same way
+ * call_function() does, and every Return except a trailing one becomes
+ * a jump to the continuation.
+ */
+static void
+emit_inlined_body(Function *target, const Function *callee, size_t base)
+{
+    size_t i, jump, position, count = callee->instructions_count;
+    size_t *positions = safe_malloc((count + 1) * sizeof(size_t));
+    Instruction instruction;
+
+    memset(&instruction, 0, sizeof(Instruction));
+    for (i = callee->args_count; i-- > 0;) {
+        instruction.op = OP_STORE_LOCAL_I64;
+        instruction.data.reg = base + i;
+        emit_instruction(target, instruction);
+    }
+
+    position = target->instructions_count;
+    for (i = 0; i < count; i++) {
+        positions[i] = position;
+        if (callee->instructions[i].op != OP_RETURN || i + 1 < count)
+            position++;
+    }
+    positions[count] = position;
+
+    for (i = 0; i < count; i++) {
+        instruction = callee->instructions[i];
+        switch (instruction.op) {
+            case OP_RETURN:
+                if (i + 1 == count)
+                    break;
+                instruction.op = OP_JUMP;
+                instruction.data.reg = positions[count];
+                emit_instruction(target, instruction);
+                break;
+            case OP_PUSH_LITERAL_STRING:
+                instruction.data.string.ptr = safe_malloc(instruction.data.string.size + 1);
+                memcpy(instruction.data.string.ptr,
+                       callee->instructions[i].data.string.ptr,
+                       instruction.data.string.size + 1);
+                emit_instruction(target, instruction);
+                break;
+            default:
+                jump = jump_target(&instruction);
+                if (jump <= count)
+                    set_jump_target(&instruction, positions[jump]);
+                relocate_locals(&instruction, base);
+                emit_instruction(target, instruction);
+                break;
+        }
+    }
+    free(positions);
+}
+
+/* With `site_counts`, only call sites that ran at least `threshold` times are expanded. */
+static int
+inline_site(const Program *program, const CallGraph *graph, const Instruction *instruction, size_t budget,
+            const uint64_t *site_counts, uint64_t threshold)
+{
+    return instruction->op == OP_CALL
+        && can_inline(program, graph, instruction->data.reg, budget)
+        && (site_counts == NULL || site_counts[0] >= threshold);
+}
+
+static size_t
+inline_calls(Program *program, const CallGraph *graph, size_t caller_id, size_t budget,
+             const uint64_t *site_counts, uint64_t threshold)
+{
+    Function *caller = program->functions + caller_id;
+    Function expanded = init_function();
+    size_t i, jump, position = 0, sites = 0, extra_slots = 0;
+    size_t count = caller->instructions_count;
+    size_t base = frame_slots(caller);
+    size_t *new_index;
+
+    new_index = safe_malloc((count + 1) * sizeof(size_t));
+    for (i = 0; i < count; i++) {
+        const Instruction *instruction = caller->instructions + i;
+        new_index[i] = position;
+        if (inline_site(program, graph, instruction, budget, site_counts ? site_counts + i : NULL, threshold)) {
+            position += inlined_size(program->functions + instruction->data.reg);
+            sites++;
+        } else {
+            position++;
+        }
+    }
+    new_index[count] = position;
+
+    if (sites == 0) {
+        free(new_index);
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        Instruction instruction = caller->instructions[i];
+        if (inline_site(program, graph, &instruction, budget, site_counts ? site_counts + i : NULL, threshold)) {
+            const Function *callee = program->functions + instruction.data.reg;
+            emit_inlined_body(&expanded, callee, base);
+            if (frame_slots(callee) > extra_slots)
+                extra_slots = frame_slots(callee);
+            continue;
+        }
+        jump = jump_target(&instruction);
+        if (jump <= count)
+            set_jump_target(&instruction, new_index[jump]);
+        emit_instruction(&expanded, instruction);
+    }
+
+    free(new_index);
+    free(caller->instructions);
+    caller->instructions = expanded.instructions;
+    caller->instructions_count = expanded.instructions_count;
+    caller->locals_count = base + extra_slots;
+    caller->stack_frame_size = caller->locals_count + caller->local_pointers_count + 3;
+    return sites;
+}
+
+/*
+ * Callers are visited after their callees, so a helper that was itself
+ * expanded is copied in its final form. Inlined bodies never overlap in
+ * time within one frame, hence every site in a caller shares the same
+ * block of extra slots.
+ */
+size_t
+inline_functions(Program *program, size_t budget)
+{
+    CallGraph graph;
+    size_t i, sites = 0;
+
+    if (budget == 0)
+        return 0;
+    graph = build_call_graph(program);
+    for (i = 0; i < graph.nodes_count; i++)
+        sites += inline_calls(program, &graph, graph.order[i], budget, NULL, 0);
+    free_call_graph(graph);
+    return sites;
+}
+
+/*
+ * Expands call sites that made at least PROFILE_HOT_PERCENT of all
+ * recorded calls, allowing callees of up to `budget` instructions. The
+ * profile must match the program; callers read their own counters before
+ * being expanded, so counters made stale by an expansion are never used.
+ */
+size_t
+inline_hot_calls(Program *program, const Profile *profile, size_t budget)
+{
+    CallGraph graph;
+    uint64_t total = 0, threshold;
+    size_t i, sites = 0;
+
+    for (i = 1; i < profile->functions_count; i++)
+        total += profile->functions[i].calls;
+    if (budget == 0 || total == 0)
+        return 0;
+    threshold = total * PROFILE_HOT_PERCENT / 100;
+    if (threshold == 0)
+        threshold = 1;
+    graph = build_call_graph(program);
+    for (i = 0; i < graph.nodes_count; i++) {
+        size_t id = graph.order[i];
+        sites += inline_calls(program, &graph, id, budget, profile->functions[id].taken, threshold);
+    }
+    free_call_graph(graph);
+    return sites;
+}
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+#define NO_BLOCK SIZE_MAX
+
+typedef struct
+{
+    size_t start;
+    size_t end;
+    size_t successors[2]; // branch target, then fall-through; NO_BLOCK when absent
+    uint64_t weights[2];
+} Block;
+
+static int
+is_conditional(InstructionOp op)
+{
+    return op == OP_JUMP_IF_FALSE
+        || op == OP_JUMP_IF_TRUE
+        || op == OP_DEC_JUMP_IF_NOT_ZERO
+        || op == OP_INC_JUMP_IF_LESS_THAN;
+}
+
+static int
+ends_block(InstructionOp op)
+{
+    return op == OP_JUMP || op == OP_RETURN || op == OP_EXIT || is_conditional(op);
+}
+
+/*
+ * Returns the number of blocks, or 0 when a jump leaves the function or a
+ * conditional branch can fall off its end; such code is left for the
+ * stack checks to reject.
+ */
+static size_t
+find_blocks(const Function *function, const FunctionProfile *profile, const uint64_t *counts,
+            Block *blocks, size_t *block_of)
+{
+    size_t i, target, blocks_count = 0, count = function->instructions_count;
+    uint8_t *leaders = safe_malloc(count + 1);
+
+    memset(leaders, 0, count + 1);
+    leaders[0] = 1;
+    for (i = 0; i < count; i++) {
+        target = jump_target(function->instructions + i);
+        if (target != SIZE_MAX && target >= count) {
+            free(leaders);
+            return 0;
+        }
+        if (target != SIZE_MAX)
+            leaders[target] = 1;
+        if (ends_block(function->instructions[i].op))
+            leaders[i + 1] = 1;
+    }
+    for (i = 0; i < count; i++) {
+        if (leaders[i]) {
+            if (blocks_count > 0)
+                blocks[blocks_count - 1].end = i;
+            blocks[blocks_count++].start = i;
+        }
+        block_of[i] = blocks_count - 1;
+    }
+    blocks[blocks_count - 1].end = count;
+    free(leaders);
+
+    for (i = 0; i < blocks_count; i++) {
+        Block *block = blocks + i;
+        size_t last = block->end - 1;
+        InstructionOp op = function->instructions[last].op;
+
+        block->successors[0] = block->successors[1] = NO_BLOCK;
+        block->weights[0] = block->weights[1] = 0;
+        if (op == OP_JUMP || is_conditional(op)) {
+            block->successors[0] = block_of[jump_target(function->instructions + last)];
+            block->weights[0] = profile->taken[last];
+        }
+        if (is_conditional(op) && block->end == count) {
+            return 0;
+        } else if (is_conditional(op)) {
+            block->successors[1] = i + 1;
+            block->weights[1] = profile->not_taken[last];
+        } else if (block->end < count && !ends_block(op)) {
+            block->successors[1] = i + 1;
+            block->weights[1] = counts[last];
+        }
+    }
+    return blocks_count;
+}
+
+/*
+ * Chains blocks greedily: each block is followed by its hottest successor
+ * not placed yet, otherwise by the hottest remaining block. Blocks that
+ * never ran keep their original order at the end.
+ */
+static void
+order_blocks(const Block *blocks, size_t blocks_count, const uint64_t *counts, size_t *order)
+{
+    uint8_t *placed = safe_malloc(blocks_count);
+    size_t i, j, current = 0, next;
+    uint64_t best;
+
+    memset(placed, 0, blocks_count);
+    placed[0] = 1;
+    order[0] = 0;
+    for (i = 1; i < blocks_count; i++) {
+        next = NO_BLOCK;
+        best = 0;
+        for (j = 2; j-- > 0;) {
+            size_t successor = blocks[current].successors[j];
+            if (successor != NO_BLOCK && !placed[successor] && blocks[current].weights[j] > best) {
+                next = successor;
+                best = blocks[current].weights[j];
+            }
+        }
+        if (next == NO_BLOCK) {
+            for (j = 0; j < blocks_count; j++) {
+                if (!placed[j] && (next == NO_BLOCK || counts[blocks[j].start] > counts[blocks[next].start]))
+                    next = j;
+            }
+        }
+        placed[next] = 1;
+        order[i] = next;
+        current = next;
+    }
+    free(placed);
+}
+
+static void
+emit_counted(Function *target, FunctionProfile *counters, Instruction instruction, uint64_t taken, uint64_t not_taken)
+{
+    counters->taken[target->instructions_count] = taken;
+    counters->not_taken[target->instructions_count] = not_taken;
+    emit_instruction(target, instruction);
+}
+
+static void
+emit_jump(Function *target, FunctionProfile *counters, size_t block, uint64_t taken)
+{
+    Instruction instruction;
+
+    memset(&instruction, 0, sizeof(Instruction));
+    instruction.op = OP_JUMP;
+    instruction.data.reg = block;
+    emit_counted(target, counters, instruction, taken, 0);
+}
+
+/*
+ * Copies one block and rewrites its exit for the block placed after it:
+ * jumps to the next block disappear, a conditional branch whose hot side
+ * is the next block is inverted so that side falls through, and a `Not`
+ * feeding a branch is folded into the branch's sense. Jump targets are
+ * left as block numbers. Returns how many of these rewrites happened.
+ */
+static size_t
+emit_block(Function *target, FunctionProfile *counters, const Function *function,
+           const FunctionProfile *profile, const Block *block, size_t next)
+{
+    size_t i, last = block->end - 1, body_end = block->end, changes = 0;
+    Instruction branch = function->instructions[last];
+    size_t taken_block = block->successors[0], fall_block = block->successors[1];
+
+    if (ends_block(branch.op))
+        body_end = last;
+    if ((branch.op == OP_JUMP_IF_FALSE || branch.op == OP_JUMP_IF_TRUE)
+        && last > block->start
+        && function->instructions[last - 1].op == OP_NOT) {
+        branch.op = branch.op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+        body_end = last - 1;
+        changes++;
+    }
+    for (i = block->start; i < body_end; i++)
+        emit_counted(target, counters, function->instructions[i], profile->taken[i], profile->not_taken[i]);
+
+    switch (branch.op) {
+        case OP_RETURN:
+        case OP_EXIT:
+            emit_counted(target, counters, branch, 0, 0);
+            break;
+        case OP_JUMP:
+            if (taken_block != next)
+                emit_jump(target, counters, taken_block, block->weights[0]);
+            else
+                changes++;
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_DEC_JUMP_IF_NOT_ZERO:
+        case OP_INC_JUMP_IF_LESS_THAN:
+            if (fall_block != next
+                && taken_block == next
+                && (branch.op == OP_JUMP_IF_FALSE || branch.op == OP_JUMP_IF_TRUE)) {
+                branch.op = branch.op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+                set_jump_target(&branch, fall_block);
+                emit_counted(target, counters, branch, block->weights[1], block->weights[0]);
+                changes++;
+                break;
+            }
+            set_jump_target(&branch, taken_block);
+            emit_counted(target, counters, branch, block->weights[0], block->weights[1]);
+            if (fall_block != next)
+                emit_jump(target, counters, fall_block, block->weights[1]);
+            break;
+        default:
+            if (fall_block != NO_BLOCK && fall_block != next)
+                emit_jump(target, counters, fall_block, block->weights[1]);
+            break;
+    }
+    return changes;
+}
+
+/* Returns the number of rewrites, 0 when the function was left as it was. */
+static size_t
+rewrite_function(Function *function, FunctionProfile *profile, const Block *blocks, size_t blocks_count,
+                 const uint64_t *counts)
+{
+    size_t i, changes = 0, size = function->instructions_count + blocks_count + 1;
+    size_t *order = safe_malloc(blocks_count * sizeof(size_t));
+    size_t *new_start = safe_malloc(blocks_count * sizeof(size_t));
+    Function laid_out = init_function();
+    FunctionProfile counters;
+
+    order_blocks(blocks, blocks_count, counts, order);
+    counters.calls = profile->calls;
+    counters.taken = safe_malloc(size * sizeof(uint64_t));
+    counters.not_taken = safe_malloc(size * sizeof(uint64_t));
+    for (i = 0; i < blocks_count; i++) {
+        new_start[order[i]] = laid_out.instructions_count;
+        changes += order[i] != i;
+        changes += emit_block(&laid_out, &counters, function, profile, blocks + order[i],
+                              i + 1 < blocks_count ? order[i + 1] : NO_BLOCK);
+    }
+
+    if (changes == 0) {
+        free(counters.taken);
+        free(counters.not_taken);
+        free(laid_out.instructions);
+    } else {
+        for (i = 0; i < laid_out.instructions_count; i++) {
+            size_t block = jump_target(laid_out.instructions + i);
+            if (block != SIZE_MAX)
+                set_jump_target(laid_out.instructions + i, new_start[block]);
+        }
+        free(function->instructions);
+        function->instructions = laid_out.instructions;
+        function->instructions_count = laid_out.instructions_count;
+        free(profile->taken);
+        free(profile->not_taken);
+        profile->taken = counters.taken;
+        profile->not_taken = counters.not_taken;
+        profile->instructions_count = laid_out.instructions_count;
+    }
+    free(order);
+    free(new_start);
+    return changes;
+}
+
+static size_t
+layout_function(Function *function, FunctionProfile *profile)
+{
+    size_t blocks_count, changes = 0, count = function->instructions_count;
+    Block *blocks = safe_malloc(count * sizeof(Block));
+    size_t *block_of = safe_malloc(count * sizeof(size_t));
+    uint64_t *counts = execution_counts(function, profile);
+
+    blocks_count = find_blocks(function, profile, counts, blocks, block_of);
+    if (blocks_count > 0)
+        changes = rewrite_function(function, profile, blocks, blocks_count, counts);
+    free(blocks);
+    free(block_of);
+    free(counts);
+    return changes;
+}
+
+/*
+ * Reorders the blocks of every function that ran so hot paths fall
+ * through. The profile's counters are moved along with the instructions,
+ * so it stays usable for inline_hot_calls(). Returns how many blocks moved
+ * plus how many branches and jumps were rewritten.
+ */
+size_t
+layout_hot_paths(Program *program, Profile *profile)
+{
+    size_t i, changes = 0;
+
+    for (i = 0; i < program->functions_count; i++) {
+        if (profile->functions[i].calls > 0 && program->functions[i].instructions_count > 0)
+            changes += layout_function(program->functions + i, profile->functions + i);
+    }
+    return changes;
+}
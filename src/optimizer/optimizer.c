@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+// the branch target of a jump, or SIZE_MAX for instructions that never branch
+size_t
+jump_target(const Instruction *instruction)
+{
+    switch (instruction->op) {
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP:
+            return instruction->data.reg;
+        case OP_DEC_JUMP_IF_NOT_ZERO:
+        case OP_INC_JUMP_IF_LESS_THAN:
+            return instruction->data.loop.target;
+        default:
+            return SIZE_MAX;
+    }
+}
+
+void
+set_jump_target(Instruction *instruction, size_t target)
+{
+    if (instruction->op == OP_DEC_JUMP_IF_NOT_ZERO || instruction->op == OP_INC_JUMP_IF_LESS_THAN)
+        instruction->data.loop.target = target;
+    else
+        instruction->data.reg = target;
+}
+
+size_t
+compact_function(Function *function, const uint8_t *removed)
+{
+    size_t i, target, kept = 0, removed_count;
+    size_t *new_index = safe_malloc((function->instructions_count + 1) * sizeof(size_t));
+
+    for (i = 0; i < function->instructions_count; i++) {
+        new_index[i] = kept;
+        if (!removed[i])
+            kept++;
+        else if (function->instructions[i].op == OP_PUSH_LITERAL_STRING)
+            free(function->instructions[i].data.string.ptr);
+    }
+    new_index[function->instructions_count] = kept;
+
+    kept = 0;
+    for (i = 0; i < function->instructions_count; i++) {
+        Instruction instruction = function->instructions[i];
+        if (removed[i])
+            continue;
+        // a jump to a removed instruction lands on the next surviving one
+        target = jump_target(&instruction);
+        if (target <= function->instructions_count)
+            set_jump_target(&instruction, new_index[target]);
+        function->instructions[kept++] = instruction;
+    }
+
+    removed_count = function->instructions_count - kept;
+    function->instructions_count = kept;
+    free(new_index);
+    return removed_count;
+}
+
+size_t
+optimize_program(Program *program)
+{
+    size_t i, removed = 0;
+    for (i = 0; i < program->functions_count; i++)
+        removed += fold_constants(&program->functions[i]);
+    return removed;
+}
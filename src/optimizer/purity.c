@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+static int
+is_locally_pure(const Function *function, size_t functions_count)
+{
+    size_t i;
+
+    if (function->instructions_count == 0
+        || function->ptr_args_count != 0
+        || function->local_pointers_count != 0)
+        return 0;
+    for (i = 0; i < function->instructions_count; i++) {
+        const Instruction *instruction = function->instructions + i;
+        switch (instruction->op) {
+            case OP_PRINT_TOP_STACK_I64:
+            case OP_PUSH_LITERAL_STRING:
+            case OP_CONCAT_STRINGS:
+            case OP_PRINT_STRING:
+            case OP_SLICE_STRING:
+            case OP_STRING_LENGTH:
+            case OP_FIND_STRING:
+            case OP_COMPARE_STRINGS:
+            case OP_LOAD_LOCAL_POINTER:
+            case OP_STORE_LOCAL_POINTER:
+            case OP_LOAD_GLOBAL_I64:
+            case OP_STORE_GLOBAL_I64:
+            case OP_LOAD_GLOBAL_POINTER:
+            case OP_STORE_GLOBAL_POINTER:
+            case OP_NEW_ARRAY_I64:
+            case OP_ARRAY_LENGTH_I64:
+            case OP_ARRAY_LOAD_I64:
+            case OP_ARRAY_STORE_I64:
+            case OP_ARRAY_FILL_I64:
+            case OP_ARRAY_COPY_I64:
+            case OP_ARRAY_ADD_I64:
+            case OP_ARRAY_SUB_I64:
+            case OP_ARRAY_MUL_I64:
+            case OP_ARRAY_ADD_SCALAR_I64:
+            case OP_ARRAY_SUB_SCALAR_I64:
+            case OP_ARRAY_MUL_SCALAR_I64:
+            case OP_ARRAY_SUM_I64:
+            case OP_ARRAY_MIN_I64:
+            case OP_ARRAY_MAX_I64:
+            case OP_ARRAY_EQUALS_I64:
+            case OP_ARRAY_LESS_THAN_I64:
+            case OP_ARRAY_GREATER_THAN_I64:
+            case OP_NEW_MAP:
+            case OP_MAP_SIZE:
+            case OP_MAP_GET_I64:
+            case OP_MAP_PUT_I64:
+            case OP_MAP_CONTAINS_I64:
+            case OP_MAP_DELETE_I64:
+            case OP_MAP_GET_POINTER_I64:
+            case OP_MAP_PUT_POINTER_I64:
+            case OP_MAP_GET_STRING:
+            case OP_MAP_PUT_STRING:
+            case OP_MAP_CONTAINS_STRING:
+            case OP_MAP_DELETE_STRING:
+            case OP_MAP_GET_POINTER_STRING:
+            case OP_MAP_PUT_POINTER_STRING:
+            case OP_READ_LINE:
+            case OP_READ_I64:
+            case OP_READ_ALL:
+            case OP_PARALLEL_MAP_I64:
+            case OP_PARALLEL_REDUCE_I64:
+            case OP_SNAPSHOT:
+            case OP_CALL_NATIVE:
+            case OP_EXIT:
+                return 0;
+            case OP_CALL:
+                if (instruction->data.reg >= functions_count)
+                    return 0;
+                break;
+            default:
+                break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Optimistically assumes every locally pure function is pure, then drops
+ * those calling an impure one until nothing changes, so recursive
+ * functions such as fib keep their mark. Candidates are tagged 2 while
+ * the fixpoint runs; explicit `pure: 1` marks are trusted as-is.
+ */
+size_t
+infer_purity(Program *program)
+{
+    CallGraph graph = build_call_graph(program);
+    size_t i, j, marked = 0;
+    int changed;
+
+    for (i = 0; i < program->functions_count; i++) {
+        if (!program->functions[i].pure)
+            program->functions[i].pure = is_locally_pure(program->functions + i, program->functions_count) ? 2 : 0;
+    }
+
+    do {
+        changed = 0;
+        for (i = 0; i < graph.nodes_count; i++) {
+            Function *function = program->functions + graph.order[i];
+            if (function->pure != 2)
+                continue;
+            for (j = 0; j < graph.nodes[graph.order[i]].callees_count; j++) {
+                if (!program->functions[graph.nodes[graph.order[i]].callees[j]].pure) {
+                    function->pure = 0;
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    } while (changed);
+
+    for (i = 0; i < program->functions_count; i++) {
+        if (program->functions[i].pure == 2) {
+            program->functions[i].pure = 1;
+            marked++;
+        }
+    }
+    free_call_graph(graph);
+    return marked;
+}
+
+/*
+ * Whether `id` and every function it can reach are locally pure, trusting
+ * no `pure: 1` mark; for running a function off the VM's thread, where a
+ * side effect would be a data race rather than a stale memo entry.
+ */
+int
+verify_purity(const Program *program, size_t id)
+{
+    size_t *worklist = safe_malloc(program->functions_count * sizeof(size_t));
+    uint8_t *seen = safe_malloc(program->functions_count);
+    size_t top = 0, i, callee;
+    int pure = 1;
+
+    memset(seen, 0, program->functions_count);
+    seen[id] = 1;
+    worklist[top++] = id;
+    while (top > 0 && pure) {
+        const Function *function = program->functions + worklist[--top];
+        pure = is_locally_pure(function, program->functions_count);
+        for (i = 0; pure && i < function->instructions_count; i++) {
+            callee = function->instructions[i].data.reg;
+            if (function->instructions[i].op == OP_CALL && !seen[callee]) {
+                seen[callee] = 1;
+                worklist[top++] = callee;
+            }
+        }
+    }
+    free(worklist);
+    free(seen);
+    return pure;
+}
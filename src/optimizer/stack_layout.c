@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+typedef enum
+{
+    LAYOUT_OK,
+    LAYOUT_INCOMPLETE,
+    LAYOUT_FAILED,
+} LayoutStatus;
+
+/*
+ * Returns 0 for unknown instructions and native calls, whose arity is only
+ * known to the VM. Calls are resolved by the caller.
+ */
+static int
+stack_effect(const Instruction *instruction, StackDepth *pops, StackDepth *pushes)
+{
+    const OpcodeInfo *info;
+
+    if (instruction->op >= OPCODES_COUNT || instruction->op == OP_CALL_NATIVE)
+        return 0;
+    info = opcodes + instruction->op;
+    pops->operands = info->operand_pops;
+    pops->pointers = info->pointer_pops;
+    pushes->operands = info->operand_pushes;
+    pushes->pointers = info->pointer_pushes;
+    return 1;
+}
+
+static int
+same_depth(StackDepth a, StackDepth b)
+{
+    return a.operands == b.operands && a.pointers == b.pointers;
+}
+
+/*
+ * Paths through a call to a function whose results are still unknown are
+ * left unexplored and reported as incomplete.
+ */
+static LayoutStatus
+analyze_function(const Program *program, size_t id, StackLayout *layout)
+{
+    const Function *function = program->functions + id;
+    StackDepth *depths = layout->depths[id], *max_depth = layout->max_depths + id;
+    StackDepth *returns = layout->returns;
+    size_t i, top = 0, count = function->instructions_count;
+    size_t *worklist;
+    LayoutStatus status = LAYOUT_OK;
+
+    if (count == 0)
+        return LAYOUT_FAILED;
+    for (i = 0; i < count; i++)
+        depths[i].operands = depths[i].pointers = STACK_DEPTH_UNKNOWN;
+    worklist = safe_malloc(count * sizeof(size_t));
+    depths[0].operands = depths[0].pointers = 0;
+    max_depth->operands = max_depth->pointers = 0;
+    worklist[top++] = 0;
+
+    while (top > 0 && status != LAYOUT_FAILED) {
+        const Instruction *instruction;
+        const Function *callee;
+        StackDepth depth, pops, pushes;
+        size_t successors[2], successors_count = 0;
+
+        i = worklist[--top];
+        instruction = function->instructions + i;
+        depth = depths[i];
+        if (!stack_effect(instruction, &pops, &pushes)
+            || depth.operands < pops.operands
+            || depth.pointers < pops.pointers) {
+            status = LAYOUT_FAILED;
+            break;
+        }
+        depth.operands += pushes.operands - pops.operands;
+        depth.pointers += pushes.pointers - pops.pointers;
+        switch (instruction->op) {
+            case OP_CALL:
+                if (instruction->data.reg >= program->functions_count) {
+                    status = LAYOUT_FAILED;
+                    continue;
+                }
+                callee = program->functions + instruction->data.reg;
+                if (depth.operands < callee->args_count || depth.pointers < callee->ptr_args_count) {
+                    status = LAYOUT_FAILED;
+                    continue;
+                }
+                if (returns[instruction->data.reg].operands == STACK_DEPTH_UNKNOWN) {
+                    status = LAYOUT_INCOMPLETE;
+                    continue;
+                }
+                depth.operands += returns[instruction->data.reg].operands - callee->args_count;
+                depth.pointers += returns[instruction->data.reg].pointers - callee->ptr_args_count;
+                successors[successors_count++] = i + 1;
+                break;
+            case OP_RETURN:
+                if (depth.operands > 1
+                    || depth.pointers > 1
+                    || (returns[id].operands != STACK_DEPTH_UNKNOWN && !same_depth(returns[id], depth)))
+                    status = LAYOUT_FAILED;
+                returns[id] = depth;
+                continue;
+            case OP_EXIT:
+                continue;
+            case OP_JUMP:
+                successors[successors_count++] = instruction->data.reg;
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_DEC_JUMP_IF_NOT_ZERO:
+            case OP_INC_JUMP_IF_LESS_THAN:
+                successors[successors_count++] = jump_target(instruction);
+                successors[successors_count++] = i + 1;
+                break;
+            default:
+                successors[successors_count++] = i + 1;
+                break;
+        }
+        if (depth.operands > max_depth->operands)
+            max_depth->operands = depth.operands;
+        if (depth.pointers > max_depth->pointers)
+            max_depth->pointers = depth.pointers;
+        while (successors_count > 0) {
+            size_t next = successors[--successors_count];
+            if (next >= count
+                || (depths[next].operands != STACK_DEPTH_UNKNOWN && !same_depth(depths[next], depth))) {
+                status = LAYOUT_FAILED;
+            } else if (depths[next].operands == STACK_DEPTH_UNKNOWN) {
+                depths[next] = depth;
+                worklist[top++] = next;
+            }
+        }
+    }
+    free(worklist);
+    return status;
+}
+
+void
+free_stack_layout(StackLayout layout)
+{
+    size_t i;
+    for (i = 0; i < layout.functions_count; i++)
+        free(layout.depths[i]);
+    free(layout.depths);
+    free(layout.max_depths);
+    free(layout.returns);
+}
+
+/*
+ * Returns 1 when every function has the same stack depths on every path
+ * into each instruction and returns at most one value of each kind.
+ * Result counts are found by iterating until no function learns anything
+ * new, so recursive functions resolve once their base case has been seen;
+ * a function that never returns is treated as returning nothing.
+ */
+int
+compute_stack_layout(const Program *program, StackLayout *layout)
+{
+    size_t i, count = program->functions_count;
+    LayoutStatus status = LAYOUT_OK;
+    StackDepth previous;
+    int changed;
+
+    layout->functions_count = count;
+    layout->depths = safe_malloc(count * sizeof(StackDepth *));
+    layout->max_depths = safe_malloc(count * sizeof(StackDepth));
+    layout->returns = safe_malloc(count * sizeof(StackDepth));
+    for (i = 0; i < count; i++) {
+        layout->depths[i] = safe_malloc((program->functions[i].instructions_count + 1) * sizeof(StackDepth));
+        layout->returns[i].operands = layout->returns[i].pointers = STACK_DEPTH_UNKNOWN;
+    }
+
+    do {
+        changed = 0;
+        for (i = 0; i < count && status != LAYOUT_FAILED; i++) {
+            previous = layout->returns[i];
+            status = analyze_function(program, i, layout);
+            if (status == LAYOUT_OK && layout->returns[i].operands == STACK_DEPTH_UNKNOWN)
+                layout->returns[i].operands = layout->returns[i].pointers = 0;
+            changed |= !same_depth(layout->returns[i], previous);
+        }
+    } while (changed && status != LAYOUT_FAILED);
+
+    // one last pass with every result count known
+    for (i = 0; i < count && status != LAYOUT_FAILED; i++) {
+        if (analyze_function(program, i, layout) != LAYOUT_OK)
+            status = LAYOUT_FAILED;
+    }
+    if (count == 0 || status == LAYOUT_FAILED) {
+        free_stack_layout(*layout);
+        memset(layout, 0, sizeof(StackLayout));
+        return 0;
+    }
+    return 1;
+}
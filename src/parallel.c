@@ -0,0 +1,311 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "assembler/assembler.h"
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+/* Blocks [next, end) of the current job that a worker has yet to run. */
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t next;
+    size_t end;
+} BlockRange;
+
+typedef struct
+{
+    struct WorkerPool *pool;
+    size_t index;
+    pthread_t thread; // unused by worker 0, the calling thread
+    VM vm;
+    BlockRange range;
+} Worker;
+
+struct WorkerPool
+{
+    Worker *workers;
+    size_t count;
+    pthread_mutex_t lock; // guards everything below
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation; // bumped by every job
+    size_t running;      // threads still working on the current job
+    int stopping;
+    const Program *program;
+    size_t function;
+    uint64_t *data;
+    size_t length;
+    uint64_t *partials; // a fold of each block when reducing, NULL when mapping
+    const Program *verified_program;
+    size_t verified_count;
+    uint8_t *verified; // per function of verified_program
+};
+
+static int
+take_block(BlockRange *range, size_t *block)
+{
+    int taken;
+
+    pthread_mutex_lock(&range->lock);
+    taken = range->next < range->end;
+    if (taken)
+        *block = range->next++;
+    pthread_mutex_unlock(&range->lock);
+    return taken;
+}
+
+/*
+ * Takes the back half of the first other worker's range that has blocks
+ * left, running the first of them now and keeping the rest as its own.
+ */
+static int
+steal_blocks(Worker *worker, size_t *block)
+{
+    WorkerPool *pool = worker->pool;
+    BlockRange *victim;
+    size_t i, start, end;
+
+    for (i = 1; i < pool->count; i++) {
+        victim = &pool->workers[(worker->index + i) % pool->count].range;
+        pthread_mutex_lock(&victim->lock);
+        end = victim->end;
+        start = victim->next + (victim->end - victim->next) / 2;
+        if (start < end)
+            victim->end = start;
+        pthread_mutex_unlock(&victim->lock);
+        if (start < end) {
+            pthread_mutex_lock(&worker->range.lock);
+            worker->range.next = start + 1;
+            worker->range.end = end;
+            pthread_mutex_unlock(&worker->range.lock);
+            *block = start;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+run_block(Worker *worker, size_t block)
+{
+    WorkerPool *pool = worker->pool;
+    size_t i, first = block * PARALLEL_BLOCK;
+    size_t last = first + PARALLEL_BLOCK < pool->length ? first + PARALLEL_BLOCK : pool->length;
+    uint64_t args[2];
+
+    if (pool->partials == NULL) {
+        for (i = first; i < last; i++)
+            pool->data[i] = invoke_i64_function(&worker->vm, pool->program, pool->function, pool->data + i);
+        return;
+    }
+    args[0] = pool->data[first];
+    for (i = first + 1; i < last; i++) {
+        args[1] = pool->data[i];
+        args[0] = invoke_i64_function(&worker->vm, pool->program, pool->function, args);
+    }
+    pool->partials[block] = args[0];
+}
+
+static void
+run_blocks(Worker *worker)
+{
+    size_t block;
+
+    while (take_block(&worker->range, &block) || steal_blocks(worker, &block))
+        run_block(worker, block);
+}
+
+static void *
+worker_main(void *argument)
+{
+    Worker *worker = argument;
+    WorkerPool *pool = worker->pool;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->generation == generation && !pool->stopping)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping)
+            break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        run_blocks(worker);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* `threads` counts the calling thread; 0 means one per online core. */
+WorkerPool *
+init_worker_pool(const VM *vm, size_t threads)
+{
+    WorkerPool *pool = safe_malloc(sizeof(WorkerPool));
+    long cores;
+    size_t i;
+
+    if (threads == 0) {
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (size_t) cores : 1;
+    }
+    memset(pool, 0, sizeof(WorkerPool));
+    pool->count = threads;
+    pool->workers = safe_malloc(threads * sizeof(Worker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i < threads; i++) {
+        Worker *worker = pool->workers + i;
+        worker->pool = pool;
+        worker->index = i;
+        worker->vm = init_vm();
+        worker->vm.checked = vm->checked;
+        worker->vm.memory = vm->memory;
+        worker->vm.memo_capacity = vm->memo_capacity;
+        worker->range.next = worker->range.end = 0;
+        pthread_mutex_init(&worker->range.lock, NULL);
+        if (i > 0 && pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Failed to start worker thread %zu\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+void
+free_worker_pool(WorkerPool *pool)
+{
+    size_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->count; i++) {
+        if (i > 0)
+            pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].range.lock);
+        free_vm(pool->workers[i].vm);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->verified);
+    free(pool);
+}
+
+/*
+ * Workers may only run code with no effects beyond its result, so the
+ * function and everything it calls must be proven pure here; `pure: 1`
+ * marks are not trusted. Lazily assembled bodies are filled in first, as
+ * the workers must not do it themselves. Returns 0 for a function that
+ * is not pure or does not take `args_count` arguments.
+ */
+int
+check_parallel_function(WorkerPool *pool, const Program *program, size_t function, size_t args_count)
+{
+    size_t *worklist, top = 0, i, id;
+    uint8_t *seen;
+
+    if (pool->verified_program != program || pool->verified_count != program->functions_count) {
+        free(pool->verified);
+        pool->verified = safe_malloc(program->functions_count);
+        memset(pool->verified, 0, program->functions_count);
+        pool->verified_program = program;
+        pool->verified_count = program->functions_count;
+    }
+    if (pool->verified[function])
+        return program->functions[function].args_count == args_count;
+
+    worklist = safe_malloc(program->functions_count * sizeof(size_t));
+    seen = safe_malloc(program->functions_count);
+    memset(seen, 0, program->functions_count);
+    seen[function] = 1;
+    worklist[top++] = function;
+    while (top > 0) {
+        const Function *callee = program->functions + worklist[--top];
+        if (callee->body != NULL)
+            assemble_body((Function *) callee);
+        for (i = 0; i < callee->instructions_count; i++) {
+            id = callee->instructions[i].data.reg;
+            if (callee->instructions[i].op == OP_CALL && id < program->functions_count && !seen[id]) {
+                seen[id] = 1;
+                worklist[top++] = id;
+            }
+        }
+    }
+    free(worklist);
+    free(seen);
+    pool->verified[function] = verify_purity(program, function);
+    return pool->verified[function] && program->functions[function].args_count == args_count;
+}
+
+/* Splits the blocks evenly, wakes the workers and runs worker 0's share on this thread. */
+static void
+run_job(WorkerPool *pool)
+{
+    size_t i, blocks = (pool->length + PARALLEL_BLOCK - 1) / PARALLEL_BLOCK;
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < pool->count; i++) {
+        pool->workers[i].range.next = blocks * i / pool->count;
+        pool->workers[i].range.end = blocks * (i + 1) / pool->count;
+    }
+    pool->running = pool->count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    run_blocks(pool->workers);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Replaces every element x of `data` with function(x). */
+void
+parallel_map(WorkerPool *pool, const Program *program, size_t function, uint64_t *data, size_t length)
+{
+    pool->program = program;
+    pool->function = function;
+    pool->data = data;
+    pool->length = length;
+    pool->partials = NULL;
+    run_job(pool);
+}
+
+/*
+ * Folds `data` into `initial` with function(accumulator, x). Blocks are
+ * folded separately and their results folded in order, so this matches a
+ * sequential fold whenever the function is associative.
+ */
+uint64_t
+parallel_reduce(WorkerPool *pool, const Program *program, size_t function, uint64_t initial, uint64_t *data,
+                size_t length)
+{
+    size_t i, blocks = (length + PARALLEL_BLOCK - 1) / PARALLEL_BLOCK;
+    uint64_t args[2];
+
+    pool->program = program;
+    pool->function = function;
+    pool->data = data;
+    pool->length = length;
+    pool->partials = safe_malloc(blocks * sizeof(uint64_t));
+    run_job(pool);
+    args[0] = initial;
+    for (i = 0; i < blocks; i++) {
+        args[1] = pool->partials[i];
+        args[0] = invoke_i64_function(&pool->workers[0].vm, program, function, args);
+    }
+    free(pool->partials);
+    pool->partials = NULL;
+    return args[0];
+}
@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+#define PROFILE_VERSION 1
+
+Profile
+init_profile(const Program *program)
+{
+    Profile profile;
+    size_t i, size;
+
+    profile.functions_count = program->functions_count;
+    profile.functions = safe_malloc(program->functions_count * sizeof(FunctionProfile));
+    profile.fingerprint = program_fingerprint(program);
+    for (i = 0; i < program->functions_count; i++) {
+        FunctionProfile *function = profile.functions + i;
+        function->calls = 0;
+        function->instructions_count = program->functions[i].instructions_count;
+        size = (function->instructions_count + 1) * sizeof(uint64_t);
+        function->taken = safe_malloc(size);
+        function->not_taken = safe_malloc(size);
+        memset(function->taken, 0, size);
+        memset(function->not_taken, 0, size);
+    }
+    return profile;
+}
+
+void
+free_profile(Profile profile)
+{
+    size_t i;
+    for (i = 0; i < profile.functions_count; i++) {
+        free(profile.functions[i].taken);
+        free(profile.functions[i].not_taken);
+    }
+    free(profile.functions);
+}
+
+/*
+ * The file is plain text: a header line, one line per function that ran
+ * and one per instruction with a non-zero counter.
+ *
+ *     hal64-profile <version> <fingerprint>
+ *     function <id> <calls>
+ *     edge <function> <instruction> <taken> <not taken>
+ */
+int
+save_profile(const Profile *profile, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    size_t i, j;
+    int ok;
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    fprintf(file, "hal64-profile %d %016llx\n", PROFILE_VERSION, (unsigned long long) profile->fingerprint);
+    for (i = 0; i < profile->functions_count; i++) {
+        const FunctionProfile *function = profile->functions + i;
+        if (function->calls == 0)
+            continue;
+        fprintf(file, "function %zu %llu\n", i, (unsigned long long) function->calls);
+        for (j = 0; j < function->instructions_count; j++) {
+            if (function->taken[j] == 0 && function->not_taken[j] == 0)
+                continue;
+            fprintf(file, "edge %zu %zu %llu %llu\n", i, j,
+                    (unsigned long long) function->taken[j], (unsigned long long) function->not_taken[j]);
+        }
+    }
+    ok = !ferror(file);
+    ok &= fclose(file) == 0;
+    if (!ok)
+        fprintf(stderr, "Failed to write %s\n", path);
+    return ok;
+}
+
+/*
+ * Reads a profile recorded on `program`, compiled the same way. Returns 0,
+ * after reporting why on stderr, when the file is malformed or belongs to
+ * another program.
+ */
+int
+load_profile(Profile *profile, const Program *program, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    unsigned long long fingerprint, calls, taken, not_taken;
+    size_t function, instruction;
+    char kind[16];
+    int version, ok = 1;
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (fscanf(file, "hal64-profile %d %llx", &version, &fingerprint) != 2 || version != PROFILE_VERSION) {
+        fprintf(stderr, "%s is not a HAL64 profile\n", path);
+        fclose(file);
+        return 0;
+    }
+    if (fingerprint != program_fingerprint(program)) {
+        fprintf(stderr, "%s was recorded on a different program\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    *profile = init_profile(program);
+    while (ok && fscanf(file, "%15s", kind) == 1) {
+        if (strcmp(kind, "function") == 0) {
+            ok = fscanf(file, "%zu %llu", &function, &calls) == 2 && function < profile->functions_count;
+            if (ok)
+                profile->functions[function].calls = calls;
+        } else if (strcmp(kind, "edge") == 0) {
+            ok = fscanf(file, "%zu %zu %llu %llu", &function, &instruction, &taken, &not_taken) == 4
+                 && function < profile->functions_count
+                 && instruction < profile->functions[function].instructions_count;
+            if (ok) {
+                profile->functions[function].taken[instruction] = taken;
+                profile->functions[function].not_taken[instruction] = not_taken;
+            }
+        } else {
+            ok = 0;
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "%s is malformed\n", path);
+        free_profile(*profile);
+        memset(profile, 0, sizeof(Profile));
+    }
+    return ok;
+}
+
+static int
+is_conditional(InstructionOp op)
+{
+    return op == OP_JUMP_IF_FALSE
+        || op == OP_JUMP_IF_TRUE
+        || op == OP_DEC_JUMP_IF_NOT_ZERO
+        || op == OP_INC_JUMP_IF_LESS_THAN;
+}
+
+/*
+ * The execution count of every instruction: jumps into it plus straight
+ * line flow from the instruction before. Fall-through only runs forward,
+ * so one pass in order sees every predecessor before it is needed.
+ */
+uint64_t *
+execution_counts(const Function *function, const FunctionProfile *profile)
+{
+    size_t i, count = function->instructions_count;
+    uint64_t *counts = safe_malloc((count + 1) * sizeof(uint64_t));
+    size_t target;
+
+    memset(counts, 0, (count + 1) * sizeof(uint64_t));
+    for (i = 0; i < count; i++) {
+        target = jump_target(function->instructions + i);
+        if (target < count)
+            counts[target] += profile->taken[i];
+    }
+    counts[0] += profile->calls;
+    for (i = 0; i < count; i++) {
+        InstructionOp op = function->instructions[i].op;
+        if (is_conditional(op))
+            counts[i + 1] += profile->not_taken[i];
+        else if (op != OP_JUMP && op != OP_RETURN && op != OP_EXIT)
+            counts[i + 1] += counts[i];
+    }
+    return counts;
+}
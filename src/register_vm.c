@@ -0,0 +1,682 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "register_vm.h"
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+#define FRAME_LINK_SIZE 4
+
+typedef enum
+{
+    OPERAND_REGISTER,
+    OPERAND_LOCAL,
+    OPERAND_CONSTANT,
+} OperandKind;
+
+/* A stack slot whose value may still live in a local or be a constant. */
+typedef struct
+{
+    OperandKind kind;
+    uint32_t reg;
+    uint64_t value;
+} Operand;
+
+typedef struct
+{
+    RegisterFunction *function;
+    size_t capacity;
+    Operand *stack;
+    size_t depth;
+    size_t slots;
+    size_t last_result; // the last emitted instruction when it computed the top of the stack
+} Translator;
+
+static size_t
+emit(Translator *t, RegisterOp op, size_t dst, size_t a, size_t b, uint64_t immediate)
+{
+    RegisterFunction *function = t->function;
+    RegisterInstruction *instruction;
+
+    if (function->instructions_count == t->capacity) {
+        t->capacity = t->capacity == 0 ? 16 : t->capacity * 2;
+        function->instructions = safe_realloc(function->instructions, t->capacity * sizeof(RegisterInstruction));
+    }
+    instruction = function->instructions + function->instructions_count;
+    instruction->op = op;
+    instruction->dst = dst;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->immediate = immediate;
+    t->last_result = SIZE_MAX;
+    return function->instructions_count++;
+}
+
+static size_t
+slot(const Translator *t, size_t index)
+{
+    return t->slots + index;
+}
+
+static void
+push_operand(Translator *t, OperandKind kind, size_t reg, uint64_t value)
+{
+    t->stack[t->depth].kind = kind;
+    t->stack[t->depth].reg = reg;
+    t->stack[t->depth].value = value;
+    t->depth++;
+}
+
+static void
+push_result(Translator *t, size_t instruction)
+{
+    push_operand(t, OPERAND_REGISTER, slot(t, t->depth), 0);
+    t->last_result = instruction;
+}
+
+/* The register holding stack slot `index`, loading a constant into it if needed. */
+static size_t
+operand_register(Translator *t, size_t index)
+{
+    Operand *operand = t->stack + index;
+    if (operand->kind == OPERAND_CONSTANT) {
+        emit(t, REG_LOAD_IMMEDIATE, slot(t, index), 0, 0, operand->value);
+        operand->kind = OPERAND_REGISTER;
+        operand->reg = slot(t, index);
+    }
+    return operand->reg;
+}
+
+/* Moves every slot from `from` up into its own register, as jumps and calls expect. */
+static void
+flush_stack(Translator *t, size_t from)
+{
+    size_t i;
+    for (i = from; i < t->depth; i++) {
+        Operand *operand = t->stack + i;
+        if (operand->kind == OPERAND_LOCAL)
+            emit(t, REG_MOVE, slot(t, i), operand->reg, 0, 0);
+        else if (operand->kind == OPERAND_CONSTANT)
+            emit(t, REG_LOAD_IMMEDIATE, slot(t, i), 0, 0, operand->value);
+        operand->kind = OPERAND_REGISTER;
+        operand->reg = slot(t, i);
+    }
+}
+
+/* Slots that still read a local must be copied out before the local is overwritten. */
+static void
+spill_local(Translator *t, size_t reg)
+{
+    size_t i;
+    for (i = 0; i < t->depth; i++) {
+        if (t->stack[i].kind == OPERAND_LOCAL && t->stack[i].reg == reg) {
+            emit(t, REG_MOVE, slot(t, i), reg, 0, 0);
+            t->stack[i].kind = OPERAND_REGISTER;
+            t->stack[i].reg = slot(t, i);
+        }
+    }
+}
+
+static RegisterOp
+register_op(InstructionOp op, int immediate)
+{
+    switch (op) {
+        case OP_ADD_I64:
+        case OP_ADD_I64_RI:
+            return immediate ? REG_ADD_IMMEDIATE : REG_ADD;
+        case OP_SUB_I64:
+        case OP_SUB_I64_RI:
+            return immediate ? REG_SUB_IMMEDIATE : REG_SUB;
+        case OP_MUL_I64:
+        case OP_MUL_I64_RI:
+            return immediate ? REG_MUL_IMMEDIATE : REG_MUL;
+        case OP_DIV_I64:
+        case OP_DIV_I64_RI:
+            return immediate ? REG_DIV_IMMEDIATE : REG_DIV;
+        case OP_MOD_I64:
+        case OP_MOD_I64_RI:
+            return immediate ? REG_MOD_IMMEDIATE : REG_MOD;
+        case OP_LESS_THAN_I64:
+        case OP_LESS_THAN_I64_RI:
+            return immediate ? REG_LESS_THAN_IMMEDIATE : REG_LESS_THAN;
+        case OP_GREATER_THAN_I64:
+        case OP_GREATER_THAN_I64_RI:
+            return immediate ? REG_GREATER_THAN_IMMEDIATE : REG_GREATER_THAN;
+        case OP_EQUALS_I64:
+        case OP_EQUALS_I64_RI:
+            return immediate ? REG_EQUALS_IMMEDIATE : REG_EQUALS;
+        default:
+            return immediate ? REG_NOT_EQUALS_IMMEDIATE : REG_NOT_EQUALS;
+    }
+}
+
+/* A zero divisor is left to a register, where the division checks for it at run time. */
+static int
+divides_by_zero(InstructionOp op, uint64_t divisor)
+{
+    return divisor == 0
+        && (op == OP_DIV_I64 || op == OP_DIV_I64_RI || op == OP_MOD_I64 || op == OP_MOD_I64_RI);
+}
+
+/* The last emitted instruction, if it computed the given stack slot and nothing came after it. */
+static RegisterInstruction *
+last_result(Translator *t, const Operand *operand)
+{
+    RegisterInstruction *last;
+
+    if (operand->kind != OPERAND_REGISTER || t->last_result == SIZE_MAX)
+        return NULL;
+    last = t->function->instructions + t->last_result;
+    return last->dst == operand->reg ? last : NULL;
+}
+
+static void
+translate_store_local(Translator *t, size_t reg)
+{
+    Operand value;
+    RegisterInstruction *last;
+
+    spill_local(t, reg);
+    value = t->stack[--t->depth];
+    last = last_result(t, &value);
+    if (last != NULL) {
+        // compute straight into the local instead of going through the stack slot
+        last->dst = reg;
+        t->last_result = SIZE_MAX;
+    } else if (value.kind == OPERAND_CONSTANT) {
+        emit(t, REG_LOAD_IMMEDIATE, reg, 0, 0, value.value);
+    } else if (value.reg != reg) {
+        emit(t, REG_MOVE, reg, value.reg, 0, 0);
+    }
+}
+
+static void
+translate_conditional_jump(Translator *t, size_t target, int if_true)
+{
+    size_t condition = t->depth - 1;
+    RegisterInstruction *last = last_result(t, t->stack + condition);
+
+    if (last != NULL && last->op == REG_NOT) {
+        // `Not; JumpIfFalse` branches on the original value
+        size_t source = last->a;
+        t->function->instructions_count--;
+        t->depth--;
+        flush_stack(t, 0);
+        emit(t, if_true ? REG_JUMP_IF_FALSE : REG_JUMP_IF_TRUE, 0, source, target, 0);
+        return;
+    }
+    condition = operand_register(t, condition);
+    t->depth--;
+    flush_stack(t, 0);
+    emit(t, if_true ? REG_JUMP_IF_TRUE : REG_JUMP_IF_FALSE, 0, condition, target, 0);
+}
+
+static void
+translate_binary(Translator *t, InstructionOp op)
+{
+    size_t index = t->depth - 2, a, b, instruction;
+
+    a = operand_register(t, index);
+    if (t->stack[index + 1].kind == OPERAND_CONSTANT && !divides_by_zero(op, t->stack[index + 1].value)) {
+        instruction = emit(t, register_op(op, 1), slot(t, index), a, 0, t->stack[index + 1].value);
+    } else {
+        b = operand_register(t, index + 1);
+        instruction = emit(t, register_op(op, 0), slot(t, index), a, b, 0);
+    }
+    t->depth = index;
+    push_result(t, instruction);
+}
+
+/* Whether the locals, globals and functions `instruction` names exist. */
+static int
+operands_in_range(const Translator *t, const Program *program, const Instruction *instruction)
+{
+    switch (opcodes[instruction->op].operands) {
+        case OPERANDS_LOCAL:
+            return instruction->data.reg < t->slots;
+        case OPERANDS_GLOBAL:
+            return instruction->data.reg < program->globals_count;
+        case OPERANDS_LOCAL_IMMEDIATE:
+            return instruction->data.ri.reg < t->slots;
+        case OPERANDS_LOCAL_TARGET:
+        case OPERANDS_LOCAL_LIMIT_TARGET:
+            return instruction->data.loop.reg < t->slots;
+        case OPERANDS_FUNCTION:
+            return instruction->data.reg < program->functions_count;
+        default:
+            return 1;
+    }
+}
+
+/*
+ * Returns 0 on success. Branch targets are left as stack instruction
+ * indices and remapped once the whole function has been translated.
+ * Operands out of range are declined here, so the register loop never
+ * checks them; the stack VM then reports them.
+ */
+static int
+translate_instruction(Translator *t, const Program *program, const StackDepth *returns,
+                      const Instruction *instruction, int *live)
+{
+    size_t index, reg;
+
+    if (!operands_in_range(t, program, instruction))
+        return 1;
+    switch (instruction->op) {
+        case OP_NOOP:
+            break;
+        case OP_PUSH_I64:
+            push_operand(t, OPERAND_CONSTANT, 0, instruction->data.immediate);
+            break;
+        case OP_LOAD_LOCAL_I64:
+            push_operand(t, OPERAND_LOCAL, instruction->data.reg, 0);
+            break;
+        case OP_STORE_LOCAL_I64:
+            translate_store_local(t, instruction->data.reg);
+            break;
+        case OP_LOAD_GLOBAL_I64:
+            push_result(t, emit(t, REG_LOAD_GLOBAL, slot(t, t->depth), 0, instruction->data.reg, 0));
+            break;
+        case OP_STORE_GLOBAL_I64:
+            reg = operand_register(t, t->depth - 1);
+            t->depth--;
+            emit(t, REG_STORE_GLOBAL, 0, reg, instruction->data.reg, 0);
+            break;
+        case OP_LESS_THAN_I64_RI:
+        case OP_GREATER_THAN_I64_RI:
+        case OP_EQUALS_I64_RI:
+        case OP_ADD_I64_RI:
+        case OP_SUB_I64_RI:
+        case OP_MUL_I64_RI:
+        case OP_DIV_I64_RI:
+        case OP_MOD_I64_RI:
+            if (divides_by_zero(instruction->op, instruction->data.ri.immediate)) {
+                emit(t, REG_LOAD_IMMEDIATE, slot(t, t->depth), 0, 0, 0);
+                push_result(t, emit(t, register_op(instruction->op, 0), slot(t, t->depth),
+                                    instruction->data.ri.reg, slot(t, t->depth), 0));
+                break;
+            }
+            push_result(t, emit(t, register_op(instruction->op, 1), slot(t, t->depth),
+                                instruction->data.ri.reg, 0, instruction->data.ri.immediate));
+            break;
+        case OP_ADD_I64:
+        case OP_SUB_I64:
+        case OP_MUL_I64:
+        case OP_DIV_I64:
+        case OP_MOD_I64:
+        case OP_LESS_THAN_I64:
+        case OP_GREATER_THAN_I64:
+        case OP_EQUALS_I64:
+        case OP_NOT_EQUALS_I64:
+            translate_binary(t, instruction->op);
+            break;
+        case OP_NOT:
+            index = t->depth - 1;
+            reg = operand_register(t, index);
+            t->depth = index;
+            push_result(t, emit(t, REG_NOT, slot(t, index), reg, 0, 0));
+            break;
+        case OP_JUMP_IF_FALSE:
+            translate_conditional_jump(t, instruction->data.reg, 0);
+            break;
+        case OP_JUMP_IF_TRUE:
+            translate_conditional_jump(t, instruction->data.reg, 1);
+            break;
+        case OP_JUMP:
+            flush_stack(t, 0);
+            emit(t, REG_JUMP, 0, 0, instruction->data.reg, 0);
+            *live = 0;
+            break;
+        case OP_DEC_JUMP_IF_NOT_ZERO:
+            flush_stack(t, 0);
+            emit(t, REG_DEC_JUMP_IF_NOT_ZERO, 0, instruction->data.loop.reg, instruction->data.loop.target, 0);
+            break;
+        case OP_INC_JUMP_IF_LESS_THAN:
+            flush_stack(t, 0);
+            emit(t, REG_INC_JUMP_IF_LESS_THAN, 0, instruction->data.loop.reg, instruction->data.loop.target,
+                 instruction->data.loop.limit);
+            break;
+        case OP_CALL:
+            // locals survive the call, so only the arguments need their own registers
+            index = t->depth - program->functions[instruction->data.reg].args_count;
+            flush_stack(t, index);
+            emit(t, REG_CALL, 0, slot(t, index), instruction->data.reg, 0);
+            t->depth = index;
+            if (returns[instruction->data.reg].operands > 0)
+                push_operand(t, OPERAND_REGISTER, slot(t, index), 0);
+            break;
+        case OP_RETURN:
+            if (t->depth == 1)
+                emit(t, REG_RETURN, 0, operand_register(t, 0), 0, 0);
+            else
+                emit(t, REG_RETURN_VOID, 0, 0, 0, 0);
+            *live = 0;
+            break;
+        case OP_PRINT_TOP_STACK_I64:
+            reg = operand_register(t, t->depth - 1);
+            t->depth--;
+            emit(t, REG_PRINT, 0, reg, 0, 0);
+            break;
+        case OP_EXIT:
+            flush_stack(t, 0);
+            emit(t, REG_EXIT, t->depth, slot(t, 0), 0, 0);
+            *live = 0;
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+static int
+is_register_jump(RegisterOp op)
+{
+    return op == REG_JUMP
+        || op == REG_JUMP_IF_FALSE
+        || op == REG_JUMP_IF_TRUE
+        || op == REG_DEC_JUMP_IF_NOT_ZERO
+        || op == REG_INC_JUMP_IF_LESS_THAN;
+}
+
+/*
+ * Operand stack slot n lives in register `slots + n`, after the locals.
+ * Within a basic block, loads of locals and constants are only recorded
+ * and get folded into the instruction that consumes them; at block
+ * boundaries every slot is back in its own register.
+ */
+static int
+translate_function(const Program *program, size_t id, const StackLayout *layout, RegisterFunction *result)
+{
+    const Function *function = program->functions + id;
+    const StackDepth *depths = layout->depths[id];
+    size_t max_depth = layout->max_depths[id].operands;
+    size_t i, target, count = function->instructions_count;
+    uint8_t *targets = safe_malloc(count + 1);
+    size_t *new_index = safe_malloc((count + 1) * sizeof(size_t));
+    Translator t;
+    int live = 1, failed = 0;
+
+    memset(result, 0, sizeof(RegisterFunction));
+    memset(targets, 0, count + 1);
+    for (i = 0; i < count; i++) {
+        target = jump_target(function->instructions + i);
+        if (target <= count)
+            targets[target] = 1;
+    }
+
+    memset(&t, 0, sizeof(Translator));
+    t.function = result;
+    t.slots = function->locals_count > function->args_count ? function->locals_count : function->args_count;
+    t.stack = safe_malloc((max_depth + 1) * sizeof(Operand));
+    t.last_result = SIZE_MAX;
+    result->args_count = function->args_count;
+    result->registers_count = t.slots + max_depth;
+    result->returns_value = layout->returns[id].operands > 0;
+
+    for (i = 0; i < count && !failed; i++) {
+        new_index[i] = result->instructions_count;
+        if (depths[i].operands == STACK_DEPTH_UNKNOWN)
+            continue;
+        if (targets[i] || !live) {
+            if (live)
+                flush_stack(&t, 0);
+            for (t.depth = 0; t.depth < depths[i].operands;)
+                push_operand(&t, OPERAND_REGISTER, slot(&t, t.depth), 0);
+            t.last_result = SIZE_MAX;
+            live = 1;
+            new_index[i] = result->instructions_count;
+        }
+        failed = translate_instruction(&t, program, layout->returns, function->instructions + i, &live);
+    }
+    new_index[count] = result->instructions_count;
+
+    for (i = 0; i < result->instructions_count; i++) {
+        if (is_register_jump(result->instructions[i].op))
+            result->instructions[i].b = new_index[result->instructions[i].b];
+    }
+    if (result->registers_count > UINT32_MAX)
+        failed = 1;
+
+    free(t.stack);
+    free(new_index);
+    free(targets);
+    return failed;
+}
+
+void
+free_register_program(RegisterProgram program)
+{
+    size_t i;
+    for (i = 0; i < program.functions_count; i++)
+        free(program.functions[i].instructions);
+    free(program.functions);
+}
+
+/*
+ * Returns 1 when every function was translated. Programs touching the heap,
+ * using pointer registers or naming locals, globals or functions that do
+ * not exist are left to the stack VM.
+ */
+int
+translate_program(const Program *program, RegisterProgram *result)
+{
+    StackLayout layout;
+    size_t i;
+    int failed = 0;
+
+    memset(result, 0, sizeof(RegisterProgram));
+    if (!compute_stack_layout(program, &layout))
+        return 0;
+    result->source = program;
+    result->functions_count = program->functions_count;
+    result->functions = safe_malloc(program->functions_count * sizeof(RegisterFunction));
+    memset(result->functions, 0, program->functions_count * sizeof(RegisterFunction));
+    for (i = 0; i < program->functions_count && !failed; i++) {
+        const Function *function = program->functions + i;
+        failed = function->ptr_args_count > 0
+            || function->local_pointers_count > 0
+            || layout.max_depths[i].pointers > 0
+            || translate_function(program, i, &layout, result->functions + i);
+    }
+
+    free_stack_layout(layout);
+    if (failed) {
+        free_register_program(*result);
+        memset(result, 0, sizeof(RegisterProgram));
+        return 0;
+    }
+    return 1;
+}
+
+static void
+reserve_registers(VM *vm, size_t size)
+{
+    if (size <= vm->call_stack.capacity)
+        return;
+    while (vm->call_stack.capacity < size)
+        vm->call_stack.capacity *= 2;
+    vm->call_stack.data = safe_realloc(vm->call_stack.data, vm->call_stack.capacity * sizeof(uint64_t));
+}
+
+static void
+division_by_zero(InstructionOp op)
+{
+    fprintf(stderr, "%s: division by zero\n", opcodes[op].name);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Frames live in the call stack: the caller's registers, then a link of
+ * caller function id, caller instruction, caller frame base and result
+ * register, then the callee's registers.
+ */
+void
+run_register_program(VM *vm, const RegisterProgram *program)
+{
+    const RegisterFunction *function = program->functions;
+    const RegisterInstruction *instruction;
+    size_t base = 0;
+    uint64_t *r;
+
+    init_globals(vm, program->source);
+    vm->program = program->source;
+    reserve_registers(vm, function->registers_count);
+    r = vm->call_stack.data;
+    memset(r, 0, function->registers_count * sizeof(uint64_t));
+    vm->call_stack.size = function->registers_count;
+    vm->gc_stats.call_stack_high_water = vm->call_stack.size;
+
+    for (instruction = function->instructions;; instruction++) {
+        switch (instruction->op) {
+            case REG_MOVE:
+                r[instruction->dst] = r[instruction->a];
+                break;
+            case REG_LOAD_IMMEDIATE:
+                r[instruction->dst] = instruction->immediate;
+                break;
+            case REG_LOAD_GLOBAL:
+                r[instruction->dst] = vm->globals[instruction->b];
+                break;
+            case REG_STORE_GLOBAL:
+                vm->globals[instruction->b] = r[instruction->a];
+                break;
+            case REG_ADD:
+                r[instruction->dst] = r[instruction->a] + r[instruction->b];
+                break;
+            case REG_SUB:
+                r[instruction->dst] = r[instruction->a] - r[instruction->b];
+                break;
+            case REG_MUL:
+                r[instruction->dst] = r[instruction->a] * r[instruction->b];
+                break;
+            case REG_DIV:
+                if (r[instruction->b] == 0)
+                    division_by_zero(OP_DIV_I64);
+                r[instruction->dst] = r[instruction->a] / r[instruction->b];
+                break;
+            case REG_MOD:
+                if (r[instruction->b] == 0)
+                    division_by_zero(OP_MOD_I64);
+                r[instruction->dst] = r[instruction->a] % r[instruction->b];
+                break;
+            case REG_LESS_THAN:
+                r[instruction->dst] = r[instruction->a] < r[instruction->b];
+                break;
+            case REG_GREATER_THAN:
+                r[instruction->dst] = r[instruction->a] > r[instruction->b];
+                break;
+            case REG_EQUALS:
+                r[instruction->dst] = r[instruction->a] == r[instruction->b];
+                break;
+            case REG_NOT_EQUALS:
+                r[instruction->dst] = r[instruction->a] != r[instruction->b];
+                break;
+            case REG_NOT:
+                r[instruction->dst] = !r[instruction->a];
+                break;
+            case REG_ADD_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] + instruction->immediate;
+                break;
+            case REG_SUB_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] - instruction->immediate;
+                break;
+            case REG_MUL_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] * instruction->immediate;
+                break;
+            case REG_DIV_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] / instruction->immediate;
+                break;
+            case REG_MOD_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] % instruction->immediate;
+                break;
+            case REG_LESS_THAN_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] < instruction->immediate;
+                break;
+            case REG_GREATER_THAN_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] > instruction->immediate;
+                break;
+            case REG_EQUALS_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] == instruction->immediate;
+                break;
+            case REG_NOT_EQUALS_IMMEDIATE:
+                r[instruction->dst] = r[instruction->a] != instruction->immediate;
+                break;
+            case REG_JUMP:
+                instruction = function->instructions + instruction->b - 1;
+                break;
+            case REG_JUMP_IF_FALSE:
+                if (!r[instruction->a])
+                    instruction = function->instructions + instruction->b - 1;
+                break;
+            case REG_JUMP_IF_TRUE:
+                if (r[instruction->a])
+                    instruction = function->instructions + instruction->b - 1;
+                break;
+            case REG_DEC_JUMP_IF_NOT_ZERO:
+                if (--r[instruction->a] != 0)
+                    instruction = function->instructions + instruction->b - 1;
+                break;
+            case REG_INC_JUMP_IF_LESS_THAN:
+                if (++r[instruction->a] < instruction->immediate)
+                    instruction = function->instructions + instruction->b - 1;
+                break;
+            case REG_CALL: {
+                const RegisterFunction *callee = program->functions + instruction->b;
+                size_t link = base + function->registers_count;
+                uint64_t *frame;
+
+                reserve_registers(vm, link + FRAME_LINK_SIZE + callee->registers_count);
+                frame = vm->call_stack.data + link;
+                frame[0] = function - program->functions;
+                frame[1] = instruction - function->instructions;
+                frame[2] = base;
+                frame[3] = instruction->a;
+                memcpy(frame + FRAME_LINK_SIZE,
+                       vm->call_stack.data + base + instruction->a,
+                       callee->args_count * sizeof(uint64_t));
+                base = link + FRAME_LINK_SIZE;
+                r = vm->call_stack.data + base;
+                function = callee;
+                instruction = function->instructions - 1;
+                vm->call_stack.size = base + function->registers_count;
+                if (vm->call_stack.size > vm->gc_stats.call_stack_high_water)
+                    vm->gc_stats.call_stack_high_water = vm->call_stack.size;
+            }
+                break;
+            case REG_RETURN:
+                if (base == 0)
+                    return;
+                vm->call_stack.data[r[-2] + r[-1]] = r[instruction->a];
+                // fallthrough
+            case REG_RETURN_VOID: {
+                uint64_t *frame = r - FRAME_LINK_SIZE;
+
+                if (base == 0)
+                    return;
+                vm->call_stack.size = base - FRAME_LINK_SIZE;
+                function = program->functions + frame[0];
+                instruction = function->instructions + frame[1];
+                base = frame[2];
+                r = vm->call_stack.data + base;
+            }
+                break;
+            case REG_PRINT:
+                printf("%zu\n", r[instruction->a]);
+                break;
+            case REG_EXIT:
+                if (vm->operands_stack.size + instruction->dst > vm->operands_stack.capacity) {
+                    vm->operands_stack.capacity = vm->operands_stack.size + instruction->dst;
+                    vm->operands_stack.data = safe_realloc(vm->operands_stack.data,
+                                                           vm->operands_stack.capacity * sizeof(uint64_t));
+                }
+                memcpy(vm->operands_stack.data + vm->operands_stack.size,
+                       r + instruction->a,
+                       instruction->dst * sizeof(uint64_t));
+                vm->operands_stack.size += instruction->dst;
+                return;
+            default:
+                fprintf(stderr, "Unknown register instruction: %d\n", instruction->op);
+                exit(EXIT_FAILURE);
+        }
+    }
+}
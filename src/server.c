@@ -0,0 +1,485 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "assembler/assembler.h"
+#include "optimizer/optimizer.h"
+#include "utils/memory.h"
+
+Server
+init_server(VM vm, size_t cache_capacity)
+{
+    Server server;
+
+    server.vm = vm;
+    server.cache.capacity = cache_capacity > 0 ? cache_capacity : 1;
+    server.cache.entries = safe_malloc(server.cache.capacity * sizeof(CachedProgram));
+    server.cache.count = 0;
+    server.cache.clock = 0;
+    server.cache.hits = 0;
+    server.cache.misses = 0;
+    server.cache.evictions = 0;
+    server.optimize = 1;
+    server.inline_budget = INLINE_DEFAULT_BUDGET;
+    return server;
+}
+
+void
+free_server(Server server)
+{
+    size_t i;
+
+    for (i = 0; i < server.cache.count; i++) {
+        free(server.cache.entries[i].path);
+        free_program(server.cache.entries[i].program);
+    }
+    free(server.cache.entries);
+    free_vm(server.vm);
+}
+
+/* Returns 0 when the other end is gone; a server goes on to the next request regardless. */
+static int
+write_all(int fd, const char *data, size_t size)
+{
+    ssize_t written;
+
+    while (size > 0) {
+        written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 0;
+        data += written;
+        size -= written;
+    }
+    return 1;
+}
+
+static int
+write_line(int fd, const char *format, ...)
+{
+    char line[SERVER_REQUEST_MAX];
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    return write_all(fd, line, length < (int) sizeof(line) ? (size_t) length : sizeof(line) - 1);
+}
+
+static int
+write_frame(int fd, const char *kind, const char *data, size_t size)
+{
+    return write_line(fd, "%s %zu\n", kind, size) && write_all(fd, data, size);
+}
+
+/* Answers a request the server could not run with an error message and status 1. */
+static void
+fail_request(int fd, const char *format, ...)
+{
+    char message[SERVER_REQUEST_MAX];
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (length >= (int) sizeof(message))
+        length = sizeof(message) - 1;
+    if (write_frame(fd, "err", message, length))
+        write_line(fd, "exit %d\n", EXIT_FAILURE);
+}
+
+/*
+ * Forks a child whose standard output and error are pipes, read from `out`
+ * and `err` in the parent. Returns 0 in the child, -1 when it could not start.
+ */
+static pid_t
+fork_child(int *out, int *err)
+{
+    int out_pipe[2], err_pipe[2];
+    pid_t pid;
+
+    if (pipe(out_pipe) < 0)
+        return -1;
+    if (pipe(err_pipe) < 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return -1;
+    }
+    // the child must not write out what the server has buffered
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid == 0) {
+        dup2(out_pipe[1], STDOUT_FILENO);
+        dup2(err_pipe[1], STDERR_FILENO);
+    }
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    if (pid <= 0) {
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+    }
+    *out = out_pipe[0];
+    *err = err_pipe[0];
+    return pid;
+}
+
+/*
+ * Sends what the child writes as out and err frames until it exits, and
+ * returns its exit status, 128 plus the signal when one killed it. The
+ * pipes are drained even once the client is gone, so the child never blocks.
+ */
+static int
+forward_child(int fd, pid_t pid, int out, int err)
+{
+    struct pollfd pipes[2];
+    char buffer[1 << 16];
+    ssize_t size;
+    int status, open = 2, connected = 1, i;
+
+    pipes[0].fd = out;
+    pipes[1].fd = err;
+    pipes[0].events = pipes[1].events = POLLIN;
+    while (open > 0) {
+        if (poll(pipes, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < 2; i++) {
+            if (pipes[i].fd < 0 || pipes[i].revents == 0)
+                continue;
+            size = read(pipes[i].fd, buffer, sizeof(buffer));
+            if (size > 0) {
+                connected = connected && write_frame(fd, i == 0 ? "out" : "err", buffer, size);
+            } else if (size == 0 || errno != EINTR) {
+                close(pipes[i].fd);
+                pipes[i].fd = -1;
+                open--;
+            }
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (pipes[i].fd >= 0)
+            close(pipes[i].fd);
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return EXIT_FAILURE;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static Program
+compile(const Server *server, const char *source)
+{
+    Program program = assemble(source);
+
+    if (server->optimize) {
+        inline_functions(&program, server->inline_budget);
+        optimize_program(&program);
+        layout_functions(&program, NULL);
+    }
+    return program;
+}
+
+static char *
+read_source(int fd, size_t size)
+{
+    char *source = safe_malloc(size + 1);
+    size_t length = 0;
+    ssize_t chunk;
+
+    while (length < size && (chunk = read(fd, source + length, size - length)) != 0) {
+        if (chunk < 0 && errno == EINTR)
+            continue;
+        if (chunk < 0) {
+            free(source);
+            return NULL;
+        }
+        length += chunk;
+    }
+    source[length] = '\0';
+    return source;
+}
+
+static CachedProgram *
+use_entry(ProgramCache *cache, CachedProgram *entry)
+{
+    entry->last_used = ++cache->clock;
+    return entry;
+}
+
+/* An empty entry, the least recently used one freed to make room when the cache is full. */
+static CachedProgram *
+new_entry(ProgramCache *cache)
+{
+    CachedProgram *entry = cache->entries;
+    size_t i;
+
+    if (cache->count < cache->capacity)
+        return cache->entries + cache->count++;
+    for (i = 1; i < cache->count; i++) {
+        if (cache->entries[i].last_used < entry->last_used)
+            entry = cache->entries + i;
+    }
+    free(entry->path);
+    free_program(entry->program);
+    cache->evictions++;
+    return entry;
+}
+
+static CachedProgram *
+find_fingerprint(ProgramCache *cache, uint64_t fingerprint)
+{
+    size_t i;
+
+    for (i = 0; i < cache->count; i++) {
+        if (cache->entries[i].fingerprint == fingerprint)
+            return use_entry(cache, cache->entries + i);
+    }
+    return NULL;
+}
+
+/*
+ * Returns the program in the file at `path`, assembling it unless it is
+ * cached and the file has not changed since; or NULL after failing the request.
+ */
+static CachedProgram *
+load_program(Server *server, const char *path, int fd)
+{
+    ProgramCache *cache = &server->cache;
+    CachedProgram *entry = NULL;
+    struct stat file;
+    char *source;
+    int out, err, status, source_fd;
+    pid_t pid;
+    size_t i;
+
+    for (i = 0; i < cache->count && entry == NULL; i++) {
+        if (cache->entries[i].path != NULL && strcmp(cache->entries[i].path, path) == 0)
+            entry = cache->entries + i;
+    }
+    if ((source_fd = open(path, O_RDONLY)) < 0 || fstat(source_fd, &file) < 0) {
+        fail_request(fd, "Failed to open %s: %s\n", path, strerror(errno));
+        if (source_fd >= 0)
+            close(source_fd);
+        return NULL;
+    }
+    if (entry != NULL && entry->mtime.tv_sec == file.st_mtim.tv_sec
+        && entry->mtime.tv_nsec == file.st_mtim.tv_nsec && entry->size == file.st_size) {
+        close(source_fd);
+        cache->hits++;
+        return use_entry(cache, entry);
+    }
+    // a changed file is assembled again, its old program can still be run by fingerprint
+    if (entry != NULL) {
+        free(entry->path);
+        entry->path = NULL;
+    }
+    cache->misses++;
+    source = read_source(source_fd, file.st_size);
+    close(source_fd);
+    if (source == NULL) {
+        fail_request(fd, "Failed to read %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    // the assembler exits on errors, so it first runs where that only ends this request
+    if ((pid = fork_child(&out, &err)) < 0) {
+        fail_request(fd, "Failed to start a process: %s\n", strerror(errno));
+        free(source);
+        return NULL;
+    }
+    if (pid == 0) {
+        compile(server, source);
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+    status = forward_child(fd, pid, out, err);
+    if (status != EXIT_SUCCESS) {
+        write_line(fd, "exit %d\n", status);
+        free(source);
+        return NULL;
+    }
+
+    entry = new_entry(cache);
+    entry->program = compile(server, source);
+    entry->path = strdup(path);
+    entry->mtime = file.st_mtim;
+    entry->size = file.st_size;
+    entry->fingerprint = program_fingerprint(&entry->program);
+    free(source);
+    return use_entry(cache, entry);
+}
+
+/* Runs in the child: the arguments are the input, one per line; they fit in a pipe as they fit in a request. */
+static void
+run_child(VM *vm, const Program *program, char **args, size_t args_count)
+{
+    int input[2];
+    size_t i;
+
+    if (pipe(input) < 0) {
+        fprintf(stderr, "Failed to pass the arguments: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < args_count; i++) {
+        write_all(input[1], args[i], strlen(args[i]));
+        write_all(input[1], "\n", 1);
+    }
+    close(input[1]);
+    vm->input.fd = input[0];
+    run_program(vm, program);
+    fflush(stdout);
+    if (vm->out_of_fuel) {
+        fprintf(stderr, "Out of fuel\n");
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void
+handle_request(Server *server, char *line, int fd)
+{
+    char *words[SERVER_REQUEST_MAX / 2], *end;
+    size_t count = 0;
+    CachedProgram *entry;
+    uint64_t fingerprint;
+    int out, err;
+    pid_t pid;
+
+    while (*line != '\0') {
+        while (isspace((unsigned char) *line))
+            *line++ = '\0';
+        if (*line != '\0')
+            words[count++] = line;
+        while (*line != '\0' && !isspace((unsigned char) *line))
+            line++;
+    }
+    if (count == 0)
+        return;
+
+    if (words[0][0] == '#') {
+        fingerprint = strtoull(words[0] + 1, &end, 16);
+        if (end == words[0] + 1 || *end != '\0') {
+            fail_request(fd, "Invalid fingerprint %s\n", words[0]);
+            return;
+        }
+        if ((entry = find_fingerprint(&server->cache, fingerprint)) == NULL) {
+            fail_request(fd, "No cached program has fingerprint %s\n", words[0]);
+            return;
+        }
+        server->cache.hits++;
+    } else if ((entry = load_program(server, words[0], fd)) == NULL) {
+        return;
+    }
+
+    write_line(fd, "program %016llx\n", (unsigned long long) entry->fingerprint);
+    if ((pid = fork_child(&out, &err)) < 0) {
+        fail_request(fd, "Failed to start a process: %s\n", strerror(errno));
+        return;
+    }
+    if (pid == 0)
+        run_child(&server->vm, &entry->program, words + 1, count - 1);
+    write_line(fd, "exit %d\n", forward_child(fd, pid, out, err));
+}
+
+/* Answers the requests read from `in_fd` on `out_fd` until end of input. Returns 0 on errors. */
+int
+serve_requests(Server *server, int in_fd, int out_fd)
+{
+    char buffer[SERVER_REQUEST_MAX];
+    char *newline;
+    size_t size = 0, length;
+    ssize_t chunk = 0;
+
+    for (;;) {
+        while ((newline = memchr(buffer, '\n', size)) != NULL) {
+            *newline = '\0';
+            length = newline + 1 - buffer;
+            handle_request(server, buffer, out_fd);
+            size -= length;
+            memmove(buffer, buffer + length, size);
+        }
+        if (size == sizeof(buffer)) {
+            fail_request(out_fd, "Requests are limited to %d bytes\n", SERVER_REQUEST_MAX);
+            return 0;
+        }
+        chunk = read(in_fd, buffer + size, sizeof(buffer) - size);
+        if (chunk < 0 && errno == EINTR)
+            continue;
+        if (chunk <= 0)
+            break;
+        size += chunk;
+    }
+    if (chunk < 0) {
+        fprintf(stderr, "Failed to read a request: %s\n", strerror(errno));
+        return 0;
+    }
+    // the last request may end without a newline
+    if (size > 0) {
+        buffer[size] = '\0';
+        handle_request(server, buffer, out_fd);
+    }
+    return 1;
+}
+
+/* Serves one connection at a time on a Unix domain socket at `path`; only returns, with 0, on errors. */
+int
+serve_socket(Server *server, const char *path)
+{
+    struct sockaddr_un address;
+    struct stat info;
+    int listener, connection;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 0;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    // only a socket left by an earlier server is replaced
+    if (lstat(path, &info) == 0 && !S_ISSOCK(info.st_mode)) {
+        fprintf(stderr, "Cannot listen on %s: it exists and is not a socket\n", path);
+        return 0;
+    }
+    if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "Failed to create a socket: %s\n", strerror(errno));
+        return 0;
+    }
+    unlink(path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+        close(listener);
+        return 0;
+    }
+    // a client hanging up only ends its own connection
+    signal(SIGPIPE, SIG_IGN);
+    for (;;) {
+        if ((connection = accept(listener, NULL, NULL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to accept a connection: %s\n", strerror(errno));
+            close(listener);
+            return 0;
+        }
+        serve_requests(server, connection, connection);
+        close(connection);
+    }
+}
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define HAL64_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define SCALAR_BINARY(NAME, OPERATOR) \
+    static void \
+    NAME(uint64_t *a, const uint64_t *b, size_t n) \
+    { \
+        size_t i; \
+        for (i = 0; i < n; i++) \
+            a[i] = a[i] OPERATOR b[i]; \
+    }
+#define SCALAR_BINARY_SCALAR(NAME, OPERATOR) \
+    static void \
+    NAME(uint64_t *a, uint64_t b, size_t n) \
+    { \
+        size_t i; \
+        for (i = 0; i < n; i++) \
+            a[i] = a[i] OPERATOR b; \
+    }
+#define SCALAR_COMPARE(NAME, OPERATOR) \
+    static void \
+    NAME(uint64_t *mask, const uint64_t *a, const uint64_t *b, size_t n) \
+    { \
+        size_t i; \
+        for (i = 0; i < n; i++) \
+            mask[i] = a[i] OPERATOR b[i]; \
+    }
+
+SCALAR_BINARY(scalar_add, +)
+SCALAR_BINARY(scalar_sub, -)
+SCALAR_BINARY(scalar_mul, *)
+SCALAR_BINARY_SCALAR(scalar_add_scalar, +)
+SCALAR_BINARY_SCALAR(scalar_sub_scalar, -)
+SCALAR_BINARY_SCALAR(scalar_mul_scalar, *)
+SCALAR_COMPARE(scalar_equals, ==)
+SCALAR_COMPARE(scalar_less_than, <)
+SCALAR_COMPARE(scalar_greater_than, >)
+
+static uint64_t
+scalar_sum(const uint64_t *a, size_t n)
+{
+    size_t i;
+    uint64_t sum = 0;
+    for (i = 0; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+/* The minimum of an empty array is UINT64_MAX and its maximum is 0. */
+static uint64_t
+scalar_min(const uint64_t *a, size_t n)
+{
+    size_t i;
+    uint64_t min = UINT64_MAX;
+    for (i = 0; i < n; i++)
+        min = a[i] < min ? a[i] : min;
+    return min;
+}
+
+static uint64_t
+scalar_max(const uint64_t *a, size_t n)
+{
+    size_t i;
+    uint64_t max = 0;
+    for (i = 0; i < n; i++)
+        max = a[i] > max ? a[i] : max;
+    return max;
+}
+
+static const SimdKernels scalar_kernels = {
+    "scalar",
+    scalar_add,
+    scalar_sub,
+    scalar_mul,
+    scalar_add_scalar,
+    scalar_sub_scalar,
+    scalar_mul_scalar,
+    scalar_sum,
+    scalar_min,
+    scalar_max,
+    scalar_equals,
+    scalar_less_than,
+    scalar_greater_than,
+};
+
+#ifdef HAL64_X86_SIMD
+
+/*
+ * Neither SSE2 nor AVX2 has a 64-bit multiply, so it is rebuilt from
+ * 32-bit partial products; the high halves of the cross terms fall off.
+ */
+static __m128i
+sse2_mul64(__m128i a, __m128i b)
+{
+    __m128i low = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                                  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+#define SSE2_BINARY(NAME, SCALAR, EXPRESSION) \
+    static void \
+    NAME(uint64_t *a, const uint64_t *b, size_t n) \
+    { \
+        size_t i; \
+        for (i = 0; i + 2 <= n; i += 2) { \
+            __m128i x = _mm_loadu_si128((const __m128i *) (a + i)); \
+            __m128i y = _mm_loadu_si128((const __m128i *) (b + i)); \
+            _mm_storeu_si128((__m128i *) (a + i), EXPRESSION); \
+        } \
+        SCALAR(a + i, b + i, n - i); \
+    }
+#define SSE2_BINARY_SCALAR(NAME, SCALAR, EXPRESSION) \
+    static void \
+    NAME(uint64_t *a, uint64_t b, size_t n) \
+    { \
+        size_t i; \
+        __m128i y = _mm_set1_epi64x((long long) b); \
+        for (i = 0; i + 2 <= n; i += 2) { \
+            __m128i x = _mm_loadu_si128((const __m128i *) (a + i)); \
+            _mm_storeu_si128((__m128i *) (a + i), EXPRESSION); \
+        } \
+        SCALAR(a + i, b, n - i); \
+    }
+
+SSE2_BINARY(sse2_add, scalar_add, _mm_add_epi64(x, y))
+SSE2_BINARY(sse2_sub, scalar_sub, _mm_sub_epi64(x, y))
+SSE2_BINARY(sse2_mul, scalar_mul, sse2_mul64(x, y))
+SSE2_BINARY_SCALAR(sse2_add_scalar, scalar_add_scalar, _mm_add_epi64(x, y))
+SSE2_BINARY_SCALAR(sse2_sub_scalar, scalar_sub_scalar, _mm_sub_epi64(x, y))
+SSE2_BINARY_SCALAR(sse2_mul_scalar, scalar_mul_scalar, sse2_mul64(x, y))
+
+static uint64_t
+sse2_sum(const uint64_t *a, size_t n)
+{
+    size_t i;
+    uint64_t lanes[2];
+    __m128i sum = _mm_setzero_si128();
+    for (i = 0; i + 2 <= n; i += 2)
+        sum = _mm_add_epi64(sum, _mm_loadu_si128((const __m128i *) (a + i)));
+    _mm_storeu_si128((__m128i *) lanes, sum);
+    return lanes[0] + lanes[1] + scalar_sum(a + i, n - i);
+}
+
+/* SSE2 has no 64-bit compare: both 32-bit halves have to be equal. */
+static void
+sse2_equals(uint64_t *mask, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    size_t i;
+    __m128i one = _mm_set1_epi64x(1);
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (a + i)),
+                                        _mm_loadu_si128((const __m128i *) (b + i)));
+        equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_si128((__m128i *) (mask + i), _mm_and_si128(equal, one));
+    }
+    scalar_equals(mask + i, a + i, b + i, n - i);
+}
+
+static const SimdKernels sse2_kernels = {
+    "sse2",
+    sse2_add,
+    sse2_sub,
+    sse2_mul,
+    sse2_add_scalar,
+    sse2_sub_scalar,
+    sse2_mul_scalar,
+    sse2_sum,
+    scalar_min,
+    scalar_max,
+    sse2_equals,
+    scalar_less_than,
+    scalar_greater_than,
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 __m256i
+avx2_mul64(__m256i a, __m256i b)
+{
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+/* AVX2 only compares signed lanes; flipping the sign bit makes it unsigned. */
+static AVX2 __m256i
+avx2_greater_than64(__m256i a, __m256i b)
+{
+    __m256i sign = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+}
+
+#define AVX2_BINARY(NAME, SCALAR, EXPRESSION) \
+    static AVX2 void \
+    NAME(uint64_t *a, const uint64_t *b, size_t n) \
+    { \
+        size_t i; \
+        for (i = 0; i + 4 <= n; i += 4) { \
+            __m256i x = _mm256_loadu_si256((const __m256i *) (a + i)); \
+            __m256i y = _mm256_loadu_si256((const __m256i *) (b + i)); \
+            _mm256_storeu_si256((__m256i *) (a + i), EXPRESSION); \
+        } \
+        SCALAR(a + i, b + i, n - i); \
+    }
+#define AVX2_BINARY_SCALAR(NAME, SCALAR, EXPRESSION) \
+    static AVX2 void \
+    NAME(uint64_t *a, uint64_t b, size_t n) \
+    { \
+        size_t i; \
+        __m256i y = _mm256_set1_epi64x((long long) b); \
+        for (i = 0; i + 4 <= n; i += 4) { \
+            __m256i x = _mm256_loadu_si256((const __m256i *) (a + i)); \
+            _mm256_storeu_si256((__m256i *) (a + i), EXPRESSION); \
+        } \
+        SCALAR(a + i, b, n - i); \
+    }
+#define AVX2_COMPARE(NAME, SCALAR, EXPRESSION) \
+    static AVX2 void \
+    NAME(uint64_t *mask, const uint64_t *a, const uint64_t *b, size_t n) \
+    { \
+        size_t i; \
+        __m256i one = _mm256_set1_epi64x(1); \
+        for (i = 0; i + 4 <= n; i += 4) { \
+            __m256i x = _mm256_loadu_si256((const __m256i *) (a + i)); \
+            __m256i y = _mm256_loadu_si256((const __m256i *) (b + i)); \
+            _mm256_storeu_si256((__m256i *) (mask + i), _mm256_and_si256(EXPRESSION, one)); \
+        } \
+        SCALAR(mask + i, a + i, b + i, n - i); \
+    }
+#define AVX2_REDUCE(NAME, SCALAR, IDENTITY, EXPRESSION) \
+    static AVX2 uint64_t \
+    NAME(const uint64_t *a, size_t n) \
+    { \
+        size_t i; \
+        uint64_t lanes[4], result; \
+        __m256i acc = _mm256_set1_epi64x((long long) (IDENTITY)); \
+        for (i = 0; i + 4 <= n; i += 4) { \
+            __m256i x = _mm256_loadu_si256((const __m256i *) (a + i)); \
+            acc = EXPRESSION; \
+        } \
+        _mm256_storeu_si256((__m256i *) lanes, acc); \
+        result = SCALAR(lanes, 4); \
+        lanes[0] = result; \
+        lanes[1] = SCALAR(a + i, n - i); \
+        return SCALAR(lanes, 2); \
+    }
+
+AVX2_BINARY(avx2_add, scalar_add, _mm256_add_epi64(x, y))
+AVX2_BINARY(avx2_sub, scalar_sub, _mm256_sub_epi64(x, y))
+AVX2_BINARY(avx2_mul, scalar_mul, avx2_mul64(x, y))
+AVX2_BINARY_SCALAR(avx2_add_scalar, scalar_add_scalar, _mm256_add_epi64(x, y))
+AVX2_BINARY_SCALAR(avx2_sub_scalar, scalar_sub_scalar, _mm256_sub_epi64(x, y))
+AVX2_BINARY_SCALAR(avx2_mul_scalar, scalar_mul_scalar, avx2_mul64(x, y))
+AVX2_COMPARE(avx2_equals, scalar_equals, _mm256_cmpeq_epi64(x, y))
+AVX2_COMPARE(avx2_less_than, scalar_less_than, avx2_greater_than64(y, x))
+AVX2_COMPARE(avx2_greater_than, scalar_greater_than, avx2_greater_than64(x, y))
+AVX2_REDUCE(avx2_sum, scalar_sum, 0, _mm256_add_epi64(acc, x))
+AVX2_REDUCE(avx2_min, scalar_min, UINT64_MAX, _mm256_blendv_epi8(acc, x, avx2_greater_than64(acc, x)))
+AVX2_REDUCE(avx2_max, scalar_max, 0, _mm256_blendv_epi8(acc, x, avx2_greater_than64(x, acc)))
+
+static const SimdKernels avx2_kernels = {
+    "avx2",
+    avx2_add,
+    avx2_sub,
+    avx2_mul,
+    avx2_add_scalar,
+    avx2_sub_scalar,
+    avx2_mul_scalar,
+    avx2_sum,
+    avx2_min,
+    avx2_max,
+    avx2_equals,
+    avx2_less_than,
+    avx2_greater_than,
+};
+
+#endif
+
+const SimdKernels *
+simd_kernels_for(SimdLevel level)
+{
+    switch (level) {
+        case SIMD_SCALAR:
+            return &scalar_kernels;
+#ifdef HAL64_X86_SIMD
+        case SIMD_SSE2:
+            return &sse2_kernels;
+        case SIMD_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * Picks the widest kernels the CPU supports on first use. HAL64_SIMD can
+ * name a narrower set (scalar, sse2, avx2) to compare them.
+ */
+const SimdKernels *
+simd_kernels(void)
+{
+    static const SimdKernels *selected = NULL;
+    const char *requested;
+    int level;
+
+    if (selected != NULL)
+        return selected;
+    requested = getenv("HAL64_SIMD");
+    for (level = SIMD_COUNT - 1; level >= 0 && selected == NULL; level--) {
+        const SimdKernels *kernels = simd_kernels_for((SimdLevel) level);
+        if (kernels != NULL && (requested == NULL || strcmp(requested, kernels->name) == 0))
+            selected = kernels;
+    }
+    if (selected == NULL)
+        selected = &scalar_kernels;
+    return selected;
+}
@@ -0,0 +1,456 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot.h"
+#include "utils/memory.h"
+
+#define SNAPSHOT_MAGIC "HAL64SNP"
+#define SNAPSHOT_VERSION 2
+#define OBJECT_RECORD_SIZE 4 // kind, size, parent reference, data offset
+
+/*
+ * A snapshot file is this header followed by 64-bit words: globals, global
+ * pointers, the call stack, the operand stack, the pointer stack, one
+ * record per heap object, then the object bytes padded to 8. Heap pointers
+ * are stored as references, 0 for NULL and (i + 1) << 1 for object i, so the
+ * file does not depend on where anything was allocated; inline strings have
+ * the low bit set and are stored as they are.
+ */
+typedef struct
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t fingerprint;
+    uint64_t globals_count;
+    uint64_t global_pointers_count;
+    uint64_t call_stack_size;
+    uint64_t operands_size;
+    uint64_t pointers_size;
+    uint64_t objects_count;
+    uint64_t data_size;
+    uint64_t function;
+    uint64_t resume_instruction;
+} SnapshotHeader;
+
+typedef struct
+{
+    const HeapObject *object;
+    uint64_t reference;
+} ObjectReference;
+
+/*
+ * Flags the call stack words that hold local pointers, walking the frames
+ * down from `function` the way the collector does. Returns 0 when the
+ * frames do not describe a valid stack.
+ */
+static int
+find_pointer_slots(const Program *program, const Function *function,
+                   const uint64_t *stack, size_t size, uint8_t *slots)
+{
+    size_t i, frame_start, frame_end = size;
+
+    memset(slots, 0, size);
+    while (frame_end > 0) {
+        if (stack[frame_end - 1] != function->stack_frame_size || stack[frame_end - 1] > frame_end)
+            return 0;
+        frame_start = frame_end - stack[frame_end - 1];
+        for (i = 0; i < function->local_pointers_count; i++)
+            slots[frame_start + function->locals_count + i] = 1;
+        if (stack[frame_end - 3] >= program->functions_count)
+            return 0;
+        function = program->functions + stack[frame_end - 3];
+        frame_end = frame_start;
+    }
+    return 1;
+}
+
+static int
+compare_references(const void *a, const void *b)
+{
+    const HeapObject *x = ((const ObjectReference *) a)->object;
+    const HeapObject *y = ((const ObjectReference *) b)->object;
+    return x < y ? -1 : x > y;
+}
+
+static int
+object_reference(const ObjectReference *references, size_t count, const HeapObject *object, uint64_t *reference)
+{
+    ObjectReference key, *found;
+
+    if (object == NULL || is_inline_string(object)) {
+        *reference = (uintptr_t) object;
+        return 1;
+    }
+    key.object = object;
+    found = bsearch(&key, references, count, sizeof(ObjectReference), compare_references);
+    if (found == NULL)
+        return 0;
+    *reference = found->reference;
+    return 1;
+}
+
+static size_t
+padded(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+static int
+write_references(FILE *file, const ObjectReference *references, size_t count,
+                 HeapObject *const *pointers, size_t size)
+{
+    uint64_t reference;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if (!object_reference(references, count, pointers[i], &reference))
+            return 0;
+        fwrite(&reference, sizeof(uint64_t), 1, file);
+    }
+    return 1;
+}
+
+/*
+ * Writes a VM paused by Snapshot to `path`. Returns 0, after reporting why
+ * on stderr, when the VM is not paused or the file cannot be written.
+ */
+int
+save_snapshot(const VM *vm, const Program *program, const char *path)
+{
+    SnapshotHeader header;
+    ObjectReference *references;
+    uint8_t *slots;
+    size_t i, offset = 0, count = vm->objects.size;
+    int ok = 1;
+    FILE *file;
+
+    if (!vm->paused) {
+        fprintf(stderr, "Cannot snapshot a VM that is not paused at a Snapshot instruction\n");
+        return 0;
+    }
+    if (vm->memo_frames_size > 0) {
+        fprintf(stderr, "Cannot snapshot inside a memoized call\n");
+        return 0;
+    }
+    if (vm->input.start < vm->input.end) {
+        fprintf(stderr, "Cannot snapshot a VM holding unread input\n");
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (vm->objects.data[i]->kind == OBJECT_MAP) {
+            fprintf(stderr, "Cannot snapshot a heap holding maps\n");
+            return 0;
+        }
+    }
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    references = safe_malloc((count + 1) * sizeof(ObjectReference));
+    for (i = 0; i < count; i++) {
+        references[i].object = vm->objects.data[i];
+        references[i].reference = (i + 1) << 1;
+    }
+    qsort(references, count, sizeof(ObjectReference), compare_references);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.fingerprint = program_fingerprint(program);
+    header.globals_count = program->globals_count;
+    header.global_pointers_count = program->global_pointers_count;
+    header.call_stack_size = vm->call_stack.size;
+    header.operands_size = vm->operands_stack.size;
+    header.pointers_size = vm->pointers_stack.size;
+    header.objects_count = count;
+    for (i = 0; i < count; i++) {
+        if (vm->objects.data[i]->kind != OBJECT_STRING_VIEW)
+            header.data_size += padded(vm->objects.data[i]->size);
+    }
+    header.function = vm->function - program->functions;
+    header.resume_instruction = vm->resume_instruction;
+    fwrite(&header, sizeof(header), 1, file);
+
+    fwrite(vm->globals, sizeof(uint64_t), program->globals_count, file);
+    ok &= write_references(file, references, count, vm->global_pointers, program->global_pointers_count);
+
+    slots = safe_malloc(vm->call_stack.size + 1);
+    ok &= find_pointer_slots(program, vm->function, vm->call_stack.data, vm->call_stack.size, slots);
+    for (i = 0; ok && i < vm->call_stack.size; i++) {
+        uint64_t word = vm->call_stack.data[i];
+        if (slots[i])
+            ok &= object_reference(references, count, (const HeapObject *) (uintptr_t) word, &word);
+        fwrite(&word, sizeof(uint64_t), 1, file);
+    }
+    free(slots);
+
+    fwrite(vm->operands_stack.data, sizeof(uint64_t), vm->operands_stack.size, file);
+    ok &= write_references(file, references, count, vm->pointers_stack.data, vm->pointers_stack.size);
+
+    for (i = 0; ok && i < count; i++) {
+        const HeapObject *object = vm->objects.data[i];
+        uint64_t record[OBJECT_RECORD_SIZE];
+        record[0] = object->kind;
+        record[1] = object->size;
+        ok &= object_reference(references, count, object->parent, record + 2);
+        if (object->kind == OBJECT_STRING_VIEW) {
+            record[3] = (const char *) object->data - (const char *) object->parent->data;
+        } else {
+            record[3] = offset;
+            offset += padded(object->size);
+        }
+        fwrite(record, sizeof(uint64_t), OBJECT_RECORD_SIZE, file);
+    }
+    for (i = 0; ok && i < count; i++) {
+        const HeapObject *object = vm->objects.data[i];
+        static const char zeros[8];
+        if (object->kind == OBJECT_STRING_VIEW)
+            continue;
+        if (object->size > 0)
+            fwrite(object->data, 1, object->size, file);
+        fwrite(zeros, 1, padded(object->size) - object->size, file);
+    }
+    free(references);
+
+    if (!ok)
+        fprintf(stderr, "Cannot snapshot: the VM holds a pointer outside its heap\n");
+    if (ferror(file) && ok) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        ok = 0;
+    }
+    if (fclose(file) != 0 && ok) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        ok = 0;
+    }
+    if (!ok)
+        remove(path);
+    return ok;
+}
+
+static void
+reserve(Array *array, size_t size)
+{
+    if (size <= array->capacity)
+        return;
+    while (array->capacity < size)
+        array->capacity *= 2;
+    array->data = safe_realloc(array->data, array->capacity * sizeof(uint64_t));
+}
+
+static void
+reserve_pointers(PointersArray *array, size_t size)
+{
+    if (size <= array->capacity)
+        return;
+    while (array->capacity < size)
+        array->capacity *= 2;
+    array->data = safe_realloc(array->data, array->capacity * sizeof(HeapObject *));
+}
+
+static int
+resolve(HeapObject **objects, size_t count, uint64_t reference, HeapObject **object)
+{
+    if (reference & 1) {
+        *object = (HeapObject *) (uintptr_t) reference;
+        return (reference & 0xff) >> 1 <= STRING_INLINE_MAX;
+    }
+    if (reference >> 1 > count)
+        return 0;
+    *object = reference == 0 ? NULL : objects[(reference >> 1) - 1];
+    return 1;
+}
+
+/* Rebuilds the heap from the object records; views are attached once every owner exists. */
+static int
+restore_objects(VM *vm, const SnapshotHeader *header, const uint64_t *records, const char *data)
+{
+    HeapObject **objects = vm->objects.data;
+    size_t i, count = header->objects_count;
+    int ok = 1;
+
+    for (i = 0; i < count; i++) {
+        const uint64_t *record = records + i * OBJECT_RECORD_SIZE;
+        HeapObject *object = safe_malloc(sizeof(HeapObject));
+        object->marked = 0;
+        object->refs = 0;
+        object->index = i;
+        object->kind = record[0];
+        object->size = record[1];
+        object->data = NULL;
+        object->parent = NULL;
+        objects[i] = object;
+        vm->objects.size++;
+        if (record[0] == OBJECT_STRING_VIEW)
+            continue;
+        if ((record[0] != OBJECT_STRING && record[0] != OBJECT_I64_ARRAY)
+            || record[2] != 0
+            || record[3] > header->data_size
+            || record[1] > header->data_size - record[3]) {
+            ok = 0;
+            break;
+        }
+        if (record[0] == OBJECT_I64_ARRAY)
+            object->data = safe_aligned_malloc(object->size, 64);
+        else
+            object->data = safe_malloc(object->size);
+        if (object->size > 0)
+            memcpy(object->data, data + record[3], object->size);
+        vm->allocated_heap_size += object->size;
+    }
+    for (i = 0; ok && i < count; i++) {
+        const uint64_t *record = records + i * OBJECT_RECORD_SIZE;
+        HeapObject *object = objects[i];
+        if (object->kind != OBJECT_STRING_VIEW)
+            continue;
+        if (!resolve(objects, count, record[2], &object->parent)
+            || object->parent == NULL
+            || is_inline_string(object->parent)
+            || object->parent->kind != OBJECT_STRING
+            || record[3] > object->parent->size
+            || record[1] > object->parent->size - record[3]) {
+            object->parent = NULL;
+            ok = 0;
+            break;
+        }
+        object->data = (char *) object->parent->data + record[3];
+        vm->allocated_heap_size += sizeof(HeapObject);
+    }
+    return ok;
+}
+
+/*
+ * Restores a snapshot of `program` into a VM fresh from init_vm(); the VM
+ * is then ready for resume_program(). The file is mapped, checked against
+ * the program, and its references turned back into pointers. Returns 0,
+ * after reporting why on stderr, when the file does not fit the program.
+ */
+int
+load_snapshot(VM *vm, const Program *program, const char *path)
+{
+    const SnapshotHeader *header;
+    const uint64_t *words;
+    const char *data;
+    uint8_t *slots;
+    size_t i, words_count, size;
+    struct stat st;
+    void *mapping;
+    int fd, ok = 1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    size = st.st_size;
+    if (size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "%s is not a HAL64 snapshot\n", path);
+        close(fd);
+        return 0;
+    }
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    header = mapping;
+    words_count = (size - sizeof(SnapshotHeader)) / sizeof(uint64_t);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s is not a HAL64 snapshot\n", path);
+        munmap(mapping, size);
+        return 0;
+    }
+    if (header->fingerprint != program_fingerprint(program)
+        || header->globals_count != program->globals_count
+        || header->global_pointers_count != program->global_pointers_count
+        || header->function >= program->functions_count
+        || header->resume_instruction >= program->functions[header->function].instructions_count) {
+        fprintf(stderr, "%s was taken from a different program\n", path);
+        munmap(mapping, size);
+        return 0;
+    }
+    if (header->call_stack_size > words_count
+        || header->operands_size > words_count
+        || header->pointers_size > words_count
+        || header->objects_count > words_count / OBJECT_RECORD_SIZE
+        || header->data_size % sizeof(uint64_t) != 0
+        || header->data_size / sizeof(uint64_t) > words_count
+        || header->globals_count + header->global_pointers_count + header->call_stack_size
+           + header->operands_size + header->pointers_size + header->objects_count * OBJECT_RECORD_SIZE
+           + header->data_size / sizeof(uint64_t) != words_count) {
+        fprintf(stderr, "%s is truncated or corrupt\n", path);
+        munmap(mapping, size);
+        return 0;
+    }
+
+    words = (const uint64_t *) (header + 1);
+    init_globals(vm, program);
+    vm->function = program->functions + header->function;
+    vm->resume_instruction = header->resume_instruction;
+    vm->paused = 1;
+
+    reserve_pointers(&vm->objects, header->objects_count);
+    data = (const char *) (words + words_count) - header->data_size;
+    ok = restore_objects(vm, header, words + header->globals_count + header->global_pointers_count
+                                         + header->call_stack_size + header->operands_size
+                                         + header->pointers_size,
+                         data);
+
+    if (program->globals_count > 0)
+        memcpy(vm->globals, words, program->globals_count * sizeof(uint64_t));
+    words += program->globals_count;
+    for (i = 0; ok && i < program->global_pointers_count; i++)
+        ok = resolve(vm->objects.data, vm->objects.size, words[i], vm->global_pointers + i);
+    words += program->global_pointers_count;
+
+    reserve(&vm->call_stack, header->call_stack_size + 1);
+    vm->call_stack.size = header->call_stack_size;
+    memcpy(vm->call_stack.data, words, header->call_stack_size * sizeof(uint64_t));
+    words += header->call_stack_size;
+    slots = safe_malloc(header->call_stack_size + 1);
+    ok = ok && header->call_stack_size > 0
+         && find_pointer_slots(program, vm->function, vm->call_stack.data, vm->call_stack.size, slots);
+    for (i = 0; ok && i < vm->call_stack.size; i++) {
+        HeapObject *object;
+        if (!slots[i])
+            continue;
+        ok = resolve(vm->objects.data, vm->objects.size, vm->call_stack.data[i], &object);
+        vm->call_stack.data[i] = (uintptr_t) object;
+    }
+    free(slots);
+
+    reserve(&vm->operands_stack, header->operands_size + 1);
+    vm->operands_stack.size = header->operands_size;
+    memcpy(vm->operands_stack.data, words, header->operands_size * sizeof(uint64_t));
+    words += header->operands_size;
+
+    reserve_pointers(&vm->pointers_stack, header->pointers_size + 1);
+    vm->pointers_stack.size = header->pointers_size;
+    for (i = 0; ok && i < header->pointers_size; i++)
+        ok = resolve(vm->objects.data, vm->objects.size, words[i], vm->pointers_stack.data + i);
+
+    munmap(mapping, size);
+    if (!ok) {
+        fprintf(stderr, "%s is truncated or corrupt\n", path);
+        vm->call_stack.size = vm->operands_stack.size = vm->pointers_stack.size = 0;
+        return 0;
+    }
+    vm->program = program;
+    if (vm->memory == MEMORY_REFCOUNT)
+        count_references(vm);
+    vm->gc_stats.peak_heap_size = vm->allocated_heap_size;
+    vm->gc_stats.call_stack_high_water = vm->call_stack.size;
+    vm->gc_stats.operands_stack_high_water = vm->operands_stack.size;
+    vm->gc_stats.pointers_stack_high_water = vm->pointers_stack.size;
+    return 1;
+}
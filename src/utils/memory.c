@@ -14,6 +14,18 @@ void *safe_malloc(size_t size)
     return buff;
 }
 
+void *safe_aligned_malloc(size_t size, size_t alignment)
+{
+    void *buff;
+    if (size == 0)
+        return NULL;
+    if (posix_memalign(&buff, alignment, size) != 0) {
+        fprintf(stderr, "[-] Memory allocation failure!");
+        exit(EXIT_FAILURE);
+    }
+    return buff;
+}
+
 void *safe_realloc(void *buff, size_t size)
 {
     void *tmp_buff = realloc(buff, size);
@@ -1,9 +1,21 @@
+#include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "hal64.h"
+#include "assembler/assembler.h"
+#include "debugger.h"
+#include "map.h"
+#include "parallel.h"
+#include "profile.h"
 #include "utils/memory.h"
 
+// the caller recorded in a frame entered by invoke_i64_function(), whose Return leaves the interpreter
+#define HOST_CALLER SIZE_MAX
+
 VM
 init_vm(void)
 {
@@ -17,6 +29,44 @@ init_vm(void)
     vm.pointers_stack.capacity = 1024;
     vm.objects.capacity = 1024;
     vm.allocated_heap_size = 0;
+    vm.gc.initial_threshold = GC_DEFAULT_THRESHOLD;
+    vm.gc.growth_factor = GC_DEFAULT_GROWTH_FACTOR;
+    vm.gc.max_heap_size = 0;
+    vm.gc_threshold = 0;
+    vm.memory = MEMORY_TRACING;
+    memset(&vm.gc_stats, 0, sizeof(GCStats));
+    vm.globals = NULL;
+    vm.global_pointers = NULL;
+    vm.program = NULL;
+    vm.function = NULL;
+    vm.simd = simd_kernels();
+    vm.memo_caches = NULL;
+    vm.memo_caches_count = 0;
+    vm.memo_capacity = MEMO_DEFAULT_CAPACITY;
+    vm.memo_keys.size = 0;
+    vm.memo_keys.capacity = 0;
+    vm.memo_keys.data = NULL;
+    vm.memo_frames = NULL;
+    vm.memo_frames_size = 0;
+    vm.memo_frames_capacity = 0;
+    vm.pause_at_snapshot = 0;
+    vm.paused = 0;
+    vm.out_of_fuel = 0;
+    vm.fuel = VM_UNLIMITED_FUEL;
+    vm.resume_instruction = 0;
+    vm.profile = NULL;
+    vm.checked = VM_CHECKED_DEFAULT;
+    vm.natives = NULL;
+    vm.natives_count = 0;
+    vm.input.fd = STDIN_FILENO;
+    vm.input.chunk_size = INPUT_DEFAULT_CHUNK_SIZE;
+    vm.input.chunk = NULL;
+    vm.input.start = 0;
+    vm.input.end = 0;
+    vm.input.eof = 0;
+    vm.threads = 0;
+    vm.workers = NULL;
+    vm.debugger = NULL;
     vm.call_stack.data = safe_malloc(vm.call_stack.capacity * sizeof(uint64_t));
     vm.operands_stack.data = safe_malloc(vm.operands_stack.capacity * sizeof(uint64_t));
     vm.pointers_stack.data = safe_malloc(vm.pointers_stack.capacity * sizeof(HeapObject *));
@@ -24,6 +74,23 @@ init_vm(void)
     return vm;
 }
 
+/* Views only own their header; the bytes belong to the parent string. */
+static size_t
+heap_object_size(const HeapObject *object)
+{
+    return object->kind == OBJECT_STRING_VIEW ? sizeof(HeapObject) : object->size;
+}
+
+static void
+free_heap_object(HeapObject *object)
+{
+    if (object->kind == OBJECT_MAP)
+        free_hash_map(object->data);
+    if (object->kind != OBJECT_STRING_VIEW)
+        free(object->data);
+    free(object);
+}
+
 void
 free_vm(VM vm)
 {
@@ -31,20 +98,98 @@ free_vm(VM vm)
     free(vm.call_stack.data);
     free(vm.operands_stack.data);
     free(vm.pointers_stack.data);
-    for (i = 0; i < vm.objects.size; i++) {
-        free(vm.objects.data[i]->data);
-        free(vm.objects.data[i]);
-    }
+    for (i = 0; i < vm.objects.size; i++)
+        free_heap_object(vm.objects.data[i]);
     free(vm.objects.data);
+    free(vm.globals);
+    for (i = 0; i < vm.memo_caches_count; i++)
+        free_memo_cache(vm.memo_caches[i]);
+    free(vm.memo_caches);
+    free(vm.memo_keys.data);
+    free(vm.memo_frames);
+    free(vm.natives);
+    if (vm.workers != NULL)
+        free_worker_pool(vm.workers);
+    detach_debugger(&vm);
+}
+
+/* Makes `native` what CallNative :id calls, replacing any earlier one. */
+void
+register_native(VM *vm, size_t id, Native native)
+{
+    if (id >= vm->natives_count) {
+        vm->natives = safe_realloc(vm->natives, (id + 1) * sizeof(Native));
+        memset(vm->natives + vm->natives_count, 0, (id + 1 - vm->natives_count) * sizeof(Native));
+        vm->natives_count = id + 1;
+    }
+    vm->natives[id] = native;
+}
+
+static HeapObject **
+local_pointers(uint64_t *locals, const Function *function)
+{
+    return (HeapObject **) (locals + function->locals_count);
 }
 
 static void
-gc_mark_all(VM *vm)
+visit_map_entries(const HashMap *map, void (*visit)(HeapObject *))
 {
     size_t i;
+
+    if (!(map->flags & MAP_KINDS))
+        return;
+    for (i = 0; i < map->capacity; i++) {
+        if (map->control[i] & 0x80)
+            continue;
+        if (map->flags & MAP_STRING_KEYS)
+            visit((HeapObject *) (uintptr_t) map->slots[i].key);
+        if (map->flags & MAP_POINTER_VALUES)
+            visit((HeapObject *) (uintptr_t) map->slots[i].value);
+    }
+}
+
+/* Maps are the only objects that hold others, so marking recurses through them alone. */
+static void
+gc_mark_object(HeapObject *object)
+{
+    if (object == NULL || is_inline_string(object) || object->marked)
+        return;
+    object->marked = 1;
+    if (object->parent != NULL)
+        object->parent->marked = 1;
+    if (object->kind == OBJECT_MAP)
+        visit_map_entries(object->data, gc_mark_object);
+}
+
+/*
+ * Visits every pointer held outside the heap. Frames only record their
+ * caller, so the walk starts from the running function and follows the
+ * saved function ids down the call stack.
+ */
+static void
+visit_roots(VM *vm, void (*visit)(HeapObject *))
+{
+    size_t i, frame_start, frame_end = vm->call_stack.size;
+    const Function *function = vm->function;
+    HeapObject **pointers;
+
     for (i = 0; i < vm->pointers_stack.size; i++)
-        vm->pointers_stack.data[i]->marked = 1;
-    // TODO: do the same for local pointers
+        visit(vm->pointers_stack.data[i]);
+    if (vm->program != NULL) {
+        for (i = 0; i < vm->program->global_pointers_count; i++)
+            visit(vm->global_pointers[i]);
+    }
+    visit(vm->input.chunk);
+    while (function != NULL && frame_end > 0) {
+        frame_start = frame_end - vm->call_stack.data[frame_end - 1];
+        pointers = local_pointers(vm->call_stack.data + frame_start, function);
+        for (i = 0; i < function->local_pointers_count; i++)
+            visit(pointers[i]);
+        function = vm->call_stack.data[frame_end - 3] == HOST_CALLER
+                       ? NULL
+                       : vm->program->functions + vm->call_stack.data[frame_end - 3];
+        frame_end = frame_start;
+    }
 }
 
 static void
@@ -53,9 +198,10 @@ gc_sweep(VM *vm)
     size_t i;
     for (i = 0; i < vm->objects.size; i++) {
         if (!vm->objects.data[i]->marked) {
-            vm->allocated_heap_size -= vm->objects.data[i]->size;
-            free(vm->objects.data[i]->data);
-            free(vm->objects.data[i]);
+            vm->gc_stats.objects_swept++;
+            vm->gc_stats.bytes_swept += heap_object_size(vm->objects.data[i]);
+            vm->allocated_heap_size -= heap_object_size(vm->objects.data[i]);
+            free_heap_object(vm->objects.data[i]);
             vm->objects.data[i] = vm->objects.data[vm->objects.size - 1];
             vm->objects.size--;
             i--;
@@ -66,6 +212,189 @@ gc_sweep(VM *vm)
     }
 }
 
+static double
+monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void
+record_gc_pause(GCStats *stats, double pause)
+{
+    size_t bucket = 0;
+    double limit = 1e-6;
+
+    while (bucket + 1 < GC_PAUSE_BUCKETS && pause >= limit) {
+        bucket++;
+        limit *= 10;
+    }
+    stats->pause_histogram[bucket]++;
+    stats->total_pause += pause;
+    if (pause > stats->max_pause)
+        stats->max_pause = pause;
+}
+
+/*
+ * The next collection is due once the live heap has grown by the growth
+ * factor, but never later than the configured cap.
+ */
+static void
+update_gc_threshold(VM *vm)
+{
+    double threshold = vm->allocated_heap_size * vm->gc.growth_factor;
+
+    if (threshold < vm->gc.initial_threshold)
+        threshold = vm->gc.initial_threshold;
+    vm->gc_threshold = (size_t) threshold;
+    if (vm->gc.max_heap_size != 0 && vm->gc_threshold > vm->gc.max_heap_size)
+        vm->gc_threshold = vm->gc.max_heap_size;
+}
+
+static void
+check_heap_limit(const VM *vm)
+{
+    if (vm->gc.max_heap_size != 0 && vm->allocated_heap_size > vm->gc.max_heap_size) {
+        fprintf(stderr, "Heap limit exceeded: %zu live bytes, limit is %zu\n",
+                vm->allocated_heap_size, vm->gc.max_heap_size);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+gc_collect(VM *vm)
+{
+    double start = monotonic_seconds();
+
+    visit_roots(vm, gc_mark_object);
+    gc_sweep(vm);
+    vm->gc_stats.collections++;
+    record_gc_pause(&vm->gc_stats, monotonic_seconds() - start);
+    check_heap_limit(vm);
+    update_gc_threshold(vm);
+}
+
+static void free_counted_object(VM *vm, HeapObject *object);
+
+/*
+ * In MEMORY_REFCOUNT mode every slot holding a pointer owns a reference:
+ * the stacks, locals, globals, map entries, a view's parent and the input
+ * chunk. A new object starts with the one reference its creator pushes,
+ * and a pointer popped and then stored or consumed passes its reference
+ * on without touching the count.
+ */
+static void
+retain(const VM *vm, HeapObject *object)
+{
+    if (vm->memory == MEMORY_REFCOUNT && object != NULL && !is_inline_string(object))
+        object->refs++;
+}
+
+static void
+release(VM *vm, HeapObject *object)
+{
+    if (vm->memory == MEMORY_REFCOUNT && object != NULL && !is_inline_string(object) && --object->refs == 0)
+        free_counted_object(vm, object);
+}
+
+static void
+release_map_entries(VM *vm, const HashMap *map)
+{
+    size_t i;
+
+    for (i = 0; i < map->capacity; i++) {
+        if (map->control[i] & 0x80)
+            continue;
+        if (map->flags & MAP_STRING_KEYS)
+            release(vm, (HeapObject *) (uintptr_t) map->slots[i].key);
+        if (map->flags & MAP_POINTER_VALUES)
+            release(vm, (HeapObject *) (uintptr_t) map->slots[i].value);
+    }
+}
+
+/* Unlinks an object nothing points at any more, then drops what it pointed at. */
+static void
+free_counted_object(VM *vm, HeapObject *object)
+{
+    HeapObject *last = vm->objects.data[--vm->objects.size];
+
+    vm->objects.data[object->index] = last;
+    last->index = object->index;
+    vm->gc_stats.objects_swept++;
+    vm->gc_stats.bytes_swept += heap_object_size(object);
+    vm->allocated_heap_size -= heap_object_size(object);
+    release(vm, object->parent);
+    if (object->kind == OBJECT_MAP)
+        release_map_entries(vm, object->data);
+    free_heap_object(object);
+}
+
+static void
+count_reference(HeapObject *object)
+{
+    if (object != NULL && !is_inline_string(object))
+        object->refs++;
+}
+
+/*
+ * Counts every object's references from scratch, for a VM in
+ * MEMORY_REFCOUNT mode whose heap was not built by running the program,
+ * as by load_snapshot().
+ */
+void
+count_references(VM *vm)
+{
+    size_t i;
+
+    for (i = 0; i < vm->objects.size; i++) {
+        vm->objects.data[i]->refs = 0;
+        vm->objects.data[i]->index = i;
+    }
+    visit_roots(vm, count_reference);
+    for (i = 0; i < vm->objects.size; i++) {
+        count_reference(vm->objects.data[i]->parent);
+        if (vm->objects.data[i]->kind == OBJECT_MAP)
+            visit_map_entries(vm->objects.data[i]->data, count_reference);
+    }
+}
+
+int
+is_inline_string(const HeapObject *string)
+{
+    return ((uintptr_t) string & 1) != 0;
+}
+
+HeapObject *
+inline_string(const char *bytes, size_t length)
+{
+    uintptr_t word = (length << 1) | 1;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+        word |= (uintptr_t) (unsigned char) bytes[i] << (8 * (i + 1));
+    return (HeapObject *) word;
+}
+
+size_t
+string_length(const HeapObject *string)
+{
+    return is_inline_string(string) ? ((uintptr_t) string & 0xff) >> 1 : string->size;
+}
+
+/* `buffer` has room for STRING_INLINE_MAX bytes; the bytes of an inline string are copied there. */
+const char *
+string_bytes(const HeapObject *string, char *buffer)
+{
+    size_t i;
+
+    if (!is_inline_string(string))
+        return string->data;
+    for (i = 0; i < STRING_INLINE_MAX; i++)
+        buffer[i] = (char) ((uintptr_t) string >> (8 * (i + 1)));
+    return buffer;
+}
+
 static HeapObject *
 new_heap_object(size_t size)
 {
@@ -73,9 +402,265 @@ new_heap_object(size_t size)
     object->size = size;
     object->data = safe_malloc(size);
     object->marked = 0;
+    object->refs = 1;
+    object->kind = OBJECT_STRING;
+    object->parent = NULL;
     return object;
 }
 
+/* A copy of `bytes`, inline when it fits; one on the heap still has to be passed to add_heap_object(). */
+static HeapObject *
+new_string(const char *bytes, size_t length)
+{
+    HeapObject *object;
+
+    if (length <= STRING_INLINE_MAX)
+        return inline_string(bytes, length);
+    object = new_heap_object(length);
+    memcpy(object->data, bytes, length);
+    return object;
+}
+
+static HeapObject *
+concat_strings(const HeapObject *a, const HeapObject *b)
+{
+    char a_buffer[STRING_INLINE_MAX], b_buffer[STRING_INLINE_MAX], bytes[2 * STRING_INLINE_MAX];
+    size_t a_length = string_length(a), b_length = string_length(b);
+    HeapObject *object;
+
+    if (a_length + b_length <= STRING_INLINE_MAX) {
+        memcpy(bytes, string_bytes(a, a_buffer), a_length);
+        memcpy(bytes + a_length, string_bytes(b, b_buffer), b_length);
+        return inline_string(bytes, a_length + b_length);
+    }
+    object = new_heap_object(a_length + b_length);
+    memcpy(object->data, string_bytes(a, a_buffer), a_length);
+    memcpy((char *) object->data + a_length, string_bytes(b, b_buffer), b_length);
+    return object;
+}
+
+static void
+check_string_range(const HeapObject *string, uint64_t offset, uint64_t length)
+{
+    if (offset > string_length(string) || length > string_length(string) - offset) {
+        fprintf(stderr, "String slice out of bounds: [%zu, %zu) (length %zu)\n",
+                (size_t) offset, (size_t) (offset + length), string_length(string));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Views of views point straight at the owning string, so marking stays one level deep. */
+static HeapObject *
+new_string_view(HeapObject *string, uint64_t offset, uint64_t length)
+{
+    HeapObject *object = safe_malloc(sizeof(HeapObject));
+    object->size = length;
+    object->data = (char *) string->data + offset;
+    object->marked = 0;
+    object->refs = 1;
+    object->kind = OBJECT_STRING_VIEW;
+    object->parent = string->parent != NULL ? string->parent : string;
+    return object;
+}
+
+/* Short slices are copied inline, longer ones are views sharing the string's bytes. */
+static HeapObject *
+slice_string(VM *vm, HeapObject *string, uint64_t offset, uint64_t length)
+{
+    char buffer[STRING_INLINE_MAX];
+    HeapObject *view;
+
+    if (length <= STRING_INLINE_MAX)
+        return inline_string(string_bytes(string, buffer) + offset, length);
+    view = new_string_view(string, offset, length);
+    retain(vm, view->parent);
+    return view;
+}
+
+static uint64_t
+find_string(const HeapObject *haystack, const HeapObject *needle)
+{
+    char haystack_buffer[STRING_INLINE_MAX], needle_buffer[STRING_INLINE_MAX];
+    const char *data = string_bytes(haystack, haystack_buffer), *bytes = string_bytes(needle, needle_buffer);
+    size_t i, size = string_length(haystack), needle_size = string_length(needle);
+
+    if (needle_size == 0)
+        return 0;
+    for (i = 0; needle_size <= size && i <= size - needle_size; i++) {
+        const char *match = memchr(data + i, *bytes, size - needle_size - i + 1);
+        if (match == NULL)
+            break;
+        i = match - data;
+        if (memcmp(match, bytes, needle_size) == 0)
+            return i;
+    }
+    return UINT64_MAX;
+}
+
+static uint64_t
+compare_strings(const HeapObject *a, const HeapObject *b)
+{
+    char a_buffer[STRING_INLINE_MAX], b_buffer[STRING_INLINE_MAX];
+    size_t a_size = string_length(a), b_size = string_length(b);
+    int result = memcmp(string_bytes(a, a_buffer), string_bytes(b, b_buffer), a_size < b_size ? a_size : b_size);
+    if (result == 0)
+        result = a_size < b_size ? -1 : a_size > b_size;
+    return result < 0 ? UINT64_MAX : (uint64_t) (result > 0);
+}
+
+static HeapObject *
+new_array_object(size_t length)
+{
+    HeapObject *object = safe_malloc(sizeof(HeapObject));
+    object->size = length * sizeof(uint64_t);
+    object->data = safe_aligned_malloc(object->size, 64);
+    if (object->data != NULL)
+        memset(object->data, 0, object->size);
+    object->marked = 0;
+    object->refs = 1;
+    object->kind = OBJECT_I64_ARRAY;
+    object->parent = NULL;
+    return object;
+}
+
+static size_t
+array_length(const HeapObject *object)
+{
+    return object->size / sizeof(uint64_t);
+}
+
+static void
+check_array_range(const HeapObject *array, uint64_t start, uint64_t count)
+{
+    if (start > array_length(array) || count > array_length(array) - start) {
+        fprintf(stderr, "Array access out of bounds: [%zu, %zu) (length %zu)\n",
+                start, start + count, array_length(array));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+check_array(const Instruction *instruction, const HeapObject *object)
+{
+    char buff[256];
+
+    if (object == NULL || is_inline_string(object) || object->kind != OBJECT_I64_ARRAY) {
+        instruction_as_string(*instruction, buff, 256);
+        fprintf(stderr, "%s: not an i64 array\n", buff);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* The arrays on top of the pointer stack, for instructions whose helpers pop them. */
+static void
+check_top_arrays(const VM *vm, const Instruction *instruction, size_t count)
+{
+    size_t i;
+
+    for (i = 1; i <= count; i++)
+        check_array(instruction, vm->pointers_stack.data[vm->pointers_stack.size - i]);
+}
+
+static HeapObject *
+new_map_object(uint64_t flags)
+{
+    HeapObject *object = safe_malloc(sizeof(HeapObject));
+    HashMap *map = safe_malloc(sizeof(HashMap));
+    *map = init_hash_map(flags & MAP_KINDS);
+    object->size = hash_map_bytes(map);
+    object->data = map;
+    object->marked = 0;
+    object->refs = 1;
+    object->kind = OBJECT_MAP;
+    object->parent = NULL;
+    return object;
+}
+
+/* `flags` are the NewMap flags the instruction expects; `mask` selects the ones it cares about. */
+static void
+check_map(const Instruction *instruction, const HeapObject *object, uint8_t flags, uint8_t mask)
+{
+    char buff[256];
+
+    if (object == NULL || is_inline_string(object) || object->kind != OBJECT_MAP) {
+        instruction_as_string(*instruction, buff, 256);
+        fprintf(stderr, "%s: not a map\n", buff);
+        exit(EXIT_FAILURE);
+    }
+    if ((((const HashMap *) object->data)->flags & mask) != flags) {
+        instruction_as_string(*instruction, buff, 256);
+        fprintf(stderr, "%s: the map has %s keys and %s values\n", buff,
+                ((const HashMap *) object->data)->flags & MAP_STRING_KEYS ? "string" : "i64",
+                ((const HashMap *) object->data)->flags & MAP_POINTER_VALUES ? "pointer" : "i64");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint64_t
+map_get(const HeapObject *object, uint64_t key)
+{
+    const HashMap *map = object->data;
+    const MapSlot *slot = hash_map_find(map, key);
+    const HeapObject *string = (const HeapObject *) (uintptr_t) key;
+    char buffer[STRING_INLINE_MAX];
+
+    if (slot != NULL)
+        return slot->value;
+    if (map->flags & MAP_STRING_KEYS)
+        fprintf(stderr, "Map key not found: \"%.*s\"\n", (int) string_length(string), string_bytes(string, buffer));
+    else
+        fprintf(stderr, "Map key not found: %zu\n", (size_t) key);
+    exit(EXIT_FAILURE);
+}
+
+static int
+map_contains(const HeapObject *object, uint64_t key)
+{
+    return hash_map_find(object->data, key) != NULL;
+}
+
+/*
+ * The table only grows here, so this is where the heap accounting catches
+ * up. The map takes over the references to the value and to a new key.
+ */
+static void
+map_put(VM *vm, HeapObject *object, uint64_t key, uint64_t value)
+{
+    HashMap *map = object->data;
+    size_t size = map->size;
+    MapSlot *slot = hash_map_insert(map, key);
+
+    if (map->size == size && (map->flags & MAP_STRING_KEYS))
+        release(vm, (HeapObject *) (uintptr_t) key);
+    if (map->flags & MAP_POINTER_VALUES)
+        release(vm, (HeapObject *) (uintptr_t) slot->value);
+    slot->value = value;
+    if (hash_map_bytes(map) != object->size) {
+        vm->allocated_heap_size += hash_map_bytes(map) - object->size;
+        object->size = hash_map_bytes(map);
+        if (vm->allocated_heap_size > vm->gc_stats.peak_heap_size)
+            vm->gc_stats.peak_heap_size = vm->allocated_heap_size;
+    }
+}
+
+static void
+map_remove(VM *vm, HeapObject *object, uint64_t key)
+{
+    HashMap *map = object->data;
+    MapSlot *slot, removed;
+
+    if (vm->memory == MEMORY_REFCOUNT && (slot = hash_map_find(map, key)) != NULL) {
+        removed = *slot;
+        hash_map_remove(map, key);
+        if (map->flags & MAP_STRING_KEYS)
+            release(vm, (HeapObject *) (uintptr_t) removed.key);
+        if (map->flags & MAP_POINTER_VALUES)
+            release(vm, (HeapObject *) (uintptr_t) removed.value);
+        return;
+    }
+    hash_map_remove(map, key);
+}
+
 static void
 add_heap_object(VM *vm, HeapObject *object)
 {
@@ -83,12 +668,15 @@ add_heap_object(VM *vm, HeapObject *object)
         vm->objects.capacity *= 2;
         vm->objects.data = safe_realloc(vm->objects.data, vm->objects.capacity * sizeof(HeapObject));
     }
+    object->index = vm->objects.size;
     vm->objects.data[vm->objects.size++] = object;
-    vm->allocated_heap_size += object->size;
-    if (vm->allocated_heap_size > GC_LIMIT) {
-        gc_mark_all(vm);
-        gc_sweep(vm);
-    }
+    vm->allocated_heap_size += heap_object_size(object);
+    if (vm->allocated_heap_size > vm->gc_stats.peak_heap_size)
+        vm->gc_stats.peak_heap_size = vm->allocated_heap_size;
+    if (vm->memory == MEMORY_REFCOUNT)
+        check_heap_limit(vm);
+    else if (vm->allocated_heap_size > vm->gc_threshold)
+        gc_collect(vm);
 }
 
 static void
@@ -99,6 +687,8 @@ push_stack(VM *vm, uint64_t value)
         vm->operands_stack.data = safe_realloc(vm->operands_stack.data, vm->operands_stack.capacity * sizeof(uint64_t));
     }
     vm->operands_stack.data[vm->operands_stack.size++] = value;
+    if (vm->operands_stack.size > vm->gc_stats.operands_stack_high_water)
+        vm->gc_stats.operands_stack_high_water = vm->operands_stack.size;
 }
 
 static void
@@ -110,6 +700,17 @@ push_pointer_stack(VM *vm, HeapObject *value)
             safe_realloc(vm->pointers_stack.data, vm->pointers_stack.capacity * sizeof(uint64_t *));
     }
     vm->pointers_stack.data[vm->pointers_stack.size++] = value;
+    if (vm->pointers_stack.size > vm->gc_stats.pointers_stack_high_water)
+        vm->gc_stats.pointers_stack_high_water = vm->pointers_stack.size;
+}
+
+/* Pushes a new string, which the collector tracks unless it is inline. */
+static void
+push_string(VM *vm, HeapObject *string)
+{
+    push_pointer_stack(vm, string);
+    if (!is_inline_string(string))
+        add_heap_object(vm, string);
 }
 
 static uint64_t
@@ -124,12 +725,266 @@ pop_pointer_stack(VM *vm)
     return vm->pointers_stack.data[--vm->pointers_stack.size];
 }
 
+/*
+ * Reads more input after the unread bytes, returning 0 at end of input.
+ * A full chunk is replaced rather than reused, since lines may still point
+ * into it; its unread bytes move to the new one, which doubles for as long
+ * as they would fill more than half of it.
+ */
+static int
+read_input(VM *vm)
+{
+    InputBuffer *input = &vm->input;
+    size_t pending = input->end - input->start, size = input->chunk_size;
+    HeapObject *chunk;
+    ssize_t count;
+
+    if (input->eof)
+        return 0;
+    if (input->chunk == NULL || input->end == input->chunk->size) {
+        while (pending * 2 > size)
+            size *= 2;
+        chunk = new_heap_object(size);
+        if (pending > 0)
+            memcpy(chunk->data, (char *) input->chunk->data + input->start, pending);
+        release(vm, input->chunk);
+        input->chunk = chunk;
+        input->start = 0;
+        input->end = pending;
+        add_heap_object(vm, chunk);
+    }
+    do {
+        count = read(input->fd, (char *) input->chunk->data + input->end, input->chunk->size - input->end);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+        fprintf(stderr, "Failed to read input: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (count == 0) {
+        input->eof = 1;
+        return 0;
+    }
+    input->end += count;
+    return 1;
+}
+
+/* The byte `offset` past the unread position, reading as far as needed, or EOF. */
+static int
+peek_input(VM *vm, size_t offset)
+{
+    while (vm->input.chunk == NULL || vm->input.start + offset >= vm->input.end) {
+        if (!read_input(vm))
+            return EOF;
+    }
+    return ((const unsigned char *) vm->input.chunk->data)[vm->input.start + offset];
+}
+
+/* Pushes the next line, without its line break, and 1; an empty string and 0 at end of input. */
+static void
+read_line(VM *vm)
+{
+    InputBuffer *input = &vm->input;
+    const char *newline;
+    size_t scanned = 0, start, length;
+    int more;
+
+    if (input->chunk == NULL)
+        read_input(vm);
+    while ((newline = memchr((char *) input->chunk->data + input->start + scanned, '\n',
+                             input->end - input->start - scanned)) == NULL) {
+        scanned = input->end - input->start;
+        if (!read_input(vm))
+            break;
+    }
+    length = newline != NULL ? (size_t) (newline - (char *) input->chunk->data) - input->start
+                             : input->end - input->start;
+    start = input->start;
+    input->start += length + (newline != NULL);
+    more = newline != NULL || length > 0;
+    if (length > 0 && ((char *) input->chunk->data)[start + length - 1] == '\r')
+        length--;
+    push_string(vm, slice_string(vm, input->chunk, start, length));
+    push_stack(vm, more);
+}
+
+/*
+ * Skips white space and pushes the decimal integer after it, and 1; 0 and
+ * 0 at end of input. Anything but an integer there is an error.
+ */
+static void
+read_i64(VM *vm)
+{
+    uint64_t value = 0;
+    size_t sign, length;
+    int c, negative;
+
+    while ((c = peek_input(vm, 0)) != EOF && isspace(c))
+        vm->input.start++;
+    if (c == EOF) {
+        push_stack(vm, 0);
+        push_stack(vm, 0);
+        return;
+    }
+    negative = c == '-';
+    sign = negative || c == '+';
+    for (length = sign; (c = peek_input(vm, length)) >= '0' && c <= '9'; length++)
+        value = value * 10 + (c - '0');
+    if (length == sign || (c != EOF && !isspace(c))) {
+        fprintf(stderr, "Invalid input: expected an integer, got \"%.*s\"\n", (int) (length + (c != EOF)),
+                (const char *) vm->input.chunk->data + vm->input.start);
+        exit(EXIT_FAILURE);
+    }
+    vm->input.start += length;
+    push_stack(vm, negative ? -value : value);
+    push_stack(vm, 1);
+}
+
+/* Pushes everything left to read, gathered into one chunk. */
+static void
+read_all(VM *vm)
+{
+    size_t start;
+
+    while (read_input(vm))
+        continue;
+    start = vm->input.start;
+    vm->input.start = vm->input.end;
+    push_string(vm, slice_string(vm, vm->input.chunk, start, vm->input.end - start));
+}
+
+/* For element-wise operations on the two arrays on top of the pointer stack. */
+static void
+check_same_length(const VM *vm)
+{
+    const HeapObject *a = vm->pointers_stack.data[vm->pointers_stack.size - 2];
+    const HeapObject *b = vm->pointers_stack.data[vm->pointers_stack.size - 1];
+    if (a->size != b->size) {
+        fprintf(stderr, "Array length mismatch: %zu and %zu\n", array_length(a), array_length(b));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Element-wise operations write their result into the first array. */
+static void
+array_binary(VM *vm, void (*kernel)(uint64_t *, const uint64_t *, size_t))
+{
+    HeapObject *b = pop_pointer_stack(vm);
+    HeapObject *a = pop_pointer_stack(vm);
+    kernel(a->data, b->data, array_length(a));
+    release(vm, a);
+    release(vm, b);
+}
+
+static void
+array_binary_scalar(VM *vm, void (*kernel)(uint64_t *, uint64_t, size_t))
+{
+    uint64_t b = pop_stack(vm);
+    HeapObject *a = pop_pointer_stack(vm);
+    kernel(a->data, b, array_length(a));
+    release(vm, a);
+}
+
+static void
+array_reduce(VM *vm, uint64_t (*kernel)(const uint64_t *, size_t))
+{
+    HeapObject *a = pop_pointer_stack(vm);
+    push_stack(vm, kernel(a->data, array_length(a)));
+    release(vm, a);
+}
+
+/* Comparisons push a new array holding 1 where the predicate holds, 0 elsewhere. */
+static void
+array_compare(VM *vm, void (*kernel)(uint64_t *, const uint64_t *, const uint64_t *, size_t))
+{
+    HeapObject *b = pop_pointer_stack(vm);
+    HeapObject *a = pop_pointer_stack(vm);
+    HeapObject *mask;
+    mask = new_array_object(array_length(a));
+    kernel(mask->data, a->data, b->data, array_length(a));
+    release(vm, a);
+    release(vm, b);
+    push_pointer_stack(vm, mask);
+    add_heap_object(vm, mask);
+}
+
 static size_t
 get_stack_frame_size(VM *vm)
 {
     return vm->call_stack.data[vm->call_stack.size - 1];
 }
 
+/*
+ * Arguments are passed in place, and results replace them, so a native
+ * call never allocates unless the operand stack has to grow.
+ */
+static void
+call_native(VM *vm, const Native *native)
+{
+    size_t i, base = vm->operands_stack.size - native->args_count;
+
+    if (base + native->results_count > vm->operands_stack.capacity) {
+        while (base + native->results_count > vm->operands_stack.capacity)
+            vm->operands_stack.capacity *= 2;
+        vm->operands_stack.data = safe_realloc(vm->operands_stack.data, vm->operands_stack.capacity * sizeof(uint64_t));
+    }
+    native->function(vm->operands_stack.data + base,
+                     vm->pointers_stack.data + vm->pointers_stack.size - native->ptr_args_count);
+    vm->operands_stack.size = base + native->results_count;
+    for (i = 0; i < native->ptr_args_count; i++)
+        release(vm, pop_pointer_stack(vm));
+    if (vm->operands_stack.size > vm->gc_stats.operands_stack_high_water)
+        vm->gc_stats.operands_stack_high_water = vm->operands_stack.size;
+}
+
+/* Verifies the function the first time, and starts the workers the first time any is run. */
+static WorkerPool *
+parallel_workers(VM *vm, const Program *program, const Instruction *instruction, size_t args_count)
+{
+    char buff[256];
+
+    if (vm->workers == NULL)
+        vm->workers = init_worker_pool(vm, vm->threads);
+    if (!check_parallel_function(vm->workers, program, instruction->data.reg, args_count)) {
+        instruction_as_string(*instruction, buff, 256);
+        fprintf(stderr, "%s: the function must be pure and take %zu i64 argument%s\n", buff, args_count,
+                args_count == 1 ? "" : "s");
+        exit(EXIT_FAILURE);
+    }
+    return vm->workers;
+}
+
+static void
+parallel_map_i64(VM *vm, const Program *program, const Instruction *instruction)
+{
+    HeapObject *array = pop_pointer_stack(vm);
+    parallel_map(parallel_workers(vm, program, instruction, 1), program, instruction->data.reg, array->data,
+                 array_length(array));
+    release(vm, array);
+}
+
+static void
+parallel_reduce_i64(VM *vm, const Program *program, const Instruction *instruction)
+{
+    HeapObject *array = pop_pointer_stack(vm);
+    uint64_t initial = pop_stack(vm);
+    push_stack(vm, parallel_reduce(parallel_workers(vm, program, instruction, 2), program, instruction->data.reg,
+                                   initial, array->data, array_length(array)));
+    release(vm, array);
+}
+
+/* A returning frame drops its local pointers, pointer arguments included. */
+static void
+release_local_pointers(VM *vm, const Function *function)
+{
+    HeapObject **pointers = local_pointers(vm->locals, function);
+    size_t i;
+
+    if (vm->memory != MEMORY_REFCOUNT)
+        return;
+    for (i = 0; i < function->local_pointers_count; i++)
+        release(vm, pointers[i]);
+}
+
 static void
 pop_stack_frame(VM *vm)
 {
@@ -137,11 +992,26 @@ pop_stack_frame(VM *vm)
     vm->locals = vm->call_stack.data + vm->call_stack.size - get_stack_frame_size(vm);
 }
 
+/*
+ * A lazily assembled program is only logically const: a body is filled in
+ * the first time it is entered.
+ */
+static void
+assemble_on_entry(const Program *program, size_t id)
+{
+    if (program->functions[id].body != NULL)
+        assemble_body((Function *) (program->functions + id));
+}
+
 static void
 call_function(VM *vm, const Program *program, size_t current_function, size_t current_instruction, size_t next_function)
 {
     uint64_t i;
-    Function function = program->functions[next_function];
+    Function function;
+    HeapObject **pointers;
+
+    assemble_on_entry(program, next_function);
+    function = program->functions[next_function];
 
     if (vm->call_stack.size + function.stack_frame_size >= vm->call_stack.capacity) {
         vm->call_stack.capacity *= 2;
@@ -153,131 +1023,383 @@ call_function(VM *vm, const Program *program, size_t current_function, size_t cu
     vm->call_stack.data[vm->call_stack.size - 1] = function.stack_frame_size;
     vm->call_stack.data[vm->call_stack.size - 2] = current_instruction;
     vm->call_stack.data[vm->call_stack.size - 3] = current_function;
+    if (vm->call_stack.size > vm->gc_stats.call_stack_high_water)
+        vm->gc_stats.call_stack_high_water = vm->call_stack.size;
 
     for (i = function.args_count - 1; i != -1; i--)
         vm->locals[i] = pop_stack(vm);
+
+    pointers = local_pointers(vm->locals, &function);
+    for (i = function.local_pointers_count; i > function.ptr_args_count; i--)
+        pointers[i - 1] = NULL;
+    for (i = function.ptr_args_count; i > 0; i--)
+        pointers[i - 1] = pop_pointer_stack(vm);
+}
+
+static void
+init_memo_caches(VM *vm, const Program *program)
+{
+    size_t i;
+    int any_pure = 0;
+
+    if (vm->memo_capacity == 0 || vm->memo_caches != NULL)
+        return;
+    for (i = 0; i < program->functions_count; i++)
+        any_pure |= program->functions[i].pure;
+    if (!any_pure)
+        return;
+
+    vm->memo_caches_count = program->functions_count;
+    vm->memo_caches = safe_malloc(vm->memo_caches_count * sizeof(MemoCache));
+    memset(vm->memo_caches, 0, vm->memo_caches_count * sizeof(MemoCache));
+    for (i = 0; i < program->functions_count; i++) {
+        if (program->functions[i].pure)
+            vm->memo_caches[i] = init_memo_cache(program->functions[i].args_count, vm->memo_capacity);
+    }
+}
+
+/*
+ * Returns 1 when the call was answered from the cache. Otherwise the
+ * arguments are saved as the key, to be stored with the result once the
+ * callee's frame returns.
+ */
+static int
+memo_enter(VM *vm, const Function *function)
+{
+    MemoCache *cache = vm->memo_caches + function->id;
+    uint64_t *args = vm->operands_stack.data + vm->operands_stack.size - function->args_count;
+    MemoFrame *frame;
+    uint64_t result;
+    size_t i;
+
+    if (memo_lookup(cache, args, &result)) {
+        vm->operands_stack.size -= function->args_count;
+        push_stack(vm, result);
+        return 1;
+    }
+
+    if (vm->memo_frames_size >= vm->memo_frames_capacity) {
+        vm->memo_frames_capacity = vm->memo_frames_capacity ? vm->memo_frames_capacity * 2 : 64;
+        vm->memo_frames = safe_realloc(vm->memo_frames, vm->memo_frames_capacity * sizeof(MemoFrame));
+    }
+    frame = vm->memo_frames + vm->memo_frames_size++;
+    frame->function = function->id;
+    frame->call_depth = vm->call_stack.size + function->stack_frame_size;
+    frame->operands_size = vm->operands_stack.size - function->args_count;
+    frame->key_offset = vm->memo_keys.size;
+
+    if (vm->memo_keys.size + function->args_count > vm->memo_keys.capacity) {
+        vm->memo_keys.capacity = (vm->memo_keys.size + function->args_count) * 2;
+        vm->memo_keys.data = safe_realloc(vm->memo_keys.data, vm->memo_keys.capacity * sizeof(uint64_t));
+    }
+    for (i = 0; i < function->args_count; i++)
+        vm->memo_keys.data[vm->memo_keys.size++] = args[i];
+    return 0;
+}
+
+/* Only calls that left exactly one value on the operand stack are cached. */
+static void
+memo_leave(VM *vm)
+{
+    MemoFrame *frame = vm->memo_frames + --vm->memo_frames_size;
+    if (vm->operands_stack.size == frame->operands_size + 1)
+        memo_insert(vm->memo_caches + frame->function,
+                    vm->memo_keys.data + frame->key_offset,
+                    vm->operands_stack.data[vm->operands_stack.size - 1]);
+    vm->memo_keys.size = frame->key_offset;
 }
 
+/*
+ * Globals and global pointers are allocated once, back to back, in a
+ * zeroed block aligned to a cache line.
+ */
 void
-execute_program(Program program)
+init_globals(VM *vm, const Program *program)
+{
+    size_t size = (program->globals_count + program->global_pointers_count) * sizeof(uint64_t);
+
+    size = (size + 63) & ~(size_t) 63;
+    vm->globals = safe_aligned_malloc(size, 64);
+    if (vm->globals != NULL)
+        memset(vm->globals, 0, size);
+    vm->global_pointers = (HeapObject **) (vm->globals + program->globals_count);
+}
+
+void
+print_memo_stats(const VM *vm)
+{
+    size_t i;
+    for (i = 0; i < vm->memo_caches_count; i++) {
+        const MemoCache *cache = vm->memo_caches + i;
+        if (cache->entries == NULL)
+            continue;
+        fprintf(stderr,
+                "Function :%zu memo: %zu hits, %zu misses, %zu evictions, %zu entries\n",
+                vm->program != NULL && i < vm->program->functions_count ? vm->program->functions[i].source_id : i,
+                cache->hits, cache->misses, cache->evictions, cache->size);
+    }
+}
+
+void
+print_gc_stats(const VM *vm)
+{
+    static const char *buckets[GC_PAUSE_BUCKETS] = {
+        "<1us", "<10us", "<100us", "<1ms", "<10ms", "<100ms", ">=100ms",
+    };
+    const GCStats *stats = &vm->gc_stats;
+    size_t i;
+
+    fprintf(stderr, "GC collections: %zu\n", stats->collections);
+    fprintf(stderr, "GC pause: %.3f ms total, %.3f ms max\n", stats->total_pause * 1e3, stats->max_pause * 1e3);
+    for (i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (stats->pause_histogram[i] > 0)
+            fprintf(stderr, "  %-8s %zu\n", buckets[i], stats->pause_histogram[i]);
+    }
+    fprintf(stderr, "GC swept: %zu objects, %zu bytes\n", stats->objects_swept, stats->bytes_swept);
+    fprintf(stderr, "Heap: %zu bytes live, %zu bytes peak\n", vm->allocated_heap_size, stats->peak_heap_size);
+    fprintf(stderr, "Stack high-water marks: call %zu, operands %zu, pointers %zu\n",
+            stats->call_stack_high_water, stats->operands_stack_high_water, stats->pointers_stack_high_water);
+}
+
+static void
+check_divisor(const Instruction *instruction, uint64_t divisor)
 {
-    VM vm = init_vm();
     char buff[256];
-    Function *func = program.functions;
-    Instruction *instr;
-
-    vm.call_stack.size = func->stack_frame_size;
-    vm.locals = vm.call_stack.data;
-    vm.call_stack.data[vm.call_stack.size - 1] = vm.call_stack.size;
-    vm.call_stack.data[vm.call_stack.size - 2] = 0;
-    vm.call_stack.data[vm.call_stack.size - 3] = 0;
-    for (instr = func->instructions;; instr++) {
-        switch (instr->op) {
-            case OP_PUSH_I64:
-                push_stack(&vm, instr->data.immediate);
-                break;
-            case OP_LOAD_LOCAL_I64:
-                push_stack(&vm, vm.locals[instr->data.reg]);
-                break;
-            case OP_ADD_I64_RI:
-                push_stack(&vm, vm.locals[instr->data.ri.reg] + instr->data.ri.immediate);
-                break;
-            case OP_ADD_I64:
-                push_stack(&vm, pop_stack(&vm) + pop_stack(&vm));
-                break;
-            case OP_SUB_I64_RI:
-                push_stack(&vm, vm.locals[instr->data.ri.reg] - instr->data.ri.immediate);
-                break;
-            case OP_SUB_I64: {
-                uint64_t b = pop_stack(&vm);
-                uint64_t a = pop_stack(&vm);
-                push_stack(&vm, a - b);
-            }
-                break;
-            case OP_MUL_I64:
-                push_stack(&vm, pop_stack(&vm) * pop_stack(&vm));
-                break;
-            case OP_DIV_I64: {
-                uint64_t b = pop_stack(&vm);
-                uint64_t a = pop_stack(&vm);
-                push_stack(&vm, a / b);
-            }
-                break;
-            case OP_MOD_I64: {
-                uint64_t b = pop_stack(&vm);
-                uint64_t a = pop_stack(&vm);
-                push_stack(&vm, a % b);
-            }
-                break;
-            case OP_LESS_THAN_I64_RI:
-                push_stack(&vm, vm.locals[instr->data.ri.reg] < instr->data.ri.immediate);
-                break;
-            case OP_LESS_THAN_I64:
-                push_stack(&vm, pop_stack(&vm) > pop_stack(&vm));
-                break;
-            case OP_GREATER_THAN_I64:
-                push_stack(&vm, pop_stack(&vm) < pop_stack(&vm));
-                break;
-            case OP_EQUALS_I64:
-                push_stack(&vm, pop_stack(&vm) == pop_stack(&vm));
-                break;
-            case OP_NOT_EQUALS_I64:
-                push_stack(&vm, pop_stack(&vm) != pop_stack(&vm));
-                break;
-            case OP_NOT:
-                push_stack(&vm, !pop_stack(&vm));
-                break;
-            case OP_JUMP_IF_FALSE:
-                if (!pop_stack(&vm)) {
-                    instr = func->instructions + instr->data.reg - 1;
-                }
-                break;
-            case OP_PRINT_TOP_STACK_I64:
-                printf("%zu\n", pop_stack(&vm));
-                break;
-            case OP_EXIT:
-                goto end;
-            case OP_CALL:
-                call_function(&vm, &program, func - program.functions, instr - func->instructions, instr->data.reg);
-                func = program.functions + instr->data.reg;
-                instr = func->instructions - 1;
-                break;
-            case OP_RETURN: {
-                func = program.functions + vm.call_stack.data[vm.call_stack.size - 3];
-                instr = func->instructions + vm.call_stack.data[vm.call_stack.size - 2];
-                pop_stack_frame(&vm);
-            }
-                break;
-            case OP_PUSH_LITERAL_STRING: {
-                HeapObject *object = new_heap_object(instr->data.string.size);
-                memcpy(object->data, instr->data.string.ptr, instr->data.string.size);
-                push_pointer_stack(&vm, object);
-                add_heap_object(&vm, object);
-            }
-                break;
-            case OP_CONCAT_STRINGS: {
-                HeapObject *b = pop_pointer_stack(&vm);
-                HeapObject *a = pop_pointer_stack(&vm);
-                HeapObject *object = new_heap_object(a->size + b->size);
-                memcpy(object->data, a->data, a->size);
-                memcpy(object->data + a->size, b->data, b->size);
-                push_pointer_stack(&vm, object);
-                add_heap_object(&vm, object);
-            }
-                break;
-            case OP_PRINT_STRING: {
-                HeapObject *object = pop_pointer_stack(&vm);
-                size_t i;
-                for (i = 0; i < object->size; i++)
-                    putchar(((char *) object->data)[i]);
-            }
+
+    if (divisor != 0)
+        return;
+    instruction_as_string(*instruction, buff, 256);
+    fprintf(stderr, "%s: division by zero\n", buff);
+    exit(EXIT_FAILURE);
+}
+
+static void
+check_index(const Instruction *instruction, const char *kind, size_t index, size_t count)
+{
+    char buff[256];
+
+    if (index < count)
+        return;
+    instruction_as_string(*instruction, buff, 256);
+    fprintf(stderr, "%s: no %s %zu, there are %zu\n", buff, kind, index, count);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Validates an instruction's operands against the running function and
+ * the program, and the stacks against the pops in the opcode table, before
+ * the checked interpreter runs it.
+ */
+static void
+check_instruction(const VM *vm, const Function *function, const Instruction *instruction)
+{
+    const Program *program = vm->program;
+    size_t operand_pops, pointer_pops;
+    char buff[256];
+
+    if (instruction->op >= OPCODES_COUNT)
+        return; // reported as an unknown instruction
+    operand_pops = opcodes[instruction->op].operand_pops;
+    pointer_pops = opcodes[instruction->op].pointer_pops;
+    switch (opcodes[instruction->op].operands) {
+        case OPERANDS_LOCAL:
+            check_index(instruction, "local", instruction->data.reg, function->locals_count);
+            break;
+        case OPERANDS_LOCAL_POINTER:
+            check_index(instruction, "local pointer", instruction->data.reg, function->local_pointers_count);
+            break;
+        case OPERANDS_GLOBAL:
+            check_index(instruction, "global", instruction->data.reg, program->globals_count);
+            break;
+        case OPERANDS_GLOBAL_POINTER:
+            check_index(instruction, "global pointer", instruction->data.reg, program->global_pointers_count);
+            break;
+        case OPERANDS_LOCAL_IMMEDIATE:
+            check_index(instruction, "local", instruction->data.ri.reg, function->locals_count);
+            break;
+        case OPERANDS_TARGET:
+            check_index(instruction, "instruction", instruction->data.reg, function->instructions_count);
+            break;
+        case OPERANDS_FUNCTION:
+            check_index(instruction, "function", instruction->data.reg, program->functions_count);
+            if (instruction->op != OP_CALL)
                 break;
-            default:
-                instruction_as_string(*instr, buff, 256);
-                fprintf(stderr, "Unknown instruction: %s\n", buff);
+            operand_pops = program->functions[instruction->data.reg].args_count;
+            pointer_pops = program->functions[instruction->data.reg].ptr_args_count;
+            break;
+        case OPERANDS_NATIVE:
+            check_index(instruction, "native", instruction->data.reg, vm->natives_count);
+            if (vm->natives[instruction->data.reg].function == NULL) {
+                instruction_as_string(*instruction, buff, 256);
+                fprintf(stderr, "%s: native %zu is not registered\n", buff, instruction->data.reg);
                 exit(EXIT_FAILURE);
-        }
+            }
+            operand_pops = vm->natives[instruction->data.reg].args_count;
+            pointer_pops = vm->natives[instruction->data.reg].ptr_args_count;
+            break;
+        case OPERANDS_LOCAL_TARGET:
+        case OPERANDS_LOCAL_LIMIT_TARGET:
+            check_index(instruction, "local", instruction->data.loop.reg, function->locals_count);
+            check_index(instruction, "instruction", instruction->data.loop.target, function->instructions_count);
+            break;
+        default:
+            break;
+    }
+    if (vm->operands_stack.size < operand_pops || vm->pointers_stack.size < pointer_pops) {
+        instruction_as_string(*instruction, buff, 256);
+        fprintf(stderr, "%s: stack underflow\n", buff);
+        exit(EXIT_FAILURE);
     }
-    end:
+}
+
+/* Jumps count in `taken`, falling through a conditional one in `not_taken`. */
+static void
+count_edge(VM *vm, const Function *func, const Instruction *instr, int taken)
+{
+    FunctionProfile *profile = vm->profile->functions + (func - vm->program->functions);
+    if (taken)
+        profile->taken[instr - func->instructions]++;
+    else
+        profile->not_taken[instr - func->instructions]++;
+}
+
+/*
+ * Fuel is only spent where control can come back around: a call costs
+ * one, a backward jump the length of the loop it closes, so fuel roughly
+ * counts instructions. Returns 0, with the VM paused before `next`, when
+ * there is not enough left; resume_program() continues from there once
+ * the host tops vm->fuel up.
+ */
+static int
+charge_fuel(VM *vm, const Function *func, const Instruction *next, uint64_t cost)
+{
+    if (vm->fuel >= cost) {
+        vm->fuel -= cost;
+        return 1;
+    }
+    vm->fuel = 0;
+    vm->resume_instruction = next - func->instructions;
+    vm->paused = 1;
+    vm->out_of_fuel = 1;
+    return 0;
+}
+
+/* Forward jumps are free. */
+static int
+charge_jump(VM *vm, const Function *func, const Instruction *instr, size_t target)
+{
+    size_t position = instr - func->instructions;
+    return target > position || charge_fuel(vm, func, func->instructions + target, position - target + 1);
+}
+
+#define VM_CHECKED 1
+#define VM_DEBUGGED 0
+#define EXECUTE execute_checked
+#include "vm_execute.h"
+#undef EXECUTE
+#undef VM_DEBUGGED
+#undef VM_CHECKED
+
+#define VM_CHECKED 0
+#define VM_DEBUGGED 0
+#define EXECUTE execute_fast
+#include "vm_execute.h"
+#undef EXECUTE
+#undef VM_DEBUGGED
+#undef VM_CHECKED
+
+#define VM_CHECKED 1
+#define VM_DEBUGGED 1
+#define EXECUTE execute_debugged
+#include "vm_execute.h"
+#undef EXECUTE
+#undef VM_DEBUGGED
+#undef VM_CHECKED
+
+static void
+execute(VM *vm, const Program *program, const Instruction *instr)
+{
+    if (vm->debugger != NULL)
+        execute_debugged(vm, program, instr);
+    else if (vm->checked)
+        execute_checked(vm, program, instr);
+    else
+        execute_fast(vm, program, instr);
+}
+
+/*
+ * Calls function `id` on the arguments in `args` and runs it to its
+ * Return, for a host rather than a Call instruction; the VM must not be
+ * running anything else. The function must leave exactly one i64.
+ */
+uint64_t
+invoke_i64_function(VM *vm, const Program *program, size_t id, const uint64_t *args)
+{
+    const Function *function = program->functions + id;
+    size_t i;
+
+    init_memo_caches(vm, program);
+    vm->program = program;
+    vm->operands_stack.size = 0;
+    for (i = 0; i < function->args_count; i++)
+        push_stack(vm, args[i]);
+    call_function(vm, program, HOST_CALLER, 0, id);
+    vm->function = function;
+    execute(vm, program, function->instructions);
+    if (vm->operands_stack.size != 1) {
+        fprintf(stderr, "Function :%zu left %zu values on the stack, it must return one i64\n", id,
+                vm->operands_stack.size);
+        exit(EXIT_FAILURE);
+    }
+    return vm->operands_stack.data[0];
+}
+
+void
+run_program(VM *vm, const Program *program)
+{
+    const Function *func = program->functions;
+
+    assemble_on_entry(program, 0);
+    init_memo_caches(vm, program);
+    init_globals(vm, program);
+    update_gc_threshold(vm);
+    vm->program = program;
+    vm->function = func;
+    vm->call_stack.size = func->stack_frame_size;
+    vm->locals = vm->call_stack.data;
+    vm->call_stack.data[vm->call_stack.size - 1] = vm->call_stack.size;
+    vm->call_stack.data[vm->call_stack.size - 2] = 0;
+    vm->call_stack.data[vm->call_stack.size - 3] = 0;
+    memset(local_pointers(vm->locals, func), 0, func->local_pointers_count * sizeof(HeapObject *));
+    vm->gc_stats.call_stack_high_water = vm->call_stack.size;
+    if (vm->profile != NULL)
+        vm->profile->functions[0].calls++;
+    if (vm->debugger != NULL)
+        vm->debugger->stopped = 0;
+    execute(vm, program, func->instructions);
+}
+
+/*
+ * Continues a VM paused by Snapshot, or one restored from a snapshot file,
+ * at the instruction after the Snapshot; or one that ran out of fuel or
+ * stopped in its debugger where it stopped.
+ */
+void
+resume_program(VM *vm, const Program *program)
+{
+    init_memo_caches(vm, program);
+    update_gc_threshold(vm);
+    vm->program = program;
+    vm->paused = 0;
+    vm->out_of_fuel = 0;
+    vm->locals = vm->call_stack.data + vm->call_stack.size - get_stack_frame_size(vm);
+    execute(vm, program, vm->function->instructions + vm->resume_instruction);
+}
+
+void
+execute_program(Program program)
+{
+    VM vm = init_vm();
+    run_program(&vm, &program);
     free_vm(vm);
 }
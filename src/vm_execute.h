@@ -0,0 +1,552 @@
+/*
+ * The body of the stack interpreter, included three times by vm.c: once with
+ * VM_CHECKED set, which validates every instruction against the opcode
+ * table and guards division and heap accesses, and once without, where
+ * every CHECK() compiles to nothing. The third copy is also VM_DEBUGGED,
+ * the only one where DEBUG_HOOK() runs the attached Debugger's hooks.
+ */
+#if VM_CHECKED
+#define CHECK(check) check
+#else
+#define CHECK(check)
+#endif
+
+#if VM_DEBUGGED
+#define DEBUG_HOOK(hook) hook
+#else
+#define DEBUG_HOOK(hook)
+#endif
+
+/*
+ * Runs from `instr` in vm->function until Exit, until a Snapshot, running
+ * out of fuel or a debugger stop pauses the VM, or until a function called by the host returns.
+ */
+static void
+EXECUTE(VM *vm, const Program *program, const Instruction *instr)
+{
+    char buff[256];
+    const Function *func = vm->function;
+    int taken;
+
+    for (;; instr++) {
+        DEBUG_HOOK(if (debug_stop(vm, func, instr)) return;)
+        CHECK(check_instruction(vm, func, instr));
+        switch (instr->op) {
+            case OP_NOOP:
+                break;
+            case OP_PUSH_I64:
+                push_stack(vm, instr->data.immediate);
+                break;
+            case OP_LOAD_LOCAL_I64:
+                push_stack(vm, vm->locals[instr->data.reg]);
+                break;
+            case OP_STORE_LOCAL_I64:
+                vm->locals[instr->data.reg] = pop_stack(vm);
+                break;
+            case OP_LOAD_LOCAL_POINTER:
+                retain(vm, local_pointers(vm->locals, func)[instr->data.reg]);
+                push_pointer_stack(vm, local_pointers(vm->locals, func)[instr->data.reg]);
+                break;
+            case OP_STORE_LOCAL_POINTER: {
+                HeapObject *old = local_pointers(vm->locals, func)[instr->data.reg];
+                local_pointers(vm->locals, func)[instr->data.reg] = pop_pointer_stack(vm);
+                release(vm, old);
+            }
+                break;
+            case OP_LOAD_GLOBAL_I64:
+                push_stack(vm, vm->globals[instr->data.reg]);
+                break;
+            case OP_STORE_GLOBAL_I64:
+                vm->globals[instr->data.reg] = pop_stack(vm);
+                break;
+            case OP_LOAD_GLOBAL_POINTER:
+                retain(vm, vm->global_pointers[instr->data.reg]);
+                push_pointer_stack(vm, vm->global_pointers[instr->data.reg]);
+                break;
+            case OP_STORE_GLOBAL_POINTER: {
+                HeapObject *old = vm->global_pointers[instr->data.reg];
+                vm->global_pointers[instr->data.reg] = pop_pointer_stack(vm);
+                release(vm, old);
+            }
+                break;
+            case OP_ADD_I64_RI:
+                push_stack(vm, vm->locals[instr->data.ri.reg] + instr->data.ri.immediate);
+                break;
+            case OP_ADD_I64:
+                push_stack(vm, pop_stack(vm) + pop_stack(vm));
+                break;
+            case OP_SUB_I64_RI:
+                push_stack(vm, vm->locals[instr->data.ri.reg] - instr->data.ri.immediate);
+                break;
+            case OP_MUL_I64_RI:
+                push_stack(vm, vm->locals[instr->data.ri.reg] * instr->data.ri.immediate);
+                break;
+            case OP_DIV_I64_RI:
+                CHECK(check_divisor(instr, instr->data.ri.immediate));
+                push_stack(vm, vm->locals[instr->data.ri.reg] / instr->data.ri.immediate);
+                break;
+            case OP_MOD_I64_RI:
+                CHECK(check_divisor(instr, instr->data.ri.immediate));
+                push_stack(vm, vm->locals[instr->data.ri.reg] % instr->data.ri.immediate);
+                break;
+            case OP_SUB_I64: {
+                uint64_t b = pop_stack(vm);
+                uint64_t a = pop_stack(vm);
+                push_stack(vm, a - b);
+            }
+                break;
+            case OP_MUL_I64:
+                push_stack(vm, pop_stack(vm) * pop_stack(vm));
+                break;
+            case OP_DIV_I64: {
+                uint64_t b = pop_stack(vm);
+                uint64_t a = pop_stack(vm);
+                CHECK(check_divisor(instr, b));
+                push_stack(vm, a / b);
+            }
+                break;
+            case OP_MOD_I64: {
+                uint64_t b = pop_stack(vm);
+                uint64_t a = pop_stack(vm);
+                CHECK(check_divisor(instr, b));
+                push_stack(vm, a % b);
+            }
+                break;
+            case OP_LESS_THAN_I64_RI:
+                push_stack(vm, vm->locals[instr->data.ri.reg] < instr->data.ri.immediate);
+                break;
+            case OP_GREATER_THAN_I64_RI:
+                push_stack(vm, vm->locals[instr->data.ri.reg] > instr->data.ri.immediate);
+                break;
+            case OP_EQUALS_I64_RI:
+                push_stack(vm, vm->locals[instr->data.ri.reg] == instr->data.ri.immediate);
+                break;
+            case OP_LESS_THAN_I64:
+                push_stack(vm, pop_stack(vm) > pop_stack(vm));
+                break;
+            case OP_GREATER_THAN_I64:
+                push_stack(vm, pop_stack(vm) < pop_stack(vm));
+                break;
+            case OP_EQUALS_I64:
+                push_stack(vm, pop_stack(vm) == pop_stack(vm));
+                break;
+            case OP_NOT_EQUALS_I64:
+                push_stack(vm, pop_stack(vm) != pop_stack(vm));
+                break;
+            case OP_NOT:
+                push_stack(vm, !pop_stack(vm));
+                break;
+            case OP_JUMP_IF_FALSE:
+                taken = !pop_stack(vm);
+                if (vm->profile != NULL)
+                    count_edge(vm, func, instr, taken);
+                if (taken) {
+                    if (!charge_jump(vm, func, instr, instr->data.reg))
+                        return;
+                    instr = func->instructions + instr->data.reg - 1;
+                }
+                break;
+            case OP_JUMP_IF_TRUE:
+                taken = pop_stack(vm) != 0;
+                if (vm->profile != NULL)
+                    count_edge(vm, func, instr, taken);
+                if (taken) {
+                    if (!charge_jump(vm, func, instr, instr->data.reg))
+                        return;
+                    instr = func->instructions + instr->data.reg - 1;
+                }
+                break;
+            case OP_JUMP:
+                if (vm->profile != NULL)
+                    count_edge(vm, func, instr, 1);
+                if (!charge_jump(vm, func, instr, instr->data.reg))
+                    return;
+                instr = func->instructions + instr->data.reg - 1;
+                break;
+            case OP_DEC_JUMP_IF_NOT_ZERO:
+                taken = --vm->locals[instr->data.loop.reg] != 0;
+                if (vm->profile != NULL)
+                    count_edge(vm, func, instr, taken);
+                if (taken) {
+                    if (!charge_jump(vm, func, instr, instr->data.loop.target))
+                        return;
+                    instr = func->instructions + instr->data.loop.target - 1;
+                }
+                break;
+            case OP_INC_JUMP_IF_LESS_THAN:
+                taken = ++vm->locals[instr->data.loop.reg] < instr->data.loop.limit;
+                if (vm->profile != NULL)
+                    count_edge(vm, func, instr, taken);
+                if (taken) {
+                    if (!charge_jump(vm, func, instr, instr->data.loop.target))
+                        return;
+                    instr = func->instructions + instr->data.loop.target - 1;
+                }
+                break;
+            case OP_PRINT_TOP_STACK_I64:
+                printf("%zu\n", pop_stack(vm));
+                break;
+            case OP_EXIT:
+                return;
+            case OP_SNAPSHOT:
+                if (vm->pause_at_snapshot) {
+                    vm->resume_instruction = instr + 1 - func->instructions;
+                    vm->paused = 1;
+                    if (vm->memory == MEMORY_TRACING)
+                        gc_collect(vm);
+                    return;
+                }
+                break;
+            case OP_CALL:
+                if (vm->profile != NULL)
+                    count_edge(vm, func, instr, 1);
+                if (vm->memo_caches != NULL
+                    && program->functions[instr->data.reg].pure
+                    && memo_enter(vm, program->functions + instr->data.reg))
+                    break;
+                if (vm->profile != NULL)
+                    vm->profile->functions[instr->data.reg].calls++;
+                call_function(vm, program, func - program->functions, instr - func->instructions, instr->data.reg);
+                func = program->functions + instr->data.reg;
+                instr = func->instructions - 1;
+                vm->function = func;
+                if (!charge_fuel(vm, func, func->instructions, 1))
+                    return;
+                break;
+            case OP_CALL_NATIVE:
+                call_native(vm, vm->natives + instr->data.reg);
+                break;
+            case OP_RETURN: {
+                if (vm->memo_frames_size > 0
+                    && vm->memo_frames[vm->memo_frames_size - 1].call_depth == vm->call_stack.size)
+                    memo_leave(vm);
+                release_local_pointers(vm, func);
+                if (vm->call_stack.data[vm->call_stack.size - 3] == HOST_CALLER) {
+                    vm->call_stack.size -= get_stack_frame_size(vm);
+                    return;
+                }
+                func = program->functions + vm->call_stack.data[vm->call_stack.size - 3];
+                instr = func->instructions + vm->call_stack.data[vm->call_stack.size - 2];
+                pop_stack_frame(vm);
+                vm->function = func;
+            }
+                break;
+            case OP_PUSH_LITERAL_STRING:
+                push_string(vm, new_string(instr->data.string.ptr, instr->data.string.size));
+                break;
+            case OP_CONCAT_STRINGS: {
+                HeapObject *b = pop_pointer_stack(vm);
+                HeapObject *a = pop_pointer_stack(vm);
+                push_string(vm, concat_strings(a, b));
+                release(vm, a);
+                release(vm, b);
+            }
+                break;
+            case OP_PRINT_STRING: {
+                HeapObject *object = pop_pointer_stack(vm);
+                char buffer[STRING_INLINE_MAX];
+                const char *bytes = string_bytes(object, buffer);
+                size_t i;
+                for (i = 0; i < string_length(object); i++)
+                    putchar(bytes[i]);
+                release(vm, object);
+            }
+                break;
+            case OP_SLICE_STRING: {
+                uint64_t length = pop_stack(vm);
+                uint64_t offset = pop_stack(vm);
+                HeapObject *string = pop_pointer_stack(vm);
+                CHECK(check_string_range(string, offset, length));
+                push_string(vm, slice_string(vm, string, offset, length));
+                release(vm, string);
+            }
+                break;
+            case OP_STRING_LENGTH: {
+                HeapObject *string = pop_pointer_stack(vm);
+                push_stack(vm, string_length(string));
+                release(vm, string);
+            }
+                break;
+            case OP_FIND_STRING: {
+                HeapObject *needle = pop_pointer_stack(vm);
+                HeapObject *haystack = pop_pointer_stack(vm);
+                push_stack(vm, find_string(haystack, needle));
+                release(vm, haystack);
+                release(vm, needle);
+            }
+                break;
+            case OP_COMPARE_STRINGS: {
+                HeapObject *b = pop_pointer_stack(vm);
+                HeapObject *a = pop_pointer_stack(vm);
+                push_stack(vm, compare_strings(a, b));
+                release(vm, a);
+                release(vm, b);
+            }
+                break;
+            case OP_READ_LINE:
+                read_line(vm);
+                break;
+            case OP_READ_I64:
+                read_i64(vm);
+                break;
+            case OP_READ_ALL:
+                read_all(vm);
+                break;
+            case OP_PARALLEL_MAP_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                parallel_map_i64(vm, program, instr);
+                break;
+            case OP_PARALLEL_REDUCE_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                parallel_reduce_i64(vm, program, instr);
+                break;
+            case OP_NEW_ARRAY_I64: {
+                HeapObject *object = new_array_object(pop_stack(vm));
+                push_pointer_stack(vm, object);
+                add_heap_object(vm, object);
+            }
+                break;
+            case OP_ARRAY_LENGTH_I64: {
+                HeapObject *array = pop_pointer_stack(vm);
+                CHECK(check_array(instr, array));
+                push_stack(vm, array_length(array));
+                release(vm, array);
+            }
+                break;
+            case OP_ARRAY_LOAD_I64: {
+                uint64_t index = pop_stack(vm);
+                HeapObject *array = pop_pointer_stack(vm);
+                CHECK(check_array(instr, array));
+                CHECK(check_array_range(array, index, 1));
+                push_stack(vm, ((uint64_t *) array->data)[index]);
+                release(vm, array);
+            }
+                break;
+            case OP_ARRAY_STORE_I64: {
+                uint64_t value = pop_stack(vm);
+                uint64_t index = pop_stack(vm);
+                HeapObject *array = pop_pointer_stack(vm);
+                CHECK(check_array(instr, array));
+                CHECK(check_array_range(array, index, 1));
+                ((uint64_t *) array->data)[index] = value;
+                release(vm, array);
+            }
+                break;
+            case OP_ARRAY_FILL_I64: {
+                uint64_t value = pop_stack(vm);
+                HeapObject *array = pop_pointer_stack(vm);
+                uint64_t *data;
+                size_t i, length;
+                CHECK(check_array(instr, array));
+                data = array->data;
+                length = array_length(array);
+                for (i = 0; i < length; i++)
+                    data[i] = value;
+                release(vm, array);
+            }
+                break;
+            case OP_ARRAY_COPY_I64: {
+                uint64_t count = pop_stack(vm);
+                uint64_t source_offset = pop_stack(vm);
+                uint64_t destination_offset = pop_stack(vm);
+                HeapObject *source = pop_pointer_stack(vm);
+                HeapObject *destination = pop_pointer_stack(vm);
+                CHECK(check_array(instr, source));
+                CHECK(check_array(instr, destination));
+                CHECK(check_array_range(source, source_offset, count));
+                CHECK(check_array_range(destination, destination_offset, count));
+                if (count > 0)
+                    memmove((uint64_t *) destination->data + destination_offset,
+                            (uint64_t *) source->data + source_offset,
+                            count * sizeof(uint64_t));
+                release(vm, source);
+                release(vm, destination);
+            }
+                break;
+            case OP_ARRAY_ADD_I64:
+                CHECK(check_top_arrays(vm, instr, 2));
+                CHECK(check_same_length(vm));
+                array_binary(vm, vm->simd->add);
+                break;
+            case OP_ARRAY_SUB_I64:
+                CHECK(check_top_arrays(vm, instr, 2));
+                CHECK(check_same_length(vm));
+                array_binary(vm, vm->simd->sub);
+                break;
+            case OP_ARRAY_MUL_I64:
+                CHECK(check_top_arrays(vm, instr, 2));
+                CHECK(check_same_length(vm));
+                array_binary(vm, vm->simd->mul);
+                break;
+            case OP_ARRAY_ADD_SCALAR_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                array_binary_scalar(vm, vm->simd->add_scalar);
+                break;
+            case OP_ARRAY_SUB_SCALAR_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                array_binary_scalar(vm, vm->simd->sub_scalar);
+                break;
+            case OP_ARRAY_MUL_SCALAR_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                array_binary_scalar(vm, vm->simd->mul_scalar);
+                break;
+            case OP_ARRAY_SUM_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                array_reduce(vm, vm->simd->sum);
+                break;
+            case OP_ARRAY_MIN_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                array_reduce(vm, vm->simd->min);
+                break;
+            case OP_ARRAY_MAX_I64:
+                CHECK(check_top_arrays(vm, instr, 1));
+                array_reduce(vm, vm->simd->max);
+                break;
+            case OP_ARRAY_EQUALS_I64:
+                CHECK(check_top_arrays(vm, instr, 2));
+                CHECK(check_same_length(vm));
+                array_compare(vm, vm->simd->equals);
+                break;
+            case OP_ARRAY_LESS_THAN_I64:
+                CHECK(check_top_arrays(vm, instr, 2));
+                CHECK(check_same_length(vm));
+                array_compare(vm, vm->simd->less_than);
+                break;
+            case OP_ARRAY_GREATER_THAN_I64:
+                CHECK(check_top_arrays(vm, instr, 2));
+                CHECK(check_same_length(vm));
+                array_compare(vm, vm->simd->greater_than);
+                break;
+            case OP_NEW_MAP: {
+                HeapObject *object = new_map_object(instr->data.immediate);
+                push_pointer_stack(vm, object);
+                add_heap_object(vm, object);
+            }
+                break;
+            case OP_MAP_SIZE: {
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, 0, 0));
+                push_stack(vm, ((const HashMap *) map->data)->size);
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_GET_I64: {
+                uint64_t key = pop_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, 0, MAP_KINDS));
+                push_stack(vm, map_get(map, key));
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_PUT_I64: {
+                uint64_t value = pop_stack(vm);
+                uint64_t key = pop_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, 0, MAP_KINDS));
+                map_put(vm, map, key, value);
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_CONTAINS_I64: {
+                uint64_t key = pop_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, 0, MAP_STRING_KEYS));
+                push_stack(vm, map_contains(map, key));
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_DELETE_I64: {
+                uint64_t key = pop_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, 0, MAP_STRING_KEYS));
+                map_remove(vm, map, key);
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_GET_POINTER_I64: {
+                uint64_t key = pop_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                HeapObject *value;
+                CHECK(check_map(instr, map, MAP_POINTER_VALUES, MAP_KINDS));
+                value = (HeapObject *) (uintptr_t) map_get(map, key);
+                retain(vm, value);
+                push_pointer_stack(vm, value);
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_PUT_POINTER_I64: {
+                HeapObject *value = pop_pointer_stack(vm);
+                uint64_t key = pop_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, MAP_POINTER_VALUES, MAP_KINDS));
+                map_put(vm, map, key, (uintptr_t) value);
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_GET_STRING: {
+                HeapObject *key = pop_pointer_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, MAP_STRING_KEYS, MAP_KINDS));
+                push_stack(vm, map_get(map, (uintptr_t) key));
+                release(vm, map);
+                release(vm, key);
+            }
+                break;
+            case OP_MAP_PUT_STRING: {
+                uint64_t value = pop_stack(vm);
+                HeapObject *key = pop_pointer_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, MAP_STRING_KEYS, MAP_KINDS));
+                map_put(vm, map, (uintptr_t) key, value);
+                release(vm, map);
+            }
+                break;
+            case OP_MAP_CONTAINS_STRING: {
+                HeapObject *key = pop_pointer_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, MAP_STRING_KEYS, MAP_STRING_KEYS));
+                push_stack(vm, map_contains(map, (uintptr_t) key));
+                release(vm, map);
+                release(vm, key);
+            }
+                break;
+            case OP_MAP_DELETE_STRING: {
+                HeapObject *key = pop_pointer_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, MAP_STRING_KEYS, MAP_STRING_KEYS));
+                map_remove(vm, map, (uintptr_t) key);
+                release(vm, map);
+                release(vm, key);
+            }
+                break;
+            case OP_MAP_GET_POINTER_STRING: {
+                HeapObject *key = pop_pointer_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                HeapObject *value;
+                CHECK(check_map(instr, map, MAP_KINDS, MAP_KINDS));
+                value = (HeapObject *) (uintptr_t) map_get(map, (uintptr_t) key);
+                retain(vm, value);
+                push_pointer_stack(vm, value);
+                release(vm, map);
+                release(vm, key);
+            }
+                break;
+            case OP_MAP_PUT_POINTER_STRING: {
+                HeapObject *value = pop_pointer_stack(vm);
+                HeapObject *key = pop_pointer_stack(vm);
+                HeapObject *map = pop_pointer_stack(vm);
+                CHECK(check_map(instr, map, MAP_KINDS, MAP_KINDS));
+                map_put(vm, map, (uintptr_t) key, (uintptr_t) value);
+                release(vm, map);
+            }
+                break;
+            default:
+                instruction_as_string(*instr, buff, 256);
+                fprintf(stderr, "Unknown instruction: %s\n", buff);
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+#undef CHECK
+#undef DEBUG_HOOK
@@ -1,3 +1,8 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "unity.h"
 #include "assembler/assembler.h"
 
@@ -83,11 +88,209 @@ parse_function(void)
         program.functions[0].instructions_count);
 }
 
+void
+parse_pure_function(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 pure: 1 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "}\n";
+
+    Program program = assemble(source);
+
+    TEST_ASSERT_EQUAL(2, program.functions_count);
+    TEST_ASSERT_EQUAL(0, program.functions[0].pure);
+    TEST_ASSERT_EQUAL(1, program.functions[1].pure);
+}
+
+void
+reject_pure_functions_with_pointers(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 1 locals: 1 local_pointers: 1 pure: 1 } {\n"
+        "    LoadLocalPointer $0;\n"
+        "    StringLength;\n"
+        "    AddI64_RI $0 0;\n"
+        "    Return;\n"
+        "}\n";
+    char output[512];
+    int errors[2], status;
+    ssize_t size;
+    pid_t pid;
+
+    // assembly errors exit, so assemble in a child
+    TEST_ASSERT_EQUAL(0, pipe(errors));
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        dup2(errors[1], STDERR_FILENO);
+        assemble(source);
+        _exit(EXIT_SUCCESS);
+    }
+    close(errors[1]);
+    size = read(errors[0], output, sizeof(output) - 1);
+    close(errors[0]);
+    TEST_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL(EXIT_FAILURE, WEXITSTATUS(status));
+    TEST_ASSERT_GREATER_THAN(0, size);
+    output[size] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(output, "Function 1 is pure, so it cannot take or keep pointers"));
+}
+
+void
+parse_loop_instructions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+        "    DecJumpIfNotZero $1 #0;\n"
+        "    IncJumpIfLessThan $0 100 #1;\n"
+        "    Jump #0;\n"
+        "}\n";
+
+    Program program = assemble(source);
+    Instruction *instructions = program.functions[0].instructions;
+
+    TEST_ASSERT_EQUAL(OP_DEC_JUMP_IF_NOT_ZERO, instructions[0].op);
+    TEST_ASSERT_EQUAL(1, instructions[0].data.loop.reg);
+    TEST_ASSERT_EQUAL(0, instructions[0].data.loop.target);
+    TEST_ASSERT_EQUAL(OP_INC_JUMP_IF_LESS_THAN, instructions[1].op);
+    TEST_ASSERT_EQUAL(0, instructions[1].data.loop.reg);
+    TEST_ASSERT_EQUAL(100, instructions[1].data.loop.limit);
+    TEST_ASSERT_EQUAL(1, instructions[1].data.loop.target);
+    TEST_ASSERT_EQUAL(OP_JUMP, instructions[2].op);
+    TEST_ASSERT_EQUAL(0, instructions[2].data.reg);
+}
+
+static const char *
+sample_operands(OperandFormat operands)
+{
+    switch (operands) {
+        case OPERANDS_LOCAL:
+        case OPERANDS_LOCAL_POINTER:
+        case OPERANDS_GLOBAL:
+        case OPERANDS_GLOBAL_POINTER:
+            return " $1";
+        case OPERANDS_IMMEDIATE:
+            return " 7";
+        case OPERANDS_LOCAL_IMMEDIATE:
+            return " $1 7";
+        case OPERANDS_TARGET:
+            return " #0";
+        case OPERANDS_FUNCTION:
+        case OPERANDS_NATIVE:
+            return " :0";
+        case OPERANDS_STRING:
+            return " \"s\"";
+        case OPERANDS_LOCAL_TARGET:
+            return " $1 #0";
+        case OPERANDS_LOCAL_LIMIT_TARGET:
+            return " $1 7 #0";
+        default:
+            return "";
+    }
+}
+
+void
+assemble_every_opcode(void)
+{
+    static char source[8192];
+    char printed[256];
+    size_t i, length;
+    Program program;
+
+    length = sprintf(source, "---\nglobals: 0\nglobal_pointers: 0\n---\n:0 { args: 0 } {\n");
+    for (i = 0; i < OPCODES_COUNT; i++)
+        length += sprintf(source + length, "    %s%s;\n", opcodes[i].mnemonic, sample_operands(opcodes[i].operands));
+    sprintf(source + length, "}\n");
+
+    program = assemble(source);
+    TEST_ASSERT_EQUAL(OPCODES_COUNT, program.functions[0].instructions_count);
+    for (i = 0; i < OPCODES_COUNT; i++) {
+        TEST_ASSERT_EQUAL(i, program.functions[0].instructions[i].op);
+        instruction_as_string(program.functions[0].instructions[i], printed, sizeof(printed));
+        TEST_ASSERT_EQUAL(0, strncmp(printed, opcodes[i].name, strlen(opcodes[i].name)));
+    }
+    free_program(program);
+}
+
+void
+lazy_assembly_defers_bodies(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 40;\n"
+        "    Call :1;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushLiteralString \"}}\";\n"
+        "    StringLength;\n"
+        "    LoadLocalI64 $0;\n"
+        "    AddI64;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushLiteralString \"\\\"}\";\n"
+        "    Frobnicate;\n"
+        "}\n";
+
+    Program program = assemble_lazy(source);
+    VM vm = init_vm();
+
+    TEST_ASSERT_EQUAL(3, program.functions_count);
+    TEST_ASSERT_EQUAL(1, program.functions[1].args_count);
+    TEST_ASSERT_EQUAL(0, program.functions[1].instructions_count);
+    TEST_ASSERT_EQUAL('{', program.functions[2].body[0]);
+    TEST_ASSERT_EQUAL('}', program.functions[2].body[program.functions[2].body_length - 1]);
+
+    run_program(&vm, &program);
+
+    TEST_ASSERT_EQUAL(1, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(42, vm.operands_stack.data[0]);
+    TEST_ASSERT_NULL(program.functions[0].body);
+    TEST_ASSERT_NULL(program.functions[1].body);
+    TEST_ASSERT_EQUAL(5, program.functions[1].instructions_count);
+    // never called, so its invalid instruction is never read
+    TEST_ASSERT_NOT_NULL(program.functions[2].body);
+    TEST_ASSERT_EQUAL(0, program.functions[2].instructions_count);
+    free_vm(vm);
+    free_program(program);
+}
+
 int
 main(void)
 {
     UNITY_BEGIN();
     RUN_TEST(parse_header);
     RUN_TEST(parse_function);
+    RUN_TEST(parse_pure_function);
+    RUN_TEST(reject_pure_functions_with_pointers);
+    RUN_TEST(parse_loop_instructions);
+    RUN_TEST(assemble_every_opcode);
+    RUN_TEST(lazy_assembly_defers_bodies);
     return UNITY_END();
 }
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "assembler/assembler.h"
+#include "compiler/compile_c.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+static char *
+compile(const char *source, int *status)
+{
+    Program program = assemble(source);
+    FILE *out = tmpfile();
+    char *text;
+    long size;
+
+    TEST_ASSERT_NOT_NULL(out);
+    *status = compile_to_c(&program, out);
+    size = ftell(out);
+    text = malloc(size + 1);
+    rewind(out);
+    text[fread(text, 1, size, out)] = '\0';
+    fclose(out);
+    free_program(program);
+    return text;
+}
+
+void
+compile_recursive_function(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 20;\n"
+        "    Call :1;\n"
+        "    PrintTopStackI64;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LessThanI64_RI $0 2;\n"
+        "    JumpIfFalse #4;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "    SubI64_RI $0 1;\n"
+        "    Call :1;\n"
+        "    SubI64_RI $0 2;\n"
+        "    Call :1;\n"
+        "    AddI64;\n"
+        "    Return;\n"
+        "}\n";
+    int status;
+    char *text = compile(source, &status);
+
+    TEST_ASSERT_EQUAL(1, status);
+    TEST_ASSERT_NOT_NULL(strstr(text, "static uint64_t\nfunction_1(uint64_t a0)\n{"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "    if (!s0) goto i4;\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "i4:\n    s0 = l0 - UINT64_C(1);\n    s0 = function_1(s0);\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "    s1 = function_1(s1);\n    s0 = s0 + s1;\n    return s0;\n"));
+    TEST_ASSERT_NULL(strstr(text, "Hal64Frame"));
+    free(text);
+}
+
+void
+compile_pointer_arguments_and_results(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushLiteralString \"a?b\";\n"
+        "    Call :1;\n"
+        "    PrintString;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 0 ptr_args: 1 locals: 0 local_pointers: 1 } {\n"
+        "    LoadLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    ConcatStrings;\n"
+        "    Return;\n"
+        "}\n";
+    int status;
+    char *text = compile(source, &status);
+
+    TEST_ASSERT_EQUAL(1, status);
+    TEST_ASSERT_NOT_NULL(strstr(text, "function_1(HeapObject *q0, HeapObject **result)"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "    p[0] = hal64_string(\"a\\077b\", 3);\n    function_1(p[0], &p[0]);\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "    p[1] = hal64_concat(p[1], p[2]);\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "*result = p[1]; hal64_leave(&frame); return;\n"));
+    free(text);
+}
+
+void
+reject_unbalanced_stacks(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    JumpIfFalse #3;\n"
+        "    PushI64 1;\n"
+        "    Exit;\n"
+        "}\n";
+    int status;
+    char *text = compile(source, &status);
+
+    TEST_ASSERT_EQUAL(0, status);
+    TEST_ASSERT_EQUAL_STRING("", text);
+    free(text);
+}
+
+void
+skip_dead_calls(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 5;\n"
+        "    PrintTopStackI64;\n"
+        "    Exit;\n"
+        "    Call :4000000;\n"
+        "    Call :1;\n"
+        "}\n"
+        ":1 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Return;\n"
+        "}\n";
+    int status;
+    char *text = compile(source, &status);
+
+    TEST_ASSERT_EQUAL(1, status);
+    TEST_ASSERT_NOT_NULL(strstr(text, "function_0("));
+    TEST_ASSERT_NULL(strstr(text, "function_1("));
+    free(text);
+}
+
+void
+reject_vm_only_instructions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    NewMap 0;\n"
+        "    MapSize;\n"
+        "    PrintTopStackI64;\n"
+        "    Exit;\n"
+        "}\n";
+    int status;
+    char *text = compile(source, &status);
+
+    TEST_ASSERT_TRUE(opcodes[OP_NEW_MAP].vm_only);
+    TEST_ASSERT_FALSE(opcodes[OP_NEW_ARRAY_I64].vm_only);
+    TEST_ASSERT_EQUAL(0, status);
+    TEST_ASSERT_EQUAL_STRING("", text);
+    free(text);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(compile_recursive_function);
+    RUN_TEST(compile_pointer_arguments_and_results);
+    RUN_TEST(reject_unbalanced_stacks);
+    RUN_TEST(skip_dead_calls);
+    RUN_TEST(reject_vm_only_instructions);
+    return UNITY_END();
+}
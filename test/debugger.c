@@ -0,0 +1,165 @@
+#include "unity.h"
+#include "debugger.h"
+#include "assembler/assembler.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+// squares 2 three times over, 17 instructions in all
+static const char *squares =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+    "    PushI64 2;\n"
+    "    Call :1;\n"
+    "    Call :1;\n"
+    "    Call :1;\n"
+    "    Exit;\n"
+    "}\n"
+    ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    MulI64;\n"
+    "    Return;\n"
+    "}\n";
+
+typedef struct
+{
+    size_t count;
+    size_t functions[32];
+    size_t instructions[32];
+} Trace;
+
+static void
+record(void *context, const VM *vm, const Function *function, size_t instruction)
+{
+    Trace *trace = context;
+
+    (void) vm;
+    if (trace->count < 32) {
+        trace->functions[trace->count] = function->id;
+        trace->instructions[trace->count] = instruction;
+    }
+    trace->count++;
+}
+
+static void
+assert_squared(const VM *vm)
+{
+    TEST_ASSERT_FALSE(vm->paused);
+    TEST_ASSERT_EQUAL(1, vm->operands_stack.size);
+    TEST_ASSERT_EQUAL(256, vm->operands_stack.data[0]);
+}
+
+void
+trace_sees_every_instruction(void)
+{
+    size_t expected_functions[] = {0, 0, 1, 1, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 1, 1, 0};
+    size_t expected_instructions[] = {0, 1, 0, 1, 2, 3, 2, 0, 1, 2, 3, 3, 0, 1, 2, 3, 4};
+    Program program = assemble(squares);
+    VM vm = init_vm();
+    Trace trace = {0};
+    Debugger *debugger = attach_debugger(&vm);
+
+    vm.checked = 0;
+    debugger->trace = record;
+    debugger->context = &trace;
+    run_program(&vm, &program);
+    assert_squared(&vm);
+    TEST_ASSERT_EQUAL(17, trace.count);
+    TEST_ASSERT_EQUAL_MEMORY(expected_functions, trace.functions, sizeof(expected_functions));
+    TEST_ASSERT_EQUAL_MEMORY(expected_instructions, trace.instructions, sizeof(expected_instructions));
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+breakpoints_pause_before_the_instruction(void)
+{
+    uint64_t expected_arguments[] = {2, 4, 16};
+    Program program = assemble(squares);
+    VM vm = init_vm();
+    Debugger *debugger = attach_debugger(&vm);
+    int i;
+
+    set_breakpoint(debugger, 1, 0);
+    set_breakpoint(debugger, 1, 0);
+    TEST_ASSERT_EQUAL(1, debugger->breakpoints_count);
+    run_program(&vm, &program);
+    for (i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(vm.paused);
+        TEST_ASSERT_TRUE(debugger->stopped);
+        TEST_ASSERT_EQUAL_PTR(program.functions + 1, vm.function);
+        TEST_ASSERT_EQUAL(0, vm.resume_instruction);
+        TEST_ASSERT_EQUAL(expected_arguments[i], vm.locals[0]);
+        resume_program(&vm, &program);
+    }
+    assert_squared(&vm);
+    TEST_ASSERT_TRUE(clear_breakpoint(debugger, 1, 0));
+    TEST_ASSERT_FALSE(clear_breakpoint(debugger, 1, 0));
+    run_program(&vm, &program);
+    TEST_ASSERT_FALSE(vm.paused);
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+stepping_stops_at_every_instruction(void)
+{
+    Program program = assemble(squares);
+    VM vm = init_vm();
+    Trace trace = {0};
+    Debugger *debugger = attach_debugger(&vm);
+    size_t steps = 0;
+
+    debugger->stepping = 1;
+    debugger->trace = record;
+    debugger->context = &trace;
+    run_program(&vm, &program);
+    while (vm.paused) {
+        TEST_ASSERT_EQUAL(steps, trace.count);
+        steps++;
+        resume_program(&vm, &program);
+    }
+    TEST_ASSERT_EQUAL(17, steps);
+    TEST_ASSERT_EQUAL(17, trace.count);
+    assert_squared(&vm);
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+detaching_runs_on_without_hooks(void)
+{
+    Program program = assemble(squares);
+    VM vm = init_vm();
+
+    set_breakpoint(attach_debugger(&vm), 1, 2);
+    run_program(&vm, &program);
+    TEST_ASSERT_TRUE(vm.paused);
+    TEST_ASSERT_EQUAL(2, vm.resume_instruction);
+    detach_debugger(&vm);
+    TEST_ASSERT_NULL(vm.debugger);
+    resume_program(&vm, &program);
+    assert_squared(&vm);
+    free_vm(vm);
+    free_program(program);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(trace_sees_every_instruction);
+    RUN_TEST(breakpoints_pause_before_the_instruction);
+    RUN_TEST(stepping_stops_at_every_instruction);
+    RUN_TEST(detaching_runs_on_without_hooks);
+    return UNITY_END();
+}
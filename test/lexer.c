@@ -56,7 +56,7 @@ basic_keywords(void)
 {
     const char *source =
         "globals global_pointers args"
-        " ptr_args locals local_pointers";
+        " ptr_args locals local_pointers pure";
     read_all_tokens(source);
 
     Token expected[] = {
@@ -66,6 +66,7 @@ basic_keywords(void)
         {TOKEN_PTR_ARGS, "ptr_args"},
         {TOKEN_LOCALS, "locals"},
         {TOKEN_LOCAL_POINTERS, "local_pointers"},
+        {TOKEN_PURE, "pure"},
         {TOKEN_EOF, ""},
     };
     compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
@@ -93,16 +94,17 @@ void
 instructions(void)
 {
     const char *source =
-        "LoadLocalI64 PushI64 LessThanI64_RI LessThanI64 GreaterThanI64_RI "
-        "GreaterThanI64 EqualsI64_RI EqualsI64 NotEqualsI64 NotI64 JumpIfFalse "
+        "LoadLocalI64 StoreLocalI64 PushI64 LessThanI64_RI LessThanI64 GreaterThanI64_RI "
+        "GreaterThanI64 EqualsI64_RI EqualsI64 NotEqualsI64 NotI64 JumpIfFalse JumpIfTrue "
         "Return AddI64_RI AddI64 SubI64_RI SubI64 MulI64_RI MulI64 DivI64_RI "
         "DivI64 ModI64_RI ModI64 Call PrintTopStackI64 PushLiteralString "
-        "ConcatStrings PrintString Exit";
+        "ConcatStrings PrintString Snapshot Exit";
 
     read_all_tokens(source);
 
     Token expected[] = {
         {TOKEN_LoadLocalI64, "LoadLocalI64"},
+        {TOKEN_StoreLocalI64, "StoreLocalI64"},
         {TOKEN_PushI64, "PushI64"},
         {TOKEN_LessThanI64_RI, "LessThanI64_RI"},
         {TOKEN_LessThanI64, "LessThanI64"},
@@ -111,8 +113,9 @@ instructions(void)
         {TOKEN_EqualsI64_RI, "EqualsI64_RI"},
         {TOKEN_EqualsI64, "EqualsI64"},
         {TOKEN_NotEqualsI64, "NotEqualsI64"},
-        {TOKEN_Not, "NotI64"},
+        {TOKEN_NotI64, "NotI64"},
         {TOKEN_JumpIfFalse, "JumpIfFalse"},
+        {TOKEN_JumpIfTrue, "JumpIfTrue"},
         {TOKEN_Return, "Return"},
         {TOKEN_AddI64_RI, "AddI64_RI"},
         {TOKEN_AddI64, "AddI64"},
@@ -129,6 +132,7 @@ instructions(void)
         {TOKEN_PushLiteralString, "PushLiteralString"},
         {TOKEN_ConcatStrings, "ConcatStrings"},
         {TOKEN_PrintString, "PrintString"},
+        {TOKEN_Snapshot, "Snapshot"},
         {TOKEN_Exit, "Exit"},
         {TOKEN_EOF, ""},
     };
@@ -136,6 +140,112 @@ instructions(void)
     compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
 }
 
+void
+array_instructions(void)
+{
+    const char *source =
+        "LoadLocalPointer StoreLocalPointer NewArrayI64 ArrayLengthI64 "
+        "ArrayLoadI64 ArrayStoreI64 ArrayFillI64 ArrayCopyI64";
+
+    read_all_tokens(source);
+
+    Token expected[] = {
+        {TOKEN_LoadLocalPointer, "LoadLocalPointer"},
+        {TOKEN_StoreLocalPointer, "StoreLocalPointer"},
+        {TOKEN_NewArrayI64, "NewArrayI64"},
+        {TOKEN_ArrayLengthI64, "ArrayLengthI64"},
+        {TOKEN_ArrayLoadI64, "ArrayLoadI64"},
+        {TOKEN_ArrayStoreI64, "ArrayStoreI64"},
+        {TOKEN_ArrayFillI64, "ArrayFillI64"},
+        {TOKEN_ArrayCopyI64, "ArrayCopyI64"},
+        {TOKEN_EOF, ""},
+    };
+
+    compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
+}
+
+void
+vector_instructions(void)
+{
+    const char *source =
+        "ArrayAddI64 ArraySubI64 ArrayMulI64 ArrayAddScalarI64 ArraySubScalarI64 "
+        "ArrayMulScalarI64 ArraySumI64 ArrayMinI64 ArrayMaxI64 ArrayEqualsI64 "
+        "ArrayLessThanI64 ArrayGreaterThanI64";
+
+    read_all_tokens(source);
+
+    Token expected[] = {
+        {TOKEN_ArrayAddI64, "ArrayAddI64"},
+        {TOKEN_ArraySubI64, "ArraySubI64"},
+        {TOKEN_ArrayMulI64, "ArrayMulI64"},
+        {TOKEN_ArrayAddScalarI64, "ArrayAddScalarI64"},
+        {TOKEN_ArraySubScalarI64, "ArraySubScalarI64"},
+        {TOKEN_ArrayMulScalarI64, "ArrayMulScalarI64"},
+        {TOKEN_ArraySumI64, "ArraySumI64"},
+        {TOKEN_ArrayMinI64, "ArrayMinI64"},
+        {TOKEN_ArrayMaxI64, "ArrayMaxI64"},
+        {TOKEN_ArrayEqualsI64, "ArrayEqualsI64"},
+        {TOKEN_ArrayLessThanI64, "ArrayLessThanI64"},
+        {TOKEN_ArrayGreaterThanI64, "ArrayGreaterThanI64"},
+        {TOKEN_EOF, ""},
+    };
+
+    compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
+}
+
+void
+global_instructions(void)
+{
+    const char *source = "LoadGlobalI64 StoreGlobalI64 LoadGlobalPointer StoreGlobalPointer";
+
+    read_all_tokens(source);
+
+    Token expected[] = {
+        {TOKEN_LoadGlobalI64, "LoadGlobalI64"},
+        {TOKEN_StoreGlobalI64, "StoreGlobalI64"},
+        {TOKEN_LoadGlobalPointer, "LoadGlobalPointer"},
+        {TOKEN_StoreGlobalPointer, "StoreGlobalPointer"},
+        {TOKEN_EOF, ""},
+    };
+
+    compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
+}
+
+void
+string_instructions(void)
+{
+    const char *source = "SliceString StringLength FindString CompareStrings";
+
+    read_all_tokens(source);
+
+    Token expected[] = {
+        {TOKEN_SliceString, "SliceString"},
+        {TOKEN_StringLength, "StringLength"},
+        {TOKEN_FindString, "FindString"},
+        {TOKEN_CompareStrings, "CompareStrings"},
+        {TOKEN_EOF, ""},
+    };
+
+    compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
+}
+
+void
+loop_instructions(void)
+{
+    const char *source = "Jump DecJumpIfNotZero IncJumpIfLessThan";
+
+    read_all_tokens(source);
+
+    Token expected[] = {
+        {TOKEN_Jump, "Jump"},
+        {TOKEN_DecJumpIfNotZero, "DecJumpIfNotZero"},
+        {TOKEN_IncJumpIfLessThan, "IncJumpIfLessThan"},
+        {TOKEN_EOF, ""},
+    };
+
+    compare_tokens(expected, list, sizeof(expected) / sizeof(expected[0]));
+}
+
 int
 main(void)
 {
@@ -144,5 +254,10 @@ main(void)
     RUN_TEST(basic_keywords);
     RUN_TEST(punctual_tokens);
     RUN_TEST(instructions);
+    RUN_TEST(array_instructions);
+    RUN_TEST(vector_instructions);
+    RUN_TEST(global_instructions);
+    RUN_TEST(string_instructions);
+    RUN_TEST(loop_instructions);
     return UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include <string.h>
+#include "unity.h"
+#include "map.h"
+#include "assembler/assembler.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+void
+insert_find_remove(void)
+{
+    HashMap map = init_hash_map(0);
+    uint64_t key;
+
+    for (key = 0; key < 100000; key++)
+        hash_map_insert(&map, key * 7)->value = key;
+    TEST_ASSERT_EQUAL(100000, map.size);
+    for (key = 0; key < 100000; key += 2)
+        TEST_ASSERT_TRUE(hash_map_remove(&map, key * 7));
+    TEST_ASSERT_FALSE(hash_map_remove(&map, 0));
+    TEST_ASSERT_EQUAL(50000, map.size);
+    for (key = 0; key < 100000; key++) {
+        MapSlot *slot = hash_map_find(&map, key * 7);
+        if (key % 2 == 0) {
+            TEST_ASSERT_NULL(slot);
+        } else {
+            TEST_ASSERT_NOT_NULL(slot);
+            TEST_ASSERT_EQUAL(key, slot->value);
+        }
+    }
+    TEST_ASSERT_NULL(hash_map_find(&map, 3));
+    free_hash_map(&map);
+}
+
+void
+churn_reuses_deleted_slots(void)
+{
+    HashMap map = init_hash_map(0);
+    uint64_t key;
+
+    // never more than 100 live keys, so cleaning up deleted slots is enough
+    for (key = 0; key < 100000; key++) {
+        hash_map_insert(&map, key);
+        if (key >= 100)
+            TEST_ASSERT_TRUE(hash_map_remove(&map, key - 100));
+    }
+    TEST_ASSERT_EQUAL(100, map.size);
+    TEST_ASSERT_EQUAL(256, map.capacity);
+    for (key = 100000 - 100; key < 100000; key++)
+        TEST_ASSERT_NOT_NULL(hash_map_find(&map, key));
+    free_hash_map(&map);
+}
+
+void
+string_keys_compare_contents(void)
+{
+    HashMap map = init_hash_map(MAP_STRING_KEYS);
+    char first_data[] = "key", second_data[] = "key", other_data[] = "kez";
+    HeapObject first = {0, OBJECT_STRING, 0, 3, first_data, NULL};
+    HeapObject second = {0, OBJECT_STRING, 0, 3, second_data, NULL};
+    HeapObject other = {0, OBJECT_STRING, 0, 3, other_data, NULL};
+
+    hash_map_insert(&map, (uintptr_t) &first)->value = 1;
+    hash_map_insert(&map, (uintptr_t) &second)->value = 2;
+    TEST_ASSERT_EQUAL(1, map.size);
+    TEST_ASSERT_EQUAL(2, hash_map_find(&map, (uintptr_t) &first)->value);
+    TEST_ASSERT_EQUAL_PTR(&first, (HeapObject *) (uintptr_t) hash_map_find(&map, (uintptr_t) &second)->key);
+    TEST_ASSERT_NULL(hash_map_find(&map, (uintptr_t) &other));
+    // an inline string with the same bytes is the same key
+    TEST_ASSERT_EQUAL(2, hash_map_find(&map, (uintptr_t) inline_string("key", 3))->value);
+    TEST_ASSERT_NULL(hash_map_find(&map, (uintptr_t) inline_string("kez", 3)));
+    free_hash_map(&map);
+}
+
+void
+maps_in_the_vm(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 2 } {\n"
+        "    NewMap 3;\n"
+        "    StoreLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"greeting\";\n"
+        "    PushLiteralString \"hello there\";\n"
+        "    MapPutPointerString;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"greet\";\n"
+        "    PushLiteralString \"ing\";\n"
+        "    ConcatStrings;\n"
+        "    MapGetPointerString;\n"
+        "    StringLength;\n"
+        "    NewMap 0;\n"
+        "    StoreLocalPointer $1;\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $0;\n"
+        "    LoadLocalPointer $1;\n"
+        "    LoadLocalI64 $0;\n"
+        "    MulI64_RI $0 3;\n"
+        "    MapPutI64;\n"
+        "    IncJumpIfLessThan $0 1000 #16;\n"
+        "    LoadLocalPointer $1;\n"
+        "    PushI64 999;\n"
+        "    MapDeleteI64;\n"
+        "    LoadLocalPointer $1;\n"
+        "    MapSize;\n"
+        "    LoadLocalPointer $1;\n"
+        "    PushI64 500;\n"
+        "    MapGetI64;\n"
+        "    LoadLocalPointer $1;\n"
+        "    PushI64 999;\n"
+        "    MapContainsI64;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"greeting\";\n"
+        "    MapContainsString;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    int checked;
+
+    // collecting at every allocation must keep keys and values held by a live map
+    for (checked = 0; checked <= 1; checked++) {
+        VM vm = init_vm();
+        vm.checked = checked;
+        vm.gc.initial_threshold = 0;
+        vm.gc.growth_factor = 0;
+        run_program(&vm, &program);
+        TEST_ASSERT_EQUAL(5, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL(11, vm.operands_stack.data[0]);
+        TEST_ASSERT_EQUAL(999, vm.operands_stack.data[1]);
+        TEST_ASSERT_EQUAL(1500, vm.operands_stack.data[2]);
+        TEST_ASSERT_EQUAL(0, vm.operands_stack.data[3]);
+        TEST_ASSERT_EQUAL(1, vm.operands_stack.data[4]);
+        // both maps, the key and value they hold, and the last literal
+        TEST_ASSERT_EQUAL(5, vm.objects.size);
+        free_vm(vm);
+
+        vm = init_vm();
+        vm.checked = checked;
+        vm.memory = MEMORY_REFCOUNT;
+        run_program(&vm, &program);
+        TEST_ASSERT_EQUAL(5, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL(11, vm.operands_stack.data[0]);
+        TEST_ASSERT_EQUAL(1, vm.operands_stack.data[4]);
+        // the two lookup keys are freed once used, the first map holds its key and value
+        TEST_ASSERT_EQUAL(4, vm.objects.size);
+        TEST_ASSERT_EQUAL(2, vm.gc_stats.objects_swept);
+        free_vm(vm);
+    }
+    free_program(program);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(insert_find_remove);
+    RUN_TEST(churn_reuses_deleted_slots);
+    RUN_TEST(string_keys_compare_contents);
+    RUN_TEST(maps_in_the_vm);
+    return UNITY_END();
+}
@@ -0,0 +1,56 @@
+#include "unity.h"
+#include "memo.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+void
+lookup_after_insert(void)
+{
+    MemoCache cache = init_memo_cache(2, 16);
+    uint64_t a[] = {1, 2}, b[] = {2, 1};
+    uint64_t result = 0;
+
+    TEST_ASSERT_FALSE(memo_lookup(&cache, a, &result));
+    memo_insert(&cache, a, 42);
+    TEST_ASSERT_TRUE(memo_lookup(&cache, a, &result));
+    TEST_ASSERT_EQUAL(42, result);
+    TEST_ASSERT_FALSE(memo_lookup(&cache, b, &result));
+    TEST_ASSERT_EQUAL(1, cache.hits);
+    TEST_ASSERT_EQUAL(2, cache.misses);
+    free_memo_cache(cache);
+}
+
+void
+bounded_by_clock_eviction(void)
+{
+    MemoCache cache = init_memo_cache(1, 8);
+    uint64_t key, result, found = 0;
+
+    for (key = 0; key < 100; key++)
+        memo_insert(&cache, &key, key * 3);
+    TEST_ASSERT_EQUAL(8, cache.size);
+    TEST_ASSERT_EQUAL(92, cache.evictions);
+    for (key = 0; key < 100; key++) {
+        if (memo_lookup(&cache, &key, &result)) {
+            TEST_ASSERT_EQUAL(key * 3, result);
+            found++;
+        }
+    }
+    TEST_ASSERT_EQUAL(8, found);
+    free_memo_cache(cache);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(lookup_after_insert);
+    RUN_TEST(bounded_by_clock_eviction);
+    return UNITY_END();
+}
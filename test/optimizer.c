@@ -0,0 +1,416 @@
+#include <string.h>
+#include "unity.h"
+#include "assembler/assembler.h"
+#include "optimizer/optimizer.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+void
+compare_instructions(Instruction *expected, Instruction *actual, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(expected[i].op, actual[i].op);
+        switch (expected[i].op) {
+            case OP_PUSH_I64:
+                TEST_ASSERT_EQUAL(expected[i].data.immediate, actual[i].data.immediate);
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP:
+            case OP_LOAD_LOCAL_I64:
+                TEST_ASSERT_EQUAL(expected[i].data.reg, actual[i].data.reg);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void
+fold_arithmetic(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 30;\n"
+        "    PushI64 12;\n"
+        "    AddI64;\n"
+        "    PushI64 2;\n"
+        "    MulI64;\n"
+        "    PrintTopStackI64;\n"
+        "    Exit;\n"
+        "}\n";
+
+    Program program = assemble(source);
+    Instruction expected[] = {
+        {.op = OP_PUSH_I64, .data.immediate = 84},
+        {.op = OP_PRINT_TOP_STACK_I64},
+        {.op = OP_EXIT},
+    };
+
+    TEST_ASSERT_EQUAL(4, optimize_program(&program));
+    TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]),
+                      program.functions[0].instructions_count);
+    compare_instructions(expected, program.functions[0].instructions, program.functions[0].instructions_count);
+    free_program(program);
+}
+
+void
+fold_constant_branches(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 1;\n"
+        "    PushI64 2;\n"
+        "    LessThanI64;\n"
+        "    JumpIfFalse #6;\n"
+        "    LoadLocalI64 $0;\n"
+        "    PrintTopStackI64;\n"
+        "    PushI64 0;\n"
+        "    JumpIfFalse #10;\n"
+        "    PushI64 7;\n"
+        "    PrintTopStackI64;\n"
+        "    Exit;\n"
+        "}\n";
+
+    Program program = assemble(source);
+    Instruction expected[] = {
+        {.op = OP_LOAD_LOCAL_I64, .data.reg = 0},
+        {.op = OP_PRINT_TOP_STACK_I64},
+        {.op = OP_JUMP, .data.reg = 3},
+        {.op = OP_EXIT},
+    };
+
+    TEST_ASSERT_EQUAL(7, optimize_program(&program));
+    TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]),
+                      program.functions[0].instructions_count);
+    compare_instructions(expected, program.functions[0].instructions, program.functions[0].instructions_count);
+    free_program(program);
+}
+
+void
+keep_jump_targets_and_division_by_zero(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    JumpIfFalse #3;\n"
+        "    PushI64 1;\n"
+        "    PushI64 0;\n"
+        "    DivI64;\n"
+        "    Return;\n"
+        "}\n";
+
+    Program program = assemble(source);
+
+    TEST_ASSERT_EQUAL(0, optimize_program(&program));
+    TEST_ASSERT_EQUAL(6, program.functions[0].instructions_count);
+    free_program(program);
+}
+
+void
+remap_loop_jumps(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+        "    PushI64 1;\n"
+        "    PushI64 2;\n"
+        "    AddI64;\n"
+        "    StoreLocalI64 $0;\n"
+        "    PushI64 7;\n"
+        "    PrintTopStackI64;\n"
+        "    DecJumpIfNotZero $0 #4;\n"
+        "    IncJumpIfLessThan $1 10 #4;\n"
+        "    Exit;\n"
+        "}\n";
+
+    Program program = assemble(source);
+
+    TEST_ASSERT_EQUAL(2, optimize_program(&program));
+    TEST_ASSERT_EQUAL(7, program.functions[0].instructions_count);
+    TEST_ASSERT_EQUAL(OP_DEC_JUMP_IF_NOT_ZERO, program.functions[0].instructions[4].op);
+    TEST_ASSERT_EQUAL(2, program.functions[0].instructions[4].data.loop.target);
+    TEST_ASSERT_EQUAL(2, program.functions[0].instructions[5].data.loop.target);
+    TEST_ASSERT_EQUAL(10, program.functions[0].instructions[5].data.loop.limit);
+    free_program(program);
+}
+
+void
+inline_small_functions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 5;\n"
+        "    Call :1;\n"
+        "    PrintTopStackI64;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LessThanI64_RI $0 2;\n"
+        "    JumpIfFalse #4;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "    AddI64_RI $0 1;\n"
+        "    Return;\n"
+        "}\n";
+
+    Program program = assemble(source);
+    Instruction expected[] = {
+        {.op = OP_PUSH_I64, .data.immediate = 5},
+        {.op = OP_STORE_LOCAL_I64, .data.reg = 1},
+        {.op = OP_LESS_THAN_I64_RI},
+        {.op = OP_JUMP_IF_FALSE, .data.reg = 6},
+        {.op = OP_LOAD_LOCAL_I64, .data.reg = 1},
+        {.op = OP_JUMP, .data.reg = 7},
+        {.op = OP_ADD_I64_RI},
+        {.op = OP_PRINT_TOP_STACK_I64},
+        {.op = OP_EXIT},
+    };
+
+    TEST_ASSERT_EQUAL(1, inline_functions(&program, INLINE_DEFAULT_BUDGET));
+    TEST_ASSERT_EQUAL(2, program.functions[0].locals_count);
+    TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]),
+                      program.functions[0].instructions_count);
+    compare_instructions(expected, program.functions[0].instructions, program.functions[0].instructions_count);
+    TEST_ASSERT_EQUAL(1, program.functions[0].instructions[2].data.ri.reg);
+    TEST_ASSERT_EQUAL(1, program.functions[0].instructions[6].data.ri.reg);
+    free_program(program);
+}
+
+void
+skip_recursive_and_large_functions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 5;\n"
+        "    Call :1;\n"
+        "    Call :3;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :2;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :1;\n"
+        "    Return;\n"
+        "}\n"
+        ":3 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    AddI64_RI $0 1;\n"
+        "    AddI64_RI $0 2;\n"
+        "    AddI64;\n"
+        "    Return;\n"
+        "}\n";
+
+    Program program = assemble(source);
+
+    TEST_ASSERT_EQUAL(0, inline_functions(&program, 3));
+    TEST_ASSERT_EQUAL(4, program.functions[0].instructions_count);
+    TEST_ASSERT_EQUAL(1, inline_functions(&program, 4));
+    TEST_ASSERT_EQUAL(OP_CALL, program.functions[0].instructions[1].op);
+    free_program(program);
+}
+
+void
+infer_pure_functions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 30;\n"
+        "    Call :1;\n"
+        "    Call :2;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LessThanI64_RI $0 2;\n"
+        "    JumpIfFalse #4;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "    SubI64_RI $0 1;\n"
+        "    Call :1;\n"
+        "    SubI64_RI $0 2;\n"
+        "    Call :1;\n"
+        "    AddI64;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :3;\n"
+        "    Return;\n"
+        "}\n"
+        ":3 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    PrintTopStackI64;\n"
+        "    PushI64 0;\n"
+        "    Return;\n"
+        "}\n";
+
+    Program program = assemble(source);
+
+    TEST_ASSERT_EQUAL(1, infer_purity(&program));
+    TEST_ASSERT_EQUAL(0, program.functions[0].pure);
+    TEST_ASSERT_EQUAL(1, program.functions[1].pure);
+    TEST_ASSERT_EQUAL(0, program.functions[2].pure);
+    TEST_ASSERT_EQUAL(0, program.functions[3].pure);
+    free_program(program);
+}
+
+void
+remove_unreachable_functions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+        "    PushI64 1;\n"
+        "    Call :4;\n"
+        "    Call :2;\n"
+        "    Call :4;\n"
+        "    PushI64 3;\n"
+        "    NewArrayI64;\n"
+        "    StoreLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    ParallelMapI64 :7;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushLiteralString \"unreachable\";\n"
+        "    PrintString;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :6;\n"
+        "    Return;\n"
+        "}\n"
+        ":3 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :2;\n"
+        "    Return;\n"
+        "}\n"
+        ":4 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "}\n"
+        ":6 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    AddI64_RI $0 1;\n"
+        "    Return;\n"
+        "}\n"
+        ":7 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    size_t old_ids[] = {0, 4, 2, 6, 7};
+    size_t instructions_count[sizeof(old_ids) / sizeof(old_ids[0])];
+    VM vm = init_vm();
+    size_t i;
+
+    for (i = 0; i < sizeof(old_ids) / sizeof(old_ids[0]); i++)
+        instructions_count[i] = program.functions[old_ids[i]].instructions_count;
+    // :4 has two call sites in :0, so it comes first; :6 follows its caller :2
+    TEST_ASSERT_EQUAL(3, layout_functions(&program, NULL));
+    TEST_ASSERT_EQUAL(5, program.functions_count);
+    for (i = 0; i < program.functions_count; i++) {
+        TEST_ASSERT_EQUAL(i, program.functions[i].id);
+        TEST_ASSERT_EQUAL(old_ids[i], program.functions[i].source_id);
+        TEST_ASSERT_EQUAL(instructions_count[i], program.functions[i].instructions_count);
+    }
+    TEST_ASSERT_EQUAL(1, program.functions[0].instructions[1].data.reg);
+    TEST_ASSERT_EQUAL(2, program.functions[0].instructions[2].data.reg);
+    TEST_ASSERT_EQUAL(1, program.functions[0].instructions[3].data.reg);
+    TEST_ASSERT_EQUAL(4, program.functions[0].instructions[8].data.reg);
+    TEST_ASSERT_EQUAL(3, program.functions[2].instructions[1].data.reg);
+    TEST_ASSERT_EQUAL(OP_ADD_I64_RI, program.functions[3].instructions[0].op);
+
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(1, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(2, vm.operands_stack.data[0]);
+    free_vm(vm);
+
+    // a second pass finds nothing left to remove and keeps the order
+    TEST_ASSERT_EQUAL(0, layout_functions(&program, NULL));
+    TEST_ASSERT_EQUAL(OP_ADD_I64_RI, program.functions[3].instructions[0].op);
+    free_program(program);
+}
+
+void
+layout_long_call_chains(void)
+{
+    // deep enough to overflow the C stack if the call graph were walked recursively
+    size_t i, n = 200000;
+    Program program = init_program();
+    Instruction instruction;
+
+    memset(&instruction, 0, sizeof(Instruction));
+    for (i = 0; i < n; i++) {
+        Function function = init_function();
+        function.id = n - 1 - i;
+        instruction.op = OP_CALL;
+        instruction.data.reg = function.id + 1;
+        if (function.id + 1 < n)
+            emit_instruction(&function, instruction);
+        instruction.op = OP_RETURN;
+        emit_instruction(&function, instruction);
+        emit_function(&program, function);
+    }
+    TEST_ASSERT_EQUAL(0, inline_functions(&program, 0));
+    TEST_ASSERT_EQUAL(0, layout_functions(&program, NULL));
+    TEST_ASSERT_EQUAL(n, program.functions_count);
+    for (i = 0; i < n; i++)
+        TEST_ASSERT_EQUAL(i, program.functions[i].source_id);
+    free_program(program);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(fold_arithmetic);
+    RUN_TEST(fold_constant_branches);
+    RUN_TEST(keep_jump_targets_and_division_by_zero);
+    RUN_TEST(remap_loop_jumps);
+    RUN_TEST(inline_small_functions);
+    RUN_TEST(skip_recursive_and_large_functions);
+    RUN_TEST(infer_pure_functions);
+    RUN_TEST(remove_unreachable_functions);
+    RUN_TEST(layout_long_call_chains);
+    return UNITY_END();
+}
@@ -0,0 +1,156 @@
+#include <string.h>
+#include "unity.h"
+#include "parallel.h"
+#include "assembler/assembler.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+/*
+ * Squares 0..99999 in place through a helper, sums them, and reduces with
+ * "keep the last", which is associative but not commutative, so partial
+ * results combined out of order would show.
+ */
+static const char *squares =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 1 } {\n"
+    "    PushI64 100000;\n"
+    "    NewArrayI64;\n"
+    "    StoreLocalPointer $0;\n"
+    "    PushI64 0;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LoadLocalPointer $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    ArrayStoreI64;\n"
+    "    IncJumpIfLessThan $0 100000 #5;\n"
+    "    LoadLocalPointer $0;\n"
+    "    ParallelMapI64 :1;\n"
+    "    PushI64 0;\n"
+    "    LoadLocalPointer $0;\n"
+    "    ParallelReduceI64 :2;\n"
+    "    PushI64 7;\n"
+    "    LoadLocalPointer $0;\n"
+    "    ParallelReduceI64 :3;\n"
+    "    LoadLocalPointer $0;\n"
+    "    PushI64 12345;\n"
+    "    ArrayLoadI64;\n"
+    "    Exit;\n"
+    "}\n"
+    ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    Call :4;\n"
+    "    Return;\n"
+    "}\n"
+    ":2 { args: 2 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalI64 $1;\n"
+    "    AddI64;\n"
+    "    Return;\n"
+    "}\n"
+    ":3 { args: 2 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+    "    LoadLocalI64 $1;\n"
+    "    Return;\n"
+    "}\n"
+    ":4 { args: 2 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+    "    LoadLocalI64 $0;\n"
+    "    LoadLocalI64 $1;\n"
+    "    MulI64;\n"
+    "    Return;\n"
+    "}\n";
+
+static void
+run_squares(Program *program, size_t threads, int checked)
+{
+    VM vm = init_vm();
+
+    vm.threads = threads;
+    vm.checked = checked;
+    run_program(&vm, program);
+    TEST_ASSERT_EQUAL(3, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(333328333350000ULL, vm.operands_stack.data[0]);
+    TEST_ASSERT_EQUAL(99999ULL * 99999, vm.operands_stack.data[1]);
+    TEST_ASSERT_EQUAL(12345 * 12345, vm.operands_stack.data[2]);
+    free_vm(vm);
+}
+
+void
+map_and_reduce_on_any_number_of_threads(void)
+{
+    Program program = assemble(squares);
+    size_t threads;
+
+    for (threads = 1; threads <= 4; threads++) {
+        run_squares(&program, threads, 0);
+        run_squares(&program, threads, 1);
+    }
+    free_program(program);
+}
+
+void
+lazy_bodies_are_assembled_before_the_workers_start(void)
+{
+    Program program = assemble_lazy(squares);
+
+    run_squares(&program, 4, 1);
+    free_program(program);
+}
+
+void
+only_pure_functions_run_in_parallel(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 1\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 pure: 1 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :2;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    StoreGlobalI64 $0;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "}\n"
+        ":3 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    VM vm = init_vm();
+    WorkerPool *pool = init_worker_pool(&vm, 2);
+
+    // :1 is marked pure, but calls a function writing a global
+    TEST_ASSERT_FALSE(check_parallel_function(pool, &program, 1, 1));
+    TEST_ASSERT_FALSE(check_parallel_function(pool, &program, 2, 1));
+    TEST_ASSERT_TRUE(check_parallel_function(pool, &program, 3, 1));
+    TEST_ASSERT_FALSE(check_parallel_function(pool, &program, 3, 2));
+    free_worker_pool(pool);
+    free_vm(vm);
+    free_program(program);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(map_and_reduce_on_any_number_of_threads);
+    RUN_TEST(lazy_bodies_are_assembled_before_the_workers_start);
+    RUN_TEST(only_pure_functions_run_in_parallel);
+    return UNITY_END();
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "unity.h"
+#include "assembler/assembler.h"
+#include "optimizer/optimizer.h"
+#include "profile.h"
+
+#define PROFILE_PATH "test_profile.txt"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{
+    remove(PROFILE_PATH);
+}
+
+// the loop body is the taken side of the branch, so it is laid out inverted
+static const char *counting_loop =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+    "    PushI64 0;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LoadLocalI64 $0;\n"
+    "    PushI64 100;\n"
+    "    LessThanI64;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #9;\n"
+    "    LoadLocalI64 $0;\n"
+    "    Exit;\n"
+    "    LoadLocalI64 $0;\n"
+    "    PushI64 1;\n"
+    "    AddI64;\n"
+    "    StoreLocalI64 $0;\n"
+    "    Jump #2;\n"
+    "}\n";
+
+static Profile
+record_profile(const Program *program)
+{
+    Profile profile = init_profile(program);
+    VM vm = init_vm();
+
+    vm.profile = &profile;
+    run_program(&vm, program);
+    free_vm(vm);
+    return profile;
+}
+
+void
+record_branch_counters(void)
+{
+    Program program = assemble(counting_loop);
+    Profile profile = record_profile(&program);
+    FunctionProfile *main_profile = profile.functions;
+    uint64_t *counts = execution_counts(program.functions, main_profile);
+
+    TEST_ASSERT_EQUAL(1, main_profile->calls);
+    TEST_ASSERT_EQUAL(100, main_profile->taken[6]);
+    TEST_ASSERT_EQUAL(1, main_profile->not_taken[6]);
+    TEST_ASSERT_EQUAL(100, main_profile->taken[13]);
+    TEST_ASSERT_EQUAL(0, main_profile->taken[4]);
+    TEST_ASSERT_EQUAL(1, counts[0]);
+    TEST_ASSERT_EQUAL(101, counts[2]);
+    TEST_ASSERT_EQUAL(1, counts[7]);
+    TEST_ASSERT_EQUAL(100, counts[12]);
+    free(counts);
+    free_profile(profile);
+    free_program(program);
+}
+
+void
+save_and_load_profile(void)
+{
+    const char *other =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(counting_loop);
+    Program other_program = assemble(other);
+    Profile profile = record_profile(&program), loaded, other_profile;
+    size_t i;
+
+    TEST_ASSERT_EQUAL(1, save_profile(&profile, PROFILE_PATH));
+    TEST_ASSERT_EQUAL(1, load_profile(&loaded, &program, PROFILE_PATH));
+    TEST_ASSERT_EQUAL(profile.functions[0].calls, loaded.functions[0].calls);
+    for (i = 0; i < program.functions[0].instructions_count; i++) {
+        TEST_ASSERT_EQUAL(profile.functions[0].taken[i], loaded.functions[0].taken[i]);
+        TEST_ASSERT_EQUAL(profile.functions[0].not_taken[i], loaded.functions[0].not_taken[i]);
+    }
+    TEST_ASSERT_EQUAL(0, load_profile(&other_profile, &other_program, PROFILE_PATH));
+    free_profile(loaded);
+    free_profile(profile);
+    free_program(program);
+    free_program(other_program);
+}
+
+void
+layout_makes_hot_path_fall_through(void)
+{
+    Program program = assemble(counting_loop);
+    Profile profile = record_profile(&program);
+    VM vm = init_vm();
+    Function *function = program.functions;
+    size_t i;
+
+    TEST_ASSERT_NOT_EQUAL(0, layout_hot_paths(&program, &profile));
+    // `Not; JumpIfFalse` into the body became a branch out of the loop
+    TEST_ASSERT_EQUAL(13, function->instructions_count);
+    TEST_ASSERT_EQUAL(OP_JUMP_IF_FALSE, function->instructions[5].op);
+    TEST_ASSERT_EQUAL(11, function->instructions[5].data.reg);
+    TEST_ASSERT_EQUAL(OP_LOAD_LOCAL_I64, function->instructions[6].op);
+    TEST_ASSERT_EQUAL(OP_JUMP, function->instructions[10].op);
+    TEST_ASSERT_EQUAL(2, function->instructions[10].data.reg);
+    for (i = 0; i < function->instructions_count; i++)
+        TEST_ASSERT_NOT_EQUAL(OP_NOT, function->instructions[i].op);
+    TEST_ASSERT_EQUAL(1, profile.functions[0].taken[5]);
+    TEST_ASSERT_EQUAL(100, profile.functions[0].not_taken[5]);
+    TEST_ASSERT_EQUAL(100, profile.functions[0].taken[10]);
+
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(1, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(100, vm.operands_stack.data[0]);
+    free_vm(vm);
+    free_profile(profile);
+    free_program(program);
+}
+
+void
+inline_only_hot_call_sites(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 200;\n"
+        "    StoreLocalI64 $0;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :1;\n"
+        "    StoreLocalI64 $0;\n"
+        "    LoadLocalI64 $0;\n"
+        "    JumpIfTrue #2;\n"
+        "    PushI64 5;\n"
+        "    Call :2;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    PushI64 1;\n"
+        "    SubI64;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    PushI64 2;\n"
+        "    MulI64;\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    Profile profile = record_profile(&program);
+    VM vm = init_vm();
+    size_t i, calls = 0;
+
+    TEST_ASSERT_EQUAL(200, profile.functions[1].calls);
+    TEST_ASSERT_EQUAL(1, profile.functions[2].calls);
+    TEST_ASSERT_EQUAL(1, inline_hot_calls(&program, &profile, INLINE_HOT_BUDGET));
+    for (i = 0; i < program.functions[0].instructions_count; i++) {
+        if (program.functions[0].instructions[i].op == OP_CALL) {
+            TEST_ASSERT_EQUAL(2, program.functions[0].instructions[i].data.reg);
+            calls++;
+        }
+    }
+    TEST_ASSERT_EQUAL(1, calls);
+
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(1, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(10, vm.operands_stack.data[0]);
+    free_vm(vm);
+    free_profile(profile);
+    free_program(program);
+}
+
+void
+functions_never_called_are_placed_last(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushI64 0;\n"
+        "    JumpIfFalse #3;\n"
+        "    Call :1;\n"
+        "    Call :2;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Call :3;\n"
+        "    Return;\n"
+        "}\n"
+        ":2 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Return;\n"
+        "}\n"
+        ":3 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    Profile profile = record_profile(&program);
+
+    // by call sites alone :1 would come first, as it has the lower id
+    TEST_ASSERT_EQUAL(0, layout_functions(&program, &profile));
+    TEST_ASSERT_EQUAL(4, program.functions_count);
+    TEST_ASSERT_EQUAL(2, program.functions[0].instructions[2].data.reg);
+    TEST_ASSERT_EQUAL(1, program.functions[0].instructions[3].data.reg);
+    TEST_ASSERT_EQUAL(OP_RETURN, program.functions[1].instructions[0].op);
+    TEST_ASSERT_EQUAL(3, program.functions[2].instructions[0].data.reg);
+    TEST_ASSERT_EQUAL(4, profile.functions_count);
+    TEST_ASSERT_EQUAL(1, profile.functions[0].calls);
+    TEST_ASSERT_EQUAL(1, profile.functions[1].calls);
+    TEST_ASSERT_EQUAL(0, profile.functions[2].calls);
+    TEST_ASSERT_EQUAL(1, profile.functions[0].taken[3]);
+    free_profile(profile);
+    free_program(program);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(record_branch_counters);
+    RUN_TEST(save_and_load_profile);
+    RUN_TEST(layout_makes_hot_path_fall_through);
+    RUN_TEST(inline_only_hot_call_sites);
+    RUN_TEST(functions_never_called_are_placed_last);
+    return UNITY_END();
+}
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "unity.h"
+#include "assembler/assembler.h"
+#include "register_vm.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+static const char *fib =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+    "    PushI64 20;\n"
+    "    Call :1;\n"
+    "    Exit;\n"
+    "}\n"
+    ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+    "    LessThanI64_RI $0 2;\n"
+    "    JumpIfFalse #4;\n"
+    "    LoadLocalI64 $0;\n"
+    "    Return;\n"
+    "    SubI64_RI $0 1;\n"
+    "    Call :1;\n"
+    "    SubI64_RI $0 2;\n"
+    "    Call :1;\n"
+    "    AddI64;\n"
+    "    Return;\n"
+    "}\n";
+
+void
+translate_counted_loop(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $0;\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $1;\n"
+        "    AddI64_RI $1 3;\n"
+        "    StoreLocalI64 $1;\n"
+        "    AddI64_RI $0 1;\n"
+        "    StoreLocalI64 $0;\n"
+        "    LessThanI64_RI $0 100;\n"
+        "    NotI64;\n"
+        "    JumpIfFalse #4;\n"
+        "    LoadLocalI64 $1;\n"
+        "    Exit;\n"
+        "}\n";
+    RegisterOp expected[] = {
+        REG_LOAD_IMMEDIATE,
+        REG_LOAD_IMMEDIATE,
+        REG_ADD_IMMEDIATE,
+        REG_ADD_IMMEDIATE,
+        REG_LESS_THAN_IMMEDIATE,
+        REG_JUMP_IF_TRUE,
+        REG_MOVE,
+        REG_EXIT,
+    };
+    Program program = assemble(source);
+    RegisterProgram registers;
+    RegisterFunction *function;
+    VM vm = init_vm();
+    size_t i;
+
+    TEST_ASSERT_EQUAL(1, translate_program(&program, &registers));
+    function = registers.functions;
+    TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]), function->instructions_count);
+    for (i = 0; i < function->instructions_count; i++)
+        TEST_ASSERT_EQUAL(expected[i], function->instructions[i].op);
+    TEST_ASSERT_EQUAL(3, function->registers_count);
+    TEST_ASSERT_EQUAL(1, function->instructions[2].dst);
+    TEST_ASSERT_EQUAL(2, function->instructions[5].b);
+
+    run_register_program(&vm, &registers);
+    TEST_ASSERT_EQUAL(1, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(300, vm.operands_stack.data[0]);
+    free_vm(vm);
+    free_register_program(registers);
+    free_program(program);
+}
+
+void
+recursive_calls_match_stack_vm(void)
+{
+    Program program = assemble(fib);
+    RegisterProgram registers;
+    VM stack_vm = init_vm();
+    VM register_vm = init_vm();
+
+    TEST_ASSERT_EQUAL(1, translate_program(&program, &registers));
+    TEST_ASSERT_EQUAL(1, registers.functions[1].returns_value);
+    run_program(&stack_vm, &program);
+    run_register_program(&register_vm, &registers);
+
+    TEST_ASSERT_EQUAL(1, register_vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(6765, register_vm.operands_stack.data[0]);
+    TEST_ASSERT_EQUAL(stack_vm.operands_stack.data[0], register_vm.operands_stack.data[0]);
+    free_vm(stack_vm);
+    free_vm(register_vm);
+    free_register_program(registers);
+    free_program(program);
+}
+
+void
+globals_and_overwritten_locals(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 1\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 7;\n"
+        "    StoreLocalI64 $0;\n"
+        "    LoadLocalI64 $0;\n"
+        "    PushI64 5;\n"
+        "    StoreLocalI64 $0;\n"
+        "    LoadLocalI64 $0;\n"
+        "    PushI64 10;\n"
+        "    PushI64 3;\n"
+        "    Call :1;\n"
+        "    LoadGlobalI64 $0;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 2 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    LoadLocalI64 $1;\n"
+        "    SubI64;\n"
+        "    StoreGlobalI64 $0;\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    RegisterProgram registers;
+    VM vm = init_vm();
+
+    TEST_ASSERT_EQUAL(1, translate_program(&program, &registers));
+    TEST_ASSERT_EQUAL(0, registers.functions[1].returns_value);
+    run_register_program(&vm, &registers);
+
+    TEST_ASSERT_EQUAL(3, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(7, vm.operands_stack.data[0]);
+    TEST_ASSERT_EQUAL(5, vm.operands_stack.data[1]);
+    TEST_ASSERT_EQUAL(7, vm.operands_stack.data[2]);
+    free_vm(vm);
+    free_register_program(registers);
+    free_program(program);
+}
+
+void
+reject_untranslatable_programs(void)
+{
+    const char *strings =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    PushLiteralString \"hi\";\n"
+        "    PrintString;\n"
+        "    Exit;\n"
+        "}\n";
+    const char *unbalanced =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    JumpIfFalse #3;\n"
+        "    PushI64 1;\n"
+        "    Exit;\n"
+        "}\n";
+    // left to the stack VM, which reports them
+    const char *out_of_range[] = {
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 1;\n"
+        "    StoreLocalI64 $100000;\n"
+        "    Exit;\n"
+        "}\n",
+        "---\n"
+        "globals: 1\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    LoadGlobalI64 $1;\n"
+        "    Exit;\n"
+        "}\n",
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    AddI64_RI $1 1;\n"
+        "    Exit;\n"
+        "}\n",
+    };
+    Program program = assemble(strings);
+    RegisterProgram registers;
+    size_t i;
+
+    TEST_ASSERT_EQUAL(0, translate_program(&program, &registers));
+    free_program(program);
+    program = assemble(unbalanced);
+    TEST_ASSERT_EQUAL(0, translate_program(&program, &registers));
+    free_program(program);
+    for (i = 0; i < sizeof(out_of_range) / sizeof(out_of_range[0]); i++) {
+        program = assemble(out_of_range[i]);
+        TEST_ASSERT_EQUAL(0, translate_program(&program, &registers));
+        free_program(program);
+    }
+}
+
+/* Runs `source` on the register VM in a child, which must fail with `message` on stderr. */
+static void
+assert_register_failure(const char *source, const char *message)
+{
+    Program program = assemble(source);
+    RegisterProgram registers;
+    char output[512];
+    int errors[2], status;
+    ssize_t size;
+    pid_t pid;
+
+    TEST_ASSERT_EQUAL(1, translate_program(&program, &registers));
+    TEST_ASSERT_EQUAL(0, pipe(errors));
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        VM vm = init_vm();
+        dup2(errors[1], STDERR_FILENO);
+        run_register_program(&vm, &registers);
+        _exit(EXIT_SUCCESS);
+    }
+    close(errors[1]);
+    size = read(errors[0], output, sizeof(output) - 1);
+    close(errors[0]);
+    TEST_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL(EXIT_FAILURE, WEXITSTATUS(status));
+    TEST_ASSERT_GREATER_THAN(0, size);
+    output[size] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(output, message));
+    free_register_program(registers);
+    free_program(program);
+}
+
+void
+division_by_zero_fails_cleanly(void)
+{
+    assert_register_failure("---\n"
+                            "globals: 0\n"
+                            "global_pointers: 0\n"
+                            "---\n"
+                            ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+                            "    PushI64 7;\n"
+                            "    LoadLocalI64 $0;\n"
+                            "    DivI64;\n"
+                            "    Exit;\n"
+                            "}\n",
+                            "DIV_I64: division by zero");
+    assert_register_failure("---\n"
+                            "globals: 0\n"
+                            "global_pointers: 0\n"
+                            "---\n"
+                            ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+                            "    PushI64 7;\n"
+                            "    PushI64 0;\n"
+                            "    ModI64;\n"
+                            "    Exit;\n"
+                            "}\n",
+                            "MOD_I64: division by zero");
+    assert_register_failure("---\n"
+                            "globals: 0\n"
+                            "global_pointers: 0\n"
+                            "---\n"
+                            ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+                            "    DivI64_RI $0 0;\n"
+                            "    Exit;\n"
+                            "}\n",
+                            "DIV_I64: division by zero");
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(translate_counted_loop);
+    RUN_TEST(recursive_calls_match_stack_vm);
+    RUN_TEST(globals_and_overwritten_locals);
+    RUN_TEST(reject_untranslatable_programs);
+    RUN_TEST(division_by_zero_fails_cleanly);
+    return UNITY_END();
+}
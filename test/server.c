@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "server.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+static const char *answer =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+    "    PushI64 %d;\n"
+    "    PrintTopStackI64;\n"
+    "    Exit;\n"
+    "}\n";
+
+// adds the two integers it is given
+static const char *add =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+    "    ReadI64;\n"
+    "    StoreLocalI64 $0;\n"
+    "    ReadI64;\n"
+    "    StoreLocalI64 $0;\n"
+    "    AddI64;\n"
+    "    PrintTopStackI64;\n"
+    "    Exit;\n"
+    "}\n";
+
+static void
+write_program(const char *path, const char *format, int value)
+{
+    FILE *file = fopen(path, "w");
+
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, format, value);
+    fclose(file);
+}
+
+static char response[1 << 14];
+
+/* Sends `requests` and reads the whole response, which must fit in a pipe, into `response`. */
+static void
+serve(Server *server, const char *requests)
+{
+    int in[2], out[2];
+    ssize_t size;
+
+    TEST_ASSERT_EQUAL(0, pipe(in));
+    TEST_ASSERT_EQUAL(0, pipe(out));
+    TEST_ASSERT_EQUAL(strlen(requests), write(in[1], requests, strlen(requests)));
+    close(in[1]);
+    TEST_ASSERT_TRUE(serve_requests(server, in[0], out[1]));
+    close(in[0]);
+    close(out[1]);
+    size = read(out[0], response, sizeof(response) - 1);
+    TEST_ASSERT_GREATER_THAN(0, size);
+    response[size] = '\0';
+    close(out[0]);
+}
+
+void
+programs_are_assembled_once_and_evicted_least_recently_used_first(void)
+{
+    Server server = init_server(init_vm(), 2);
+    char expected[512], fingerprint[32];
+
+    write_program("test_server_answer.hal", answer, 42);
+    write_program("test_server_add.hal", add, 0);
+    serve(&server, "test_server_answer.hal\n\ntest_server_answer.hal\n");
+    TEST_ASSERT_EQUAL(1, sscanf(response, "program %16s\n", fingerprint));
+    sprintf(expected, "program %s\nout 3\n42\nexit 0\nprogram %s\nout 3\n42\nexit 0\n", fingerprint, fingerprint);
+    TEST_ASSERT_EQUAL_STRING(expected, response);
+    TEST_ASSERT_EQUAL(1, server.cache.misses);
+    TEST_ASSERT_EQUAL(1, server.cache.hits);
+
+    // the last request needs no newline; a changed file gets a new program, the old one stays runnable
+    sprintf(expected, "test_server_add.hal 5 7\n#%s", fingerprint);
+    serve(&server, expected);
+    TEST_ASSERT_NOT_NULL(strstr(response, "out 3\n12\nexit 0\n"));
+    TEST_ASSERT_NOT_NULL(strstr(response, "out 3\n42\nexit 0\n"));
+    write_program("test_server_answer.hal", answer, 420);
+    serve(&server, "test_server_answer.hal");
+    TEST_ASSERT_NULL(strstr(response, fingerprint));
+    TEST_ASSERT_NOT_NULL(strstr(response, "out 4\n420\nexit 0\n"));
+    TEST_ASSERT_EQUAL(1, server.cache.evictions);
+    TEST_ASSERT_EQUAL(3, server.cache.misses);
+
+    // the add program was used least recently, so it was the one evicted, and now the new one is
+    sprintf(expected, "#%s", fingerprint);
+    serve(&server, expected);
+    TEST_ASSERT_NOT_NULL(strstr(response, "out 3\n42\nexit 0\n"));
+    serve(&server, "test_server_add.hal 1 2\n");
+    TEST_ASSERT_NOT_NULL(strstr(response, "out 2\n3\nexit 0\n"));
+    TEST_ASSERT_EQUAL(4, server.cache.misses);
+    TEST_ASSERT_EQUAL(2, server.cache.evictions);
+    free_server(server);
+    remove("test_server_answer.hal");
+    remove("test_server_add.hal");
+}
+
+void
+failures_only_end_their_request(void)
+{
+    Server server = init_server(init_vm(), 2);
+
+    write_program("test_server_add.hal", add, 0);
+    write_program("test_server_broken.hal", "---\nglobals: %d\nglobal_pointers: 0\n---\n:0 { Bogus; }\n", 0);
+    serve(&server, "test_server_missing.hal\n");
+    TEST_ASSERT_EQUAL(0, strncmp(response, "err ", 4));
+    TEST_ASSERT_NOT_NULL(strstr(response, "Failed to open test_server_missing.hal"));
+    TEST_ASSERT_NOT_NULL(strstr(response, "\nexit 1\n"));
+
+    serve(&server, "test_server_broken.hal\n#0123456789abcdef\n#nothex\n");
+    TEST_ASSERT_EQUAL(0, strncmp(response, "err ", 4));
+    TEST_ASSERT_NULL(strstr(response, "exit 0"));
+    TEST_ASSERT_EQUAL(1, server.cache.misses);
+    TEST_ASSERT_NOT_NULL(strstr(response, "No cached program has fingerprint #0123456789abcdef\n"));
+    TEST_ASSERT_NOT_NULL(strstr(response, "Invalid fingerprint #nothex\n"));
+    TEST_ASSERT_EQUAL(0, server.cache.count);
+
+    // a runtime error exits the child, the server goes on
+    serve(&server, "test_server_add.hal 1 x\ntest_server_add.hal 2 2\n");
+    TEST_ASSERT_NOT_NULL(strstr(response, "Invalid input: expected an integer"));
+    TEST_ASSERT_NOT_NULL(strstr(response, "exit 1\nprogram "));
+    TEST_ASSERT_NOT_NULL(strstr(response, "out 2\n4\nexit 0\n"));
+    free_server(server);
+    remove("test_server_add.hal");
+    remove("test_server_broken.hal");
+}
+
+void
+other_files_are_not_replaced_by_the_socket(void)
+{
+    Server server = init_server(init_vm(), 2);
+    FILE *file;
+
+    write_program("test_server_answer.hal", answer, 42);
+    TEST_ASSERT_FALSE(serve_socket(&server, "test_server_answer.hal"));
+    file = fopen("test_server_answer.hal", "r");
+    TEST_ASSERT_NOT_NULL(file);
+    fclose(file);
+    free_server(server);
+    remove("test_server_answer.hal");
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(programs_are_assembled_once_and_evicted_least_recently_used_first);
+    RUN_TEST(failures_only_end_their_request);
+    RUN_TEST(other_files_are_not_replaced_by_the_socket);
+    return UNITY_END();
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "simd.h"
+
+#define LENGTH 37
+
+static uint64_t a[LENGTH], b[LENGTH];
+
+void
+setUp(void)
+{
+    size_t i;
+    srand(42);
+    for (i = 0; i < LENGTH; i++) {
+        a[i] = ((uint64_t) rand() << 33) ^ (uint64_t) rand();
+        b[i] = i % 5 == 0 ? a[i] : ((uint64_t) rand() << 33) ^ (uint64_t) rand();
+    }
+}
+
+void
+tearDown(void)
+{}
+
+static void
+compare_kernels(const SimdKernels *expected, const SimdKernels *actual)
+{
+    uint64_t x[LENGTH], y[LENGTH];
+
+    memcpy(x, a, sizeof(a));
+    memcpy(y, a, sizeof(a));
+    expected->mul(x, b, LENGTH);
+    actual->mul(y, b, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+    expected->sub(x, b, LENGTH);
+    actual->sub(y, b, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+    expected->add_scalar(x, 12345, LENGTH);
+    actual->add_scalar(y, 12345, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+    expected->mul_scalar(x, 0xdeadbeefcafeULL, LENGTH);
+    actual->mul_scalar(y, 0xdeadbeefcafeULL, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+
+    TEST_ASSERT_TRUE(expected->sum(a, LENGTH) == actual->sum(a, LENGTH));
+    TEST_ASSERT_TRUE(expected->min(a, LENGTH) == actual->min(a, LENGTH));
+    TEST_ASSERT_TRUE(expected->max(a, LENGTH) == actual->max(a, LENGTH));
+    TEST_ASSERT_TRUE(expected->min(a, 0) == actual->min(a, 0));
+
+    expected->equals(x, a, b, LENGTH);
+    actual->equals(y, a, b, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+    expected->less_than(x, a, b, LENGTH);
+    actual->less_than(y, a, b, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+    expected->greater_than(x, a, b, LENGTH);
+    actual->greater_than(y, a, b, LENGTH);
+    TEST_ASSERT_EQUAL_MEMORY(x, y, sizeof(x));
+}
+
+void
+scalar_kernels(void)
+{
+    uint64_t x[] = {1, 5, 3}, y[] = {4, 5, 6}, mask[3];
+    const SimdKernels *kernels = simd_kernels_for(SIMD_SCALAR);
+
+    TEST_ASSERT_EQUAL(9, kernels->sum(x, 3));
+    TEST_ASSERT_EQUAL(1, kernels->min(x, 3));
+    TEST_ASSERT_EQUAL(5, kernels->max(x, 3));
+    kernels->less_than(mask, x, y, 3);
+    TEST_ASSERT_EQUAL(1, mask[0]);
+    TEST_ASSERT_EQUAL(0, mask[1]);
+    TEST_ASSERT_EQUAL(1, mask[2]);
+    kernels->add(x, y, 3);
+    TEST_ASSERT_EQUAL(5, x[0]);
+    TEST_ASSERT_EQUAL(10, x[1]);
+    TEST_ASSERT_EQUAL(9, x[2]);
+}
+
+void
+vector_kernels_match_scalar(void)
+{
+    int level;
+    const SimdKernels *scalar = simd_kernels_for(SIMD_SCALAR);
+    for (level = SIMD_SCALAR + 1; level < SIMD_COUNT; level++) {
+        const SimdKernels *kernels = simd_kernels_for((SimdLevel) level);
+        if (kernels != NULL)
+            compare_kernels(scalar, kernels);
+    }
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(scalar_kernels);
+    RUN_TEST(vector_kernels_match_scalar);
+    return UNITY_END();
+}
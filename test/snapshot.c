@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include "unity.h"
+#include "assembler/assembler.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_PATH "test_snapshot.snap"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{
+    remove(SNAPSHOT_PATH);
+}
+
+static const char *warm_start =
+    "---\n"
+    "globals: 1\n"
+    "global_pointers: 2\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+    "    PushLiteralString \"key=valuable\";\n"
+    "    StoreGlobalPointer $0;\n"
+    "    PushLiteralString \"short\";\n"
+    "    StoreGlobalPointer $1;\n"
+    "    PushI64 7;\n"
+    "    StoreGlobalI64 $0;\n"
+    "    PushI64 100;\n"
+    "    NewArrayI64;\n"
+    "    StoreLocalPointer $0;\n"
+    "    LoadLocalPointer $0;\n"
+    "    PushI64 3;\n"
+    "    ArrayFillI64;\n"
+    "    LoadGlobalPointer $0;\n"
+    "    PushI64 4;\n"
+    "    PushI64 8;\n"
+    "    SliceString;\n"
+    "    PushI64 41;\n"
+    "    LoadLocalPointer $0;\n"
+    "    Call :1;\n"
+    "    LoadGlobalI64 $0;\n"
+    "    Exit;\n"
+    "}\n"
+    ":1 { args: 1 ptr_args: 1 locals: 1 local_pointers: 1 } {\n"
+    "    Snapshot;\n"
+    "    LoadLocalPointer $0;\n"
+    "    ArraySumI64;\n"
+    "    LoadLocalI64 $0;\n"
+    "    AddI64;\n"
+    "    Return;\n"
+    "}\n";
+
+void
+restore_paused_call(void)
+{
+    Program program = assemble(warm_start);
+    VM vm = init_vm();
+    VM restored = init_vm();
+    HeapObject *view;
+
+    vm.pause_at_snapshot = 1;
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(1, vm.paused);
+    TEST_ASSERT_EQUAL(1, save_snapshot(&vm, &program, SNAPSHOT_PATH));
+
+    TEST_ASSERT_EQUAL(1, load_snapshot(&restored, &program, SNAPSHOT_PATH));
+    TEST_ASSERT_EQUAL(3, restored.objects.size);
+    TEST_ASSERT_EQUAL(1, restored.pointers_stack.size);
+    view = restored.pointers_stack.data[0];
+    TEST_ASSERT_EQUAL(OBJECT_STRING_VIEW, view->kind);
+    TEST_ASSERT_EQUAL_PTR(restored.global_pointers[0], view->parent);
+    TEST_ASSERT_EQUAL_MEMORY("valuable", view->data, 8);
+    TEST_ASSERT_EQUAL_PTR(inline_string("short", 5), restored.global_pointers[1]);
+
+    resume_program(&restored, &program);
+    TEST_ASSERT_EQUAL(0, restored.paused);
+    TEST_ASSERT_EQUAL(2, restored.operands_stack.size);
+    TEST_ASSERT_EQUAL(341, restored.operands_stack.data[0]);
+    TEST_ASSERT_EQUAL(7, restored.operands_stack.data[1]);
+
+    resume_program(&vm, &program);
+    TEST_ASSERT_EQUAL(341, vm.operands_stack.data[0]);
+    free_vm(vm);
+    free_vm(restored);
+    free_program(program);
+}
+
+void
+restore_counts_references(void)
+{
+    Program program = assemble(warm_start);
+    VM vm = init_vm();
+    VM restored = init_vm();
+    HeapObject *view;
+
+    vm.pause_at_snapshot = 1;
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(1, save_snapshot(&vm, &program, SNAPSHOT_PATH));
+
+    restored.memory = MEMORY_REFCOUNT;
+    TEST_ASSERT_EQUAL(1, load_snapshot(&restored, &program, SNAPSHOT_PATH));
+    view = restored.pointers_stack.data[0];
+    TEST_ASSERT_EQUAL(1, view->refs);
+    // held by the global and by the view
+    TEST_ASSERT_EQUAL(2, view->parent->refs);
+
+    resume_program(&restored, &program);
+    TEST_ASSERT_EQUAL(341, restored.operands_stack.data[0]);
+    free_vm(vm);
+    free_vm(restored);
+    free_program(program);
+}
+
+void
+snapshot_is_a_no_op_unless_requested(void)
+{
+    Program program = assemble(warm_start);
+    VM vm = init_vm();
+
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(0, vm.paused);
+    TEST_ASSERT_EQUAL(2, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(0, save_snapshot(&vm, &program, SNAPSHOT_PATH));
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+reject_snapshot_of_other_program(void)
+{
+    const char *other =
+        "---\n"
+        "globals: 1\n"
+        "global_pointers: 1\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    Snapshot;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(warm_start);
+    Program other_program = assemble(other);
+    VM vm = init_vm();
+    VM restored = init_vm();
+
+    vm.pause_at_snapshot = 1;
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(1, save_snapshot(&vm, &program, SNAPSHOT_PATH));
+    TEST_ASSERT_EQUAL(0, load_snapshot(&restored, &other_program, SNAPSHOT_PATH));
+    free_vm(vm);
+    free_vm(restored);
+    free_program(program);
+    free_program(other_program);
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(restore_paused_call);
+    RUN_TEST(restore_counts_references);
+    RUN_TEST(snapshot_is_a_no_op_unless_requested);
+    RUN_TEST(reject_snapshot_of_other_program);
+    return UNITY_END();
+}
@@ -0,0 +1,704 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "unity.h"
+#include "assembler/assembler.h"
+#include "optimizer/optimizer.h"
+
+void
+setUp(void)
+{}
+
+void
+tearDown(void)
+{}
+
+static const char *garbage_loop =
+    "---\n"
+    "globals: 0\n"
+    "global_pointers: 0\n"
+    "---\n"
+    ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 1 } {\n"
+    "    PushI64 0;\n"
+    "    StoreLocalI64 $0;\n"
+    "    PushLiteralString \"hello \";\n"
+    "    PushLiteralString \"world\";\n"
+    "    ConcatStrings;\n"
+    "    StoreLocalPointer $0;\n"
+    "    AddI64_RI $0 1;\n"
+    "    StoreLocalI64 $0;\n"
+    "    LessThanI64_RI $0 1000;\n"
+    "    NotI64;\n"
+    "    JumpIfFalse #2;\n"
+    "    Exit;\n"
+    "}\n";
+
+void
+gc_threshold_and_stats(void)
+{
+    Program program = assemble(garbage_loop);
+    VM vm = init_vm();
+
+    vm.gc.initial_threshold = 1024;
+    vm.gc.growth_factor = 2.0;
+    run_program(&vm, &program);
+
+    TEST_ASSERT_GREATER_THAN(0, vm.gc_stats.collections);
+    TEST_ASSERT_GREATER_THAN(0, vm.gc_stats.objects_swept);
+    // only the concatenations are too long to be inline
+    TEST_ASSERT_EQUAL(1000 - vm.objects.size, vm.gc_stats.objects_swept);
+    TEST_ASSERT_LESS_OR_EQUAL(2048 + 11, vm.gc_stats.peak_heap_size);
+    TEST_ASSERT_EQUAL(2, vm.gc_stats.pointers_stack_high_water);
+    TEST_ASSERT_EQUAL(1, vm.gc_stats.operands_stack_high_water);
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+gc_keeps_reachable_objects(void)
+{
+    Program program = assemble(garbage_loop);
+    VM vm = init_vm();
+
+    vm.gc.initial_threshold = 0;
+    vm.gc.growth_factor = 0;
+    run_program(&vm, &program);
+
+    // the previous string is still held by $0 when the last one is made
+    TEST_ASSERT_EQUAL(1000, vm.gc_stats.collections);
+    TEST_ASSERT_EQUAL(2, vm.objects.size);
+    TEST_ASSERT_EQUAL(22, vm.allocated_heap_size);
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+string_views_keep_parent_alive(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+        "    PushLiteralString \"hello wonderful world\";\n"
+        "    PushI64 6;\n"
+        "    PushI64 15;\n"
+        "    SliceString;\n"
+        "    PushI64 1;\n"
+        "    PushI64 11;\n"
+        "    SliceString;\n"
+        "    StoreLocalPointer $0;\n"
+        "    PushLiteralString \"garbage\";\n"
+        "    LoadLocalPointer $0;\n"
+        "    StringLength;\n"
+        "    PushLiteralString \"hello wonderful world\";\n"
+        "    LoadLocalPointer $0;\n"
+        "    FindString;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"onderful wo\";\n"
+        "    CompareStrings;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"onderful wz\";\n"
+        "    CompareStrings;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    VM vm = init_vm();
+    HeapObject *view = NULL;
+    size_t i, views = 0;
+
+    vm.gc.initial_threshold = 0;
+    vm.gc.growth_factor = 0;
+    run_program(&vm, &program);
+
+    // the intermediate "wonderful world" view is gone, the slice of it points at the root
+    for (i = 0; i < vm.objects.size; i++) {
+        if (vm.objects.data[i]->kind == OBJECT_STRING_VIEW) {
+            view = vm.objects.data[i];
+            views++;
+        }
+    }
+    TEST_ASSERT_EQUAL(1, views);
+    TEST_ASSERT_EQUAL(OBJECT_STRING, view->parent->kind);
+    TEST_ASSERT_EQUAL(11, view->size);
+    TEST_ASSERT_EQUAL(0, memcmp(view->data, "onderful wo", 11));
+
+    TEST_ASSERT_EQUAL(4, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(11, vm.operands_stack.data[0]);
+    TEST_ASSERT_EQUAL(7, vm.operands_stack.data[1]);
+    TEST_ASSERT_EQUAL(0, vm.operands_stack.data[2]);
+    TEST_ASSERT_EQUAL(UINT64_MAX, vm.operands_stack.data[3]);
+    free_vm(vm);
+    free_program(program);
+}
+
+static void
+assert_string(const char *expected, const HeapObject *string)
+{
+    char buffer[STRING_INLINE_MAX];
+
+    TEST_ASSERT_EQUAL(strlen(expected), string_length(string));
+    if (string_length(string) > 0)
+        TEST_ASSERT_EQUAL_MEMORY(expected, string_bytes(string, buffer), string_length(string));
+}
+
+void
+short_strings_are_inline(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+        "    PushLiteralString \"abc\";\n"
+        "    PushLiteralString \"defg\";\n"
+        "    ConcatStrings;\n"
+        "    StoreLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"h\";\n"
+        "    ConcatStrings;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushI64 2;\n"
+        "    PushI64 3;\n"
+        "    SliceString;\n"
+        "    PushLiteralString \"hello wonderful world\";\n"
+        "    PushI64 6;\n"
+        "    PushI64 3;\n"
+        "    SliceString;\n"
+        "    LoadLocalPointer $0;\n"
+        "    StringLength;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"efg\";\n"
+        "    FindString;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushLiteralString \"abcdefgh\";\n"
+        "    CompareStrings;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    int checked;
+
+    for (checked = 0; checked <= 1; checked++) {
+        VM vm = init_vm();
+        vm.checked = checked;
+        run_program(&vm, &program);
+        TEST_ASSERT_EQUAL(3, vm.pointers_stack.size);
+        TEST_ASSERT_FALSE(is_inline_string(vm.pointers_stack.data[0]));
+        assert_string("abcdefgh", vm.pointers_stack.data[0]);
+        TEST_ASSERT_TRUE(is_inline_string(vm.pointers_stack.data[1]));
+        assert_string("cde", vm.pointers_stack.data[1]);
+        TEST_ASSERT_TRUE(is_inline_string(vm.pointers_stack.data[2]));
+        assert_string("won", vm.pointers_stack.data[2]);
+        TEST_ASSERT_EQUAL(3, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL(7, vm.operands_stack.data[0]);
+        TEST_ASSERT_EQUAL(4, vm.operands_stack.data[1]);
+        TEST_ASSERT_EQUAL(UINT64_MAX, vm.operands_stack.data[2]);
+        // the 8 byte concatenation and the two long literals; slices this short are copies
+        TEST_ASSERT_EQUAL(3, vm.objects.size);
+        free_vm(vm);
+    }
+    free_program(program);
+}
+
+void
+reference_counting_frees_objects_at_once(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+        "    PushLiteralString \"hello wonderful world\";\n"
+        "    PushI64 6;\n"
+        "    PushI64 15;\n"
+        "    SliceString;\n"
+        "    StoreLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    Call :1;\n"
+        "    PushLiteralString \"short\";\n"
+        "    StoreLocalPointer $0;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 0 ptr_args: 1 locals: 0 local_pointers: 1 } {\n"
+        "    LoadLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    ConcatStrings;\n"
+        "    StringLength;\n"
+        "    Return;\n"
+        "}\n";
+    Program loop = assemble(garbage_loop);
+    Program program = assemble(source);
+    int checked;
+
+    for (checked = 0; checked <= 1; checked++) {
+        VM vm = init_vm();
+        vm.memory = MEMORY_REFCOUNT;
+        vm.checked = checked;
+        run_program(&vm, &loop);
+        // each concatenation is freed as soon as the next one replaces it in $0
+        TEST_ASSERT_EQUAL(0, vm.gc_stats.collections);
+        TEST_ASSERT_EQUAL(999, vm.gc_stats.objects_swept);
+        TEST_ASSERT_EQUAL(1, vm.objects.size);
+        TEST_ASSERT_EQUAL(1, vm.objects.data[0]->refs);
+        TEST_ASSERT_EQUAL(11, vm.allocated_heap_size);
+        TEST_ASSERT_EQUAL(22, vm.gc_stats.peak_heap_size);
+        free_vm(vm);
+
+        vm = init_vm();
+        vm.memory = MEMORY_REFCOUNT;
+        vm.checked = checked;
+        run_program(&vm, &program);
+        // the view kept the literal alive until $0 let go of it, and the callee's frame let go of its argument
+        TEST_ASSERT_EQUAL(1, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL(30, vm.operands_stack.data[0]);
+        TEST_ASSERT_EQUAL(3, vm.gc_stats.objects_swept);
+        TEST_ASSERT_EQUAL(0, vm.objects.size);
+        TEST_ASSERT_EQUAL(0, vm.allocated_heap_size);
+        free_vm(vm);
+    }
+    free_program(loop);
+    free_program(program);
+}
+
+void
+counted_loops(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $1;\n"
+        "    PushI64 4;\n"
+        "    StoreLocalI64 $0;\n"
+        "    AddI64_RI $1 10;\n"
+        "    StoreLocalI64 $1;\n"
+        "    DecJumpIfNotZero $0 #4;\n"
+        "    LoadLocalI64 $1;\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $0;\n"
+        "    IncJumpIfLessThan $0 3 #10;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Jump #14;\n"
+        "    PushI64 99;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    VM vm = init_vm();
+
+    run_program(&vm, &program);
+
+    TEST_ASSERT_EQUAL(2, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(40, vm.operands_stack.data[0]);
+    TEST_ASSERT_EQUAL(3, vm.operands_stack.data[1]);
+    free_vm(vm);
+    free_program(program);
+}
+
+void
+register_immediate_operations(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 17;\n"
+        "    StoreLocalI64 $0;\n"
+        "    MulI64_RI $0 3;\n"
+        "    DivI64_RI $0 5;\n"
+        "    ModI64_RI $0 5;\n"
+        "    GreaterThanI64_RI $0 16;\n"
+        "    EqualsI64_RI $0 16;\n"
+        "    Noop;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    int checked;
+
+    // both interpreter loops must agree
+    for (checked = 0; checked <= 1; checked++) {
+        VM vm = init_vm();
+        vm.checked = checked;
+        run_program(&vm, &program);
+        TEST_ASSERT_EQUAL(5, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL(51, vm.operands_stack.data[0]);
+        TEST_ASSERT_EQUAL(3, vm.operands_stack.data[1]);
+        TEST_ASSERT_EQUAL(2, vm.operands_stack.data[2]);
+        TEST_ASSERT_EQUAL(1, vm.operands_stack.data[3]);
+        TEST_ASSERT_EQUAL(0, vm.operands_stack.data[4]);
+        free_vm(vm);
+    }
+    free_program(program);
+}
+
+void
+fuel_time_slices(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 2 local_pointers: 0 } {\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $0;\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $1;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Call :1;\n"
+        "    LoadLocalI64 $1;\n"
+        "    AddI64;\n"
+        "    StoreLocalI64 $1;\n"
+        "    IncJumpIfLessThan $0 100 #4;\n"
+        "    LoadLocalI64 $1;\n"
+        "    Exit;\n"
+        "}\n"
+        ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    LoadLocalI64 $0;\n"
+        "    AddI64;\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    VM vms[2];
+    size_t i, slices = 0;
+
+    // round-robin the two interpreter loops, 10 units of fuel at a time
+    for (i = 0; i < 2; i++) {
+        vms[i] = init_vm();
+        vms[i].checked = i;
+        vms[i].fuel = 10;
+        run_program(vms + i, &program);
+    }
+    while (vms[0].paused || vms[1].paused) {
+        for (i = 0; i < 2; i++) {
+            if (!vms[i].paused)
+                continue;
+            TEST_ASSERT_EQUAL(1, vms[i].out_of_fuel);
+            vms[i].fuel = 10;
+            resume_program(vms + i, &program);
+            slices++;
+        }
+    }
+
+    // a slice of 10 runs two iterations, each a call and a 6 instruction loop
+    TEST_ASSERT_EQUAL(2 * 49, slices);
+    for (i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(0, vms[i].out_of_fuel);
+        TEST_ASSERT_EQUAL(1, vms[i].operands_stack.size);
+        TEST_ASSERT_EQUAL(9900, vms[i].operands_stack.data[0]);
+        free_vm(vms[i]);
+    }
+    free_program(program);
+}
+
+static void
+native_divmod(uint64_t *args, HeapObject **ptr_args)
+{
+    uint64_t a = args[0], b = args[1];
+    (void) ptr_args;
+    args[0] = a / b;
+    args[1] = a % b;
+}
+
+static void
+native_scaled_sum(uint64_t *args, HeapObject **ptr_args)
+{
+    const uint64_t *data = ptr_args[0]->data;
+    size_t i;
+    uint64_t sum = 0;
+    for (i = 0; i < ptr_args[0]->size / sizeof(uint64_t); i++)
+        sum += data[i];
+    args[0] *= sum;
+}
+
+static void
+native_answers(uint64_t *args, HeapObject **ptr_args)
+{
+    (void) ptr_args;
+    args[0] = 42;
+    args[1] = 43;
+}
+
+void
+native_functions(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 1 } {\n"
+        "    PushI64 17;\n"
+        "    PushI64 5;\n"
+        "    CallNative :0;\n"
+        "    PushI64 4;\n"
+        "    NewArrayI64;\n"
+        "    StoreLocalPointer $0;\n"
+        "    LoadLocalPointer $0;\n"
+        "    PushI64 3;\n"
+        "    ArrayFillI64;\n"
+        "    LoadLocalPointer $0;\n"
+        "    CallNative :2;\n"
+        "    CallNative :3;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    Native divmod = {native_divmod, 2, 0, 2};
+    Native scaled_sum = {native_scaled_sum, 1, 1, 1};
+    Native answers = {native_answers, 0, 0, 2};
+    int checked;
+
+    TEST_ASSERT_EQUAL(OP_CALL_NATIVE, program.functions[0].instructions[2].op);
+    TEST_ASSERT_EQUAL(3, program.functions[0].instructions[11].data.reg);
+    for (checked = 0; checked <= 1; checked++) {
+        VM vm = init_vm();
+        vm.checked = checked;
+        vm.operands_stack.capacity = 3; // so the last call has to grow the stack
+        register_native(&vm, 0, divmod);
+        register_native(&vm, 2, scaled_sum);
+        register_native(&vm, 3, answers);
+        run_program(&vm, &program);
+        TEST_ASSERT_EQUAL(4, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL(3, vm.operands_stack.data[0]);
+        TEST_ASSERT_EQUAL(2 * 12, vm.operands_stack.data[1]);
+        TEST_ASSERT_EQUAL(42, vm.operands_stack.data[2]);
+        TEST_ASSERT_EQUAL(43, vm.operands_stack.data[3]);
+        TEST_ASSERT_EQUAL(0, vm.pointers_stack.size);
+        free_vm(vm);
+    }
+    free_program(program);
+}
+
+void
+reading_input(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+        "    ReadI64;\n"
+        "    ReadI64;\n"
+        "    ReadI64;\n"
+        "    ReadLine;\n"
+        "    ReadLine;\n"
+        "    ReadAll;\n"
+        "    ReadLine;\n"
+        "    ReadI64;\n"
+        "    Exit;\n"
+        "}\n";
+    const char *input = "12 -7\n  +30\nthis line is longer than a chunk\r\nlast";
+    static const uint64_t operands[] = {12, 1, (uint64_t) -7, 1, 30, 1, 1, 1, 0, 0, 0};
+    Program program = assemble(source);
+    int checked, fds[2];
+
+    // tiny chunks and a collection at every allocation, so lines outlive the chunks they were read into
+    for (checked = 0; checked <= 1; checked++) {
+        VM vm = init_vm();
+        TEST_ASSERT_EQUAL(0, pipe(fds));
+        TEST_ASSERT_EQUAL(strlen(input), write(fds[1], input, strlen(input)));
+        close(fds[1]);
+        vm.checked = checked;
+        vm.input.fd = fds[0];
+        vm.input.chunk_size = 8;
+        vm.gc.initial_threshold = 0;
+        vm.gc.growth_factor = 0;
+        run_program(&vm, &program);
+        close(fds[0]);
+        TEST_ASSERT_EQUAL(11, vm.operands_stack.size);
+        TEST_ASSERT_EQUAL_MEMORY(operands, vm.operands_stack.data, sizeof(operands));
+        TEST_ASSERT_EQUAL(4, vm.pointers_stack.size);
+        assert_string("", vm.pointers_stack.data[0]);
+        assert_string("this line is longer than a chunk", vm.pointers_stack.data[1]);
+        assert_string("last", vm.pointers_stack.data[2]);
+        assert_string("", vm.pointers_stack.data[3]);
+        free_vm(vm);
+    }
+    free_program(program);
+}
+
+void
+input_streams_in_constant_memory(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $0;\n"
+        "    ReadLine;\n"
+        "    JumpIfFalse #9;\n"
+        "    StringLength;\n"
+        "    LoadLocalI64 $0;\n"
+        "    AddI64;\n"
+        "    StoreLocalI64 $0;\n"
+        "    Jump #2;\n"
+        "    LoadLocalI64 $0;\n"
+        "    Exit;\n"
+        "}\n";
+    Program program = assemble(source);
+    FILE *file = tmpfile();
+    VM vm = init_vm();
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL(file);
+    for (i = 0; i < 200000; i++)
+        fputs("12345\n", file);
+    fflush(file);
+    rewind(file);
+    vm.input.fd = fileno(file);
+    vm.gc.initial_threshold = 64 * 1024;
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(5 * 200000, vm.operands_stack.data[0]);
+    TEST_ASSERT_LESS_THAN(256 * 1024, vm.gc_stats.peak_heap_size);
+    free_vm(vm);
+    fclose(file);
+    free_program(program);
+}
+
+void
+optimized_pure_calls_are_memoized(void)
+{
+    const char *source =
+        "---\n"
+        "globals: 0\n"
+        "global_pointers: 0\n"
+        "---\n"
+        ":0 { args: 0 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+        "    PushI64 0;\n"
+        "    StoreLocalI64 $0;\n"
+        "    PushI64 7;\n"
+        "    Call :3;\n"
+        "    IncJumpIfLessThan $0 50 #2;\n"
+        "    Exit;\n"
+        "}\n"
+        ":3 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 pure: 1 } {\n"
+        "    LoadLocalI64 $0;\n"
+        "    AddI64_RI $0 1;\n"
+        "    MulI64;\n"
+        "    Return;\n"
+        "}\n";
+    Program program = assemble(source);
+    VM vm = init_vm();
+
+    // the same pipeline HAL64 runs: the pure callee must be neither inlined nor removed
+    inline_functions(&program, INLINE_DEFAULT_BUDGET);
+    optimize_program(&program);
+    layout_functions(&program, NULL);
+    TEST_ASSERT_EQUAL(2, program.functions_count);
+    TEST_ASSERT_TRUE(program.functions[1].pure);
+    run_program(&vm, &program);
+    TEST_ASSERT_EQUAL(50, vm.operands_stack.size);
+    TEST_ASSERT_EQUAL(56, vm.operands_stack.data[49]);
+    TEST_ASSERT_EQUAL(1, vm.memo_caches[1].misses);
+    TEST_ASSERT_EQUAL(49, vm.memo_caches[1].hits);
+    free_vm(vm);
+    free_program(program);
+}
+
+/* Runs `source` on a checked VM in a child, which must fail with `message` on stderr. */
+static void
+assert_checked_failure(const char *source, const char *message)
+{
+    Program program = assemble(source);
+    char output[512];
+    int errors[2], status;
+    ssize_t size;
+    pid_t pid;
+
+    TEST_ASSERT_EQUAL(0, pipe(errors));
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        VM vm = init_vm();
+        dup2(errors[1], STDERR_FILENO);
+        vm.checked = 1;
+        run_program(&vm, &program);
+        _exit(EXIT_SUCCESS);
+    }
+    close(errors[1]);
+    size = read(errors[0], output, sizeof(output) - 1);
+    close(errors[0]);
+    TEST_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL(EXIT_FAILURE, WEXITSTATUS(status));
+    TEST_ASSERT_GREATER_THAN(0, size);
+    output[size] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(output, message));
+    free_program(program);
+}
+
+void
+array_instructions_check_their_operands(void)
+{
+    assert_checked_failure("---\n"
+                           "globals: 0\n"
+                           "global_pointers: 0\n"
+                           "---\n"
+                           ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+                           "    PushLiteralString \"abc\";\n"
+                           "    PushI64 1;\n"
+                           "    ArrayLoadI64;\n"
+                           "    Exit;\n"
+                           "}\n",
+                           "ARRAY_LOAD_I64: not an i64 array");
+    assert_checked_failure("---\n"
+                           "globals: 0\n"
+                           "global_pointers: 0\n"
+                           "---\n"
+                           ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+                           "    NewMap 0;\n"
+                           "    PushI64 0;\n"
+                           "    PushI64 5;\n"
+                           "    ArrayStoreI64;\n"
+                           "    Exit;\n"
+                           "}\n",
+                           "ARRAY_STORE_I64: not an i64 array");
+    assert_checked_failure("---\n"
+                           "globals: 0\n"
+                           "global_pointers: 0\n"
+                           "---\n"
+                           ":0 { args: 0 ptr_args: 0 locals: 0 local_pointers: 0 } {\n"
+                           "    PushLiteralString \"a string longer than a pointer\";\n"
+                           "    ParallelMapI64 :1;\n"
+                           "    Exit;\n"
+                           "}\n"
+                           ":1 { args: 1 ptr_args: 0 locals: 1 local_pointers: 0 } {\n"
+                           "    LoadLocalI64 $0;\n"
+                           "    Return;\n"
+                           "}\n",
+                           "not an i64 array");
+}
+
+int
+main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(gc_threshold_and_stats);
+    RUN_TEST(gc_keeps_reachable_objects);
+    RUN_TEST(string_views_keep_parent_alive);
+    RUN_TEST(short_strings_are_inline);
+    RUN_TEST(reference_counting_frees_objects_at_once);
+    RUN_TEST(counted_loops);
+    RUN_TEST(register_immediate_operations);
+    RUN_TEST(fuel_time_slices);
+    RUN_TEST(native_functions);
+    RUN_TEST(reading_input);
+    RUN_TEST(input_streams_in_constant_memory);
+    RUN_TEST(optimized_pure_calls_are_memoized);
+    RUN_TEST(array_instructions_check_their_operands);
+    return UNITY_END();
+}